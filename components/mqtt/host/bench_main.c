@@ -0,0 +1,585 @@
+/*
+ * bench_main.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Host build: micro-benchmarks for the packet builders, the parsers, the ring buffer and the transport write path.
+ * build_publish_by_name and build_publish_by_handle compare publishing to a topic given as a string with
+ *  publishing to one interned in a TopicTable_t.
+ *
+ *   mqtt_bench [--min-ms N] [--filter S] [--compare baseline.json] [--threshold PCT]
+ *
+ * Each benchmark is run in growing batches until one batch takes at least --min-ms (default 200),
+ *  and that batch is reported on stdout as JSON, one benchmark per line:
+ *  ns per operation, bytes per second and heap allocations per operation.
+ * The allocations are counted by linking with --wrap=malloc,calloc,realloc (see Makefile).
+ *
+ * With --compare, the results are checked against an earlier run's output. A benchmark has regressed
+ *  when it is more than --threshold percent (default 10) slower, or allocates more per operation.
+ * The comparison goes to stderr, and the exit status is the number of regressions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+
+#include "mqtt_structs.h"
+#include "mqtt_packet.h"
+#include "mqtt_message.h"
+#include "mqtt_outbox.h"
+#include "mqtt_transport.h"
+#include "mqtt_topic.h"
+#include "ringbuf.h"
+
+#define BENCH_MIN_MS			200
+#define BENCH_THRESHOLD_PCT		10.0
+#define BENCH_MAX_BASELINE		64
+#define BENCH_LANE_SIZE			4096
+#define BENCH_RING_SIZE			4000  // Not a multiple of the chunk sizes, so copies split at the end
+#define BENCH_PUBLISH_PAYLOAD	64
+#define BENCH_TOPICS			200  // A house worth of device topics
+#define BENCH_TOPIC_PREFIX		"pyhouse/House 1/"
+
+typedef struct Bench {
+	const char			*Name;
+	int					Size;
+	void				(*Setup)(int p_size);
+	uint64_t			(*Run)(int p_size, uint32_t p_iterations);  // Returns the bytes handled
+	void				(*Teardown)(void);
+} Bench_t;
+
+typedef struct BenchResult {
+	char				Name[64];
+	uint32_t			Iterations;
+	double				NsPerOp;
+	double				BytesPerSec;
+	double				AllocsPerOp;
+} BenchResult_t;
+
+static uint32_t s_allocs = 0;
+static volatile uintptr_t s_sink;  // Keeps results the compiler could otherwise drop
+
+// ===== Heap allocation counting =====
+
+void *__real_malloc(size_t p_size);
+void *__real_calloc(size_t p_count, size_t p_size);
+void *__real_realloc(void *p_ptr, size_t p_size);
+
+void *__wrap_malloc(size_t p_size) {
+	__atomic_add_fetch(&s_allocs, 1, __ATOMIC_RELAXED);
+	return __real_malloc(p_size);
+}
+
+void *__wrap_calloc(size_t p_count, size_t p_size) {
+	__atomic_add_fetch(&s_allocs, 1, __ATOMIC_RELAXED);
+	return __real_calloc(p_count, p_size);
+}
+
+void *__wrap_realloc(void *p_ptr, size_t p_size) {
+	__atomic_add_fetch(&s_allocs, 1, __ATOMIC_RELAXED);
+	return __real_realloc(p_ptr, p_size);
+}
+
+static uint64_t now_ns(void) {
+	struct timespec l_now;
+	clock_gettime(CLOCK_MONOTONIC, &l_now);
+	return (uint64_t) l_now.tv_sec * 1000000000ULL + l_now.tv_nsec;
+}
+
+// ===== Builders =====
+
+static Client_t s_client;
+static Outbox_t s_outbox;
+static State_t s_state;
+static BrokerConfig_t s_broker;
+static Will_t s_will;
+static PacketInfo_t s_arena;
+static uint8_t s_arena_buffer[128];
+static char s_payload[1024];
+
+static void builder_setup(int p_size) {
+	memset(&s_client, 0, sizeof(s_client));
+	memset(&s_state, 0, sizeof(s_state));
+	memset(&s_broker, 0, sizeof(s_broker));
+	memset(&s_will, 0, sizeof(s_will));
+	memset(&s_arena, 0, sizeof(s_arena));
+	memset(s_payload, 'x', sizeof(s_payload));
+	mqtt_outbox_init(&s_outbox, BENCH_LANE_SIZE);
+	s_client.Outbox = &s_outbox;
+	s_client.State = &s_state;
+	s_client.Broker = &s_broker;
+	s_client.Will = &s_will;
+	s_client.Packet = &s_arena;
+	strcpy(s_broker.ClientId, "bench-client");
+	strcpy(s_broker.Username, "user");
+	strcpy(s_broker.Password, "secret");
+	s_will.WillTopic = "pyhouse/bench/lwt";
+	s_will.WillMessage = "offline";
+	s_will.WillQos = 1;
+	s_will.CleanSession = 1;
+	s_will.Keepalive = 60;
+	s_arena.PacketBuffer = s_arena_buffer;
+	s_arena.PacketBuffer_length = sizeof(s_arena_buffer);
+}
+
+static void builder_teardown(void) {
+	mqtt_outbox_deinit(&s_outbox);
+}
+
+static uint64_t run_build_connect(int p_size, uint32_t p_iterations) {
+	uint64_t l_bytes = 0;
+	uint32_t l_ix;
+
+	for (l_ix = 0; l_ix < p_iterations; l_ix++) {
+		if (mqtt_build_connect_packet(&s_client) != ESP_OK) {
+			return 0;
+		}
+		l_bytes += s_arena.Packet_length;
+	}
+	return l_bytes;
+}
+
+/**
+ * The publish and subscribe builders write into the outbox, so each one is committed and taken off again.
+ */
+static uint64_t outbox_take(PacketInfo_t *p_packet) {
+	uint8_t *l_data;
+	int32_t l_length;
+
+	mqtt_outbox_commit(&s_outbox, p_packet);
+	l_length = mqtt_outbox_peek(&s_outbox, &l_data);
+	s_sink += (uintptr_t) l_data;
+	mqtt_outbox_consume(&s_outbox);
+	return l_length;
+}
+
+static uint64_t run_build_publish(int p_size, uint32_t p_iterations) {
+	PacketInfo_t l_packet;
+	uint64_t l_bytes = 0;
+	uint32_t l_ix;
+	uint16_t l_id;
+
+	for (l_ix = 0; l_ix < p_iterations; l_ix++) {
+		if (mqtt_build_publish_packet(&s_client, &l_packet, "pyhouse/house_1/lighting/status", s_payload, p_size, 0, 0, &l_id) != ESP_OK) {
+			return 0;
+		}
+		l_bytes += outbox_take(&l_packet);
+	}
+	return l_bytes;
+}
+
+static uint64_t run_build_subscribe(int p_size, uint32_t p_iterations) {
+	PacketInfo_t l_packet;
+	uint64_t l_bytes = 0;
+	uint32_t l_ix;
+	uint16_t l_id;
+
+	for (l_ix = 0; l_ix < p_iterations; l_ix++) {
+		if (mqtt_build_subscribe_packet(&s_client, &l_packet, "pyhouse/house_1/#", 1, &l_id) != ESP_OK) {
+			return 0;
+		}
+		l_bytes += outbox_take(&l_packet);
+	}
+	return l_bytes;
+}
+
+// ===== Publish by name and by handle =====
+
+static TopicTable_t s_topics;
+static char s_topic_names[BENCH_TOPICS][48];
+static TopicHandle_t s_handles[BENCH_TOPICS];
+
+static void topic_setup(int p_size) {
+	static const char *l_devices[] = { "light", "temp", "motion", "door" };
+	int l_ix;
+
+	builder_setup(p_size);
+	mqtt_topic_table_init(&s_topics, BENCH_TOPIC_PREFIX, BENCH_TOPICS, 4096);
+	s_client.Topics = &s_topics;
+	for (l_ix = 0; l_ix < BENCH_TOPICS; l_ix++) {
+		snprintf(s_topic_names[l_ix], sizeof(s_topic_names[l_ix]), BENCH_TOPIC_PREFIX "room%d/%s", l_ix / 4, l_devices[l_ix % 4]);
+		mqtt_topic_intern(&s_topics, s_topic_names[l_ix], &s_handles[l_ix]);
+	}
+}
+
+static void topic_teardown(void) {
+	builder_teardown();
+	mqtt_topic_table_deinit(&s_topics);
+}
+
+/**
+ * QoS 0 publishes to each of the topics in turn.  Only the builder is timed: the packet is never committed,
+ *  so the next one is built in the same place and the outbox costs nothing more than the reservation.
+ */
+static uint64_t run_publish_by_name(int p_size, uint32_t p_iterations) {
+	PacketInfo_t l_packet;
+	uint64_t l_bytes = 0;
+	uint32_t l_ix;
+	uint16_t l_id;
+
+	for (l_ix = 0; l_ix < p_iterations; l_ix++) {
+		if (mqtt_build_publish_packet(&s_client, &l_packet, s_topic_names[l_ix % BENCH_TOPICS], s_payload, p_size, 0, 0, &l_id) != ESP_OK) {
+			return 0;
+		}
+		l_bytes += l_packet.Packet_length;
+	}
+	return l_bytes;
+}
+
+static uint64_t run_publish_by_handle(int p_size, uint32_t p_iterations) {
+	PacketInfo_t l_packet;
+	uint64_t l_bytes = 0;
+	uint32_t l_ix;
+	uint16_t l_id;
+
+	for (l_ix = 0; l_ix < p_iterations; l_ix++) {
+		if (mqtt_build_publish_handle_packet(&s_client, &l_packet, s_handles[l_ix % BENCH_TOPICS], s_payload, p_size, 0, 0, &l_id) != ESP_OK) {
+			return 0;
+		}
+		l_bytes += l_packet.Packet_length;
+	}
+	return l_bytes;
+}
+
+// ===== Parsers =====
+
+static uint8_t s_publish[4 + 7 + 2 + BENCH_PUBLISH_PAYLOAD];  // QoS 1 PUBLISH to "a/b/c"
+
+static void parse_setup(int p_size) {
+	uint8_t *l_ptr = s_publish;
+
+	*l_ptr++ = 0x32;
+	*l_ptr++ = 7 + 2 + BENCH_PUBLISH_PAYLOAD;
+	*l_ptr++ = 0x00;
+	*l_ptr++ = 0x05;
+	memcpy(l_ptr, "a/b/c", 5);
+	l_ptr += 5;
+	*l_ptr++ = 0x12;
+	*l_ptr++ = 0x34;
+	memset(l_ptr, 'x', BENCH_PUBLISH_PAYLOAD);
+}
+
+static void parse_teardown(void) {
+}
+
+#define PARSE_LENGTH	(2 + 7 + 2 + BENCH_PUBLISH_PAYLOAD)
+
+static uint64_t run_parse_packet(int p_size, uint32_t p_iterations) {
+	PacketView_t l_view;
+	uint32_t l_ix;
+
+	for (l_ix = 0; l_ix < p_iterations; l_ix++) {
+		if (mqtt_parse_packet(s_publish, PARSE_LENGTH, &l_view) != ESP_OK) {
+			return 0;
+		}
+		s_sink += l_view.PacketId;
+	}
+	return (uint64_t) p_iterations * PARSE_LENGTH;
+}
+
+static uint64_t run_get_total_length(int p_size, uint32_t p_iterations) {
+	uint32_t l_ix;
+
+	for (l_ix = 0; l_ix < p_iterations; l_ix++) {
+		s_sink += mqtt_get_total_length(s_publish, PARSE_LENGTH);
+	}
+	return (uint64_t) p_iterations * PARSE_LENGTH;
+}
+
+static uint64_t run_get_publish_topic(int p_size, uint32_t p_iterations) {
+	uint16_t l_length;
+	uint32_t l_ix;
+
+	for (l_ix = 0; l_ix < p_iterations; l_ix++) {
+		l_length = PARSE_LENGTH;
+		s_sink += (uintptr_t) mqtt_get_publish_topic(s_publish, &l_length) + l_length;
+	}
+	return (uint64_t) p_iterations * PARSE_LENGTH;
+}
+
+static uint64_t run_get_publish_data(int p_size, uint32_t p_iterations) {
+	uint16_t l_length;
+	uint32_t l_ix;
+
+	for (l_ix = 0; l_ix < p_iterations; l_ix++) {
+		l_length = PARSE_LENGTH;
+		s_sink += (uintptr_t) mqtt_get_publish_data(s_publish, &l_length) + l_length;
+	}
+	return (uint64_t) p_iterations * PARSE_LENGTH;
+}
+
+static uint64_t run_get_id(int p_size, uint32_t p_iterations) {
+	uint32_t l_ix;
+
+	for (l_ix = 0; l_ix < p_iterations; l_ix++) {
+		s_sink += mqtt_get_id(s_publish, PARSE_LENGTH);
+	}
+	return (uint64_t) p_iterations * PARSE_LENGTH;
+}
+
+// ===== Ring buffer =====
+
+static Ringbuff_t s_ring;
+static uint8_t s_ring_store[BENCH_RING_SIZE];
+static uint8_t s_chunk[1024];
+
+static void ring_setup(int p_size) {
+	rb_init(&s_ring, s_ring_store, sizeof(s_ring_store), 1);
+	memset(s_chunk, 'r', sizeof(s_chunk));
+}
+
+static void ring_teardown(void) {
+	rb_deinit(&s_ring);
+}
+
+/**
+ * One rb_write and one rb_read of p_size bytes per operation; the bytes are counted once.
+ */
+static uint64_t run_ring(int p_size, uint32_t p_iterations) {
+	uint64_t l_bytes = 0;
+	uint32_t l_ix;
+
+	for (l_ix = 0; l_ix < p_iterations; l_ix++) {
+		if (rb_write(&s_ring, s_chunk, p_size, 0) != p_size) {
+			return 0;
+		}
+		l_bytes += rb_read(&s_ring, s_chunk, p_size, 0);
+	}
+	return l_bytes;
+}
+
+// ===== Transport =====
+
+static int s_pair[2];
+static SemaphoreHandle_t s_drained;
+static PacketInfo_t s_wire;
+static uint8_t s_wire_buffer[4 + 2 + 64 + 1024];
+
+/**
+ * Plays the broker: reads and throws away everything until the client end is closed.
+ */
+static void drain_task(void *p_arg) {
+	uint8_t l_buffer[4096];
+
+	while (read(s_pair[1], l_buffer, sizeof(l_buffer)) > 0) {
+	}
+	xSemaphoreGive(s_drained);
+	vTaskDelete(NULL);
+}
+
+/**
+ * A PUBLISH of p_size payload bytes, in the three parts mqtt_transport_write() gathers.
+ */
+static void transport_setup(int p_size) {
+	memset(&s_wire, 0, sizeof(s_wire));
+	memset(s_wire_buffer, 'w', sizeof(s_wire_buffer));
+	s_wire.PacketBuffer = s_wire_buffer;
+	s_wire.PacketFixedHeader = s_wire_buffer;
+	s_wire.PacketFixedHeader_length = 3;
+	s_wire.PacketVariableHeader = s_wire_buffer + 3;
+	s_wire.PacketVariableHeader_length = 2 + 5;
+	s_wire.PacketPayload = s_wire_buffer + 3 + 7;
+	s_wire.PacketPayload_length = p_size;
+	s_wire.Packet_length = 3 + 7 + p_size;
+	socketpair(AF_UNIX, SOCK_STREAM, 0, s_pair);
+	s_drained = xSemaphoreCreateBinary();
+	xTaskCreate(&drain_task, "bench_drain", 4096, NULL, 5, NULL);
+}
+
+static void transport_teardown(void) {
+	close(s_pair[0]);
+	xSemaphoreTake(s_drained, portMAX_DELAY);
+	close(s_pair[1]);
+	vSemaphoreDelete(s_drained);
+}
+
+static uint64_t run_transport_write(int p_size, uint32_t p_iterations) {
+	uint64_t l_bytes = 0;
+	uint32_t l_ix;
+	int l_len;
+
+	for (l_ix = 0; l_ix < p_iterations; l_ix++) {
+		l_len = mqtt_transport_write(s_pair[0], &s_wire);
+		if (l_len != s_wire.Packet_length) {
+			return 0;
+		}
+		l_bytes += l_len;
+	}
+	return l_bytes;
+}
+
+static const Bench_t s_benches[] = {
+	{ "build_connect",			0,		builder_setup,		run_build_connect,		builder_teardown },
+	{ "build_publish/16",		16,		builder_setup,		run_build_publish,		builder_teardown },
+	{ "build_publish/1024",		1024,	builder_setup,		run_build_publish,		builder_teardown },
+	{ "build_subscribe",		0,		builder_setup,		run_build_subscribe,	builder_teardown },
+	{ "build_publish_by_name",	2,		topic_setup,		run_publish_by_name,	topic_teardown },
+	{ "build_publish_by_handle",	2,	topic_setup,		run_publish_by_handle,	topic_teardown },
+	{ "parse_packet",			0,		parse_setup,		run_parse_packet,		parse_teardown },
+	{ "get_total_length",		0,		parse_setup,		run_get_total_length,	parse_teardown },
+	{ "get_publish_topic",		0,		parse_setup,		run_get_publish_topic,	parse_teardown },
+	{ "get_publish_data",		0,		parse_setup,		run_get_publish_data,	parse_teardown },
+	{ "get_id",					0,		parse_setup,		run_get_id,				parse_teardown },
+	{ "rb_write_read/16",		16,		ring_setup,			run_ring,				ring_teardown },
+	{ "rb_write_read/256",		256,	ring_setup,			run_ring,				ring_teardown },
+	{ "rb_write_read/1024",		1024,	ring_setup,			run_ring,				ring_teardown },
+	{ "transport_write/64",		64,		transport_setup,	run_transport_write,	transport_teardown },
+	{ "transport_write/1024",	1024,	transport_setup,	run_transport_write,	transport_teardown },
+};
+
+#define BENCH_COUNT		(sizeof(s_benches) / sizeof(s_benches[0]))
+
+/**
+ * Run p_bench in batches, ten times larger or sized from the last, until one batch takes p_min_ns.
+ * @return ESP_FAIL if the benchmark's run failed.
+ */
+static esp_err_t bench_run(const Bench_t *p_bench, uint64_t p_min_ns, BenchResult_t *r_result) {
+	uint32_t l_iterations = 1;
+	uint32_t l_allocs;
+	uint64_t l_start, l_elapsed, l_bytes;
+
+	p_bench->Setup(p_bench->Size);
+	p_bench->Run(p_bench->Size, 1);  // Warm up
+	for (;;) {
+		l_allocs = __atomic_load_n(&s_allocs, __ATOMIC_RELAXED);
+		l_start = now_ns();
+		l_bytes = p_bench->Run(p_bench->Size, l_iterations);
+		l_elapsed = now_ns() - l_start;
+		l_allocs = __atomic_load_n(&s_allocs, __ATOMIC_RELAXED) - l_allocs;
+		if (l_bytes == 0 || l_elapsed >= p_min_ns || l_iterations >= 0x40000000) {
+			break;
+		}
+		if (l_elapsed < p_min_ns / 10) {
+			l_iterations *= 10;
+		} else {
+			l_iterations = (uint32_t) ((double) l_iterations * p_min_ns * 1.1 / l_elapsed) + 1;
+		}
+	}
+	p_bench->Teardown();
+	if (l_bytes == 0) {
+		return ESP_FAIL;
+	}
+	snprintf(r_result->Name, sizeof(r_result->Name), "%s", p_bench->Name);
+	r_result->Iterations = l_iterations;
+	r_result->NsPerOp = (double) l_elapsed / l_iterations;
+	r_result->BytesPerSec = (double) l_bytes * 1e9 / l_elapsed;
+	r_result->AllocsPerOp = (double) l_allocs / l_iterations;
+	return ESP_OK;
+}
+
+/**
+ * Reads the lines an earlier run wrote; anything else in the file is skipped.
+ * @return the number of results read into r_results.
+ */
+static int baseline_load(const char *p_path, BenchResult_t *r_results, int p_max) {
+	FILE *l_file = fopen(p_path, "r");
+	char l_line[256];
+	int l_count = 0;
+
+	if (l_file == NULL) {
+		fprintf(stderr, "Cannot open baseline %s\n", p_path);
+		return 0;
+	}
+	while (l_count < p_max && fgets(l_line, sizeof(l_line), l_file)) {
+		BenchResult_t *l_result = &r_results[l_count];
+		if (sscanf(l_line, " {\"name\": \"%63[^\"]\", \"iterations\": %u, \"ns_per_op\": %lf, \"bytes_per_sec\": %lf, \"allocs_per_op\": %lf",
+				l_result->Name, &l_result->Iterations, &l_result->NsPerOp, &l_result->BytesPerSec, &l_result->AllocsPerOp) == 5) {
+			l_count++;
+		}
+	}
+	fclose(l_file);
+	return l_count;
+}
+
+static const BenchResult_t *baseline_find(const BenchResult_t *p_baseline, int p_count, const char *p_name) {
+	int l_ix;
+
+	for (l_ix = 0; l_ix < p_count; l_ix++) {
+		if (strcmp(p_baseline[l_ix].Name, p_name) == 0) {
+			return &p_baseline[l_ix];
+		}
+	}
+	return NULL;
+}
+
+int main(int p_argc, char **p_argv) {
+	BenchResult_t l_baseline[BENCH_MAX_BASELINE];
+	BenchResult_t l_result;
+	const BenchResult_t *l_base;
+	const char *l_filter = NULL;
+	const char *l_compare = NULL;
+	double l_threshold = BENCH_THRESHOLD_PCT;
+	double l_change;
+	uint64_t l_min_ns = (uint64_t) BENCH_MIN_MS * 1000000;
+	int l_baseline_count = 0;
+	int l_regressions = 0;
+	int l_first = 1;
+	int l_regressed;
+	uint32_t l_ix;
+
+	for (l_ix = 1; l_ix < p_argc; l_ix++) {
+		if (strcmp(p_argv[l_ix], "--min-ms") == 0 && l_ix + 1 < p_argc) {
+			l_min_ns = strtoull(p_argv[++l_ix], NULL, 10) * 1000000;
+		} else if (strcmp(p_argv[l_ix], "--filter") == 0 && l_ix + 1 < p_argc) {
+			l_filter = p_argv[++l_ix];
+		} else if (strcmp(p_argv[l_ix], "--compare") == 0 && l_ix + 1 < p_argc) {
+			l_compare = p_argv[++l_ix];
+		} else if (strcmp(p_argv[l_ix], "--threshold") == 0 && l_ix + 1 < p_argc) {
+			l_threshold = strtod(p_argv[++l_ix], NULL);
+		} else {
+			fprintf(stderr, "usage: %s [--min-ms N] [--filter S] [--compare baseline.json] [--threshold PCT]\n", p_argv[0]);
+			return 2;
+		}
+	}
+	if (l_compare) {
+		l_baseline_count = baseline_load(l_compare, l_baseline, BENCH_MAX_BASELINE);
+		if (l_baseline_count == 0) {
+			fprintf(stderr, "No results in baseline %s\n", l_compare);
+			return 2;
+		}
+		fprintf(stderr, "%-24s %12s %12s %9s\n", "benchmark", "base ns/op", "ns/op", "change");
+	}
+
+	printf("{\"benchmarks\": [\n");
+	for (l_ix = 0; l_ix < BENCH_COUNT; l_ix++) {
+		if (l_filter && strstr(s_benches[l_ix].Name, l_filter) == NULL) {
+			continue;
+		}
+		if (bench_run(&s_benches[l_ix], l_min_ns, &l_result) != ESP_OK) {
+			fprintf(stderr, "%s failed\n", s_benches[l_ix].Name);
+			l_regressions++;
+			continue;
+		}
+		printf("%s    {\"name\": \"%s\", \"iterations\": %u, \"ns_per_op\": %.2f, \"bytes_per_sec\": %.0f, \"allocs_per_op\": %.3f",
+				l_first ? "" : ",\n", l_result.Name, l_result.Iterations, l_result.NsPerOp, l_result.BytesPerSec, l_result.AllocsPerOp);
+		l_first = 0;
+		l_base = l_compare ? baseline_find(l_baseline, l_baseline_count, l_result.Name) : NULL;
+		if (l_base) {
+			l_change = (l_result.NsPerOp - l_base->NsPerOp) * 100.0 / l_base->NsPerOp;
+			l_regressed = l_change > l_threshold || l_result.AllocsPerOp > l_base->AllocsPerOp + 0.001;
+			l_regressions += l_regressed;
+			printf(", \"baseline_ns_per_op\": %.2f, \"change_pct\": %.1f, \"regression\": %s",
+					l_base->NsPerOp, l_change, l_regressed ? "true" : "false");
+			fprintf(stderr, "%-24s %12.2f %12.2f %+8.1f%%%s\n", l_result.Name, l_base->NsPerOp, l_result.NsPerOp, l_change,
+					l_regressed ? "  REGRESSION" : "");
+		} else if (l_compare) {
+			fprintf(stderr, "%-24s %12s %12.2f  (new)\n", l_result.Name, "-", l_result.NsPerOp);
+		}
+		printf("}");
+		fflush(stdout);
+	}
+	printf("\n]}\n");
+	if (l_compare) {
+		fprintf(stderr, "%d regressions beyond %.1f%%\n", l_regressions, l_threshold);
+	}
+	return l_regressions;
+}
+
+// ### END DBK
@@ -0,0 +1,25 @@
+/*
+ * host_esp.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Host build: the esp-idf system and logging calls the mqtt component uses.
+ */
+
+#include <stdlib.h>
+
+#include "esp_system.h"
+#include "esp_log.h"
+
+int host_log_level = 0;  // Silent unless the runner is given -v
+
+uint32_t esp_get_free_heap_size(void) {
+	return 0x100000;
+}
+
+uint32_t esp_random(void) {
+	return ((uint32_t) random() << 16) ^ (uint32_t) random();
+}
+
+// ### END DBK
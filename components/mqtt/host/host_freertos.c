@@ -0,0 +1,277 @@
+/*
+ * host_freertos.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Host build: the FreeRTOS calls the mqtt component uses, on pthreads.
+ * A task is a detached thread, a tick is a millisecond of CLOCK_MONOTONIC,
+ *  and queues and semaphores share one mutex and condition based ring.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+typedef struct HostTask {
+	pthread_t			Thread;
+	TaskFunction_t		Function;
+	void				*Parameter;
+	pthread_mutex_t		Lock;
+	pthread_cond_t		Cond;
+	uint32_t			Notify;
+} HostTask_t;
+
+typedef struct HostQueue {
+	pthread_mutex_t		Lock;
+	pthread_cond_t		Cond;
+	uint8_t				*Items;
+	UBaseType_t			ItemSize;  // 0 for a semaphore
+	UBaseType_t			Length;
+	UBaseType_t			Head;
+	UBaseType_t			Count;
+} HostQueue_t;
+
+static __thread HostTask_t *t_current;
+
+static void host_deadline(TickType_t p_ticks, struct timespec *r_deadline) {
+	clock_gettime(CLOCK_REALTIME, r_deadline);
+	r_deadline->tv_sec += p_ticks / 1000;
+	r_deadline->tv_nsec += (long) (p_ticks % 1000) * 1000000L;
+	if (r_deadline->tv_nsec >= 1000000000L) {
+		r_deadline->tv_sec++;
+		r_deadline->tv_nsec -= 1000000000L;
+	}
+}
+
+static int host_wait(pthread_cond_t *p_cond, pthread_mutex_t *p_lock, TickType_t p_ticks, const struct timespec *p_deadline) {
+	if (p_ticks == portMAX_DELAY) {
+		return pthread_cond_wait(p_cond, p_lock);
+	}
+	return pthread_cond_timedwait(p_cond, p_lock, p_deadline);
+}
+
+static HostTask_t *host_task_new(void) {
+	HostTask_t *l_task = calloc(1, sizeof(HostTask_t));
+	pthread_mutex_init(&l_task->Lock, NULL);
+	pthread_cond_init(&l_task->Cond, NULL);
+	return l_task;
+}
+
+static void *host_task_start(void *p_task) {
+	HostTask_t *l_task = p_task;
+	t_current = l_task;
+	l_task->Function(l_task->Parameter);
+	return NULL;
+}
+
+// ===== Tasks =====
+
+BaseType_t xTaskCreate(TaskFunction_t p_function, const char *p_name, uint32_t p_stack, void *p_parameter,
+		UBaseType_t p_priority, TaskHandle_t *r_handle) {
+	HostTask_t *l_task = host_task_new();
+	l_task->Function = p_function;
+	l_task->Parameter = p_parameter;
+	if (r_handle) {
+		*r_handle = l_task;
+	}
+	if (pthread_create(&l_task->Thread, NULL, host_task_start, l_task) != 0) {
+		return pdFAIL;
+	}
+	pthread_detach(l_task->Thread);
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t p_task) {
+	HostTask_t *l_task = p_task;
+	if (l_task == NULL || l_task == t_current) {
+		pthread_exit(NULL);
+	}
+	pthread_cancel(l_task->Thread);
+}
+
+void vTaskDelay(TickType_t p_ticks) {
+	usleep((useconds_t) p_ticks * 1000);
+}
+
+TickType_t xTaskGetTickCount(void) {
+	struct timespec l_now;
+	clock_gettime(CLOCK_MONOTONIC, &l_now);
+	return (TickType_t) (l_now.tv_sec * 1000 + l_now.tv_nsec / 1000000);
+}
+
+/**
+ * Threads not started by xTaskCreate(), the test runner's own for one, get a task on first use.
+ */
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+	if (t_current == NULL) {
+		t_current = host_task_new();
+		t_current->Thread = pthread_self();
+	}
+	return t_current;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t p_task) {
+	HostTask_t *l_task = p_task;
+	pthread_mutex_lock(&l_task->Lock);
+	l_task->Notify++;
+	pthread_cond_signal(&l_task->Cond);
+	pthread_mutex_unlock(&l_task->Lock);
+	return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t p_clear, TickType_t p_ticks) {
+	HostTask_t *l_task = (HostTask_t *) xTaskGetCurrentTaskHandle();
+	struct timespec l_deadline;
+	uint32_t l_value;
+
+	host_deadline(p_ticks, &l_deadline);
+	pthread_mutex_lock(&l_task->Lock);
+	while (l_task->Notify == 0 && p_ticks != 0) {
+		if (host_wait(&l_task->Cond, &l_task->Lock, p_ticks, &l_deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+	l_value = l_task->Notify;
+	if (l_value) {
+		l_task->Notify = p_clear ? 0 : l_value - 1;
+	}
+	pthread_mutex_unlock(&l_task->Lock);
+	return l_value;
+}
+
+// ===== Queues =====
+
+QueueHandle_t xQueueCreate(UBaseType_t p_length, UBaseType_t p_item_size) {
+	HostQueue_t *l_queue = calloc(1, sizeof(HostQueue_t));
+	pthread_mutex_init(&l_queue->Lock, NULL);
+	pthread_cond_init(&l_queue->Cond, NULL);
+	l_queue->Items = calloc(p_length, p_item_size ? p_item_size : 1);
+	l_queue->Length = p_length;
+	l_queue->ItemSize = p_item_size;
+	return l_queue;
+}
+
+static BaseType_t host_queue_send(QueueHandle_t p_queue, const void *p_item, TickType_t p_ticks, int p_front) {
+	HostQueue_t *l_queue = p_queue;
+	struct timespec l_deadline;
+	UBaseType_t l_slot;
+
+	host_deadline(p_ticks, &l_deadline);
+	pthread_mutex_lock(&l_queue->Lock);
+	while (l_queue->Count == l_queue->Length) {
+		if (p_ticks == 0 || host_wait(&l_queue->Cond, &l_queue->Lock, p_ticks, &l_deadline) == ETIMEDOUT) {
+			pthread_mutex_unlock(&l_queue->Lock);
+			return errQUEUE_FULL;
+		}
+	}
+	if (p_front) {
+		l_queue->Head = (l_queue->Head + l_queue->Length - 1) % l_queue->Length;
+		l_slot = l_queue->Head;
+	} else {
+		l_slot = (l_queue->Head + l_queue->Count) % l_queue->Length;
+	}
+	if (l_queue->ItemSize) {
+		memcpy(l_queue->Items + l_slot * l_queue->ItemSize, p_item, l_queue->ItemSize);
+	}
+	l_queue->Count++;
+	pthread_cond_broadcast(&l_queue->Cond);
+	pthread_mutex_unlock(&l_queue->Lock);
+	return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t p_queue, const void *p_item, TickType_t p_ticks) {
+	return host_queue_send(p_queue, p_item, p_ticks, 0);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t p_queue, const void *p_item, TickType_t p_ticks) {
+	return host_queue_send(p_queue, p_item, p_ticks, 1);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t p_queue, void *r_item, TickType_t p_ticks) {
+	HostQueue_t *l_queue = p_queue;
+	struct timespec l_deadline;
+
+	host_deadline(p_ticks, &l_deadline);
+	pthread_mutex_lock(&l_queue->Lock);
+	while (l_queue->Count == 0) {
+		if (p_ticks == 0 || host_wait(&l_queue->Cond, &l_queue->Lock, p_ticks, &l_deadline) == ETIMEDOUT) {
+			pthread_mutex_unlock(&l_queue->Lock);
+			return pdFALSE;
+		}
+	}
+	if (l_queue->ItemSize && r_item) {
+		memcpy(r_item, l_queue->Items + l_queue->Head * l_queue->ItemSize, l_queue->ItemSize);
+	}
+	l_queue->Head = (l_queue->Head + 1) % l_queue->Length;
+	l_queue->Count--;
+	pthread_cond_broadcast(&l_queue->Cond);
+	pthread_mutex_unlock(&l_queue->Lock);
+	return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t p_queue) {
+	HostQueue_t *l_queue = p_queue;
+	UBaseType_t l_count;
+
+	pthread_mutex_lock(&l_queue->Lock);
+	l_count = l_queue->Count;
+	pthread_mutex_unlock(&l_queue->Lock);
+	return l_count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t p_queue) {
+	HostQueue_t *l_queue = p_queue;
+	UBaseType_t l_spaces;
+
+	pthread_mutex_lock(&l_queue->Lock);
+	l_spaces = l_queue->Length - l_queue->Count;
+	pthread_mutex_unlock(&l_queue->Lock);
+	return l_spaces;
+}
+
+void vQueueDelete(QueueHandle_t p_queue) {
+	HostQueue_t *l_queue = p_queue;
+	pthread_mutex_destroy(&l_queue->Lock);
+	pthread_cond_destroy(&l_queue->Cond);
+	free(l_queue->Items);
+	free(l_queue);
+}
+
+// ===== Semaphores =====
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+	return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t p_max, UBaseType_t p_initial) {
+	HostQueue_t *l_semaphore = xQueueCreate(p_max, 0);
+	l_semaphore->Count = p_initial;
+	return l_semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+	return xSemaphoreCreateCounting(1, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t p_semaphore, TickType_t p_ticks) {
+	return xQueueReceive(p_semaphore, NULL, p_ticks);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t p_semaphore) {
+	return xQueueSend(p_semaphore, NULL, 0);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t p_semaphore) {
+	vQueueDelete(p_semaphore);
+}
+
+// ### END DBK
@@ -0,0 +1,43 @@
+/*
+ * esp_err.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Host build: the esp-idf error codes the mqtt component uses.
+ */
+
+#ifndef HOST_INCLUDE_ESP_ERR_H_
+#define HOST_INCLUDE_ESP_ERR_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef int32_t esp_err_t;
+
+#define ESP_OK						0
+#define ESP_FAIL					-1
+#define ESP_ERR_NO_MEM				0x101
+#define ESP_ERR_INVALID_ARG			0x102
+#define ESP_ERR_INVALID_STATE		0x103
+#define ESP_ERR_INVALID_SIZE		0x104
+#define ESP_ERR_NOT_FOUND			0x105
+#define ESP_ERR_NOT_SUPPORTED		0x106
+#define ESP_ERR_TIMEOUT				0x107
+#define ESP_ERR_INVALID_RESPONSE	0x108
+#define ESP_ERR_INVALID_CRC			0x109
+#define ESP_ERR_INVALID_VERSION		0x10A
+#define ESP_ERR_INVALID_MAC			0x10B
+
+#define ESP_ERROR_CHECK(x) do { \
+		esp_err_t l_rc = (x); \
+		if (l_rc != ESP_OK) { \
+			fprintf(stderr, "ESP_ERROR_CHECK failed: 0x%x at %s:%d\n", (int) l_rc, __FILE__, __LINE__); \
+			abort(); \
+		} \
+	} while (0)
+
+#endif /* HOST_INCLUDE_ESP_ERR_H_ */
+
+// ### END DBK
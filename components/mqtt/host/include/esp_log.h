@@ -0,0 +1,28 @@
+/*
+ * esp_log.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Host build: ESP_LOGx onto stdout, filtered by host_log_level (0 is silent, 5 is verbose).
+ */
+
+#ifndef HOST_INCLUDE_ESP_LOG_H_
+#define HOST_INCLUDE_ESP_LOG_H_
+
+#include <stdio.h>
+
+extern int host_log_level;
+
+#define HOST_LOG(level, letter, tag, format, ...) \
+	if (host_log_level >= (level)) { printf(#letter " (%s) " format "\n", tag, ##__VA_ARGS__); }
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG(1, E, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG(2, W, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG(3, I, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) HOST_LOG(4, D, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) HOST_LOG(5, V, tag, format, ##__VA_ARGS__)
+
+#endif /* HOST_INCLUDE_ESP_LOG_H_ */
+
+// ### END DBK
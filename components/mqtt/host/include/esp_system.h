@@ -0,0 +1,22 @@
+/*
+ * esp_system.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Host build: the esp-idf system calls the mqtt component uses.
+ */
+
+#ifndef HOST_INCLUDE_ESP_SYSTEM_H_
+#define HOST_INCLUDE_ESP_SYSTEM_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_random(void);
+
+#endif /* HOST_INCLUDE_ESP_SYSTEM_H_ */
+
+// ### END DBK
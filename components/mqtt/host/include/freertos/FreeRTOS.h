@@ -0,0 +1,34 @@
+/*
+ * FreeRTOS.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Host build: FreeRTOS types with a 1 ms tick (see host_freertos.c).
+ */
+
+#ifndef HOST_INCLUDE_FREERTOS_FREERTOS_H_
+#define HOST_INCLUDE_FREERTOS_FREERTOS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define portMAX_DELAY		((TickType_t) 0xffffffffUL)
+#define portTICK_PERIOD_MS	((TickType_t) 1)
+#define portTICK_RATE_MS	portTICK_PERIOD_MS
+#define pdMS_TO_TICKS(ms)	((TickType_t) (ms))
+#define pdTRUE				1
+#define pdFALSE				0
+#define pdPASS				pdTRUE
+#define pdFAIL				pdFALSE
+#define errQUEUE_FULL		0
+
+#endif /* HOST_INCLUDE_FREERTOS_FREERTOS_H_ */
+
+// ### END DBK
@@ -0,0 +1,29 @@
+/*
+ * queue.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Host build: FreeRTOS queues on a pthread mutex and condition.
+ */
+
+#ifndef HOST_INCLUDE_FREERTOS_QUEUE_H_
+#define HOST_INCLUDE_FREERTOS_QUEUE_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t p_length, UBaseType_t p_item_size);
+BaseType_t xQueueSend(QueueHandle_t p_queue, const void *p_item, TickType_t p_ticks);
+BaseType_t xQueueSendToFront(QueueHandle_t p_queue, const void *p_item, TickType_t p_ticks);
+BaseType_t xQueueReceive(QueueHandle_t p_queue, void *r_item, TickType_t p_ticks);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t p_queue);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t p_queue);
+void vQueueDelete(QueueHandle_t p_queue);
+
+#define xQueueSendToBack xQueueSend
+
+#endif /* HOST_INCLUDE_FREERTOS_QUEUE_H_ */
+
+// ### END DBK
@@ -0,0 +1,26 @@
+/*
+ * semphr.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Host build: FreeRTOS semaphores, as queues of zero sized items.
+ */
+
+#ifndef HOST_INCLUDE_FREERTOS_SEMPHR_H_
+#define HOST_INCLUDE_FREERTOS_SEMPHR_H_
+
+#include "freertos/queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t p_max, UBaseType_t p_initial);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t p_semaphore, TickType_t p_ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t p_semaphore);
+void vSemaphoreDelete(SemaphoreHandle_t p_semaphore);
+
+#endif /* HOST_INCLUDE_FREERTOS_SEMPHR_H_ */
+
+// ### END DBK
@@ -0,0 +1,29 @@
+/*
+ * task.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Host build: FreeRTOS tasks as detached pthreads, with task notifications.
+ */
+
+#ifndef HOST_INCLUDE_FREERTOS_TASK_H_
+#define HOST_INCLUDE_FREERTOS_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *);
+typedef void *TaskHandle_t;
+
+BaseType_t xTaskCreate(TaskFunction_t p_function, const char *p_name, uint32_t p_stack, void *p_parameter,
+		UBaseType_t p_priority, TaskHandle_t *r_handle);
+void vTaskDelete(TaskHandle_t p_task);
+void vTaskDelay(TickType_t p_ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xTaskNotifyGive(TaskHandle_t p_task);
+uint32_t ulTaskNotifyTake(BaseType_t p_clear, TickType_t p_ticks);
+
+#endif /* HOST_INCLUDE_FREERTOS_TASK_H_ */
+
+// ### END DBK
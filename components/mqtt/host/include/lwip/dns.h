@@ -0,0 +1,15 @@
+/*
+ * dns.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Host build: nothing from lwIP's DNS is used directly.
+ */
+
+#ifndef HOST_INCLUDE_LWIP_DNS_H_
+#define HOST_INCLUDE_LWIP_DNS_H_
+
+#endif /* HOST_INCLUDE_LWIP_DNS_H_ */
+
+// ### END DBK
@@ -0,0 +1,17 @@
+/*
+ * netdb.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Host build: getaddrinfo() and friends from the host.
+ */
+
+#ifndef HOST_INCLUDE_LWIP_NETDB_H_
+#define HOST_INCLUDE_LWIP_NETDB_H_
+
+#include <netdb.h>
+
+#endif /* HOST_INCLUDE_LWIP_NETDB_H_ */
+
+// ### END DBK
@@ -0,0 +1,26 @@
+/*
+ * sockets.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Host build: lwIP's BSD socket API is the host's own.
+ */
+
+#ifndef HOST_INCLUDE_LWIP_SOCKETS_H_
+#define HOST_INCLUDE_LWIP_SOCKETS_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#endif /* HOST_INCLUDE_LWIP_SOCKETS_H_ */
+
+// ### END DBK
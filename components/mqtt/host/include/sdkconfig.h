@@ -0,0 +1,33 @@
+/*
+ * sdkconfig.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Host build: the Kconfig values menuconfig would otherwise generate.
+ * Only the options mqtt_config.h has no fallback for are here; bool options are left off,
+ *  pass them in EXTRA_CFLAGS (see Makefile).
+ */
+
+#ifndef HOST_INCLUDE_SDKCONFIG_H_
+#define HOST_INCLUDE_SDKCONFIG_H_
+
+#define CONFIG_PYHOUSE_HOUSE_NAME			"House 1"
+#define CONFIG_MQTT_HOST_NAME				"127.0.0.1"
+#define CONFIG_MQTT_HOST_PORT				1883
+#define CONFIG_MQTT_HOST_USERNAME			""
+#define CONFIG_MQTT_HOST_PASSWORD			""
+#define CONFIG_MQTT_CLIENT_ID				"host"
+#define CONFIG_MQTT_RECONNECT_TIMEOUT		60
+#define CONFIG_MQTT_QUEUE_BUFFER_SIZE_WORD	1024
+#define CONFIG_MQTT_BUFFER_SIZE_BYTE		1024
+#define CONFIG_MQTT_MAX_HOST_LEN			64
+#define CONFIG_MQTT_MAX_CLIENT_LEN			32
+#define CONFIG_MQTT_MAX_USERNAME_LEN		32
+#define CONFIG_MQTT_MAX_PASSWORD_LEN		32
+#define CONFIG_MQTT_MAX_LWT_TOPIC			32
+#define CONFIG_MQTT_MAX_LWT_MSG				32
+
+#endif /* HOST_INCLUDE_SDKCONFIG_H_ */
+
+// ### END DBK
@@ -0,0 +1,55 @@
+/*
+ * unity.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Host build: the esp-idf TEST_CASE registration and the subset of Unity assertions the tests use.
+ * A failed assertion returns from the function it is in, so assert only in the test case itself
+ *  or in void helpers, and only from the thread running the test.
+ */
+
+#ifndef HOST_INCLUDE_UNITY_H_
+#define HOST_INCLUDE_UNITY_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef void (*HostTestFunction_t)(void);
+
+void host_test_register(const char *p_name, const char *p_tags, HostTestFunction_t p_function);
+void host_test_fail(const char *p_file, int p_line, const char *p_message);
+void host_count_allocations(int p_on);
+uint32_t host_allocations(void);
+
+#define HOST_TEST_CAT2(a, b) a##b
+#define HOST_TEST_CAT(a, b) HOST_TEST_CAT2(a, b)
+
+#define TEST_CASE(name, tags) \
+	static void HOST_TEST_CAT(host_test_, __LINE__)(void); \
+	__attribute__((constructor)) static void HOST_TEST_CAT(host_test_register_, __LINE__)(void) { \
+		host_test_register(name, tags, &HOST_TEST_CAT(host_test_, __LINE__)); \
+	} \
+	static void HOST_TEST_CAT(host_test_, __LINE__)(void)
+
+#define TEST_ASSERT_MESSAGE(c, m) do { if (!(c)) { host_test_fail(__FILE__, __LINE__, m); return; } } while (0)
+#define TEST_ASSERT(c) TEST_ASSERT_MESSAGE((c), #c)
+#define TEST_ASSERT_TRUE(c) TEST_ASSERT(c)
+#define TEST_ASSERT_FALSE(c) TEST_ASSERT(!(c))
+#define TEST_ASSERT_NULL(p) TEST_ASSERT((p) == NULL)
+#define TEST_ASSERT_NOT_NULL(p) TEST_ASSERT((p) != NULL)
+#define TEST_ASSERT_EQUAL(e, a) TEST_ASSERT_MESSAGE((long long) (e) == (long long) (a), #a " != " #e)
+#define TEST_ASSERT_EQUAL_INT(e, a) TEST_ASSERT_EQUAL(e, a)
+#define TEST_ASSERT_EQUAL_UINT32(e, a) TEST_ASSERT_EQUAL(e, a)
+#define TEST_ASSERT_EQUAL_HEX8(e, a) TEST_ASSERT_EQUAL(e, a)
+#define TEST_ASSERT_NOT_EQUAL(e, a) TEST_ASSERT_MESSAGE((long long) (e) != (long long) (a), #a " == " #e)
+#define TEST_ASSERT_GREATER_THAN(t, a) TEST_ASSERT_MESSAGE((long long) (a) > (long long) (t), #a " <= " #t)
+#define TEST_ASSERT_LESS_OR_EQUAL(t, a) TEST_ASSERT_MESSAGE((long long) (a) <= (long long) (t), #a " > " #t)
+#define TEST_ASSERT_EQUAL_MEMORY(e, a, n) TEST_ASSERT_MESSAGE(memcmp((e), (a), (n)) == 0, #a " differs from " #e)
+#define TEST_ASSERT_EQUAL_STRING(e, a) TEST_ASSERT_MESSAGE(strcmp((e), (a)) == 0, #a " != " #e)
+#define TEST_ASSERT_EQUAL_STRING_LEN(e, a, n) TEST_ASSERT_MESSAGE(strncmp((e), (a), (n)) == 0, #a " != " #e)
+
+#endif /* HOST_INCLUDE_UNITY_H_ */
+
+// ### END DBK
@@ -0,0 +1,115 @@
+/*
+ * test_main.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Host build: runs the TEST_CASEs in ../test, in the order they were linked.
+ *
+ *   mqtt_test [-v ...] [filter]
+ *
+ * filter picks the cases whose name or tags contain it, e.g. "[keepalive]" or "outbox".
+ * Each -v raises the ESP_LOGx level by one. The exit status is the number of failed cases.
+ * The runner is linked with --wrap=malloc,calloc,realloc (see Makefile) so a test can count its heap allocations.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "unity.h"
+#include "esp_log.h"
+
+#define HOST_MAX_TESTS		256
+
+typedef struct HostTest {
+	const char			*Name;
+	const char			*Tags;
+	HostTestFunction_t	Function;
+} HostTest_t;
+
+static HostTest_t s_tests[HOST_MAX_TESTS];
+static int s_count = 0;
+static int s_failed = 0;
+static __thread int s_counting;
+static __thread uint32_t s_allocations;
+
+void *__real_malloc(size_t p_size);
+void *__real_calloc(size_t p_count, size_t p_size);
+void *__real_realloc(void *p_ptr, size_t p_size);
+
+void *__wrap_malloc(size_t p_size) {
+	s_allocations += s_counting;
+	return __real_malloc(p_size);
+}
+
+void *__wrap_calloc(size_t p_count, size_t p_size) {
+	s_allocations += s_counting;
+	return __real_calloc(p_count, p_size);
+}
+
+void *__wrap_realloc(void *p_ptr, size_t p_size) {
+	s_allocations += s_counting;
+	return __real_realloc(p_ptr, p_size);
+}
+
+/*
+ * Start (from zero) or stop counting the heap allocations made by the calling thread.
+ */
+void host_count_allocations(int p_on) {
+	if (p_on) {
+		s_allocations = 0;
+	}
+	s_counting = p_on;
+}
+
+uint32_t host_allocations(void) {
+	return s_allocations;
+}
+
+void host_test_register(const char *p_name, const char *p_tags, HostTestFunction_t p_function) {
+	if (s_count >= HOST_MAX_TESTS) {
+		fprintf(stderr, "Too many test cases; raise HOST_MAX_TESTS\n");
+		return;
+	}
+	s_tests[s_count].Name = p_name;
+	s_tests[s_count].Tags = p_tags;
+	s_tests[s_count].Function = p_function;
+	s_count++;
+}
+
+void host_test_fail(const char *p_file, int p_line, const char *p_message) {
+	printf("  %s:%d: %s\n", p_file, p_line, p_message);
+	s_failed = 1;
+}
+
+int main(int p_argc, char **p_argv) {
+	const char *l_filter = NULL;
+	int l_ran = 0;
+	int l_failures = 0;
+	int l_ix;
+
+	for (l_ix = 1; l_ix < p_argc; l_ix++) {
+		if (strcmp(p_argv[l_ix], "-v") == 0) {
+			host_log_level++;
+		} else {
+			l_filter = p_argv[l_ix];
+		}
+	}
+	for (l_ix = 0; l_ix < s_count; l_ix++) {
+		if (l_filter && strstr(s_tests[l_ix].Name, l_filter) == NULL && strstr(s_tests[l_ix].Tags, l_filter) == NULL) {
+			continue;
+		}
+		printf("%s %s\n", s_tests[l_ix].Name, s_tests[l_ix].Tags);
+		fflush(stdout);
+		s_failed = 0;
+		s_tests[l_ix].Function();
+		printf("  %s\n", s_failed ? "FAIL" : "PASS");
+		l_ran++;
+		l_failures += s_failed;
+	}
+	printf("-----------------------\n%d Tests %d Failures\n", l_ran, l_failures);
+	return l_failures;
+}
+
+// ### END DBK
@@ -2,6 +2,7 @@
  * @file mqtt.c
  */
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -11,6 +12,7 @@
 #include "freertos/queue.h"
 
 #include "esp_log.h"
+#include "esp_system.h"
 
 #include "lwip/sockets.h"
 #include "lwip/dns.h"
@@ -20,210 +22,494 @@
 
 #include "mqtt_structs.h"
 #include "ringbuf.h"
+#include "mqtt_outbox.h"
+#include "mqtt_inflight.h"
+#include "mqtt_router.h"
+#include "mqtt_property.h"
 #include "mqtt_packet.h"
 #include "mqtt_debug.h"
 #include "mqtt_transport.h"
+#include "mqtt_reconnect.h"
+#include "mqtt_loop.h"
+#include "mqtt_keepalive.h"
 #include "mqtt.h"
 
 static TaskHandle_t xMqttTask = NULL;
+#ifndef CONFIG_MQTT_EVENT_LOOP
 static TaskHandle_t xMqttSendingTask = NULL;
+#endif
+static SemaphoreHandle_t xMqttSendingDone = NULL;  // Given by mqtt_sending_task as it exits
+static volatile uint32_t s_sending_stop = 0;
 
 static const char *TAG = "Mqtt          ";
 
+/*
+ * Filters a SUBSCRIBE or UNSUBSCRIBE is packed from at a time, on the caller's stack (12 bytes each);
+ *  so the most one packet carries, if CONFIG_MQTT_SUBSCRIBE_PACKET_BYTE does not stop it first.
+ */
+#define MQTT_FILTER_WINDOW	32
+
 uint8_t		g_BufferIn;
 uint8_t 	g_BufferOut;
 Client_t   	g_ClientPtr;
 
 /*
- * Write the payload
+ * The protocol level received packets are parsed at.
  */
-static void mqtt_queue(Client_t *p_client) {
-// TOD: detect buffer full (ringbuf and queue)
+static int mqtt_level(Client_t *p_client) {
+	return p_client->State->protocol_level == MQTT_PROTOCOL_LEVEL_5 ? MQTT_PROTOCOL_LEVEL_5 : MQTT_PROTOCOL_LEVEL_311;
+}
+
+/*
+ * Hand the packet the builder has just written into the outbox over to the sending task.
+ */
+static esp_err_t mqtt_queue(Client_t *p_client, PacketInfo_t *p_packet) {
 	ESP_LOGI(TAG, " 38 Mqtt_Queue - All");
-	print_buffer(p_client->State->outbound_message->PayloadData, p_client->State->outbound_message->PayloadLength);
-	rb_write(p_client->Send_rb, p_client->State->outbound_message->PayloadData, p_client->State->outbound_message->PayloadLength);
-	xQueueSend(p_client->SendingQueue, &p_client->State->outbound_message->PayloadLength, 0);
+	print_buffer(p_packet->PacketBuffer, p_packet->Packet_length);
+	mqtt_outbox_commit(p_client->Outbox, p_packet);
 	ESP_LOGI(TAG, " 42 Mqtt_Queue - All");
+	return ESP_OK;
+}
+
+
+
+/*
+ * @return the packet id of a QoS 1 or QoS 2 PUBLISH, or 0 for any other packet.
+ */
+static uint16_t mqtt_tracked_id(const uint8_t *p_packet, uint32_t p_length) {
+	uint32_t l_ix = 1;
+	if ((p_packet[0] & 0xf0) != 0x30 || (p_packet[0] & 0x06) == 0) {
+		return 0;
+	}
+	while (l_ix < p_length && (p_packet[l_ix] & 0x80)) {
+		l_ix++;
+	}
+	l_ix++;
+	if (l_ix + 2 > p_length) {
+		return 0;
+	}
+	l_ix += 2 + (p_packet[l_ix] << 8 | p_packet[l_ix + 1]);
+	if (l_ix + 2 > p_length) {
+		return 0;
+	}
+	return p_packet[l_ix] << 8 | p_packet[l_ix + 1];
+}
+
+/*
+ * A packet is leaving the outbox; if it is a publish in the window, a reconnect now has to resend it from there.
+ */
+static void mqtt_window_sent(Client_t *p_client, const uint8_t *p_packet, uint32_t p_length) {
+	uint16_t l_id = mqtt_tracked_id(p_packet, p_length);
+	if (l_id != 0) {
+		mqtt_inflight_sent(&p_client->State->inflight, l_id);
+	}
 }
 
+/*
+ * The outbox threw a packet away unsent; a publish in the window will never be acked, so give its place back.
+ */
+static void mqtt_window_dropped(void *p_arg, const uint8_t *p_packet, uint32_t p_length) {
+	Client_t *l_client = (Client_t *) p_arg;
+	uint16_t l_id = mqtt_tracked_id(p_packet, p_length);
+	if (l_id != 0) {
+		ESP_LOGW(TAG, " 46 Window_Dropped - Publish id %d thrown away unsent", l_id);
+		mqtt_inflight_close(&l_client->State->inflight, l_id);
+	}
+}
 
+/*
+ * Write out the batch buffer.
+ * @return bytes written, or -1 if the write failed; the batch is kept to try again.
+ */
+static int mqtt_flush_batch(Client_t *p_client) {
+	Buffers_t *l_buffers = p_client->Buffers;
+	int l_written = l_buffers->batch_fill;
+	if (l_written == 0) {
+		return 0;
+	}
+	ESP_LOGD(TAG, " 50 Flush_Batch - %d bytes", l_written);
+	if (mqtt_transport_write_buffer(p_client->Broker->Socket, l_buffers->batch_buffer, l_written) < 0) {
+		return -1;
+	}
+	l_buffers->batch_fill = 0;
+	mqtt_keepalive_sent(&p_client->State->keepalive, xTaskGetTickCount());
+	return l_written;
+}
+
+/*
+ * Write out everything the outbox has ready.
+ * Packets are copied into the batch buffer until the next one will not fit, or nothing more arrives within
+ *  CONFIG_MQTT_BATCH_FLUSH_MS of the first, and then the whole batch goes out in one write.
+ * Packets bigger than the batch are written straight from the outbox.
+ * On an MQTT 5 connection each PUBLISH gets its topic alias as it goes into the batch (see mqtt_alias_rewrite).
+ * Must be called by the outbox's consumer task.
+ * @return bytes written to the socket.
+ */
+uint32_t mqtt_send_ready(Client_t *p_client) {
+	Buffers_t *l_buffers = p_client->Buffers;
+	TickType_t l_deadline = xTaskGetTickCount();
+	uint32_t l_sent = 0;
+	int32_t msg_len;
+	int32_t l_remaining;
+	int l_flushed;
+	uint32_t l_written;
+	uint8_t *l_data;
+
+	while (1) {
+		msg_len = mqtt_outbox_peek(p_client->Outbox, &l_data);
+		if (msg_len == 0) {
+			l_remaining = (int32_t) (l_deadline - xTaskGetTickCount());
+			if (l_buffers->batch_fill > 0 && l_remaining > 0 && mqtt_outbox_wait(p_client->Outbox, l_remaining)) {
+				continue;
+			}
+			l_flushed = mqtt_flush_batch(p_client);
+			return l_flushed > 0 ? l_sent + l_flushed : l_sent;
+		}
+		if (l_buffers->batch_fill + msg_len > l_buffers->batch_size) {
+			// The socket may block for a long time; DROP_OLDEST must not wait on us meanwhile
+			mqtt_outbox_pin(p_client->Outbox);
+			if ((l_flushed = mqtt_flush_batch(p_client)) < 0) {
+				return l_sent;
+			}
+			l_sent += l_flushed;
+			if (msg_len > l_buffers->batch_size) {
+				ESP_LOGD(TAG, " 68 Send_Ready - Sending...%d bytes", msg_len);
+				if (mqtt_transport_write_buffer(p_client->Broker->Socket, l_data, msg_len) < 0) {
+					// Leave it in the outbox; it is peeked again on the next pass
+					return l_sent;
+				}
+				mqtt_window_sent(p_client, l_data, msg_len);
+				mqtt_outbox_consume(p_client->Outbox);
+				mqtt_keepalive_sent(&p_client->State->keepalive, xTaskGetTickCount());
+				l_sent += msg_len;
+				continue;
+			}
+		}
+		if (l_buffers->batch_fill == 0) {
+			l_deadline = xTaskGetTickCount() + MQTT_MS_TO_TICKS(CONFIG_MQTT_BATCH_FLUSH_MS);
+		}
+		l_written = mqtt_alias_rewrite(&p_client->State->outbound_alias, l_data, msg_len,
+				l_buffers->batch_buffer + l_buffers->batch_fill, l_buffers->batch_size - l_buffers->batch_fill);
+		if (l_written == 0) {
+			memcpy(l_buffers->batch_buffer + l_buffers->batch_fill, l_data, msg_len);
+			l_written = msg_len;
+		}
+		l_buffers->batch_fill += l_written;
+		mqtt_window_sent(p_client, l_data, msg_len);
+		mqtt_outbox_consume(p_client->Outbox);
+	}
+}
+
+/*
+ * Queue a PINGREQ if one is due.
+ * @return ESP_OK, or ESP_ERR_TIMEOUT once the broker has let a PINGREQ go unanswered: the connection is dead.
+ *  *r_wait is how many ticks until this needs calling again.
+ */
+static esp_err_t mqtt_keepalive_due(Client_t *p_client, TickType_t *r_wait) {
+	Keepalive_t *l_keepalive = &p_client->State->keepalive;
+	TickType_t l_now = xTaskGetTickCount();
+
+	switch (mqtt_keepalive_check(l_keepalive, l_now, r_wait)) {
+	case KEEPALIVE_PING:
+		ESP_LOGI(TAG, " 83 Keepalive - Quiet - Queue pingreq");
+		mqtt_build_pingreq_packet(p_client);
+		// Counted as sent even if the control queue was full; that is no better than no answer
+		mqtt_keepalive_ping_sent(l_keepalive, l_now);
+		mqtt_keepalive_check(l_keepalive, l_now, r_wait);
+		return ESP_OK;
+	case KEEPALIVE_DEAD:
+		return ESP_ERR_TIMEOUT;
+	default:
+		return ESP_OK;
+	}
+}
 
 /*
  * A FreeRtos TASK for sending packets.
+ * It sleeps until something is queued or the keepalive next needs looking at.
  */
 void mqtt_sending_task(void *pvParameters) {
 	Client_t *l_client = (Client_t *) pvParameters;
-	uint32_t msg_len, send_len;
+	TickType_t l_wait;
 
 	ESP_LOGI(TAG, " 57 Sending_Task - Begin");
-	while (1) {
-		// this loop checks for some packet to be sent
-		if (xQueueReceive(l_client->SendingQueue, &msg_len, 1000 / portTICK_RATE_MS)) {
-			//queue available
-			ESP_LOGI(TAG, " 62 Sending_Task - Something to send");
-			while (msg_len > 0) {
-				send_len = msg_len;
-				if (send_len > CONFIG_MQTT_BUFFER_SIZE_BYTE) {
-					send_len = CONFIG_MQTT_BUFFER_SIZE_BYTE;
-				}
-				ESP_LOGE(TAG, " 68 Sending_Task - Sending...%d bytes", send_len);
-
-				rb_read(l_client->Send_rb, l_client->Buffers->out_buffer, send_len);
-//				l_client->State->pending_msg_type = mqtt_get_type(l_client->Buffers->out_buffer);
-//				l_client->State->pending_msg_id = mqtt_get_id(l_client->Buffers->out_buffer, send_len);
-				write(l_client->Broker->Socket, l_client->Buffers->out_buffer, send_len);
-				//TOD: Check sending type, to callback publish message
-				msg_len -= send_len;
-			}
-			//invalidate keep alive timer
-			l_client->Will->Keepalive_tick = l_client->Will->Keepalive / 2;
-		} else {
-			if (l_client->Will->Keepalive_tick > 0)
-				l_client->Will->Keepalive_tick--;
-			else {
-				ESP_LOGI(TAG, " 83 Sending_Task - Timed out ");
-				l_client->Will->Keepalive_tick = l_client->Will->Keepalive / 2;
-				mqtt_build_pingreq_packet(l_client);
-				//print_packet(l_client->Packet);
-				ESP_LOGI(TAG, " 86 Sending_Task ");
-//				l_client->Buffers->out_buffer = l_client->Packet;
-//				l_client->State->pending_msg_type = mqtt_get_type(l_client->State->outbound_message->PayloadData);
-//				l_client->State->pending_msg_id = mqtt_get_id(l_client->State->outbound_message->PayloadData, l_client->State->outbound_message->PayloadLength);
-				ESP_LOGI(TAG, " 89 Sending_Task - Sending pingreq");
-				mqtt_transport_write(l_client->Broker->Socket, l_client->Packet);
-			}
+	mqtt_outbox_set_consumer(l_client->Outbox, xTaskGetCurrentTaskHandle());
+	while (!s_sending_stop) {
+		if (mqtt_keepalive_due(l_client, &l_wait) != ESP_OK) {
+			// Wake the receive task out of its read; the transport task reconnects
+			shutdown(l_client->Broker->Socket, SHUT_RDWR);
 		}
+		mqtt_outbox_wait(l_client->Outbox, l_wait);
+		// Write each packet whole, straight out of the outbox.
+		// Peek hands out control packets ahead of the publish lanes, so acks and pings never wait behind the backlog.
+		mqtt_send_ready(l_client);
+		//TOD: Check sending type, to callback publish message
 	}
-	vQueueDelete(l_client->SendingQueue);
+	// Let go of the outbox in an order the next sending task can pick up from
+	mqtt_outbox_release(l_client->Outbox);
+	mqtt_outbox_set_consumer(l_client->Outbox, NULL);
 	ESP_LOGI(TAG, " 95 Sending_Task - Exiting");
+	if (xMqttSendingDone) {
+		xSemaphoreGive(xMqttSendingDone);
+	}
 	vTaskDelete(NULL);
 }
 
 /*
- *
+ * Hand a received PUBLISH, or the next chunk of one, to the application:
+ *  to the handler of every filter registered with mqtt_route() that matches its topic, or else to data_cb.
  */
-void deliver_publish(Client_t *p_client, uint8_t *p_message, int p_length) {
-	PacketInfo_t  event_data;
-	int len_read, total_mqtt_len = 0, mqtt_len = 0, mqtt_offset = 0;
-	ESP_LOGI(TAG, " 92 Deliver Publish");
-	do {
-		event_data.PacketTopic_length = p_length;
-//		event_data.PacketTopic = mqtt_get_publish_topic(p_message, &event_data.PacketTopic_length);
-		event_data.PacketPayload_length = p_length;
-//		event_data.PacketPayload = mqtt_get_publish_data(p_message, &event_data.PacketPayload_length);
-		if (total_mqtt_len == 0) {
-			total_mqtt_len = p_client->State->message_length - p_client->State->message_length_read + event_data.PacketPayload_length;
-			mqtt_len = event_data.PacketPayload_length;
-		} else {
-			mqtt_len = len_read;
+static void deliver_chunk(Client_t *p_client, DataEvent_t *p_event) {
+	ESP_LOGI(TAG, "107 Data received: %d/%d bytes at %d", p_event->Data_length, p_event->Total_length, p_event->Offset);
+	if (p_client->Router != NULL && mqtt_router_dispatch(p_client->Router, p_event->Topic, p_event->Topic_length, p_client, p_event) > 0) {
+		return;
+	}
+	if (p_client->Cb->data_cb) {
+		p_client->Cb->data_cb(p_client, p_event);
+	}
+}
+
+/*
+ * Hand a received PUBLISH to the application, as one chunk.
+ * Topic and payload point into the receive buffer and are only valid during the callback.
+ */
+void deliver_publish(Client_t *p_client, PacketView_t *p_view) {
+	DataEvent_t l_event;
+	l_event.Topic = p_view->Topic;
+	l_event.Topic_length = p_view->Topic_length;
+	l_event.PacketId = p_view->PacketId;
+	l_event.Qos = p_view->Qos;
+	l_event.Retain = p_view->Flags & 0x01;
+	l_event.Data = p_view->Payload;
+	l_event.Data_length = p_view->Payload_length;
+	l_event.Offset = 0;
+	l_event.Total_length = p_view->Payload_length;
+	deliver_chunk(p_client, &l_event);
+}
+
+/*
+ * Answer a received PUBLISH on the outbox's control lane.
+ * Called before the publish is handed to data_cb, so the ack never waits on the application.
+ */
+static void mqtt_ack_publish(Client_t *p_client, uint8_t p_qos, uint16_t p_id) {
+	if (p_qos == 1) {
+		mqtt_build_puback_packet(p_client, p_id);
+	} else if (p_qos == 2) {
+		mqtt_build_pubrec_packet(p_client, p_id);
+	}
+}
+
+/*
+ * Should a received PUBLISH reach data_cb?
+ * A QoS 2 publish is delivered once; a resend of one still waiting for its PUBREL is only acked again.
+ * A new QoS 2 id is recorded as delivered here; a caller that then fails to deliver must release it.
+ */
+static int mqtt_first_delivery(Client_t *p_client, uint8_t p_qos, uint16_t p_id) {
+	if (p_qos == 2 && mqtt_inbound_qos2_receive(&p_client->State->inbound_qos2, p_id) == ESP_ERR_INVALID_STATE) {
+		ESP_LOGD(TAG, "Receive_Schedule - Publish %d already delivered", p_id);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Act on one part of a packet too big for the receive buffer.
+ * Only a PUBLISH is worth streaming; its payload goes to data_cb a chunk at a time, never held whole.
+ * The fixed header and topic are kept at the front of the decoder's buffer so the topic stays valid for every chunk.
+ */
+static void mqtt_dispatch_part(Client_t *p_client, MqttFrame_t *p_frame) {
+	DataEvent_t *l_event = &p_client->State->inbound;
+	PacketView_t l_view;
+	uint32_t l_header;
+
+	if (p_frame->Offset == 0) {
+		p_client->State->inbound_skip = 1;
+		l_event->Qos = 0;
+		if (mqtt_parse_packet_level(p_frame->Packet, p_frame->Available, mqtt_level(p_client), &l_view) != ESP_ERR_INVALID_SIZE
+				|| l_view.Type != MQTT_CONTROL_PACKET_TYPE_PUBLISH || l_view.Payload == NULL) {
+			ESP_LOGW(TAG, "136 Receive_Schedule - Dropping a %d byte packet, type %d", p_frame->Length, p_frame->Type >> 4);
+			return;
 		}
-		event_data.Packet_length = total_mqtt_len;
-//		event_data.PacketPayload_offset = mqtt_offset;
-		event_data.PacketPayload_length = mqtt_len;
-		ESP_LOGI(TAG, "107 Data received: %d/%d bytes ", mqtt_len, total_mqtt_len);
-		if (p_client->Cb->data_cb) {
-			p_client->Cb->data_cb(p_client, &event_data);
+		// Whatever becomes of the payload, the publish is acked when its last part arrives
+		l_event->Qos = l_view.Qos;
+		l_event->PacketId = l_view.PacketId;
+		// A resend we have delivered already: drop the payload
+		if (!mqtt_first_delivery(p_client, l_view.Qos, l_view.PacketId)) {
+			return;
+		}
+		l_header = l_view.Payload - p_frame->Packet;
+		if (mqtt_decoder_keep(&p_client->Buffers->in_decoder, l_header) != ESP_OK) {
+			ESP_LOGW(TAG, "137 Receive_Schedule - Dropping a publish, topic too long to stream");
+			// Never delivered, so not a duplicate if it comes again
+			if (l_view.Qos == 2) {
+				mqtt_inbound_qos2_release(&p_client->State->inbound_qos2, l_view.PacketId);
+			}
+			return;
 		}
-		mqtt_offset += mqtt_len;
-		if (p_client->State->message_length_read >= p_client->State->message_length)
-			break;
-		len_read = mqtt_transport_read(p_client->Broker->Socket, p_client->Buffers->in_buffer);
-		p_client->State->message_length_read += len_read;
-	} while (1);
+		p_client->State->inbound_skip = 0;
+		l_event->Topic = l_view.Topic;
+		l_event->Topic_length = l_view.Topic_length;
+		l_event->Retain = l_view.Flags & 0x01;
+		l_event->Data = l_view.Payload;
+		l_event->Data_length = l_view.Payload_length;
+		l_event->Offset = 0;
+		l_event->Total_length = p_frame->Length - l_header;
+		deliver_chunk(p_client, l_event);
+		l_event->Offset = l_view.Payload_length;
+		return;
+	}
+	// The whole publish is here once the last part is; ack it before the application sees that part
+	if (p_frame->Offset + p_frame->Available == p_frame->Length) {
+		mqtt_ack_publish(p_client, l_event->Qos, l_event->PacketId);
+	}
+	if (p_client->State->inbound_skip) {
+		return;
+	}
+	l_event->Data = p_frame->Packet;
+	l_event->Data_length = p_frame->Available;
+	deliver_chunk(p_client, l_event);
+	l_event->Offset += p_frame->Available;
 }
 
 /*
- * This is a high level routine called from                                                                                                                                          the users application.
- * It will read MQTT packets from the transport socket and dispatch/act on the packets.
+ * Act on one received packet.
  */
-void mqtt_start_receive_schedule(Client_t *p_client) {
-	int l_read_len;
-	uint8_t l_msg_type;
-	uint8_t l_msg_qos;
-//	uint16_t msg_id;
+static void mqtt_dispatch(Client_t *p_client, MqttFrame_t *p_frame) {
+	PacketView_t l_view;
+	uint16_t l_msg_id;
 
-	ESP_LOGI(TAG, "128 Receive_Schedule");
-	while (1) {
-		l_read_len = mqtt_transport_read(p_client->Broker->Socket, p_client->Buffers->in_buffer);
-		ESP_LOGI(TAG, "131 Receive_Schedule - Read length %d\n", l_read_len);
-		if (l_read_len == 0) {
-			break;
-		}
-		l_msg_type = mqtt_get_packet_type(p_client->Buffers->in_buffer);
-		l_msg_qos = mqtt_get_packet_qos(p_client->Buffers->in_buffer);
+	if (mqtt_parse_packet_level(p_frame->Packet, p_frame->Length, mqtt_level(p_client), &l_view) != ESP_OK) {
+		ESP_LOGW(TAG, "135 Receive_Schedule - Dropping a malformed packet, type %d", p_frame->Type >> 4);
+		return;
+	}
+	l_msg_id = l_view.PacketId;
 //		msg_id = mqtt_get_packet_id(p_client->Buffers->in_buffer, p_client->Buffers->in_buffer_length);
 //		ESP_LOGE(TAG, "137 Receive_Schedule - msg_type:%d;  msg_id:%d;  pending_id:%d", msg_type, msg_id, p_client->State->pending_msg_type);
-		switch (l_msg_type) {
-		case MQTT_CONTROL_PACKET_TYPE_SUBACK:
-//			if (p_client->State->pending_msg_type == MQTT_MSG_TYPE_SUBSCRIBE && p_client->State->pending_msg_id == msg_id) {
-//				ESP_LOGE(TAG, "Receive_Schedule - Subscribe successful");
-//				if (p_client->Cb->subscribe_cb) {
-//					p_client->Cb->subscribe_cb(p_client, NULL);
-//				}
-//			}
-			break;
-		case MQTT_CONTROL_PACKET_TYPE_UNSUBACK:
-			ESP_LOGI(TAG, "Receive_Schedule - UnSubAck");
+	switch (l_view.Type) {
+	case MQTT_CONTROL_PACKET_TYPE_SUBACK:
+		// One return code per filter, in the order the SUBSCRIBE carried them
+		ESP_LOGI(TAG, "Receive_Schedule - SubAck %d, %d filters", l_msg_id, l_view.Payload_length);
+		if (p_client->Subscriptions != NULL) {
+			mqtt_subscription_granted(p_client->Subscriptions, l_msg_id, l_view.Payload, l_view.Payload_length);
+		}
+		if (p_client->Cb != NULL && p_client->Cb->subscribe_cb) {
+			p_client->Cb->subscribe_cb(p_client, &l_view);
+		}
+		break;
+	case MQTT_CONTROL_PACKET_TYPE_UNSUBACK:
+		ESP_LOGI(TAG, "Receive_Schedule - UnSubAck");
 //			if (p_client->State->pending_msg_type == MQTT_MSG_TYPE_UNSUBSCRIBE && p_client->State->pending_msg_id == msg_id) {
 //				ESP_LOGI(TAG, "Receive_Schedule - UnSubscribe successful");
 //		}
-			break;
-		case MQTT_CONTROL_PACKET_TYPE_PUBLISH:
-			ESP_LOGI(TAG, "Receive_Schedule - Publish");
-//			if (msg_qos == 1) {
-//				// mqtt_msg_puback(p_client->State->Connection, msg_id);
-//				mqtt_msg_puback(p_client->Packet, msg_id);
-//				p_client->Buffers->out_buffer = p_client->State->Connection;
-//			} else if (msg_qos == 2) {
-//				mqtt_msg_pubrec(p_client->State->Connection, msg_id);
-//				p_client->State->outbound_message = p_client->State->Connection;
-//				;
-//			}
-//			if (msg_qos == 1 || msg_qos == 2) {
-//				ESP_LOGI(TAG,"Receive_Schedule - Queue response QoS: %d", msg_qos);
-//				mqtt_queue(p_client);
-//			}
-//			p_client->State->message_length_read = read_len;
-//			p_client->State->message_length = mqtt_get_total_length(p_client->Buffers->in_buffer, p_client->State->message_length_read);
-//			ESP_LOGI(TAG, "Receive_Schedule - deliver_publish");
-
-//			deliver_publish(p_client, p_client->Buffers->in_buffer, p_client->State->message_length_read);
-//			deliver_publish(p_client, p_client->Buffers->in_buffer, p_client->State->message_length_read);
- 			break;
-		case MQTT_CONTROL_PACKET_TYPE_PUBACK:
-			ESP_LOGI(TAG, "Receive_Schedule - PubAck");
-//			if (p_client->State->pending_msg_type == MQTT_MSG_TYPE_PUBLISH && p_client->State->pending_msg_id == msg_id) {
-//				ESP_LOGI(TAG, "Receive_Schedule - received MQTT_MSG_TYPE_PUBACK, finish QoS1 publish");
-//			}
-			break;
-		case MQTT_CONTROL_PACKET_TYPE_PUBREC:
-			ESP_LOGI(TAG, "Receive_Schedule - PubRec");
+		break;
+	case MQTT_CONTROL_PACKET_TYPE_PUBLISH:
+		ESP_LOGI(TAG, "Receive_Schedule - Publish");
+		mqtt_ack_publish(p_client, l_view.Qos, l_msg_id);
+		if (mqtt_first_delivery(p_client, l_view.Qos, l_msg_id)) {
+			deliver_publish(p_client, &l_view);
+		}
+		break;
+	case MQTT_CONTROL_PACKET_TYPE_PUBACK:
+		ESP_LOGD(TAG, "Receive_Schedule - PubAck %d", l_msg_id);
+		if (mqtt_inflight_ack(&p_client->State->inflight, l_msg_id, INFLIGHT_PUBACK) != ESP_OK) {
+			ESP_LOGW(TAG, "Receive_Schedule - PubAck for %d, which is not waiting for one", l_msg_id);
+		}
+		break;
+	case MQTT_CONTROL_PACKET_TYPE_PUBREC:
+		ESP_LOGD(TAG, "Receive_Schedule - PubRec %d", l_msg_id);
+		// A repeated PUBREC finds the slot already waiting for PUBCOMP; it still gets its PUBREL
+		mqtt_inflight_ack(&p_client->State->inflight, l_msg_id, INFLIGHT_PUBREC);
+		mqtt_build_pubrel_packet(p_client, l_msg_id);
 //			mqtt_msg_pubrel(p_client->State->Connection, msg_id);
 //			p_client->Buffers->out_buffer = p_client->State->Connection;
 //			mqtt_queue(p_client);
-			break;
-		case MQTT_CONTROL_PACKET_TYPE_PUBREL:
-			ESP_LOGI(TAG, "Receive_Schedule - PubRel");
+		break;
+	case MQTT_CONTROL_PACKET_TYPE_PUBREL:
+		ESP_LOGD(TAG, "Receive_Schedule - PubRel %d", l_msg_id);
+		mqtt_inbound_qos2_release(&p_client->State->inbound_qos2, l_msg_id);
+		mqtt_build_pubcomp_packet(p_client, l_msg_id);
 //			mqtt_msg_pubcomp(p_client->State->Connection, msg_id);
 //			p_client->Buffers->out_buffer = p_client->State->Connection;
 //			mqtt_queue(p_client);
-			break;
-		case MQTT_CONTROL_PACKET_TYPE_PUBCOMP:
-			ESP_LOGI(TAG, "Receive_Schedule - PubComp");
-//			if (p_client->State->pending_msg_type == MQTT_MSG_TYPE_PUBLISH && p_client->State->pending_msg_id == msg_id) {
-//				ESP_LOGI(TAG, "Receive_Schedule - Receive MQTT_MSG_TYPE_PUBCOMP, finish QoS2 publish");
-//			}
-			break;
-		case MQTT_CONTROL_PACKET_TYPE_PINGREQ:
-			ESP_LOGI(TAG, "Receive_Schedule - PingReq");
+		break;
+	case MQTT_CONTROL_PACKET_TYPE_PUBCOMP:
+		ESP_LOGD(TAG, "Receive_Schedule - PubComp %d", l_msg_id);
+		if (mqtt_inflight_ack(&p_client->State->inflight, l_msg_id, INFLIGHT_PUBCOMP) != ESP_OK) {
+			ESP_LOGW(TAG, "Receive_Schedule - PubComp for %d, which is not waiting for one", l_msg_id);
+		}
+		break;
+	case MQTT_CONTROL_PACKET_TYPE_PINGREQ:
+		ESP_LOGI(TAG, "Receive_Schedule - PingReq");
 //			mqtt_msg_pingresp(p_client->State->Connection);
 //			p_client->Buffers->out_buffer = p_client->State->Connection;
 //			mqtt_queue(p_client);
-			break;
-		case MQTT_CONTROL_PACKET_TYPE_PINGRESP:
-			ESP_LOGI(TAG, "MQTT_MSG_TYPE_PINGRESP");
-			break;
+		break;
+	case MQTT_CONTROL_PACKET_TYPE_PINGRESP:
+		// Already counted as proof of life by mqtt_receive()
+		ESP_LOGI(TAG, "MQTT_MSG_TYPE_PINGRESP");
+		break;
+	case MQTT_CONTROL_PACKET_TYPE_DISCONNECT:
+		// MQTT 5 only; the broker closes the connection after it
+		ESP_LOGW(TAG, "Receive_Schedule - Disconnected by the broker, reason 0x%02x", l_view.ReasonCode);
+		break;
+	}
+}
+
+/*
+ * Read whatever the socket has into the decoder's free space.
+ * @return bytes read, 0 if the broker closed the connection, < 0 on error or timeout.
+ */
+static int mqtt_receive(Client_t *p_client) {
+	uint32_t l_room;
+	uint8_t *l_space;
+	int l_read_len;
+
+	l_space = mqtt_decoder_space(&p_client->Buffers->in_decoder, &l_room);
+	l_read_len = mqtt_transport_read_some(p_client->Broker->Socket, l_space, l_room);
+	if (l_read_len > 0) {
+		mqtt_decoder_commit(&p_client->Buffers->in_decoder, l_read_len);
+		mqtt_keepalive_received(&p_client->State->keepalive, xTaskGetTickCount());
+	}
+	return l_read_len;
+}
+
+/*
+ * One read from the socket, and act on every packet (or part of a streamed PUBLISH) it completes.
+ * @return bytes read; 0 or less when the connection is finished - closed, failed or sent us garbage.
+ */
+static int mqtt_receive_frames(Client_t *p_client) {
+	MqttFrame_t l_frame;
+	int l_read_len;
+	int l_result;
+
+	l_read_len = mqtt_receive(p_client);
+	ESP_LOGI(TAG, "131 Receive_Schedule - Read length %d\n", l_read_len);
+	if (l_read_len <= 0) {
+		return l_read_len;
+	}
+	while ((l_result = mqtt_decoder_next(&p_client->Buffers->in_decoder, &l_frame)) != MQTT_DECODE_MORE) {
+		if (l_result == MQTT_DECODE_MALFORMED) {
+			ESP_LOGE(TAG, "131 Receive_Schedule - Malformed packet, dropping the connection");
+			return -1;
 		}
+		if (l_result == MQTT_DECODE_FRAME) {
+			mqtt_dispatch(p_client, &l_frame);
+		} else {
+			mqtt_dispatch_part(p_client, &l_frame);
+		}
+	}
+	return l_read_len;
+}
+
+/*
+ * This is a high level routine called from                                                                                                                                          the users application.
+ * It will read MQTT packets from the transport socket and dispatch/act on the packets.
+ * A read may end part way through a packet or hold several; the decoder hands out each complete one,
+ *  and a PUBLISH too big for in_buffer as it arrives.
+ */
+void mqtt_start_receive_schedule(Client_t *p_client) {
+	ESP_LOGI(TAG, "128 Receive_Schedule");
+	while (mqtt_receive_frames(p_client) > 0) {
 	}
 	ESP_LOGI(TAG, "Receive_Schedule - network disconnected");
 }
@@ -235,36 +521,219 @@ esp_err_t mqtt_destroy(Client_t *p_client) {
 	ESP_LOGI(TAG, "Destroy");
 	free(p_client->Buffers->in_buffer);
 	free(p_client->Buffers->out_buffer);
+	free(p_client->Buffers->batch_buffer);
+	free(p_client->Packet->PacketBuffer);
+	mqtt_inflight_deinit(&p_client->State->inflight);
+	mqtt_alias_deinit(&p_client->State->outbound_alias);
+	mqtt_router_deinit(p_client->Router);
+	mqtt_topic_table_deinit(p_client->Topics);
+	mqtt_subscription_deinit(p_client->Subscriptions);
+	free(p_client->Reconnect);
+	free(p_client->Loop);
 	free(p_client);
 	vTaskDelete(xMqttTask);
 	return ESP_OK;
 }
 
-/**
- * We only support one topic/qos per subscription.
+/*
+ * Describe the next filters for a SUBSCRIBE or UNSUBSCRIBE in r_filters, from *p_next on.
+ * With p_topics NULL they are the kept subscriptions, to be sent again; otherwise the application's p_topics,
+ *  which a SUBSCRIBE adds to the kept set (or updates) and an UNSUBSCRIBE takes out of it.
  *
+ * @return the number described; 0 once there are no more.
  */
-esp_err_t mqtt_subscribe(Client_t *p_client, char *p_topic, uint8_t p_qos) {
-	ESP_LOGI(TAG, "240 Subscribe - Begin");
-	mqtt_build_subscribe_packet(p_client, p_topic, p_qos, &p_client->State->pending_msg_id);
-	ESP_LOGI(TAG, "220 Subscribe - Queue subscribe, topic\"%s\", id: %d", p_topic, p_client->State->pending_msg_id);
-	mqtt_queue(p_client);
+static uint32_t mqtt_next_filters(Client_t *p_client, int p_type, char **p_topics, const uint8_t *p_qos, uint32_t p_count,
+		uint32_t *p_next, SubscribeFilter_t *r_filters, uint32_t p_max) {
+	SubscriptionSet_t *l_set = p_client->Subscriptions;
+	uint32_t l_count = 0;
+	SubscribeFilter_t *l_filter;
+
+	if (p_topics == NULL) {
+		return l_set != NULL ? mqtt_subscription_collect(l_set, p_next, r_filters, p_max) : 0;
+	}
+	for (; *p_next < p_count && l_count < p_max; (*p_next)++) {
+		l_filter = &r_filters[l_count++];
+		if (p_type == MQTT_CONTROL_PACKET_TYPE_SUBSCRIBE && l_set != NULL
+				&& mqtt_subscription_add(l_set, p_topics[*p_next], p_qos[*p_next], l_filter) == ESP_OK) {
+			continue;
+		}
+		if (p_type == MQTT_CONTROL_PACKET_TYPE_UNSUBSCRIBE && l_set != NULL) {
+			mqtt_subscription_remove(l_set, p_topics[*p_next]);
+		}
+		// Not kept: sent all the same, but not sent again on reconnect
+		l_filter->Filter = p_topics[*p_next];
+		l_filter->Length = strlen(p_topics[*p_next]);
+		l_filter->Qos = p_qos != NULL ? p_qos[*p_next] : 0;
+		l_filter->Entry = 0;
+	}
+	return l_count;
+}
+
+/*
+ * Queue SUBSCRIBEs (or UNSUBSCRIBEs) for the filters mqtt_next_filters() gives, as few packets as they pack into.
+ * A window of MQTT_FILTER_WINDOW filters is kept full; each packet takes what fits from its front.
+ */
+static esp_err_t mqtt_send_filters(Client_t *p_client, int p_type, char **p_topics, const uint8_t *p_qos, uint32_t p_count) {
+	SubscribeFilter_t l_filters[MQTT_FILTER_WINDOW];
+	PacketInfo_t l_packet;
+	uint32_t l_next = 0;
+	uint32_t l_count = 0;
+	uint32_t l_packed;
+	uint16_t l_id;
+	esp_err_t l_err;
+
+	while ((l_count += mqtt_next_filters(p_client, p_type, p_topics, p_qos, p_count, &l_next, l_filters + l_count, MQTT_FILTER_WINDOW - l_count)) > 0) {
+		if (p_type == MQTT_CONTROL_PACKET_TYPE_SUBSCRIBE) {
+			l_err = mqtt_build_subscribe_list_packet(p_client, &l_packet, l_filters, l_count, &l_id, &l_packed);
+		} else {
+			l_err = mqtt_build_unsubscribe_list_packet(p_client, &l_packet, l_filters, l_count, &l_id, &l_packed);
+		}
+		if (l_err != ESP_OK) {
+			return l_err;
+		}
+		// Before it can be sent, so the SUBACK always finds its filters
+		if (p_type == MQTT_CONTROL_PACKET_TYPE_SUBSCRIBE && p_client->Subscriptions != NULL) {
+			mqtt_subscription_sent(p_client->Subscriptions, l_filters, l_packed, l_id);
+		}
+		ESP_LOGI(TAG, "220 Subscribe - Queue %s, %d filters, id: %d",
+				p_type == MQTT_CONTROL_PACKET_TYPE_SUBSCRIBE ? "subscribe" : "unsubscribe", l_packed, l_id);
+		mqtt_queue(p_client, &l_packet);
+		l_count -= l_packed;
+		memmove(l_filters, l_filters + l_packed, l_count * sizeof(SubscribeFilter_t));
+	}
 	return ESP_OK;
 }
 
+/*
+ * @return ESP_ERR_INVALID_ARG unless every one of p_topics is a filter.
+ */
+static esp_err_t mqtt_check_filters(char **p_topics, int p_count) {
+	int l_ix;
+	if (p_topics == NULL || p_count <= 0) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	for (l_ix = 0; l_ix < p_count; l_ix++) {
+		if (p_topics[l_ix] == NULL || p_topics[l_ix][0] == '\0' || strlen(p_topics[l_ix]) > 0xffff) {
+			ESP_LOGE(TAG, "240 Subscribe - Topic %d missing", l_ix);
+			return ESP_ERR_INVALID_ARG;
+		}
+	}
+	return ESP_OK;
+}
+
+/**
+ * Subscribe to p_count topic filters, p_topics[i] at QoS p_qos[i], in as few SUBSCRIBEs as they pack into.
+ * The filters are kept and subscribed to again each time the client connects.
+ * Safe to call from any task.
+ */
+esp_err_t mqtt_subscribe_many(Client_t *p_client, char **p_topics, const uint8_t *p_qos, int p_count) {
+	ESP_LOGI(TAG, "240 Subscribe - Begin, %d filters", p_count);
+	if (mqtt_check_filters(p_topics, p_count) != ESP_OK || p_qos == NULL) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	return mqtt_send_filters(p_client, MQTT_CONTROL_PACKET_TYPE_SUBSCRIBE, p_topics, p_qos, p_count);
+}
 
+/**
+ * Subscribe to one topic filter; see mqtt_subscribe_many().
+ * Safe to call from any task.
+ */
+esp_err_t mqtt_subscribe(Client_t *p_client, char *p_topic, uint8_t p_qos) {
+	return mqtt_subscribe_many(p_client, &p_topic, &p_qos, 1);
+}
 
+/**
+ * Unsubscribe from p_count topic filters in as few UNSUBSCRIBEs as they pack into; they are no longer kept.
+ * Safe to call from any task.
+ */
+esp_err_t mqtt_unsubscribe_many(Client_t *p_client, char **p_topics, int p_count) {
+	esp_err_t l_err;
+	ESP_LOGI(TAG, "241 Unsubscribe - Begin, %d filters", p_count);
+	if ((l_err = mqtt_check_filters(p_topics, p_count)) != ESP_OK) {
+		return l_err;
+	}
+	return mqtt_send_filters(p_client, MQTT_CONTROL_PACKET_TYPE_UNSUBSCRIBE, p_topics, NULL, p_count);
+}
+
+/**
+ * Safe to call from any task.
+ */
+esp_err_t mqtt_unsubscribe(Client_t *p_client, char *p_topic) {
+	return mqtt_unsubscribe_many(p_client, &p_topic, 1);
+}
+
+/**
+ * Subscribe again to every kept filter, packed into as few SUBSCRIBEs as they fit.
+ * Called once the broker has accepted a connection; the packets go ahead of anything queued after it.
+ */
+esp_err_t mqtt_resubscribe(Client_t *p_client) {
+	ESP_LOGI(TAG, "242 Resubscribe - Begin");
+	return mqtt_send_filters(p_client, MQTT_CONTROL_PACKET_TYPE_SUBSCRIBE, NULL, NULL, 0);
+}
+
+/**
+ * Send received publishes whose topic matches p_filter ('+' and '#' allowed) to p_handler(client, DataEvent_t *)
+ *  instead of data_cb.  A NULL p_handler removes the filter.
+ * This only routes; the broker still has to be sent a subscription that covers the filter.
+ * Safe to call from any task, at any time.
+ */
+esp_err_t mqtt_route(Client_t *p_client, const char *p_filter, mqtt_callback p_handler) {
+	if (p_client->Router == NULL) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	return mqtt_router_add(p_client->Router, p_filter, p_handler);
+}
 
 /*
- *
+ * Safe to call from any task.
+ * The packet is built on the caller's stack description, straight into the caller's outbox lane.
  */
 esp_err_t mqtt_publish(Client_t *p_client, char *p_topic, char *p_data, int p_len, int p_qos, int p_retain) {
+	PacketInfo_t l_packet;
+	uint16_t l_id;
+	esp_err_t l_err;
 	ESP_LOGI(TAG, "240 Publish - Begin");
-//	p_client->Buffers->out_buffer = mqtt_msg_publish(p_client->State->Connection, p_topic, p_data, p_len, p_qos, p_retain, &p_client->State->pending_msg_id);
-	mqtt_queue(p_client);
-	ESP_LOGI(TAG, "Queuing publish, length: %d, queue size(%d/%d)\r\n",
-			p_client->State->outbound_message->PayloadLength, p_client->Send_rb->fill_cnt, p_client->Send_rb->size);
-	return ESP_OK;
+	l_err = mqtt_build_publish_packet(p_client, &l_packet, p_topic, p_data, p_len, p_qos, p_retain, &l_id);
+	if (l_err != ESP_OK) {
+		return l_err;
+	}
+	ESP_LOGI(TAG, "Queuing publish, length: %d, id: %d", l_packet.Packet_length, l_id);
+	return mqtt_queue(p_client, &l_packet);
+}
+
+/**
+ * Register a topic to publish to by handle with mqtt_publish_handle().
+ * Topics starting "pyhouse/<house>/" keep only the rest; the same topic always gets the same handle.
+ * Safe to call from any task, at any time.
+ */
+esp_err_t mqtt_intern_topic(Client_t *p_client, const char *p_topic, TopicHandle_t *r_handle) {
+	if (p_client->Topics == NULL) {
+		*r_handle = 0;
+		return ESP_ERR_INVALID_STATE;
+	}
+	return mqtt_topic_intern(p_client->Topics, p_topic, r_handle);
+}
+
+/*
+ * As mqtt_publish(), to an interned topic; nothing about the topic is measured or encoded again.
+ */
+esp_err_t mqtt_publish_handle(Client_t *p_client, TopicHandle_t p_handle, char *p_data, int p_len, int p_qos, int p_retain) {
+	PacketInfo_t l_packet;
+	uint16_t l_id;
+	esp_err_t l_err;
+	l_err = mqtt_build_publish_handle_packet(p_client, &l_packet, p_handle, p_data, p_len, p_qos, p_retain, &l_id);
+	if (l_err != ESP_OK) {
+		return l_err;
+	}
+	ESP_LOGD(TAG, "Queuing publish, handle: %d, length: %d, id: %d", p_handle, l_packet.Packet_length, l_id);
+	return mqtt_queue(p_client, &l_packet);
+}
+
+/*
+ * The calling task has published for the last time; call it before the task exits so its outbox lane can be reused.
+ */
+void mqtt_publisher_done(Client_t *p_client) {
+	mqtt_outbox_release_lane(p_client->Outbox);
 }
 
 /*
@@ -281,46 +750,96 @@ void mqtt_stop() {
 
 
 /*
- * mqtt_connect
- * input - client
- * return -
+ * Take up what an accepted CONNACK allows this connection: how many of our QoS 1 and 2 publishes the broker
+ *  will take at once (Receive Maximum) and how many topic aliases (Topic Alias Maximum).
+ * An MQTT 3.1.1 CONNACK has no properties: no limit and no aliases.
  */
-esp_err_t mqtt_connect(Client_t *p_client) {
+static void mqtt_connack_limits(Client_t *p_client, PacketView_t *p_view) {
+	const uint8_t *l_ptr = p_view->Properties;
+	const uint8_t *l_end = l_ptr + p_view->Properties_length;
+	uint32_t l_receive_max = 0xffff;
+	uint32_t l_alias_max = 0;
+	Property_t l_property;
+
+	while (l_ptr != NULL && l_ptr < l_end && mqtt_property_next(&l_ptr, l_end, &l_property) == ESP_OK) {
+		if (l_property.Id == MQTT_PROPERTY_RECEIVE_MAXIMUM && l_property.Value > 0) {
+			l_receive_max = l_property.Value;
+		} else if (l_property.Id == MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM) {
+			l_alias_max = l_property.Value;
+		}
+	}
+	ESP_LOGI(TAG, "318 Connect - Receive maximum %d, topic alias maximum %d", l_receive_max, l_alias_max);
+	mqtt_inflight_limit(&p_client->State->inflight, l_receive_max);
+	mqtt_alias_reset(&p_client->State->outbound_alias, l_alias_max);
+	// A batch the last connection failed to write may use its aliases; its publishes are resent from the window
+	p_client->Buffers->batch_fill = 0;
+}
+
+/*
+ * Send the CONNECT already built in the packet arena and wait for the CONNACK.
+ * CONNECT goes straight to the socket before the sending task exists, so nothing in the outbox can get ahead of it.
+ */
+static esp_err_t mqtt_handshake(Client_t *p_client) {
 	int l_write_length;
 	int l_read_length;
+	int l_result;
 	int l_connection_response_code;
+	MqttFrame_t l_frame;
+	PacketView_t l_view;
 
 	ESP_LOGI(TAG, "280 Connect - Begin.");
 	mqtt_transport_set_timeout(p_client->Broker->Socket, 10);
 	ESP_LOGI(TAG, "282 Connect - Socket options set");
-
-	mqtt_build_connect_packet(p_client);
-	ESP_LOGI(TAG, "288 Connect - Sending MQTT CONNECT message, MsgType: %d, MessageId: %04X", p_client->State->pending_msg_type, p_client->State->pending_msg_id);
+	ESP_LOGI(TAG, "288 Connect - Sending MQTT CONNECT message, %d publishes in flight", mqtt_inflight_count(&p_client->State->inflight));
 
 //	print_packet(p_client->Packet);
 	l_write_length = mqtt_transport_write(p_client->Broker->Socket, p_client->Packet);
 	ESP_LOGI(TAG, "292 Connect - Write Len: %d;  %d ", l_write_length, p_client->Packet->PacketPayload_length)
 
-	l_read_length = mqtt_transport_read(p_client->Broker->Socket, p_client->Buffers->in_buffer);
-	ESP_LOGI(TAG, "289 Connect - ReadLen: %d;  Buffer:%p", l_read_length, p_client->Buffers->in_buffer);
-	print_buffer(p_client->Buffers->in_buffer, l_read_length);
+	// Anything the broker sends after the CONNACK stays in the decoder for the receive schedule
+	mqtt_decoder_init(&p_client->Buffers->in_decoder, p_client->Buffers->in_buffer, p_client->Buffers->in_buffer_length);
+	do {
+		l_read_length = mqtt_receive(p_client);
+		ESP_LOGI(TAG, "289 Connect - ReadLen: %d;  Buffer:%p", l_read_length, p_client->Buffers->in_buffer);
+		l_result = l_read_length > 0 ? mqtt_decoder_next(&p_client->Buffers->in_decoder, &l_frame) : MQTT_DECODE_MORE;
+	} while (l_read_length > 0 && l_result == MQTT_DECODE_MORE);
 
 	mqtt_transport_set_timeout(p_client->Broker->Socket, 0);
 
-	if (l_read_length < 0) {
+	if (l_read_length <= 0) {
 		ESP_LOGE(TAG, "304 Connect - Error network response");
 		return ESP_FAIL;
 	}
+	if (l_result != MQTT_DECODE_FRAME) {
+		ESP_LOGE(TAG, "306 Connect - Malformed response");
+		return ESP_FAIL;
+	}
+	print_buffer(l_frame.Packet, l_frame.Length);
 
-	if (mqtt_get_packet_type(p_client->Buffers->in_buffer) != MQTT_CONTROL_PACKET_TYPE_CONNACK) {
-		ESP_LOGE(TAG, "309 Connect - Invalid MSG_TYPE response: %d, read_len: %d", mqtt_get_packet_type(p_client->Buffers->in_buffer), l_read_length);
+	if (mqtt_get_packet_type(l_frame.Packet) != MQTT_CONTROL_PACKET_TYPE_CONNACK
+			|| mqtt_parse_packet_level(l_frame.Packet, l_frame.Length, mqtt_level(p_client), &l_view) != ESP_OK) {
+		ESP_LOGE(TAG, "309 Connect - Invalid MSG_TYPE response: %d, read_len: %d", mqtt_get_packet_type(l_frame.Packet), l_read_length);
+		return ESP_FAIL;
+	}
+	l_connection_response_code = l_view.ReasonCode;
+	if (mqtt_level(p_client) == MQTT_PROTOCOL_LEVEL_5 && l_connection_response_code >= 0x80) {
+		ESP_LOGW(TAG, "313 Connect - Connection refused, reason code: 0x%02x", l_connection_response_code);
 		return ESP_FAIL;
 	}
-	l_connection_response_code = mqtt_get_packet_connect_return_code(p_client->Buffers->in_buffer);
 	switch (l_connection_response_code) {
 		case CONNECTION_ACCEPTED:
 			ESP_LOGI(TAG, "315 Connect - Connected");
-			// Subscribe
+			// Without a session on the broker, the QoS state we kept for either direction means nothing to it [MQTT-3.2.2-2]
+			if (p_client->Will->CleanSession || (l_frame.Packet[2] & 0x01) == 0) {
+				mqtt_inflight_clear(&p_client->State->inflight);
+				mqtt_inbound_qos2_clear(&p_client->State->inbound_qos2);
+			}
+			mqtt_connack_limits(p_client, &l_view);
+			mqtt_keepalive_start(&p_client->State->keepalive, p_client->Will->Keepalive, xTaskGetTickCount());
+			// Even with a session kept, a SUBSCRIBE lost with the last connection is sent again
+			if (mqtt_resubscribe(p_client) != ESP_OK) {
+				ESP_LOGW(TAG, "317 Connect - Could not queue every subscription again");
+			}
 			return ESP_OK;
 
 		case CONNECTION_REFUSE_PROTOCOL:
@@ -337,35 +856,358 @@ esp_err_t mqtt_connect(Client_t *p_client) {
 }
 
 
+/*
+ * mqtt_connect
+ * input - client, whose Broker->Socket is connected to the broker
+ * return - ESP_OK once the broker has accepted the connection
+ */
+esp_err_t mqtt_connect(Client_t *p_client) {
+	if (mqtt_build_connect_packet(p_client) != ESP_OK) {
+		return ESP_FAIL;
+	}
+	return mqtt_handshake(p_client);
+}
+
+/*
+ * One attempt at a connection: find the broker (from the cache, usually), start the TCP handshake,
+ *  build CONNECT while it is in flight, then wait up to CONFIG_MQTT_CONNECT_TIMEOUT_MS for it and send CONNECT.
+ * @return ESP_OK with Broker->Socket connected; otherwise no socket is left open.
+ */
+static esp_err_t mqtt_establish(Client_t *p_client) {
+	Reconnect_t *l_reconnect = p_client->Reconnect;
+	struct in_addr l_address;
+	esp_err_t l_err;
+	int l_sock;
+
+	if (mqtt_reconnect_resolve(l_reconnect, p_client->Broker->Host, &l_address) != ESP_OK) {
+		return ESP_ERR_NOT_FOUND;
+	}
+	l_reconnect->Stats.Attempts++;
+	l_sock = mqtt_transport_connect_start(&l_address, p_client->Broker->Port);
+	if (l_sock < 0) {
+		return ESP_FAIL;
+	}
+	if (mqtt_build_connect_packet(p_client) != ESP_OK) {
+		close(l_sock);
+		return ESP_FAIL;
+	}
+	l_err = mqtt_transport_connect_wait(l_sock, CONFIG_MQTT_CONNECT_TIMEOUT_MS);
+	if (l_err != ESP_OK) {
+		if (l_err == ESP_ERR_TIMEOUT) {
+			l_reconnect->Stats.Timeouts++;
+		}
+		// The broker may have moved
+		mqtt_reconnect_forget(l_reconnect);
+		close(l_sock);
+		return l_err;
+	}
+	p_client->Broker->Socket = l_sock;
+	if (mqtt_handshake(p_client) != ESP_OK) {
+		close(l_sock);
+		return ESP_FAIL;
+	}
+	mqtt_reconnect_up(l_reconnect);
+	return ESP_OK;
+}
+
+/**
+ * How reconnecting has gone, down time from losing the broker to its CONNACK included.
+ */
+void mqtt_get_reconnect_stats(Client_t *p_client, ReconnectStats_t *r_stats) {
+	*r_stats = p_client->Reconnect->Stats;
+}
+
+/*
+ * Put one unacknowledged publish (or the PUBREL of one) back in the outbox.
+ */
+static void mqtt_resend_one(void *p_arg, uint16_t p_id, uint8_t *p_packet, uint32_t p_length) {
+	Client_t *l_client = (Client_t *) p_arg;
+	PacketInfo_t l_packet;
+	uint32_t l_flags = mqtt_outbox_is_consumer(l_client->Outbox) ? OUTBOX_RESERVE_NOW : 0;
+	esp_err_t l_err;
+	if (p_packet == NULL) {
+		mqtt_build_pubrel_packet(l_client, p_id);
+		return;
+	}
+	l_err = mqtt_outbox_reserve(l_client->Outbox, &l_packet, p_length, l_flags);
+	if (l_err != ESP_OK && l_flags) {
+		// The event loop resending after a reconnect: it is the consumer, so send to make room rather than wait
+		mqtt_send_ready(l_client);
+		l_err = mqtt_outbox_reserve(l_client->Outbox, &l_packet, p_length, l_flags);
+	}
+	if (l_err != ESP_OK) {
+		ESP_LOGW(TAG, "335 Resend - No room to resend id %d; it goes out after the next reconnect", p_id);
+		mqtt_inflight_sent(&l_client->State->inflight, p_id);
+		return;
+	}
+	memcpy(l_packet.PacketBuffer, p_packet, p_length);
+	mqtt_outbox_commit(l_client->Outbox, &l_packet);
+}
+
+/**
+ * After reconnecting to a session the broker kept, send again, in order and with DUP set,
+ *  every publish it has not acknowledged.
+ */
+void mqtt_resend_inflight(Client_t *p_client) {
+	ESP_LOGI(TAG, "330 Resend - %d publishes in flight", mqtt_inflight_count(&p_client->State->inflight));
+	mqtt_inflight_resend(&p_client->State->inflight, mqtt_resend_one, p_client);
+}
+
+/*
+ * Event loop: the connection is lost; wait out the backoff before the next attempt.
+ */
+static void mqtt_loop_down(Client_t *p_client) {
+	EventLoop_t *l_loop = p_client->Loop;
+	uint32_t l_wait_ms;
+
+	if (l_loop->Up) {
+		close(p_client->Broker->Socket);
+		mqtt_outbox_release(p_client->Outbox);
+		mqtt_reconnect_down(p_client->Reconnect);
+		if (p_client->State->keepalive.Dead) {
+			mqtt_reconnect_dead(p_client->Reconnect, p_client->State->keepalive.DetectMs);
+		}
+		l_loop->Up = 0;
+	}
+	mqtt_timer_cancel(&l_loop->Timers, MQTT_TIMER_KEEPALIVE);
+	mqtt_timer_cancel(&l_loop->Timers, MQTT_TIMER_ACK);
+	// Devices that lost the broker together each wait their own while before coming back
+	l_wait_ms = mqtt_reconnect_backoff(p_client->Reconnect);
+	ESP_LOGW(TAG, "350 EventLoop - Down, next try in %" PRIu32 " ms", l_wait_ms);
+	mqtt_timer_arm(&l_loop->Timers, MQTT_TIMER_RECONNECT, xTaskGetTickCount(), MQTT_MS_TO_TICKS(l_wait_ms));
+}
+
+/*
+ * Event loop: the reconnect deadline has come; try the broker.
+ */
+static void mqtt_loop_connect(Client_t *p_client) {
+	EventLoop_t *l_loop = p_client->Loop;
+
+	if (mqtt_establish(p_client) != ESP_OK) {
+		mqtt_loop_down(p_client);
+		return;
+	}
+	ESP_LOGI(TAG, "351 EventLoop - Connected to MQTT broker");
+	l_loop->Up = 1;
+	mqtt_resend_inflight(p_client);
+	if (p_client->Cb->connected_cb) {
+		p_client->Cb->connected_cb(p_client, NULL);
+	}
+}
+
+/*
+ * Event loop: write whatever the outbox has, then start the ack timer if publishes are now waiting for acks
+ *  and it is not already running.
+ */
+static void mqtt_loop_send(Client_t *p_client) {
+	EventLoop_t *l_loop = p_client->Loop;
+	TickType_t l_now;
+
+	mqtt_outbox_rearm_wakeup(p_client->Outbox);
+	if (mqtt_send_ready(p_client) == 0) {
+		return;
+	}
+	l_now = xTaskGetTickCount();
+	if (l_loop->AckTicks > 0 && !mqtt_timer_armed(&l_loop->Timers, MQTT_TIMER_ACK)
+			&& mqtt_inflight_count(&p_client->State->inflight) > 0) {
+		l_loop->Acked = p_client->State->inflight.Acked;
+		mqtt_timer_arm(&l_loop->Timers, MQTT_TIMER_ACK, l_now, l_loop->AckTicks);
+	}
+}
+
+/*
+ * Event loop: queue a PINGREQ if one is due and set the keepalive timer for when it next needs looking at.
+ * @return ESP_OK, or ESP_ERR_TIMEOUT if the connection is dead.
+ */
+static esp_err_t mqtt_loop_keepalive(Client_t *p_client) {
+	EventLoop_t *l_loop = p_client->Loop;
+	TickType_t l_wait;
+
+	if (mqtt_keepalive_due(p_client, &l_wait) != ESP_OK) {
+		return ESP_ERR_TIMEOUT;
+	}
+	if (l_wait == portMAX_DELAY) {
+		mqtt_timer_cancel(&l_loop->Timers, MQTT_TIMER_KEEPALIVE);
+	} else {
+		mqtt_timer_arm(&l_loop->Timers, MQTT_TIMER_KEEPALIVE, xTaskGetTickCount(), l_wait);
+	}
+	return ESP_OK;
+}
+
+/*
+ * Event loop: the ack timer has run out.
+ * MQTT only allows publishes to be sent again on a new connection, so a broker that has taken
+ *  AckTicks without acking any of them costs us the connection.
+ * @return ESP_OK, or ESP_ERR_TIMEOUT to reconnect.
+ */
+static esp_err_t mqtt_loop_check_acks(Client_t *p_client) {
+	EventLoop_t *l_loop = p_client->Loop;
+	Inflight_t *l_inflight = &p_client->State->inflight;
+
+	if (mqtt_inflight_count(l_inflight) == 0) {
+		return ESP_OK;
+	}
+	if (l_inflight->Acked == l_loop->Acked) {
+		ESP_LOGW(TAG, "352 EventLoop - No ack in %d ms for %d publishes", l_loop->AckTicks * portTICK_RATE_MS, mqtt_inflight_count(l_inflight));
+		return ESP_ERR_TIMEOUT;
+	}
+	l_loop->Acked = l_inflight->Acked;
+	mqtt_timer_arm(&l_loop->Timers, MQTT_TIMER_ACK, xTaskGetTickCount(), l_loop->AckTicks);
+	return ESP_OK;
+}
+
+/**
+ * Do all of the client's I/O in the calling task, until mqtt_event_loop_stop().
+ *
+ * The task sleeps in select() on the broker's socket and the outbox's wakeup socket, for no longer than
+ *  the next deadline in Loop->Timers: keepalive, ack timeout or reconnect.
+ * It wakes only when the broker sends something, a producer commits to the outbox or a deadline comes,
+ *  and does the work of both the receive task and mqtt_sending_task, on one stack.
+ * Connecting (DNS, TCP handshake, CONNACK) still blocks, as in the transport task.
+ * Writes block too; the socket's send buffer absorbs them.
+ */
+void mqtt_event_loop(Client_t *p_client) {
+	EventLoop_t *l_loop = p_client->Loop;
+	struct timeval l_timeout;
+	fd_set l_fds;
+	TickType_t l_wait;
+	uint32_t l_expired;
+	int l_max;
+	int l_ready;
+
+	l_loop->Wake = mqtt_transport_wakeup_open();
+	if (l_loop->Wake < 0) {
+		return;
+	}
+	ESP_LOGI(TAG, "353 EventLoop - Begin");
+	l_loop->Up = 0;
+	mqtt_timer_init(&l_loop->Timers);
+	mqtt_outbox_set_consumer(p_client->Outbox, xTaskGetCurrentTaskHandle());
+	mqtt_outbox_set_wakeup(p_client->Outbox, l_loop->Wake);
+	mqtt_reconnect_down(p_client->Reconnect);
+	mqtt_timer_arm(&l_loop->Timers, MQTT_TIMER_RECONNECT, xTaskGetTickCount(), 0);
+	while (!l_loop->Stop) {
+		l_expired = mqtt_timer_expired(&l_loop->Timers, xTaskGetTickCount());
+		if (l_expired & MQTT_TIMER_BIT(MQTT_TIMER_RECONNECT)) {
+			mqtt_loop_connect(p_client);
+		}
+		if (l_loop->Up && (l_expired & MQTT_TIMER_BIT(MQTT_TIMER_ACK)) && mqtt_loop_check_acks(p_client) != ESP_OK) {
+			mqtt_loop_down(p_client);
+		}
+		if (l_loop->Up) {
+			mqtt_loop_send(p_client);
+		}
+		// After the writes, which push it back, and the reads, which answer a ping
+		if (l_loop->Up && mqtt_loop_keepalive(p_client) != ESP_OK) {
+			mqtt_loop_down(p_client);
+		}
+
+		FD_ZERO(&l_fds);
+		FD_SET(l_loop->Wake, &l_fds);
+		l_max = l_loop->Wake;
+		if (l_loop->Up) {
+			FD_SET(p_client->Broker->Socket, &l_fds);
+			l_max = (int) p_client->Broker->Socket > l_max ? (int) p_client->Broker->Socket : l_max;
+		}
+		l_wait = mqtt_timer_next(&l_loop->Timers, xTaskGetTickCount());
+		l_timeout.tv_sec = l_wait * portTICK_RATE_MS / 1000;
+		l_timeout.tv_usec = (l_wait * portTICK_RATE_MS % 1000) * 1000;
+		l_ready = select(l_max + 1, &l_fds, NULL, NULL, l_wait == portMAX_DELAY ? NULL : &l_timeout);
+		if (l_ready <= 0) {
+			continue;
+		}
+		if (FD_ISSET(l_loop->Wake, &l_fds)) {
+			mqtt_transport_wakeup_drain(l_loop->Wake);
+		}
+		if (l_loop->Up && FD_ISSET(p_client->Broker->Socket, &l_fds) && mqtt_receive_frames(p_client) <= 0) {
+			mqtt_loop_down(p_client);
+		}
+	}
+	ESP_LOGI(TAG, "355 EventLoop - Stopped");
+	if (l_loop->Up) {
+		close(p_client->Broker->Socket);
+		l_loop->Up = 0;
+	}
+	mqtt_outbox_release(p_client->Outbox);
+	mqtt_outbox_release_lane(p_client->Outbox);
+	mqtt_outbox_set_wakeup(p_client->Outbox, -1);
+	mqtt_outbox_set_consumer(p_client->Outbox, NULL);
+	close(l_loop->Wake);
+	l_loop->Wake = -1;
+}
+
+/**
+ * Have mqtt_event_loop() close the connection and return. Safe from any task.
+ */
+void mqtt_event_loop_stop(Client_t *p_client) {
+	p_client->Loop->Stop = 1;
+	if (p_client->Loop->Wake >= 0) {
+		mqtt_transport_wakeup(p_client->Loop->Wake);
+	}
+}
+
+#ifndef CONFIG_MQTT_EVENT_LOOP
+/*
+ * Stop the sending task and wait for it to go.
+ * It is asked rather than deleted, so it never dies holding ConsumerLock or IndexLock in the outbox.
+ * Shutting the socket down first fails any write it is blocked in.
+ */
+static void mqtt_sending_stop(Client_t *p_client) {
+	shutdown(p_client->Broker->Socket, SHUT_RDWR);
+	s_sending_stop = 1;
+	xTaskNotifyGive(xMqttSendingTask);
+	xSemaphoreTake(xMqttSendingDone, portMAX_DELAY);
+	xMqttSendingTask = NULL;
+}
+#endif
+
 /**
  * A FreeRtos TASK.
  * Network connect to the broker.
- * Create a sending task.
+ * Create a sending task - or, with CONFIG_MQTT_EVENT_LOOP, do everything here in mqtt_event_loop().
  */
 void Mqtt_transport_task(void *pvParameters) {
 	Client_t *l_client = (Client_t *) pvParameters;
 
+#ifndef CONFIG_MQTT_EVENT_LOOP
+	uint32_t l_wait_ms;
+#endif
+
 	ESP_LOGI(TAG, "340 TransportTask - Begin.  l_client:%p;  pvParams:%p", l_client, pvParameters);
+#ifdef CONFIG_MQTT_EVENT_LOOP
+	mqtt_event_loop(l_client);
+#else
+	xMqttSendingDone = xSemaphoreCreateBinary();
+	mqtt_reconnect_down(l_client->Reconnect);
 	while (1) {
 		// Establish a transport connection
-		l_client->Broker->Socket = mqtt_transport_connect(l_client->Broker->Host, l_client->Broker->Port);
-		if (mqtt_connect(l_client) != ESP_OK) {
-			ESP_LOGE(TAG, "340 TransportTask - Connect Failed");
+		if (mqtt_establish(l_client) != ESP_OK) {
+			l_wait_ms = mqtt_reconnect_backoff(l_client->Reconnect);
+			ESP_LOGE(TAG, "340 TransportTask - Connect Failed, next try in %" PRIu32 " ms", l_wait_ms);
+			vTaskDelay(MQTT_MS_TO_TICKS(l_wait_ms));
 			continue;
 		}
 		ESP_LOGI(TAG, "340 TransportTask - Connected to MQTT broker, create sending thread before call connected callback");
+		s_sending_stop = 0;
 		xTaskCreate(&mqtt_sending_task, "mqtt_sending_task", 2048, l_client, 6, &xMqttSendingTask);
+		mqtt_resend_inflight(l_client);
 		if (l_client->Cb->connected_cb) {
 			l_client->Cb->connected_cb(l_client, NULL);
 		}
 		ESP_LOGI(TAG, "340 TransportTask - mqtt_start_receive_schedule");
 		mqtt_start_receive_schedule(l_client);
+		mqtt_sending_stop(l_client);
 		close(l_client->Broker->Socket);
-		vTaskDelete(xMqttSendingTask);
-		vTaskDelay(1000 / portTICK_RATE_MS);
+		mqtt_reconnect_down(l_client->Reconnect);
+		if (l_client->State->keepalive.Dead) {
+			mqtt_reconnect_dead(l_client->Reconnect, l_client->State->keepalive.DetectMs);
+		}
+		// Devices that lost the broker together each wait their own while before coming back
+		vTaskDelay(MQTT_MS_TO_TICKS(mqtt_reconnect_backoff(l_client->Reconnect)));
 	}
+#endif
 	ESP_LOGW(TAG, "340 TransportTask - Exiting")
-	mqtt_destroy(NULL);
+	mqtt_destroy(l_client);
 }
 
 /*
@@ -410,44 +1252,80 @@ esp_err_t Mqtt_init_will(Client_t *p_client) {
 	p_client->Will->WillRetain = 0;
 	p_client->Will->CleanSession = 0;
 	p_client->Will->Keepalive = 60;
-	p_client->Will->Keepalive_tick = 30;
 	ESP_LOGI(TAG, "433 Will has been set up. ClientPtr:%p;  Will:%p", p_client, p_client->Will);
 	return ESP_OK;
 }
 
 esp_err_t Mqtt_init_state(Client_t *p_client) {
 	ESP_LOGI(TAG, "439 InitState - ClientPtr:%p", p_client);
-	return ESP_OK;
+#ifdef CONFIG_MQTT_PROTOCOL_5
+	p_client->State->protocol_level = MQTT_PROTOCOL_LEVEL_5;
+	if (mqtt_alias_init(&p_client->State->outbound_alias, CONFIG_MQTT_TOPIC_ALIAS_MAX, CONFIG_MQTT_TOPIC_ALIAS_TEXT_BYTE) != ESP_OK) {
+		ESP_LOGW(TAG, "441 InitState - No memory for topic aliases; topics go in full");
+	}
+#else
+	p_client->State->protocol_level = MQTT_PROTOCOL_LEVEL_311;
+#endif
+	mqtt_keepalive_init(&p_client->State->keepalive, CONFIG_MQTT_PINGRESP_TIMEOUT_MS);
+	return mqtt_inflight_init(&p_client->State->inflight, CONFIG_MQTT_INFLIGHT_WINDOW, CONFIG_MQTT_INFLIGHT_STORE_BYTE);
 }
 
-esp_err_t Mqtt_init_ring_buffer(Client_t *p_client) {
-	uint8_t *l_rb_buf;
-	ESP_LOGI(TAG, "445 InitRingBuff - All");
-	l_rb_buf = (uint8_t*) malloc(CONFIG_MQTT_QUEUE_BUFFER_SIZE_WORD * 4);
-	if (l_rb_buf == 0) {
+esp_err_t Mqtt_init_outbox(Client_t *p_client) {
+	ESP_LOGI(TAG, "445 InitOutbox - All");
+	if (mqtt_outbox_init(p_client->Outbox, CONFIG_MQTT_QUEUE_BUFFER_SIZE_WORD * 4) != ESP_OK) {
 		ESP_LOGE(TAG, "442 Start - Not Enough Memory");
 		return ESP_ERR_NO_MEM;
 	}
-//	p_client->Send_rb = l_rb_buf;
-	rb_init(p_client->Send_rb,  l_rb_buf, CONFIG_MQTT_QUEUE_BUFFER_SIZE_WORD * 4, 1);
-	ESP_LOGI(TAG, "467 InitRingBuffer - clientPtr:%p;  Created RingBuffer:%p", p_client, p_client->Send_rb);
+	mqtt_outbox_set_drop(p_client->Outbox, mqtt_window_dropped, p_client);
+	ESP_LOGI(TAG, "467 InitOutbox - clientPtr:%p;  Created Outbox:%p", p_client, p_client->Outbox);
 	return ESP_OK;
 }
 
-esp_err_t Mqtt_init_sending_queue(Client_t *p_client) {
-	p_client->SendingQueue = xQueueCreate(64, sizeof(uint32_t));
-	ESP_LOGI(TAG, "459 InitSendingQueue - All");
-	if (p_client->SendingQueue == NULL){
-		ESP_LOGE(TAG, "459 Start Failed to create a Packet Sending Queue");
+esp_err_t Mqtt_init_packet(Client_t *p_client) {
+	ESP_LOGI(TAG, "470 InitPacket - ClientPtr:%p", p_client);
+	p_client->Packet->PacketBuffer_length = CONFIG_MQTT_PACKET_ARENA_BYTE;
+	p_client->Packet->PacketBuffer = malloc(CONFIG_MQTT_PACKET_ARENA_BYTE);
+	if (p_client->Packet->PacketBuffer == NULL) {
+		p_client->Packet->PacketBuffer_length = 0;
 		return ESP_ERR_NO_MEM;
 	}
-	ESP_LOGI(TAG, "462 InitSendingQueue - ClientPtr:%p;  Created SendingQueue:%p", p_client, p_client->SendingQueue);
 	return ESP_OK;
 }
 
-esp_err_t Mqtt_init_packet(Client_t *p_client) {
-	ESP_LOGI(TAG, "470 InitPacket - ClientPtr:%p", p_client);
-	p_client->Packet->PacketFixedHeader = calloc(5, sizeof(uint8_t));
+esp_err_t Mqtt_init_router(Client_t *p_client) {
+	ESP_LOGI(TAG, "475 InitRouter - %d nodes", CONFIG_MQTT_ROUTER_NODES);
+	return mqtt_router_init(p_client->Router, CONFIG_MQTT_ROUTER_NODES, CONFIG_MQTT_ROUTER_TEXT_BYTE);
+}
+
+esp_err_t Mqtt_init_topics(Client_t *p_client) {
+	char l_prefix[64];
+	snprintf(l_prefix, sizeof(l_prefix), "pyhouse/%s/", CONFIG_PYHOUSE_HOUSE_NAME);
+	ESP_LOGI(TAG, "477 InitTopics - %d topics under \"%s\"", CONFIG_MQTT_TOPIC_HANDLES, l_prefix);
+	return mqtt_topic_table_init(p_client->Topics, l_prefix, CONFIG_MQTT_TOPIC_HANDLES, CONFIG_MQTT_TOPIC_TEXT_BYTE);
+}
+
+esp_err_t Mqtt_init_subscriptions(Client_t *p_client) {
+	ESP_LOGI(TAG, "478 InitSubscriptions - %d filters", CONFIG_MQTT_SUBSCRIPTIONS);
+	return mqtt_subscription_init(p_client->Subscriptions, CONFIG_MQTT_SUBSCRIPTIONS, CONFIG_MQTT_SUBSCRIPTION_TEXT_BYTE);
+}
+
+esp_err_t Mqtt_init_reconnect(Client_t *p_client) {
+	ESP_LOGI(TAG, "479 InitReconnect - %d to %d ms", CONFIG_MQTT_RECONNECT_MIN_MS, CONFIG_MQTT_RECONNECT_MAX_MS);
+	mqtt_reconnect_init(p_client->Reconnect, CONFIG_MQTT_RECONNECT_MIN_MS, CONFIG_MQTT_RECONNECT_MAX_MS,
+			CONFIG_MQTT_DNS_CACHE_TTL_S * 1000, esp_random());
+	return ESP_OK;
+}
+
+esp_err_t Mqtt_init_loop(Client_t *p_client) {
+#ifdef CONFIG_MQTT_EVENT_LOOP
+	ESP_LOGI(TAG, "479 InitLoop - Ack timeout %d ms", CONFIG_MQTT_ACK_TIMEOUT_MS);
+	p_client->Loop = calloc(1, sizeof(EventLoop_t));
+	if (p_client->Loop == NULL) {
+		return ESP_ERR_NO_MEM;
+	}
+	p_client->Loop->Wake = -1;
+	p_client->Loop->AckTicks = MQTT_MS_TO_TICKS(CONFIG_MQTT_ACK_TIMEOUT_MS);
+#endif
 	return ESP_OK;
 }
 
@@ -461,6 +1339,14 @@ esp_err_t Mqtt_init_buffers(Client_t *p_client) {
 	p_client->Buffers->in_buffer = calloc(1024, sizeof(uint8_t));
 	p_client->Buffers->out_buffer_length = 1024;
 	p_client->Buffers->out_buffer = calloc(1024, sizeof(uint8_t));
+	p_client->Buffers->batch_size = CONFIG_MQTT_BATCH_SIZE_BYTE;
+	p_client->Buffers->batch_fill = 0;
+	if (p_client->Buffers->batch_size > 0) {
+		p_client->Buffers->batch_buffer = malloc(p_client->Buffers->batch_size);
+		if (p_client->Buffers->batch_buffer == NULL) {
+			p_client->Buffers->batch_size = 0;
+		}
+	}
 //	ESP_LOGI(TAG, "485 InitBuffers - ClientPtr:%p;  BufferPtr:%p", p_client, p_client->Buffers);
 	return ESP_OK;
 }
@@ -485,14 +1371,23 @@ esp_err_t Mqtt_init(Client_t *p_client) {
 	p_client->Buffers	= calloc(1, sizeof(Buffers_t));
 	p_client->Cb		= calloc(1, sizeof(Callback_t));
 	p_client->Packet	= calloc(1, sizeof(PacketInfo_t));
+	p_client->Outbox	= calloc(1, sizeof(Outbox_t));
 	p_client->State		= calloc(1, sizeof(State_t));
 	p_client->Will 		= calloc(1, sizeof(Will_t));
+	p_client->Router	= calloc(1, sizeof(Router_t));
+	p_client->Topics	= calloc(1, sizeof(TopicTable_t));
+	p_client->Subscriptions = calloc(1, sizeof(SubscriptionSet_t));
+	p_client->Reconnect	= calloc(1, sizeof(Reconnect_t));
 	Mqtt_init_broker(p_client);
 	Mqtt_init_buffers(p_client);
 	Mqtt_init_callback(p_client);
+	Mqtt_init_router(p_client);
+	Mqtt_init_topics(p_client);
+	Mqtt_init_subscriptions(p_client);
+	Mqtt_init_reconnect(p_client);
+	Mqtt_init_loop(p_client);
 	Mqtt_init_packet(p_client);
-	Mqtt_init_sending_queue(p_client);
-//	Mqtt_init_ring_buffer(p_client);
+	Mqtt_init_outbox(p_client);
 	Mqtt_init_state(p_client);
 	Mqtt_init_will(p_client);
 	print_client(p_client);
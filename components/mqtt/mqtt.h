@@ -27,6 +27,11 @@ static inline int mqtt_get_packet_retain(uint8_t* p_buffer) {
 static inline int mqtt_get_packet_connect_return_code(uint8_t* p_buffer) {
 	return p_buffer[3];
 }
+/*
+ * Received packets - mqtt_msessage.c
+ */
+esp_err_t mqtt_parse_packet(const uint8_t *p_buffer, uint32_t p_length, PacketView_t *r_view);
+esp_err_t mqtt_parse_packet_level(const uint8_t *p_buffer, uint32_t p_length, int p_level, PacketView_t *r_view);
 
 
 /**
@@ -39,7 +44,25 @@ void mqtt_task(void *);
 esp_err_t mqtt_connect(Client_t*);
 esp_err_t mqtt_detroy(Client_t*);
 esp_err_t mqtt_subscribe(Client_t*, char*, uint8_t);
+esp_err_t mqtt_unsubscribe(Client_t*, char*);
+esp_err_t mqtt_subscribe_many(Client_t*, char **, const uint8_t *, int);
+esp_err_t mqtt_unsubscribe_many(Client_t*, char **, int);
+esp_err_t mqtt_resubscribe(Client_t*);
 esp_err_t mqtt_publish(Client_t*, char *, char *, int, int, int);
+esp_err_t mqtt_route(Client_t*, const char *, mqtt_callback);
+esp_err_t mqtt_intern_topic(Client_t*, const char *, TopicHandle_t *);
+esp_err_t mqtt_publish_handle(Client_t*, TopicHandle_t, char *, int, int, int);
+void mqtt_publisher_done(Client_t*);
+void mqtt_get_reconnect_stats(Client_t*, ReconnectStats_t *);
+void mqtt_event_loop(Client_t*);
+void mqtt_event_loop_stop(Client_t*);
+
+// Sending task internals
+uint32_t mqtt_send_ready(Client_t*);
+// Receive task internals
+void mqtt_start_receive_schedule(Client_t*);
+// Transport task internals
+void mqtt_resend_inflight(Client_t*);
 
 #endif  /* __MQTT_H__ */
 
@@ -0,0 +1,153 @@
+/*
+ * mqtt_alias.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * MQTT 5 outbound topic aliases (see TopicAlias_t in mqtt_alias.h).
+ * See section 3.3.2.3.4 of the MQTT 5 spec:  https://docs.oasis-open.org/mqtt/mqtt/v5.0/mqtt-v5.0.html
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "mqtt_alias.h"
+#include "mqtt_property.h"
+
+static const char *TAG = "MqttAlias     ";
+
+/*
+ * @return the alias of the topic, or 0; *r_slot is where it is in Index, or the empty slot it would go in.
+ */
+static uint16_t alias_find(TopicAlias_t *p_alias, const uint8_t *p_topic, uint32_t p_length, uint32_t p_hash, uint32_t *r_slot) {
+	uint32_t l_ix = p_hash & p_alias->IndexMask;
+	AliasEntry_t *l_entry;
+	uint16_t l_number;
+	while ((l_number = p_alias->Index[l_ix]) != 0) {
+		l_entry = &p_alias->Entries[l_number];
+		if (l_entry->Hash == p_hash && l_entry->Length == p_length && mqtt_text_equal(&p_alias->Pool, l_entry->Text, p_topic, p_length)) {
+			break;
+		}
+		l_ix = (l_ix + 1) & p_alias->IndexMask;
+	}
+	*r_slot = l_ix;
+	return l_number;
+}
+
+/**
+ * Allocate room for p_aliases topics of up to p_text_size bytes in all.
+ * A p_aliases of 0 leaves the table empty; no PUBLISH is ever aliased.
+ */
+esp_err_t mqtt_alias_init(TopicAlias_t *p_alias, uint32_t p_aliases, uint32_t p_text_size) {
+	uint32_t l_index = 1;
+
+	memset(p_alias, 0, sizeof(TopicAlias_t));
+	if (p_aliases == 0) {
+		return ESP_OK;
+	}
+	if (p_aliases >= 0xffff || p_text_size > 0xffff) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	while (l_index < 2 * p_aliases) {
+		l_index <<= 1;
+	}
+	p_alias->Entries = calloc(p_aliases + 1, sizeof(AliasEntry_t));
+	p_alias->Index = calloc(l_index, sizeof(uint16_t));
+	if (p_alias->Entries == NULL || p_alias->Index == NULL || mqtt_text_init(&p_alias->Pool, p_text_size) != ESP_OK) {
+		ESP_LOGE(TAG, "Init - Not enough memory for %d aliases", p_aliases);
+		mqtt_alias_deinit(p_alias);
+		return ESP_ERR_NO_MEM;
+	}
+	p_alias->Capacity = p_aliases;
+	p_alias->IndexMask = l_index - 1;
+	return ESP_OK;
+}
+
+void mqtt_alias_deinit(TopicAlias_t *p_alias) {
+	free(p_alias->Entries);
+	free(p_alias->Index);
+	mqtt_text_deinit(&p_alias->Pool);
+	memset(p_alias, 0, sizeof(TopicAlias_t));
+}
+
+/**
+ * Forget every alias and allow p_broker_max of them - the Topic Alias Maximum of the new connection's CONNACK
+ *  (0 for an MQTT 3.1.1 connection).
+ */
+void mqtt_alias_reset(TopicAlias_t *p_alias, uint32_t p_broker_max) {
+	if (p_alias->Index != NULL) {
+		memset(p_alias->Index, 0, (p_alias->IndexMask + 1) * sizeof(uint16_t));
+	}
+	p_alias->Max = p_broker_max < p_alias->Capacity ? p_broker_max : p_alias->Capacity;
+	p_alias->Count = 0;
+	mqtt_text_clear(&p_alias->Pool);
+}
+
+/**
+ * Write the MQTT 5 PUBLISH at p_packet to p_out with its topic aliased:
+ *  a topic already aliased goes as an empty topic and its alias, a new one as the topic and the next alias.
+ * Anything else - not a PUBLISH, no alias left, or no room in p_out - is left for the caller to copy as it is.
+ * Sending task only.
+ *
+ * @return the bytes written to p_out, or 0 if nothing was.
+ */
+uint32_t mqtt_alias_rewrite(TopicAlias_t *p_alias, const uint8_t *p_packet, uint32_t p_length, uint8_t *p_out, uint32_t p_room) {
+	uint32_t l_remaining, l_topic_len, l_props_at, l_props_len, l_hash, l_slot, l_new_remaining, l_length;
+	int l_size, l_props_size;
+	const uint8_t *l_topic;
+	uint16_t l_number;
+	uint8_t *l_ptr;
+
+	if (p_alias->Max == 0 || p_packet[0] >> 4 != 3) {
+		return 0;
+	}
+	if ((l_size = mqtt_varint_get(p_packet + 1, p_length - 1, &l_remaining)) <= 0 || 1 + l_size + 2 > p_length) {
+		return 0;
+	}
+	l_topic = p_packet + 1 + l_size + 2;
+	l_topic_len = l_topic[-2] << 8 | l_topic[-1];
+	l_props_at = (l_topic - p_packet) + l_topic_len + ((p_packet[0] & 0x06) ? 2 : 0);
+	if (l_topic_len == 0 || l_props_at >= p_length
+			|| (l_props_size = mqtt_varint_get(p_packet + l_props_at, p_length - l_props_at, &l_props_len)) <= 0) {
+		return 0;
+	}
+
+	l_hash = mqtt_text_hash(l_topic, l_topic_len);
+	l_number = alias_find(p_alias, l_topic, l_topic_len, l_hash, &l_slot);
+	if (l_number == 0 && (p_alias->Count >= p_alias->Max || p_alias->Pool.Fill + l_topic_len > p_alias->Pool.Size)) {
+		return 0;
+	}
+	// Topic Alias property (3 bytes) in front of any others; the topic itself goes once the alias is known
+	l_new_remaining = l_remaining - (l_number != 0 ? l_topic_len : 0) + 3 + mqtt_varint_size(l_props_len + 3) - l_props_size;
+	l_length = 1 + mqtt_varint_size(l_new_remaining) + l_new_remaining;
+	if (l_length > p_room) {
+		return 0;
+	}
+	if (l_number == 0) {
+		l_number = ++p_alias->Count;
+		p_alias->Entries[l_number].Hash = l_hash;
+		p_alias->Entries[l_number].Text = mqtt_text_add(&p_alias->Pool, l_topic, l_topic_len);
+		p_alias->Entries[l_number].Length = l_topic_len;
+		p_alias->Index[l_slot] = l_number;
+		l_ptr = mqtt_varint_put(p_out + 1, l_new_remaining);
+		memcpy(l_ptr, l_topic - 2, 2 + l_topic_len);
+		l_ptr += 2 + l_topic_len;
+	} else {
+		l_ptr = mqtt_varint_put(p_out + 1, l_new_remaining);
+		*l_ptr++ = 0;
+		*l_ptr++ = 0;
+	}
+	p_out[0] = p_packet[0];
+	// Packet id, if there is one
+	memcpy(l_ptr, l_topic + l_topic_len, l_props_at - (l_topic - p_packet) - l_topic_len);
+	l_ptr += l_props_at - (l_topic - p_packet) - l_topic_len;
+	l_ptr = mqtt_varint_put(l_ptr, l_props_len + 3);
+	l_ptr = mqtt_property_put_u16(l_ptr, MQTT_PROPERTY_TOPIC_ALIAS, l_number);
+	// The other properties and the payload
+	memcpy(l_ptr, p_packet + l_props_at + l_props_size, p_length - l_props_at - l_props_size);
+	return l_length;
+}
+
+// ### END DBK
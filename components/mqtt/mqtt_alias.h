@@ -0,0 +1,53 @@
+/*
+ * mqtt_alias.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#ifndef COMPONENTS_MQTT_MQTT_ALIAS_H_
+#define COMPONENTS_MQTT_MQTT_ALIAS_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "mqtt_text.h"
+
+/**
+ * A topic given an alias on this connection.
+ */
+typedef struct AliasEntry {
+	uint32_t			Hash;
+	uint16_t			Text;  // Where the topic is in TopicAlias.Pool
+	uint16_t			Length;
+} AliasEntry_t;
+
+/**
+ * MQTT 5 outbound topic aliases for one connection.
+ *
+ * The sending task rewrites each PUBLISH as it goes into the batch, so aliases are handed out in the order
+ *  the broker sees them: the first PUBLISH to a topic carries the topic and a new alias, every later one
+ *  an empty topic and the alias.  Packets are built and kept (for resending) with the full topic.
+ * Topics are aliased first come, up to what the broker's CONNACK allows; the rest always go in full.
+ *
+ * Everything is allocated once by mqtt_alias_init(); mqtt_alias_reset() starts each connection afresh.
+ */
+typedef struct TopicAlias {
+	AliasEntry_t		*Entries;  // By alias; entry 0 is unused
+	uint16_t			*Index;  // Open addressed by topic hash: the alias, 0 = empty
+	TextPool_t			Pool;
+	uint32_t			Capacity;  // Aliases there is room for
+	uint32_t			Max;  // Aliases this connection may use; 0 = none
+	uint32_t			Count;
+	uint32_t			IndexMask;
+} TopicAlias_t;
+
+esp_err_t mqtt_alias_init(TopicAlias_t *p_alias, uint32_t p_aliases, uint32_t p_text_size);
+void mqtt_alias_deinit(TopicAlias_t *p_alias);
+void mqtt_alias_reset(TopicAlias_t *p_alias, uint32_t p_broker_max);
+uint32_t mqtt_alias_rewrite(TopicAlias_t *p_alias, const uint8_t *p_packet, uint32_t p_length, uint8_t *p_out, uint32_t p_room);
+
+#endif /* COMPONENTS_MQTT_MQTT_ALIAS_H_ */
+
+// ### END DBK
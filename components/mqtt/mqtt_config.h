@@ -4,6 +4,11 @@
 #include <stdio.h>
 #include "sdkconfig.h"
 
+/*
+ * Milliseconds to ticks, rounded up so that a short delay never becomes 0 ticks (2 ms at a 100 Hz tick is 1 tick, not 0).
+ */
+#define MQTT_MS_TO_TICKS(ms) (((ms) + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS)
+
 //#ifdef CONFIG_MQTT_LOG_ERROR_ON
 //#define mqtt_error(format, ... ) printf( "[MQTT ERROR] " format "\n", ##__VA_ARGS__)
 //#else
@@ -26,4 +31,124 @@
 #define CONFIG_MQTT_QUEUE_BUFFER_SIZE_WORD 1024
 #endif
 
+#ifndef CONFIG_MQTT_OUTBOX_LANES
+#define CONFIG_MQTT_OUTBOX_LANES 4
+#endif
+
+#if !defined(CONFIG_MQTT_OUTBOX_POLICY_BLOCK) && !defined(CONFIG_MQTT_OUTBOX_POLICY_REJECT_NEWEST) && !defined(CONFIG_MQTT_OUTBOX_POLICY_DROP_OLDEST)
+#define CONFIG_MQTT_OUTBOX_POLICY_BLOCK 1
+#endif
+
+#ifndef CONFIG_MQTT_OUTBOX_BLOCK_MS
+#define CONFIG_MQTT_OUTBOX_BLOCK_MS 5000
+#endif
+
+#ifndef CONFIG_MQTT_OUTBOX_TTL_MS
+#define CONFIG_MQTT_OUTBOX_TTL_MS 0
+#endif
+
+#ifndef CONFIG_MQTT_OUTBOX_COALESCE_SLOTS
+#define CONFIG_MQTT_OUTBOX_COALESCE_SLOTS 32
+#endif
+
+#if (CONFIG_MQTT_OUTBOX_COALESCE_SLOTS & (CONFIG_MQTT_OUTBOX_COALESCE_SLOTS - 1)) != 0
+#error "CONFIG_MQTT_OUTBOX_COALESCE_SLOTS must be a power of two"
+#endif
+
+#ifndef CONFIG_MQTT_TCP_SEND_BUFFER_BYTE
+#define CONFIG_MQTT_TCP_SEND_BUFFER_BYTE 0
+#endif
+
+#ifndef CONFIG_MQTT_BATCH_SIZE_BYTE
+#define CONFIG_MQTT_BATCH_SIZE_BYTE 1460
+#endif
+
+#ifndef CONFIG_MQTT_BATCH_FLUSH_MS
+#define CONFIG_MQTT_BATCH_FLUSH_MS 2
+#endif
+
+#ifndef CONFIG_MQTT_CONTROL_QUEUE_LENGTH
+#define CONFIG_MQTT_CONTROL_QUEUE_LENGTH 8
+#endif
+
+#ifndef CONFIG_MQTT_INFLIGHT_WINDOW
+#define CONFIG_MQTT_INFLIGHT_WINDOW 16
+#endif
+
+#ifndef CONFIG_MQTT_INFLIGHT_STORE_BYTE
+#define CONFIG_MQTT_INFLIGHT_STORE_BYTE 256
+#endif
+
+#ifndef CONFIG_MQTT_INBOUND_QOS2_SLOTS
+#define CONFIG_MQTT_INBOUND_QOS2_SLOTS 16
+#endif
+
+#if (CONFIG_MQTT_INBOUND_QOS2_SLOTS & (CONFIG_MQTT_INBOUND_QOS2_SLOTS - 1)) != 0
+#error "CONFIG_MQTT_INBOUND_QOS2_SLOTS must be a power of two"
+#endif
+
+#ifndef CONFIG_MQTT_ROUTER_NODES
+#define CONFIG_MQTT_ROUTER_NODES 64
+#endif
+
+#ifndef CONFIG_MQTT_ROUTER_TEXT_BYTE
+#define CONFIG_MQTT_ROUTER_TEXT_BYTE 512
+#endif
+
+#ifndef CONFIG_MQTT_TOPIC_HANDLES
+#define CONFIG_MQTT_TOPIC_HANDLES 64
+#endif
+
+#ifndef CONFIG_MQTT_TOPIC_TEXT_BYTE
+#define CONFIG_MQTT_TOPIC_TEXT_BYTE 1024
+#endif
+
+#ifndef CONFIG_MQTT_TOPIC_ALIAS_MAX
+#define CONFIG_MQTT_TOPIC_ALIAS_MAX 16
+#endif
+
+#ifndef CONFIG_MQTT_TOPIC_ALIAS_TEXT_BYTE
+#define CONFIG_MQTT_TOPIC_ALIAS_TEXT_BYTE 512
+#endif
+
+#ifndef CONFIG_MQTT_SUBSCRIPTIONS
+#define CONFIG_MQTT_SUBSCRIPTIONS 32
+#endif
+
+#ifndef CONFIG_MQTT_SUBSCRIPTION_TEXT_BYTE
+#define CONFIG_MQTT_SUBSCRIPTION_TEXT_BYTE 512
+#endif
+
+#ifndef CONFIG_MQTT_SUBSCRIBE_PACKET_BYTE
+#define CONFIG_MQTT_SUBSCRIBE_PACKET_BYTE 1024
+#endif
+
+#ifndef CONFIG_MQTT_RECONNECT_MIN_MS
+#define CONFIG_MQTT_RECONNECT_MIN_MS 500
+#endif
+
+#ifndef CONFIG_MQTT_RECONNECT_MAX_MS
+#define CONFIG_MQTT_RECONNECT_MAX_MS 60000
+#endif
+
+#ifndef CONFIG_MQTT_CONNECT_TIMEOUT_MS
+#define CONFIG_MQTT_CONNECT_TIMEOUT_MS 5000
+#endif
+
+#ifndef CONFIG_MQTT_DNS_CACHE_TTL_S
+#define CONFIG_MQTT_DNS_CACHE_TTL_S 300
+#endif
+
+#ifndef CONFIG_MQTT_PINGRESP_TIMEOUT_MS
+#define CONFIG_MQTT_PINGRESP_TIMEOUT_MS 5000
+#endif
+
+#ifndef CONFIG_MQTT_ACK_TIMEOUT_MS
+#define CONFIG_MQTT_ACK_TIMEOUT_MS 30000
+#endif
+
+#ifndef CONFIG_MQTT_PACKET_ARENA_BYTE
+#define CONFIG_MQTT_PACKET_ARENA_BYTE 512
+#endif
+
 #endif
@@ -66,7 +66,7 @@ void print_client(Client_t *p_client) {
 	ESP_LOGD(TAG, "ClientDebug - StatePtr:%p; BuffersPtr:%p", p_client->State, p_client->Buffers);
 	ESP_LOGD(TAG, "ClientDebug - BrokerPtr:%p; WillPtr:%p", p_client->Broker, p_client->Will);
 	ESP_LOGD(TAG, "ClientDebug - CbPtr:%p; PacketPtr:%p", p_client->Cb, p_client->Packet);
-	ESP_LOGD(TAG, "ClientDebug - SendingQueuePtr:%p; RingBuffPtr:%p", p_client->SendingQueue, p_client->Send_rb);
+	ESP_LOGD(TAG, "ClientDebug - OutboxPtr:%p", p_client->Outbox);
 	ESP_LOGD(TAG, " ");
 }
 
@@ -0,0 +1,182 @@
+/*
+ * mqtt_decoder.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Split the received byte stream into MQTT packets.
+ *
+ * TCP gives no packet boundaries - one read may hold several packets, or a piece of one.
+ * The receive task reads straight into the decoder's buffer (mqtt_decoder_space / mqtt_decoder_commit)
+ *  and then takes out every complete packet with mqtt_decoder_next().
+ * Frames point into the buffer, so nothing is copied; only the tail of a partial packet is moved
+ *  back to the front of the buffer before the next read.
+ *
+ * The fixed header is parsed again from Start on every call, so a header split across reads needs no extra state.
+ *
+ * A packet bigger than the buffer is handed out in parts (MQTT_DECODE_PART) so a large PUBLISH
+ *  can be streamed to the application without ever being held whole.
+ */
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "mqtt_decoder.h"
+
+static const char *TAG = "MqttDecoder   ";
+
+/*
+ * Decode the remaining length that starts at p_ptr.
+ * @return the bytes it takes (1 to 4), 0 if more bytes are needed, or -1 if it runs past 4 bytes.
+ */
+static int decoder_remaining_length(const uint8_t *p_ptr, uint32_t p_available, uint32_t *r_length) {
+	uint32_t l_multiplier = 1;
+	uint32_t l_length = 0;
+	int l_ix;
+	for (l_ix = 0; l_ix < 4; l_ix++) {
+		if (l_ix >= p_available) {
+			return 0;
+		}
+		l_length += (p_ptr[l_ix] & 0x7f) * l_multiplier;
+		if ((p_ptr[l_ix] & 0x80) == 0) {
+			*r_length = l_length;
+			return l_ix + 1;
+		}
+		l_multiplier *= 128;
+	}
+	return -1;
+}
+
+
+
+void mqtt_decoder_init(MqttDecoder_t *p_decoder, uint8_t *p_buffer, uint32_t p_size) {
+	p_decoder->Buffer = p_buffer;
+	p_decoder->Size = p_size;
+	p_decoder->Start = 0;
+	p_decoder->Fill = 0;
+	p_decoder->Keep = 0;
+	p_decoder->Streaming = 0;
+	p_decoder->StreamLength = 0;
+	p_decoder->StreamType = 0;
+}
+
+/**
+ * Where the next read should go, and how many bytes it may take.
+ * Any partial packet is first moved to the front of the buffer (after Keep), which ends the life of earlier frames.
+ */
+uint8_t *mqtt_decoder_space(MqttDecoder_t *p_decoder, uint32_t *r_room) {
+	if (p_decoder->Start > p_decoder->Keep) {
+		memmove(p_decoder->Buffer + p_decoder->Keep, p_decoder->Buffer + p_decoder->Start, p_decoder->Fill - p_decoder->Start);
+		p_decoder->Fill -= p_decoder->Start - p_decoder->Keep;
+		p_decoder->Start = p_decoder->Keep;
+	}
+	*r_room = p_decoder->Size - p_decoder->Fill;
+	return p_decoder->Buffer + p_decoder->Fill;
+}
+
+/**
+ * p_length bytes have been read into the space.
+ */
+void mqtt_decoder_commit(MqttDecoder_t *p_decoder, uint32_t p_length) {
+	p_decoder->Fill += p_length;
+}
+
+/**
+ * Copy in as much of p_data as there is room for.
+ * @return the bytes taken; call mqtt_decoder_next() until it wants more, then feed the rest.
+ */
+uint32_t mqtt_decoder_feed(MqttDecoder_t *p_decoder, const uint8_t *p_data, uint32_t p_length) {
+	uint32_t l_room;
+	uint8_t *l_space = mqtt_decoder_space(p_decoder, &l_room);
+	if (p_length > l_room) {
+		p_length = l_room;
+	}
+	memcpy(l_space, p_data, p_length);
+	mqtt_decoder_commit(p_decoder, p_length);
+	return p_length;
+}
+
+/**
+ * While a packet is being streamed, leave its first p_length bytes (say the fixed header and topic of a PUBLISH)
+ *  where they are, so pointers into them stay good for every part.
+ * Only at least half the buffer is left for the parts; released when the last part has been handed out.
+ */
+esp_err_t mqtt_decoder_keep(MqttDecoder_t *p_decoder, uint32_t p_length) {
+	if (p_decoder->Streaming == 0 || p_length > p_decoder->Size / 2) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	p_decoder->Keep = p_length;
+	return ESP_OK;
+}
+
+/**
+ * Take the next complete packet, or the next part of one too big for the buffer.
+ * @return one of mqtt_decode_result.
+ */
+int mqtt_decoder_next(MqttDecoder_t *p_decoder, MqttFrame_t *r_frame) {
+	uint32_t l_available, l_remaining, l_part;
+	uint8_t *l_ptr;
+	int l_header;
+
+	l_ptr = p_decoder->Buffer + p_decoder->Start;
+	l_available = p_decoder->Fill - p_decoder->Start;
+	// The rest of a packet we had no room for
+	if (p_decoder->Streaming > 0) {
+		if (l_available == 0) {
+			return MQTT_DECODE_MORE;
+		}
+		l_part = l_available < p_decoder->Streaming ? l_available : p_decoder->Streaming;
+		r_frame->Type = p_decoder->StreamType;
+		r_frame->Packet = l_ptr;
+		r_frame->Available = l_part;
+		r_frame->Offset = p_decoder->StreamLength - p_decoder->Streaming;
+		r_frame->Length = p_decoder->StreamLength;
+		r_frame->Body = NULL;
+		r_frame->BodyLength = 0;
+		p_decoder->Start += l_part;
+		p_decoder->Streaming -= l_part;
+		if (p_decoder->Streaming == 0) {
+			p_decoder->Keep = 0;
+		}
+		return MQTT_DECODE_PART;
+	}
+	if (l_available < 2) {
+		return MQTT_DECODE_MORE;
+	}
+	l_header = decoder_remaining_length(l_ptr + 1, l_available - 1, &l_remaining);
+	if (l_header < 0) {
+		ESP_LOGE(TAG, "Next - Malformed remaining length");
+		return MQTT_DECODE_MALFORMED;
+	}
+	if (l_header == 0) {
+		return MQTT_DECODE_MORE;
+	}
+	r_frame->Type = l_ptr[0];
+	r_frame->Packet = l_ptr;
+	r_frame->Offset = 0;
+	r_frame->Length = 1 + l_header + l_remaining;
+	r_frame->Body = l_ptr + 1 + l_header;
+	r_frame->BodyLength = l_remaining;
+	if (r_frame->Length > p_decoder->Size) {
+		// Fill the buffer before the first part, so the variable header is not split
+		if (p_decoder->Fill < p_decoder->Size || p_decoder->Start > 0) {
+			return MQTT_DECODE_MORE;
+		}
+		ESP_LOGD(TAG, "Next - Streaming a %d byte packet, type %d", r_frame->Length, l_ptr[0] >> 4);
+		r_frame->Available = l_available;
+		p_decoder->Start += l_available;
+		p_decoder->Streaming = r_frame->Length - l_available;
+		p_decoder->StreamLength = r_frame->Length;
+		p_decoder->StreamType = l_ptr[0];
+		return MQTT_DECODE_PART;
+	}
+	if (r_frame->Length > l_available) {
+		return MQTT_DECODE_MORE;
+	}
+	r_frame->Available = r_frame->Length;
+	p_decoder->Start += r_frame->Length;
+	return MQTT_DECODE_FRAME;
+}
+
+// ### END DBK
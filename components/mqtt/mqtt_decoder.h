@@ -0,0 +1,68 @@
+/*
+ * mqtt_decoder.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#ifndef COMPONENTS_MQTT_MQTT_DECODER_H_
+#define COMPONENTS_MQTT_MQTT_DECODER_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * One complete packet, or one part of a packet too big for the buffer, still in the decoder's buffer.
+ * Valid until the next mqtt_decoder_space() or mqtt_decoder_feed().
+ */
+typedef struct MqttFrame {
+	uint8_t				Type;  // Packet type and flags - the first byte
+	uint8_t				*Packet;  // The bytes of this frame
+	uint32_t			Available;  // Bytes at Packet; Length unless the packet comes in parts
+	uint32_t			Offset;  // Where Packet starts in the whole packet; 0 for the first part
+	uint32_t			Length;  // Whole packet length
+	uint8_t				*Body;  // Variable header and payload; NULL after the first part
+	uint32_t			BodyLength;  // The remaining length
+} MqttFrame_t;
+
+/**
+ * Resumable frame decoder.
+ * Bytes go in however the socket delivers them; whole packets come out.
+ *
+ * |=============================================================================|
+ * | Buffer | Keep | Start ... complete or partial packets ... Fill |  room ... | Size
+ * |=============================================================================|
+ *
+ * A packet bigger than the buffer comes out in parts: the first part once the buffer is full,
+ *  so the variable header is in one piece, then each read's worth as it arrives.
+ * While it streams, the first Keep bytes (see mqtt_decoder_keep) stay where they are.
+ */
+typedef struct MqttDecoder {
+	uint8_t				*Buffer;
+	uint32_t			Size;
+	uint32_t			Start;  // First byte not yet handed out as a frame
+	uint32_t			Fill;  // End of the bytes received
+	uint32_t			Keep;  // Bytes at the front of the buffer left alone until the packet being streamed ends
+	uint32_t			Streaming;  // Bytes still to come of a packet too big for the buffer
+	uint32_t			StreamLength;  // Whole length of that packet
+	uint8_t				StreamType;
+} MqttDecoder_t;
+
+enum mqtt_decode_result {
+	MQTT_DECODE_PART = 2,  // r_frame holds part of a packet too big for the buffer
+	MQTT_DECODE_FRAME = 1,  // r_frame holds a packet
+	MQTT_DECODE_MORE = 0,  // Need more bytes
+	MQTT_DECODE_MALFORMED = -2  // Remaining length over 4 bytes; the stream cannot be resynchronised
+};
+
+void mqtt_decoder_init(MqttDecoder_t *p_decoder, uint8_t *p_buffer, uint32_t p_size);
+uint8_t *mqtt_decoder_space(MqttDecoder_t *p_decoder, uint32_t *r_room);
+void mqtt_decoder_commit(MqttDecoder_t *p_decoder, uint32_t p_length);
+uint32_t mqtt_decoder_feed(MqttDecoder_t *p_decoder, const uint8_t *p_data, uint32_t p_length);
+int mqtt_decoder_next(MqttDecoder_t *p_decoder, MqttFrame_t *r_frame);
+esp_err_t mqtt_decoder_keep(MqttDecoder_t *p_decoder, uint32_t p_length);
+
+#endif /* COMPONENTS_MQTT_MQTT_DECODER_H_ */
+
+// ### END DBK
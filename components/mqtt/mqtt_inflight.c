@@ -0,0 +1,461 @@
+/*
+ * mqtt_inflight.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Track the QoS 1 and QoS 2 publishes we have sent and the broker has not yet acknowledged.
+ *
+ * Up to Window publishes may be outstanding at once, so a producer does not wait a round trip for each
+ *  PUBACK before sending the next one.  Acks are matched by packet id in any order.
+ * A packet id is never handed out again while it is still in the table, whichever packet asks for it.
+ *
+ * Producers (any task) open a slot before they build a publish; the sending task marks it sent as the packet
+ *  leaves the outbox; the receive task acks and closes them.
+ * Every side takes Lock, which is only ever held for a probe or two.
+ * A slot that is not yet sent still has its packet queued in the outbox, so a reconnect leaves it to go out from there.
+ *
+ * The other direction - QoS 2 publishes from the broker between our PUBREC and its PUBREL - is a plain id set
+ *  (InboundQos2_t) that only the receive task touches.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "mqtt_inflight.h"
+
+static const char *TAG = "MqttInflight  ";
+
+/*
+ * @return the slot holding p_id, or -1.
+ */
+static int inflight_find(Inflight_t *p_inflight, uint16_t p_id) {
+	uint32_t l_ix = p_id & p_inflight->Mask;
+	while (p_inflight->Slots[l_ix].Id != 0) {
+		if (p_inflight->Slots[l_ix].Id == p_id) {
+			return l_ix;
+		}
+		l_ix = (l_ix + 1) & p_inflight->Mask;
+	}
+	return -1;
+}
+
+/*
+ * A place in the window has come free: give it back, unless mqtt_inflight_limit() still wants it held.
+ * Lock must be held.
+ */
+static void inflight_give_place(Inflight_t *p_inflight) {
+	if (p_inflight->Owed > 0) {
+		p_inflight->Owed--;
+		p_inflight->Held++;
+		return;
+	}
+	xSemaphoreGive(p_inflight->Free);
+}
+
+/*
+ * Empty slot p_ix and give its place in the window back.
+ * Later entries of the same probe run are shifted back into the hole so lookups never stop short.
+ */
+static void inflight_remove(Inflight_t *p_inflight, uint32_t p_ix) {
+	InflightSlot_t *l_slots = p_inflight->Slots;
+	uint32_t l_mask = p_inflight->Mask;
+	uint32_t l_next = p_ix, l_home;
+
+	p_inflight->FreeBlocks[p_inflight->FreeCount++] = l_slots[p_ix].Block;
+	while (1) {
+		l_next = (l_next + 1) & l_mask;
+		if (l_slots[l_next].Id == 0) {
+			break;
+		}
+		// An entry may move back to the hole only if its home is not between the hole and where it sits
+		l_home = l_slots[l_next].Id & l_mask;
+		if (((l_next - l_home) & l_mask) >= ((l_next - p_ix) & l_mask)) {
+			l_slots[p_ix] = l_slots[l_next];
+			p_ix = l_next;
+		}
+	}
+	memset(&l_slots[p_ix], 0, sizeof(InflightSlot_t));
+	inflight_give_place(p_inflight);
+}
+
+/*
+ * Next id from the shared counter that is neither 0 nor in flight.  Lock must be held when there is a window.
+ */
+static uint16_t inflight_take_id(Inflight_t *p_inflight, uint32_t *p_counter) {
+	uint16_t l_id;
+	do {
+		l_id = __atomic_add_fetch(p_counter, 1, __ATOMIC_RELAXED) & 0xffff;
+	} while (l_id == 0 || (p_inflight->Slots != NULL && inflight_find(p_inflight, l_id) >= 0));
+	return l_id;
+}
+
+
+
+/**
+ * Allocate the table and the store for p_window outstanding publishes of up to p_block_size bytes each.
+ * A p_window of 0 leaves the client without a window: publishes are sent and forgotten, as before.
+ */
+esp_err_t mqtt_inflight_init(Inflight_t *p_inflight, uint32_t p_window, uint32_t p_block_size) {
+	uint32_t l_table = 1, l_ix;
+
+	memset(p_inflight, 0, sizeof(Inflight_t));
+	if (p_window == 0) {
+		return ESP_OK;
+	}
+	if (p_window > 255) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	while (l_table < 2 * p_window) {
+		l_table <<= 1;
+	}
+	p_inflight->Slots = calloc(l_table, sizeof(InflightSlot_t));
+	p_inflight->Store = malloc(p_window * p_block_size);
+	p_inflight->FreeBlocks = malloc(p_window);
+	p_inflight->Resend = malloc(p_window * sizeof(uint16_t));
+	p_inflight->Lock = xSemaphoreCreateMutex();
+	p_inflight->Free = xSemaphoreCreateCounting(p_window, p_window);
+	if (p_inflight->Slots == NULL || p_inflight->Store == NULL || p_inflight->FreeBlocks == NULL || p_inflight->Resend == NULL
+			|| p_inflight->Lock == NULL || p_inflight->Free == NULL) {
+		ESP_LOGE(TAG, "Init - Not enough memory for a window of %d", p_window);
+		mqtt_inflight_deinit(p_inflight);
+		return ESP_ERR_NO_MEM;
+	}
+	for (l_ix = 0; l_ix < p_window; l_ix++) {
+		p_inflight->FreeBlocks[l_ix] = l_ix;
+	}
+	p_inflight->FreeCount = p_window;
+	p_inflight->Window = p_window;
+	p_inflight->Mask = l_table - 1;
+	p_inflight->BlockSize = p_block_size;
+	return ESP_OK;
+}
+
+void mqtt_inflight_deinit(Inflight_t *p_inflight) {
+	free(p_inflight->Slots);
+	free(p_inflight->Store);
+	free(p_inflight->FreeBlocks);
+	free(p_inflight->Resend);
+	if (p_inflight->Lock != NULL) {
+		vSemaphoreDelete(p_inflight->Lock);
+	}
+	if (p_inflight->Free != NULL) {
+		vSemaphoreDelete(p_inflight->Free);
+	}
+	memset(p_inflight, 0, sizeof(Inflight_t));
+}
+
+/**
+ * A packet id for a packet that is not tracked here (SUBSCRIBE, UNSUBSCRIBE), still never one in flight.
+ */
+uint16_t mqtt_inflight_next_id(Inflight_t *p_inflight, uint32_t *p_counter) {
+	uint16_t l_id;
+	if (p_inflight->Slots == NULL) {
+		return inflight_take_id(p_inflight, p_counter);
+	}
+	xSemaphoreTake(p_inflight->Lock, portMAX_DELAY);
+	l_id = inflight_take_id(p_inflight, p_counter);
+	xSemaphoreGive(p_inflight->Lock);
+	return l_id;
+}
+
+/**
+ * Take a place in the window for a QoS p_qos publish, waiting up to p_wait for one to come free, and give it an id.
+ * Without a window this only takes the id.
+ *
+ * @return ESP_OK, or ESP_ERR_TIMEOUT if the window stayed full.
+ */
+esp_err_t mqtt_inflight_open(Inflight_t *p_inflight, uint32_t *p_counter, uint8_t p_qos, TickType_t p_wait, uint16_t *r_id) {
+	InflightSlot_t *l_slot;
+	uint32_t l_ix;
+
+	if (p_inflight->Slots == NULL) {
+		*r_id = inflight_take_id(p_inflight, p_counter);
+		return ESP_OK;
+	}
+	if (xSemaphoreTake(p_inflight->Free, p_wait) != pdTRUE) {
+		ESP_LOGW(TAG, "Open - Window of %d full", p_inflight->Window);
+		return ESP_ERR_TIMEOUT;
+	}
+	xSemaphoreTake(p_inflight->Lock, portMAX_DELAY);
+	*r_id = inflight_take_id(p_inflight, p_counter);
+	l_ix = *r_id & p_inflight->Mask;
+	while (p_inflight->Slots[l_ix].Id != 0) {
+		l_ix = (l_ix + 1) & p_inflight->Mask;
+	}
+	l_slot = &p_inflight->Slots[l_ix];
+	l_slot->Id = *r_id;
+	l_slot->State = p_qos == 1 ? INFLIGHT_PUBACK : INFLIGHT_PUBREC;
+	l_slot->Block = p_inflight->FreeBlocks[--p_inflight->FreeCount];
+	l_slot->Length = 0;
+	l_slot->Sent = 0;
+	l_slot->Sequence = ++p_inflight->Sequence;
+	xSemaphoreGive(p_inflight->Lock);
+	return ESP_OK;
+}
+
+/**
+ * Keep a copy of the publish just built for p_id, to resend after a reconnect.
+ * A packet bigger than a store block is still tracked, but cannot be resent.
+ */
+void mqtt_inflight_store(Inflight_t *p_inflight, uint16_t p_id, const uint8_t *p_packet, uint32_t p_length) {
+	int l_ix;
+	if (p_inflight->Slots == NULL) {
+		return;
+	}
+	xSemaphoreTake(p_inflight->Lock, portMAX_DELAY);
+	l_ix = inflight_find(p_inflight, p_id);
+	if (l_ix >= 0 && p_length <= p_inflight->BlockSize) {
+		memcpy(p_inflight->Store + p_inflight->Slots[l_ix].Block * p_inflight->BlockSize, p_packet, p_length);
+		p_inflight->Slots[l_ix].Length = p_length;
+	}
+	xSemaphoreGive(p_inflight->Lock);
+}
+
+/**
+ * The publish for p_id has left the outbox; a reconnect from now on must send it again from the store.
+ */
+void mqtt_inflight_sent(Inflight_t *p_inflight, uint16_t p_id) {
+	int l_ix;
+	if (p_inflight->Slots == NULL) {
+		return;
+	}
+	xSemaphoreTake(p_inflight->Lock, portMAX_DELAY);
+	l_ix = inflight_find(p_inflight, p_id);
+	if (l_ix >= 0) {
+		p_inflight->Slots[l_ix].Sent = 1;
+	}
+	xSemaphoreGive(p_inflight->Lock);
+}
+
+/**
+ * Give up on p_id, say because the publish could not be queued or the outbox threw it away unsent.
+ */
+void mqtt_inflight_close(Inflight_t *p_inflight, uint16_t p_id) {
+	int l_ix;
+	if (p_inflight->Slots == NULL) {
+		return;
+	}
+	xSemaphoreTake(p_inflight->Lock, portMAX_DELAY);
+	l_ix = inflight_find(p_inflight, p_id);
+	if (l_ix >= 0) {
+		inflight_remove(p_inflight, l_ix);
+	}
+	xSemaphoreGive(p_inflight->Lock);
+}
+
+/**
+ * The broker has answered p_id with the ack that a slot in state p_waiting is waiting for.
+ * PUBACK and PUBCOMP end the publish; PUBREC moves it on to waiting for PUBCOMP.
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND for an id that is not in flight, or ESP_ERR_INVALID_STATE for an ack out of turn.
+ */
+esp_err_t mqtt_inflight_ack(Inflight_t *p_inflight, uint16_t p_id, InflightState_t p_waiting) {
+	esp_err_t l_err = ESP_OK;
+	int l_ix;
+	if (p_inflight->Slots == NULL) {
+		return ESP_ERR_NOT_FOUND;
+	}
+	xSemaphoreTake(p_inflight->Lock, portMAX_DELAY);
+	l_ix = inflight_find(p_inflight, p_id);
+	if (l_ix < 0) {
+		l_err = ESP_ERR_NOT_FOUND;
+	} else if (p_inflight->Slots[l_ix].State != p_waiting) {
+		l_err = ESP_ERR_INVALID_STATE;
+	} else if (p_waiting == INFLIGHT_PUBREC) {
+		p_inflight->Slots[l_ix].State = INFLIGHT_PUBCOMP;
+		p_inflight->Acked++;
+	} else {
+		inflight_remove(p_inflight, l_ix);
+		p_inflight->Acked++;
+	}
+	xSemaphoreGive(p_inflight->Lock);
+	return l_err;
+}
+
+/**
+ * Number of publishes outstanding.
+ */
+uint32_t mqtt_inflight_count(Inflight_t *p_inflight) {
+	uint32_t l_count;
+	if (p_inflight->Slots == NULL) {
+		return 0;
+	}
+	xSemaphoreTake(p_inflight->Lock, portMAX_DELAY);
+	l_count = p_inflight->Window - p_inflight->FreeCount;
+	xSemaphoreGive(p_inflight->Lock);
+	return l_count;
+}
+
+/**
+ * After a reconnect that kept the session, hand every outstanding publish to p_fn again in the order they were first sent,
+ *  with DUP set [MQTT-4.4.0-1].  Publishes that were too big to keep are dropped here.
+ * Only publishes that have left the outbox are resent; the rest are still queued there and go out as they are.
+ * A resent one counts as unsent again until its new copy leaves the outbox, so a second reconnect does not queue it twice.
+ *
+ * The slots are picked out under Lock and handed over after it is released, so p_fn may wait on the outbox.
+ * Their store blocks stay theirs meanwhile: only an ack or a drop from the outbox closes a sent slot,
+ *  and neither can come for one that is not back in the outbox until this returns.
+ */
+void mqtt_inflight_resend(Inflight_t *p_inflight, inflight_resend_fn p_fn, void *p_arg) {
+	InflightSlot_t *l_slot;
+	uint32_t l_last = 0, l_count = 0, l_length, l_ix;
+	uint8_t *l_packet;
+	int l_oldest;
+
+	if (p_inflight->Slots == NULL) {
+		return;
+	}
+	xSemaphoreTake(p_inflight->Lock, portMAX_DELAY);
+	while (1) {
+		l_oldest = -1;
+		for (l_ix = 0; l_ix <= p_inflight->Mask; l_ix++) {
+			l_slot = &p_inflight->Slots[l_ix];
+			if (l_slot->Id != 0 && l_slot->Sequence > l_last && (l_oldest < 0 || l_slot->Sequence < p_inflight->Slots[l_oldest].Sequence)) {
+				l_oldest = l_ix;
+			}
+		}
+		if (l_oldest < 0) {
+			break;
+		}
+		l_slot = &p_inflight->Slots[l_oldest];
+		l_last = l_slot->Sequence;
+		if (l_slot->State != INFLIGHT_PUBCOMP && !l_slot->Sent) {
+			continue;
+		}
+		if (l_slot->State != INFLIGHT_PUBCOMP && l_slot->Length == 0) {
+			ESP_LOGW(TAG, "Resend - Id %d was too big to keep; dropped", l_slot->Id);
+			inflight_remove(p_inflight, l_oldest);
+			continue;
+		}
+		if (l_slot->State != INFLIGHT_PUBCOMP) {
+			l_slot->Sent = 0;
+		}
+		p_inflight->Resend[l_count++] = l_slot->Id;
+	}
+	xSemaphoreGive(p_inflight->Lock);
+
+	for (l_ix = 0; l_ix < l_count; l_ix++) {
+		xSemaphoreTake(p_inflight->Lock, portMAX_DELAY);
+		l_oldest = inflight_find(p_inflight, p_inflight->Resend[l_ix]);
+		l_packet = NULL;
+		l_length = 0;
+		if (l_oldest >= 0 && p_inflight->Slots[l_oldest].State != INFLIGHT_PUBCOMP) {
+			l_slot = &p_inflight->Slots[l_oldest];
+			l_packet = p_inflight->Store + l_slot->Block * p_inflight->BlockSize;
+			l_packet[0] |= 0x08;
+			l_length = l_slot->Length;
+		}
+		xSemaphoreGive(p_inflight->Lock);
+		if (l_oldest >= 0) {
+			p_fn(p_arg, p_inflight->Resend[l_ix], l_packet, l_length);
+		}
+	}
+}
+
+/**
+ * Forget every publish sent and outstanding - the broker has started a clean session.
+ * Those still in the outbox keep their places and ids; they go out on the new session and are acked there.
+ */
+void mqtt_inflight_clear(Inflight_t *p_inflight) {
+	uint32_t l_ix = 0;
+	if (p_inflight->Slots == NULL) {
+		return;
+	}
+	xSemaphoreTake(p_inflight->Lock, portMAX_DELAY);
+	while (l_ix <= p_inflight->Mask) {
+		// Removing shifts a later entry back into l_ix, so look at the same place again
+		if (p_inflight->Slots[l_ix].Id != 0 && (p_inflight->Slots[l_ix].Sent || p_inflight->Slots[l_ix].State == INFLIGHT_PUBCOMP)) {
+			inflight_remove(p_inflight, l_ix);
+		} else {
+			l_ix++;
+		}
+	}
+	xSemaphoreGive(p_inflight->Lock);
+}
+
+/**
+ * Keep no more than p_limit publishes outstanding - the Receive Maximum the broker gave in its CONNACK.
+ * It never grows past the configured window.  Places in use now are held back as they come free.
+ */
+void mqtt_inflight_limit(Inflight_t *p_inflight, uint32_t p_limit) {
+	uint32_t l_hold;
+	if (p_inflight->Slots == NULL) {
+		return;
+	}
+	l_hold = p_limit < p_inflight->Window ? p_inflight->Window - p_limit : 0;
+	xSemaphoreTake(p_inflight->Lock, portMAX_DELAY);
+	while (p_inflight->Held > l_hold) {
+		p_inflight->Held--;
+		xSemaphoreGive(p_inflight->Free);
+	}
+	p_inflight->Owed = l_hold - p_inflight->Held;
+	while (p_inflight->Owed > 0 && xSemaphoreTake(p_inflight->Free, 0) == pdTRUE) {
+		p_inflight->Owed--;
+		p_inflight->Held++;
+	}
+	xSemaphoreGive(p_inflight->Lock);
+	if (l_hold > 0) {
+		ESP_LOGI(TAG, "Limit - Broker takes %d at a time; window of %d held to it", p_limit, p_inflight->Window);
+	}
+}
+
+/**
+ * A QoS 2 PUBLISH with p_id has arrived.
+ *
+ * @return ESP_OK if it is new and now recorded - deliver it,
+ *  ESP_ERR_INVALID_STATE if it was delivered already and its PUBREL has not come yet - only PUBREC it again,
+ *  ESP_ERR_NO_MEM if the set is full - deliver it, but a resend of it would be delivered again.
+ */
+esp_err_t mqtt_inbound_qos2_receive(InboundQos2_t *p_inbound, uint16_t p_id) {
+	uint32_t l_mask = CONFIG_MQTT_INBOUND_QOS2_SLOTS - 1;
+	uint32_t l_ix = p_id & l_mask;
+	while (p_inbound->Ids[l_ix] != 0) {
+		if (p_inbound->Ids[l_ix] == p_id) {
+			return ESP_ERR_INVALID_STATE;
+		}
+		l_ix = (l_ix + 1) & l_mask;
+	}
+	if (p_inbound->Count >= CONFIG_MQTT_INBOUND_QOS2_SLOTS * 3 / 4) {
+		ESP_LOGW(TAG, "InboundQos2 - %d ids waiting for PUBREL; id %d not recorded", p_inbound->Count, p_id);
+		return ESP_ERR_NO_MEM;
+	}
+	p_inbound->Ids[l_ix] = p_id;
+	p_inbound->Count++;
+	return ESP_OK;
+}
+
+/**
+ * The PUBREL for p_id has come; a PUBLISH with that id is new again.
+ */
+void mqtt_inbound_qos2_release(InboundQos2_t *p_inbound, uint16_t p_id) {
+	uint32_t l_mask = CONFIG_MQTT_INBOUND_QOS2_SLOTS - 1;
+	uint32_t l_ix = p_id & l_mask, l_next, l_home;
+	if (p_id == 0) {
+		return;
+	}
+	while (p_inbound->Ids[l_ix] != p_id) {
+		if (p_inbound->Ids[l_ix] == 0) {
+			return;
+		}
+		l_ix = (l_ix + 1) & l_mask;
+	}
+	// Shift the rest of the probe run back, as inflight_remove() does
+	for (l_next = (l_ix + 1) & l_mask; p_inbound->Ids[l_next] != 0; l_next = (l_next + 1) & l_mask) {
+		l_home = p_inbound->Ids[l_next] & l_mask;
+		if (((l_next - l_home) & l_mask) >= ((l_next - l_ix) & l_mask)) {
+			p_inbound->Ids[l_ix] = p_inbound->Ids[l_next];
+			l_ix = l_next;
+		}
+	}
+	p_inbound->Ids[l_ix] = 0;
+	p_inbound->Count--;
+}
+
+void mqtt_inbound_qos2_clear(InboundQos2_t *p_inbound) {
+	memset(p_inbound, 0, sizeof(InboundQos2_t));
+}
+
+// ### END DBK
@@ -0,0 +1,105 @@
+/*
+ * mqtt_inflight.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#ifndef COMPONENTS_MQTT_MQTT_INFLIGHT_H_
+#define COMPONENTS_MQTT_MQTT_INFLIGHT_H_
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_err.h"
+
+#include "mqtt_config.h"
+
+/**
+ * What an outstanding publish is waiting for.
+ */
+typedef enum InflightState {
+	INFLIGHT_FREE = 0,
+	INFLIGHT_PUBACK,  // QoS 1 sent
+	INFLIGHT_PUBREC,  // QoS 2 sent
+	INFLIGHT_PUBCOMP  // QoS 2, PUBREL sent
+} InflightState_t;
+
+/**
+ * One entry of the open addressed table, keyed by packet id (0 = empty).
+ */
+typedef struct InflightSlot {
+	uint16_t			Id;
+	uint8_t				State;  // InflightState_t
+	uint8_t				Block;  // Which block of the store holds the packet
+	uint16_t			Length;  // Bytes of the packet in its block; 0 if it was too big to keep
+	uint8_t				Sent;  // The packet has left the outbox; until then the outbox copy is the one to send
+	uint32_t			Sequence;  // Order of sending, so a reconnect resends in the original order
+} InflightSlot_t;
+
+/**
+ * Window of QoS 1 and QoS 2 publishes sent and not yet acknowledged.
+ *
+ * Window outstanding publishes at most; a producer waits for a free place (Free) before it builds the next one.
+ * The table has twice as many slots as the window so probes stay short; it uses linear probing,
+ *  and deletion shifts later entries back, so there are no tombstones.
+ * Each place in the window owns a fixed block of the store holding a copy of the packet, to resend with DUP set
+ *  after a reconnect.
+ * Everything is allocated once by mqtt_inflight_init().
+ */
+typedef struct Inflight {
+	InflightSlot_t		*Slots;  // NULL when there is no window
+	uint8_t				*Store;
+	uint8_t				*FreeBlocks;  // Stack of unused store blocks
+	uint16_t			*Resend;  // Ids mqtt_inflight_resend() has picked out, in the order sent
+	uint32_t			FreeCount;
+	uint32_t			Window;
+	uint32_t			Mask;  // Table size - 1
+	uint32_t			BlockSize;
+	uint32_t			Sequence;
+	uint32_t			Held;  // Places taken out of Free to keep to the broker's Receive Maximum
+	uint32_t			Owed;  // Places still to hold back as they come free
+	uint32_t			Acked;  // Acks matched since init; shows whether the broker is still acking
+	SemaphoreHandle_t	Lock;
+	SemaphoreHandle_t	Free;  // Counts the free places in the window
+} Inflight_t;
+
+/**
+ * Ids of QoS 2 publishes from the broker that we have delivered and sent PUBREC for, until their PUBREL comes.
+ * A PUBLISH that arrives again with one of these ids is a resend and must not reach data_cb twice.
+ * Open addressed like the window, at most 3/4 full; used only by the receive task so it takes no lock.
+ */
+typedef struct InboundQos2 {
+	uint16_t			Ids[CONFIG_MQTT_INBOUND_QOS2_SLOTS];  // 0 = empty
+	uint32_t			Count;
+} InboundQos2_t;
+
+/**
+ * Called for each outstanding publish, oldest first, to put it back in the outbox after a reconnect.
+ * p_packet is the stored copy (DUP already set), or NULL when the slot is waiting for PUBCOMP and only the PUBREL is resent.
+ * It is called without Lock held, so it may wait for room in the outbox.
+ */
+typedef void (*inflight_resend_fn)(void *p_arg, uint16_t p_id, uint8_t *p_packet, uint32_t p_length);
+
+esp_err_t mqtt_inflight_init(Inflight_t *p_inflight, uint32_t p_window, uint32_t p_block_size);
+void mqtt_inflight_deinit(Inflight_t *p_inflight);
+uint16_t mqtt_inflight_next_id(Inflight_t *p_inflight, uint32_t *p_counter);
+esp_err_t mqtt_inflight_open(Inflight_t *p_inflight, uint32_t *p_counter, uint8_t p_qos, TickType_t p_wait, uint16_t *r_id);
+void mqtt_inflight_store(Inflight_t *p_inflight, uint16_t p_id, const uint8_t *p_packet, uint32_t p_length);
+void mqtt_inflight_sent(Inflight_t *p_inflight, uint16_t p_id);
+void mqtt_inflight_close(Inflight_t *p_inflight, uint16_t p_id);
+esp_err_t mqtt_inflight_ack(Inflight_t *p_inflight, uint16_t p_id, InflightState_t p_waiting);
+uint32_t mqtt_inflight_count(Inflight_t *p_inflight);
+void mqtt_inflight_resend(Inflight_t *p_inflight, inflight_resend_fn p_fn, void *p_arg);
+void mqtt_inflight_clear(Inflight_t *p_inflight);
+void mqtt_inflight_limit(Inflight_t *p_inflight, uint32_t p_limit);
+
+esp_err_t mqtt_inbound_qos2_receive(InboundQos2_t *p_inbound, uint16_t p_id);
+void mqtt_inbound_qos2_release(InboundQos2_t *p_inbound, uint16_t p_id);
+void mqtt_inbound_qos2_clear(InboundQos2_t *p_inbound);
+
+#endif /* COMPONENTS_MQTT_MQTT_INFLIGHT_H_ */
+
+// ### END DBK
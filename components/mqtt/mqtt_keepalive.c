@@ -0,0 +1,105 @@
+/*
+ * mqtt_keepalive.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * When to ping the broker, and when to give up on it (see Keepalive_t in mqtt_keepalive.h).
+ * Ticks wrap, so stamps are only ever compared by the sign of their difference.
+ */
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include "mqtt_config.h"
+#include "mqtt_keepalive.h"
+
+static const char *TAG = "MqttKeepalive ";
+
+/**
+ * p_timeout_ms is how long a PINGREQ may go unanswered before the connection is taken for dead.
+ */
+void mqtt_keepalive_init(Keepalive_t *p_keepalive, uint32_t p_timeout_ms) {
+	memset(p_keepalive, 0, sizeof(Keepalive_t));
+	p_keepalive->TimeoutTicks = MQTT_MS_TO_TICKS(p_timeout_ms);
+}
+
+/**
+ * A new connection has been accepted with a keepalive of p_keepalive_s seconds (0 for none).
+ */
+void mqtt_keepalive_start(Keepalive_t *p_keepalive, uint32_t p_keepalive_s, TickType_t p_now) {
+	p_keepalive->IntervalTicks = p_keepalive_s * 1000 / 2 / portTICK_RATE_MS;
+	p_keepalive->LastSent = p_now;
+	__atomic_store_n(&p_keepalive->LastReceived, p_now, __ATOMIC_RELEASE);
+	p_keepalive->Outstanding = 0;
+	p_keepalive->Dead = 0;
+}
+
+/**
+ * Something has been written to the broker.
+ */
+void mqtt_keepalive_sent(Keepalive_t *p_keepalive, TickType_t p_now) {
+	p_keepalive->LastSent = p_now;
+}
+
+/**
+ * Something has been read from the broker. Receiving side only.
+ */
+void mqtt_keepalive_received(Keepalive_t *p_keepalive, TickType_t p_now) {
+	__atomic_store_n(&p_keepalive->LastReceived, p_now, __ATOMIC_RELEASE);
+}
+
+/**
+ * The PINGREQ asked for by mqtt_keepalive_check() has been queued.
+ */
+void mqtt_keepalive_ping_sent(Keepalive_t *p_keepalive, TickType_t p_now) {
+	p_keepalive->PingSent = p_now;
+	p_keepalive->Outstanding = 1;
+	p_keepalive->Pings++;
+}
+
+/**
+ * What is due at p_now, and in *r_wait how many ticks until something next will be (portMAX_DELAY for never).
+ * KEEPALIVE_DEAD is given once per connection, with DetectMs set.
+ */
+KeepaliveAction_t mqtt_keepalive_check(Keepalive_t *p_keepalive, TickType_t p_now, TickType_t *r_wait) {
+	TickType_t l_received = __atomic_load_n(&p_keepalive->LastReceived, __ATOMIC_ACQUIRE);
+	TickType_t l_quiet;
+	int32_t l_left;
+
+	*r_wait = portMAX_DELAY;
+	if (p_keepalive->IntervalTicks == 0 || p_keepalive->Dead) {
+		return KEEPALIVE_IDLE;
+	}
+	if (p_keepalive->Outstanding && (int32_t) (l_received - p_keepalive->PingSent) >= 0) {
+		p_keepalive->Outstanding = 0;
+	}
+	if (p_keepalive->Outstanding) {
+		if (p_keepalive->TimeoutTicks == 0) {
+			return KEEPALIVE_IDLE;
+		}
+		l_left = (int32_t) (p_keepalive->PingSent + p_keepalive->TimeoutTicks - p_now);
+		if (l_left > 0) {
+			*r_wait = l_left;
+			return KEEPALIVE_IDLE;
+		}
+		p_keepalive->Outstanding = 0;
+		p_keepalive->Dead = 1;
+		p_keepalive->DetectMs = (p_now - l_received) * portTICK_RATE_MS;
+		ESP_LOGW(TAG, "Check - No answer to PINGREQ in %d ms; nothing heard for %d ms",
+				p_keepalive->TimeoutTicks * portTICK_RATE_MS, p_keepalive->DetectMs);
+		return KEEPALIVE_DEAD;
+	}
+	// Whichever direction has been quiet longer
+	l_quiet = (int32_t) (p_keepalive->LastSent - l_received) < 0 ? p_keepalive->LastSent : l_received;
+	l_left = (int32_t) (l_quiet + p_keepalive->IntervalTicks - p_now);
+	if (l_left > 0) {
+		*r_wait = l_left;
+		return KEEPALIVE_IDLE;
+	}
+	return KEEPALIVE_PING;
+}
+
+// ### END DBK
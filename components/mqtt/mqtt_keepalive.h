@@ -0,0 +1,55 @@
+/*
+ * mqtt_keepalive.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#ifndef COMPONENTS_MQTT_MQTT_KEEPALIVE_H_
+#define COMPONENTS_MQTT_MQTT_KEEPALIVE_H_
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+/**
+ * What mqtt_keepalive_check() wants done.
+ */
+typedef enum KeepaliveAction {
+	KEEPALIVE_IDLE = 0,  // Nothing yet
+	KEEPALIVE_PING,  // Queue a PINGREQ, then call mqtt_keepalive_ping_sent()
+	KEEPALIVE_DEAD  // No PINGRESP, or anything else, within TimeoutTicks: drop the connection
+} KeepaliveAction_t;
+
+/**
+ * Keepalive and dead link detection for one connection, from tick stamps rather than counted wakeups.
+ *
+ * A PINGREQ goes out when either direction has been quiet for half the keepalive:
+ *  quiet sending keeps the broker from dropping us [MQTT-3.1.2-23], and quiet receiving
+ *  gets the link tested even while we publish, since writes to a half open connection still succeed
+ *  until the send buffer fills.
+ * Anything at all from the broker answers the ping.
+ * The sending side writes LastSent, PingSent and Outstanding; the receiving side writes only LastReceived.
+ */
+typedef struct Keepalive {
+	TickType_t			IntervalTicks;  // Keepalive / 2; 0 turns keepalive off
+	TickType_t			TimeoutTicks;  // Longest wait for an answer to PINGREQ; 0 waits for ever
+	TickType_t			LastSent;
+	TickType_t			LastReceived;
+	TickType_t			PingSent;
+	uint8_t				Outstanding;  // A PINGREQ is waiting for an answer
+	uint8_t				Dead;  // KEEPALIVE_DEAD has been given for this connection
+	uint32_t			DetectMs;  // From the last thing heard to KEEPALIVE_DEAD
+	uint32_t			Pings;
+} Keepalive_t;
+
+void mqtt_keepalive_init(Keepalive_t *p_keepalive, uint32_t p_timeout_ms);
+void mqtt_keepalive_start(Keepalive_t *p_keepalive, uint32_t p_keepalive_s, TickType_t p_now);
+void mqtt_keepalive_sent(Keepalive_t *p_keepalive, TickType_t p_now);
+void mqtt_keepalive_received(Keepalive_t *p_keepalive, TickType_t p_now);
+void mqtt_keepalive_ping_sent(Keepalive_t *p_keepalive, TickType_t p_now);
+KeepaliveAction_t mqtt_keepalive_check(Keepalive_t *p_keepalive, TickType_t p_now, TickType_t *r_wait);
+
+#endif /* COMPONENTS_MQTT_MQTT_KEEPALIVE_H_ */
+
+// ### END DBK
@@ -0,0 +1,78 @@
+/*
+ * mqtt_loop.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Deadlines for the event loop (see mqtt_event_loop() in mqtt.c).
+ * Ticks wrap, so deadlines are compared by the sign of their difference from now, never by value.
+ */
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "mqtt_loop.h"
+
+void mqtt_timer_init(Timers_t *p_timers) {
+	memset(p_timers, 0, sizeof(Timers_t));
+}
+
+/**
+ * Start (or restart) timer p_id to run out p_ticks after p_now.
+ */
+void mqtt_timer_arm(Timers_t *p_timers, LoopTimer_t p_id, TickType_t p_now, TickType_t p_ticks) {
+	p_timers->Deadline[p_id] = p_now + p_ticks;
+	p_timers->Armed |= MQTT_TIMER_BIT(p_id);
+}
+
+void mqtt_timer_cancel(Timers_t *p_timers, LoopTimer_t p_id) {
+	p_timers->Armed &= ~MQTT_TIMER_BIT(p_id);
+}
+
+uint32_t mqtt_timer_armed(Timers_t *p_timers, LoopTimer_t p_id) {
+	return (p_timers->Armed & MQTT_TIMER_BIT(p_id)) != 0;
+}
+
+/**
+ * How long the loop may sleep.
+ * @return ticks until the first running timer runs out (0 if one already has), or portMAX_DELAY if none is running.
+ */
+TickType_t mqtt_timer_next(Timers_t *p_timers, TickType_t p_now) {
+	TickType_t l_next = portMAX_DELAY;
+	int32_t l_left;
+	uint32_t l_id;
+
+	for (l_id = 0; l_id < MQTT_TIMER_COUNT; l_id++) {
+		if (!(p_timers->Armed & MQTT_TIMER_BIT(l_id))) {
+			continue;
+		}
+		l_left = (int32_t) (p_timers->Deadline[l_id] - p_now);
+		if (l_left <= 0) {
+			return 0;
+		}
+		if ((TickType_t) l_left < l_next) {
+			l_next = l_left;
+		}
+	}
+	return l_next;
+}
+
+/**
+ * Stop every timer that has run out by p_now.
+ * @return MQTT_TIMER_BIT() of each of them.
+ */
+uint32_t mqtt_timer_expired(Timers_t *p_timers, TickType_t p_now) {
+	uint32_t l_expired = 0;
+	uint32_t l_id;
+
+	for (l_id = 0; l_id < MQTT_TIMER_COUNT; l_id++) {
+		if ((p_timers->Armed & MQTT_TIMER_BIT(l_id)) && (int32_t) (p_timers->Deadline[l_id] - p_now) <= 0) {
+			l_expired |= MQTT_TIMER_BIT(l_id);
+		}
+	}
+	p_timers->Armed &= ~l_expired;
+	return l_expired;
+}
+
+// ### END DBK
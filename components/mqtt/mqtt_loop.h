@@ -0,0 +1,57 @@
+/*
+ * mqtt_loop.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#ifndef COMPONENTS_MQTT_MQTT_LOOP_H_
+#define COMPONENTS_MQTT_MQTT_LOOP_H_
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+/**
+ * The deadlines the event loop keeps.
+ */
+typedef enum LoopTimer {
+	MQTT_TIMER_KEEPALIVE = 0,  // Queue a PINGREQ; pushed back by every write
+	MQTT_TIMER_ACK,  // Publishes are waiting and the broker has had long enough to ack one
+	MQTT_TIMER_RECONNECT,  // Next connect attempt
+	MQTT_TIMER_COUNT
+} LoopTimer_t;
+
+#define MQTT_TIMER_BIT(id)	(1u << (id))
+
+/**
+ * One deadline per LoopTimer_t, in ticks.
+ * With this few timers a table scanned on each pass is cheaper than a wheel, and exact to the tick.
+ */
+typedef struct Timers {
+	TickType_t			Deadline[MQTT_TIMER_COUNT];
+	uint32_t			Armed;  // MQTT_TIMER_BIT() of each timer that is running
+} Timers_t;
+
+/**
+ * State of mqtt_event_loop(), the single task that does all the client's I/O (CONFIG_MQTT_EVENT_LOOP).
+ */
+typedef struct EventLoop {
+	Timers_t			Timers;
+	int					Wake;  // Loopback UDP socket the outbox writes to when it has something to send; -1 if none
+	uint32_t			Up;  // Connected and CONNACK accepted
+	TickType_t			AckTicks;  // How long publishes may wait with no ack at all; 0 for ever
+	uint32_t			Acked;  // Inflight acks counted when the ack timer was armed
+	volatile uint32_t	Stop;
+} EventLoop_t;
+
+void mqtt_timer_init(Timers_t *p_timers);
+void mqtt_timer_arm(Timers_t *p_timers, LoopTimer_t p_id, TickType_t p_now, TickType_t p_ticks);
+void mqtt_timer_cancel(Timers_t *p_timers, LoopTimer_t p_id);
+uint32_t mqtt_timer_armed(Timers_t *p_timers, LoopTimer_t p_id);
+TickType_t mqtt_timer_next(Timers_t *p_timers, TickType_t p_now);
+uint32_t mqtt_timer_expired(Timers_t *p_timers, TickType_t p_now);
+
+#endif /* COMPONENTS_MQTT_MQTT_LOOP_H_ */
+
+// ### END DBK
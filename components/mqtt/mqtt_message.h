@@ -12,6 +12,7 @@
 #include "esp_err.h"
 
 #include "mqtt_structs.h"
+#include "mqtt_packet.h"
 #include "mqtt.h"
 
 /**
@@ -61,14 +62,7 @@ enum mqtt_message_type {
 	MQTT_MSG_TYPE_DISCONNECT = 14
 };
 
-enum mqtt_connect_return_code {
-	CONNECTION_ACCEPTED = 0,
-	CONNECTION_REFUSE_PROTOCOL,
-	CONNECTION_REFUSE_ID_REJECTED,
-	CONNECTION_REFUSE_SERVER_UNAVAILABLE,
-	CONNECTION_REFUSE_BAD_USERNAME,
-	CONNECTION_REFUSE_NOT_AUTHORIZED
-};
+// enum mqtt_connect_return_code is in mqtt_packet.h
 
 
 static inline int mqtt_get_type(uint8_t* p_buffer) {
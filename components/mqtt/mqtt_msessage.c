@@ -39,6 +39,7 @@
 
 #include "mqtt.h"
 #include "mqtt_message.h"
+#include "mqtt_property.h"
 #include "mqtt_debug.h"
 
 #define MQTT_MAX_FIXED_HEADER_SIZE 3
@@ -178,26 +179,203 @@ esp_err_t _fixed_header(PacketInfo_t* p_packet, int p_type, int p_dup, int p_qos
 
 
 /*
- * This only works for up to 16,383 bytes
+ * Check that a p_size byte field at p_ix lies within the packet (p_end) and within the bytes we have (p_have).
  */
-int mqtt_get_total_length(uint8_t* buffer, uint16_t length) {
-	int i;
-	int totlen = 0;
-	ESP_LOGI(TAG, "175 Get_Total_Length - All");
-	for (i = 1; i < length; ++i) {
-		totlen += (buffer[i] & 0x7f) << (7 * (i - 1));
-		if ((buffer[i] & 0x80) == 0) {
-			++i;
-			break;
+static esp_err_t parse_field(uint32_t p_ix, uint32_t p_size, uint32_t p_end, uint32_t p_have) {
+	if (p_ix + p_size > p_end) {
+		return ESP_ERR_INVALID_RESPONSE;
+	}
+	if (p_ix + p_size > p_have) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	return ESP_OK;
+}
+
+/*
+ * MQTT 5: the property length at *p_ix and the properties after it; moves *p_ix past them.
+ */
+static esp_err_t parse_properties(const uint8_t *p_buffer, uint32_t *p_ix, uint32_t p_end, uint32_t p_have, PacketView_t *r_view) {
+	uint32_t l_length;
+	int l_size = mqtt_varint_get(p_buffer + *p_ix, (p_end < p_have ? p_end : p_have) - *p_ix, &l_length);
+	esp_err_t l_err;
+	if (l_size < 0 || (l_size == 0 && p_end <= p_have)) {
+		return ESP_ERR_INVALID_RESPONSE;
+	}
+	if (l_size == 0) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	*p_ix += l_size;
+	if ((l_err = parse_field(*p_ix, l_length, p_end, p_have)) != ESP_OK) {
+		return l_err;
+	}
+	r_view->Properties = p_buffer + *p_ix;
+	r_view->Properties_length = l_length;
+	*p_ix += l_length;
+	return ESP_OK;
+}
+
+/*
+ * MQTT 5: the optional reason code and properties that end an ack or DISCONNECT; absent means success, no properties.
+ */
+static esp_err_t parse_reason(const uint8_t *p_buffer, uint32_t *p_ix, uint32_t p_end, uint32_t p_have, PacketView_t *r_view) {
+	if (*p_ix >= p_end) {
+		return ESP_OK;
+	}
+	if (*p_ix >= p_have) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	r_view->ReasonCode = p_buffer[(*p_ix)++];
+	if (*p_ix >= p_end) {
+		return ESP_OK;
+	}
+	return parse_properties(p_buffer, p_ix, p_end, p_have, r_view);
+}
+
+/**
+ * Decode a received MQTT 3.1.1 packet in one pass; see mqtt_parse_packet_level().
+ */
+esp_err_t mqtt_parse_packet(const uint8_t *p_buffer, uint32_t p_length, PacketView_t *r_view) {
+	return mqtt_parse_packet_level(p_buffer, p_length, MQTT_PROTOCOL_LEVEL_311, r_view);
+}
+
+/**
+ * Decode a received packet in one pass.
+ *
+ * Walks the fixed header, the remaining length (1 to 4 bytes), the topic and packet id of a PUBLISH,
+ *  or the packet id of the acks, and fills in r_view with pointers into p_buffer.
+ * At p_level MQTT_PROTOCOL_LEVEL_5 it also walks the reason codes and property lists (left for the caller to read
+ *  with mqtt_property_next()), so Payload is what follows them.
+ * Every field is checked against the packet length and against p_length before it is read.
+ *
+ * p_buffer may hold only the start of the packet (the first part of a streamed PUBLISH);
+ *  the fields that are there are filled in and Payload_length counts the payload bytes present.
+ *
+ * @return ESP_OK,
+ *  ESP_ERR_INVALID_SIZE if p_length ends before the packet does (Payload is NULL if it ends before the payload),
+ *  ESP_ERR_INVALID_RESPONSE if the packet is malformed.
+ */
+esp_err_t mqtt_parse_packet_level(const uint8_t *p_buffer, uint32_t p_length, int p_level, PacketView_t *r_view) {
+	uint32_t l_remaining = 0;
+	uint32_t l_multiplier = 1;
+	uint32_t l_ix = 1;
+	uint32_t l_end, l_have;
+	esp_err_t l_err = ESP_OK;
+
+	memset(r_view, 0, sizeof(PacketView_t));
+	if (p_length < 2) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	r_view->Type = p_buffer[0] >> 4;
+	r_view->Flags = p_buffer[0] & 0x0f;
+	do {
+		if (l_ix > 4) {
+			return ESP_ERR_INVALID_RESPONSE;
+		}
+		if (l_ix >= p_length) {
+			return ESP_ERR_INVALID_SIZE;
 		}
+		l_remaining += (p_buffer[l_ix] & 0x7f) * l_multiplier;
+		l_multiplier *= 128;
+	} while (p_buffer[l_ix++] & 0x80);
+	l_end = l_ix + l_remaining;
+	l_have = l_end < p_length ? l_end : p_length;
+	r_view->Total_length = l_end;
+
+	switch (r_view->Type) {
+		case MQTT_MSG_TYPE_PUBLISH:
+			r_view->Qos = (r_view->Flags >> 1) & 3;
+			if (r_view->Qos == 3) {
+				return ESP_ERR_INVALID_RESPONSE;
+			}
+			if ((l_err = parse_field(l_ix, 2, l_end, l_have)) != ESP_OK) {
+				return l_err;
+			}
+			r_view->Topic_length = p_buffer[l_ix] << 8 | p_buffer[l_ix + 1];
+			l_ix += 2;
+			if ((l_err = parse_field(l_ix, r_view->Topic_length, l_end, l_have)) != ESP_OK) {
+				return l_err;
+			}
+			r_view->Topic = p_buffer + l_ix;
+			l_ix += r_view->Topic_length;
+			if (r_view->Qos > 0) {
+				if ((l_err = parse_field(l_ix, 2, l_end, l_have)) != ESP_OK) {
+					return l_err;
+				}
+				r_view->PacketId = p_buffer[l_ix] << 8 | p_buffer[l_ix + 1];
+				l_ix += 2;
+			}
+			if (p_level == MQTT_PROTOCOL_LEVEL_5) {
+				l_err = parse_properties(p_buffer, &l_ix, l_end, l_have, r_view);
+			}
+			break;
+		case MQTT_MSG_TYPE_CONNACK:
+			// Acknowledge flags, then the return (3.1.1) or reason (5) code
+			if ((l_err = parse_field(l_ix, 2, l_end, l_have)) != ESP_OK) {
+				return l_err;
+			}
+			r_view->ReasonCode = p_buffer[l_ix + 1];
+			l_ix += 2;
+			if (p_level == MQTT_PROTOCOL_LEVEL_5) {
+				l_err = parse_properties(p_buffer, &l_ix, l_end, l_have, r_view);
+			}
+			break;
+		case MQTT_MSG_TYPE_PUBACK:
+		case MQTT_MSG_TYPE_PUBREC:
+		case MQTT_MSG_TYPE_PUBREL:
+		case MQTT_MSG_TYPE_PUBCOMP:
+		case MQTT_MSG_TYPE_SUBSCRIBE:
+		case MQTT_MSG_TYPE_SUBACK:
+		case MQTT_MSG_TYPE_UNSUBSCRIBE:
+		case MQTT_MSG_TYPE_UNSUBACK:
+			if ((l_err = parse_field(l_ix, 2, l_end, l_have)) != ESP_OK) {
+				return l_err;
+			}
+			r_view->PacketId = p_buffer[l_ix] << 8 | p_buffer[l_ix + 1];
+			l_ix += 2;
+			if (p_level != MQTT_PROTOCOL_LEVEL_5) {
+				break;
+			}
+			if (r_view->Type <= MQTT_MSG_TYPE_PUBCOMP) {
+				l_err = parse_reason(p_buffer, &l_ix, l_end, l_have, r_view);
+			} else {
+				l_err = parse_properties(p_buffer, &l_ix, l_end, l_have, r_view);
+			}
+			break;
+		case MQTT_MSG_TYPE_DISCONNECT:
+			if (p_level == MQTT_PROTOCOL_LEVEL_5) {
+				l_err = parse_reason(p_buffer, &l_ix, l_end, l_have, r_view);
+			}
+			break;
+		default:
+			break;
 	}
-	totlen += i;
-	return totlen;
+	if (l_err != ESP_OK) {
+		return l_err;
+	}
+	if (l_ix > l_have) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	r_view->Payload = p_buffer + l_ix;
+	r_view->Payload_length = l_have - l_ix;
+	return l_have < l_end ? ESP_ERR_INVALID_SIZE : ESP_OK;
 }
 
 
 
 
+/*
+ * The older single field getters, kept for callers that want one field.
+ * Each is a full mqtt_parse_packet(); use that directly to get several fields.
+ */
+int mqtt_get_total_length(uint8_t* buffer, uint16_t length) {
+	PacketView_t l_view;
+	esp_err_t l_err = mqtt_parse_packet(buffer, length, &l_view);
+	if (l_err != ESP_OK && l_err != ESP_ERR_INVALID_SIZE) {
+		return 0;
+	}
+	return l_view.Total_length;
+}
+
 
 
 
@@ -205,133 +383,40 @@ int mqtt_get_total_length(uint8_t* buffer, uint16_t length) {
  * Extract the topic portion from the MQTT Packet
  */
 const uint8_t* mqtt_get_publish_topic(uint8_t* p_packet, uint16_t* p_length) {
-	int i;
-	int totlen = 0;
-	int topiclen;
-	ESP_LOGI(TAG, "200 Get_Publish_Topic - All");
-	for (i = 1; i < *p_length; ++i) {
-		totlen += (p_packet[i] & 0x7f) << (7 * (i - 1));
-		if ((p_packet[i] & 0x80) == 0) {
-			++i;
-			break;
-		}
-	}
-	totlen += i;
-	if (i + 2 >= *p_length) {
+	PacketView_t l_view;
+	if (mqtt_parse_packet(p_packet, *p_length, &l_view) != ESP_OK || l_view.Topic == NULL) {
 		return 0;
 	}
-	topiclen = p_packet[i++] << 8;
-	topiclen |= p_packet[i++];
-	if (i + topiclen > *p_length) {
-		return 0;
-	}
-	*p_length = topiclen;
-	return (const uint8_t*) (p_packet + i);
+	*p_length = l_view.Topic_length;
+	return l_view.Topic;
 }
 
 
 
 
-
-
 /*
  *
  */
 const uint8_t* mqtt_get_publish_data(uint8_t* buffer, uint16_t* length) {
-	int i;
-	int totlen = 0;
-	int topiclen;
-	int blength = *length;
+	PacketView_t l_view;
+	esp_err_t l_err = mqtt_parse_packet(buffer, *length, &l_view);
 	*length = 0;
-	ESP_LOGI(TAG, "235 Get_Publish_Data");
-	for (i = 1; i < blength; ++i) {
-		totlen += (buffer[i] & 0x7f) << (7 * (i - 1));
-		if ((buffer[i] & 0x80) == 0) {
-			++i;
-			break;
-		}
-	}
-	totlen += i;
-	if (i + 2 >= blength) {
-		return 0;
-	}
-	topiclen = buffer[i++] << 8;
-	topiclen |= buffer[i++];
-	if (i + topiclen >= blength) {
+	if (l_err != ESP_OK || l_view.Type != MQTT_MSG_TYPE_PUBLISH) {
 		return 0;
 	}
-	i += topiclen;
-	if (mqtt_get_qos(buffer) > 0) {
-		if (i + 2 >= blength) {
-			return 0;
-		}
-		i += 2;
-	}
-	if (totlen < i) {
-		return 0;
-	}
-	if (totlen <= blength) {
-		*length = totlen - i;
-	} else {
-		*length = blength - i;
-	}
-	return (const uint8_t*) (buffer + i);
+	*length = l_view.Payload_length;
+	return l_view.Payload;
 }
 
 
 
 
-
 uint16_t mqtt_get_id(uint8_t* buffer, uint16_t length) {
-	ESP_LOGI(TAG, "275 Get_Id - All");
-	if (length < 1) {
+	PacketView_t l_view;
+	if (mqtt_parse_packet(buffer, length, &l_view) != ESP_OK) {
 		return 0;
 	}
-	switch (mqtt_get_type(buffer)) {
-		case MQTT_MSG_TYPE_PUBLISH: {
-			int i;
-			int topiclen;
-			for (i = 1; i < length; ++i) {
-				if ((buffer[i] & 0x80) == 0) {
-					++i;
-					break;
-				}
-			}
-			if (i + 2 >= length) {
-				return 0;
-			}
-			topiclen = buffer[i++] << 8;
-			topiclen |= buffer[i++];
-			if (i + topiclen >= length) {
-				return 0;
-			}
-			i += topiclen;
-			if (mqtt_get_qos(buffer) > 0) {
-				if (i + 2 >= length)
-					return 0;
-				i += 2;
-			} else {
-				return 0;
-			}
-			return (buffer[i] << 8) | buffer[i + 1];
-		}
-		case MQTT_MSG_TYPE_PUBACK:
-		case MQTT_MSG_TYPE_PUBREC:
-		case MQTT_MSG_TYPE_PUBREL:
-		case MQTT_MSG_TYPE_PUBCOMP:
-		case MQTT_MSG_TYPE_SUBACK:
-		case MQTT_MSG_TYPE_UNSUBACK:
-		case MQTT_MSG_TYPE_SUBSCRIBE: {
-			// This requires the remaining length to be encoded in 1 byte, which it should be.
-			if (length >= 4 && (buffer[1] & 0x80) == 0) {
-				return (buffer[2] << 8) | buffer[3];
-			} else {
-				return 0;
-			}
-		}
-		default:
-			return 0;
-	}
+	return l_view.PacketId;
 }
 
 
@@ -384,7 +469,7 @@ esp_err_t mqtt_msg_connect(Client_t* p_client) {
 		l_variable_header->flags |= MQTT_CONNECT_FLAG_CLEAN_SESSION;
 	}
 
-	if (p_client->Broker->ClientId != 0 && p_client->Broker->ClientId[0] != '\0') {
+	if (p_client->Broker->ClientId[0] != '\0') {
 		if (append_string(p_client->Packet, p_client->Broker->ClientId, strlen(p_client->Broker->ClientId)) != ESP_OK) {
 			ESP_LOGE(TAG, "387 Msg_Connect - Failed - Wrong ID")
 			return fail_message(p_client->Packet);
@@ -411,7 +496,7 @@ esp_err_t mqtt_msg_connect(Client_t* p_client) {
 		l_variable_header->flags |= (p_client->Will->WillQos & 3) << 3;
 	}
 
-	if (p_client->Broker->Username != 0 && p_client->Broker->Username[0] != '\0') {
+	if (p_client->Broker->Username[0] != '\0') {
 		if (append_string(p_client->Packet, p_client->Broker->Username, strlen(p_client->Broker->Username)) < 0) {
 			ESP_LOGE(TAG, "414 Msg_Connect - Failed - Username")
 			return fail_message(p_client->Packet);
@@ -419,7 +504,7 @@ esp_err_t mqtt_msg_connect(Client_t* p_client) {
 		l_variable_header->flags |= MQTT_CONNECT_FLAG_USERNAME;
 	}
 
-	if (p_client->Broker->Password != 0 && p_client->Broker->Password[0] != '\0') {
+	if (p_client->Broker->Password[0] != '\0') {
 		if (append_string(p_client->Packet, p_client->Broker->Password, strlen(p_client->Broker->Password)) < 0) {
 			ESP_LOGE(TAG, "422 Msg_Connect - Failed - Password")
 			return fail_message(p_client->Packet);
@@ -0,0 +1,649 @@
+/*
+ * mqtt_outbox.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * The outbox is where packets wait for the sending task.
+ *
+ * Several application tasks may publish at once, so each producer task gets its own SPSC lane
+ *  and never has to take a lock.
+ * The sending task drains the lanes round robin, one whole packet at a time, so packets from
+ *  different tasks can never be interleaved.
+ *
+ * Control packets (PINGREQ, the publish acks, DISCONNECT) go through a separate high priority queue.
+ * The sending task empties it before every packet it takes from a lane, so a keepalive or ack
+ *  waits for at most the one packet already on its way out, however deep the publish backlog is.
+ *
+ * When a lane is full the admission policy decides what gives - see OutboxPolicy_t.
+ * Fresh publishes may also carry an expiry tick; the sending task throws stale ones away unsent.
+ * Only they are expendable: a resend the broker may already hold, or a SUBSCRIBE whose SUBACK is awaited,
+ *  is never expired or dropped.
+ *
+ * With coalescing on, a small topic hash index points at the newest unsent QoS 0 publish for each topic.
+ * A new publish to that topic marks the old record superseded and the sending task skips it.
+ *
+ * |======================================================|
+ * | Lane ring  | Record | Packet ... | pad | Record | ... |
+ * |======================================================|
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+
+#include "esp_log.h"
+
+#include "mqtt_outbox.h"
+#include "mqtt_transport.h"
+#include "mqtt_text.h"
+
+static const char *TAG = "MqttOutbox    ";
+
+#define OUTBOX_SHARED_LANE	(CONFIG_MQTT_OUTBOX_LANES - 1)
+
+/*
+ * Ring space taken by a record and its packet.
+ */
+static inline uint32_t outbox_record_size(uint32_t p_length) {
+	return (sizeof(OutboxRecord_t) + p_length + 3) & ~3;
+}
+
+/*
+ * Find the calling task's lane, claiming a free one the first time.
+ * Lanes given back by mqtt_outbox_release_lane() leave gaps, so the task's own lane is looked for everywhere
+ *  before a free one is claimed.
+ */
+static OutboxLane_t *outbox_lane(Outbox_t *p_outbox) {
+	TaskHandle_t l_self = xTaskGetCurrentTaskHandle();
+	TaskHandle_t l_owner;
+	int l_ix;
+	for (l_ix = 0; l_ix < OUTBOX_SHARED_LANE; l_ix++) {
+		if (__atomic_load_n(&p_outbox->Lanes[l_ix].Owner, __ATOMIC_ACQUIRE) == l_self) {
+			return &p_outbox->Lanes[l_ix];
+		}
+	}
+	for (l_ix = 0; l_ix < OUTBOX_SHARED_LANE; l_ix++) {
+		l_owner = __atomic_load_n(&p_outbox->Lanes[l_ix].Owner, __ATOMIC_ACQUIRE);
+		if (l_owner == NULL && __atomic_compare_exchange_n(&p_outbox->Lanes[l_ix].Owner, &l_owner, l_self,
+				0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			ESP_LOGI(TAG, "Lane - Task:%p claimed lane %d", l_self, l_ix);
+			return &p_outbox->Lanes[l_ix];
+		}
+	}
+	return &p_outbox->Lanes[OUTBOX_SHARED_LANE];
+}
+
+/*
+ * Find the topic of a QoS 0 PUBLISH packet.
+ * @return the topic length, or -1 if this is not a packet that may be coalesced.
+ */
+static int outbox_topic(const uint8_t *p_packet, uint32_t p_length, const uint8_t **r_topic) {
+	uint32_t l_ix = 1;
+	int l_len;
+	if ((p_packet[0] & 0xf6) != 0x30) {
+		return -1;
+	}
+	while (l_ix < p_length && (p_packet[l_ix] & 0x80)) {
+		l_ix++;
+	}
+	l_ix++;
+	if (l_ix + 2 > p_length) {
+		return -1;
+	}
+	l_len = p_packet[l_ix] << 8 | p_packet[l_ix + 1];
+	if (l_ix + 2 + l_len > p_length) {
+		return -1;
+	}
+	*r_topic = &p_packet[l_ix + 2];
+	return l_len;
+}
+
+/*
+ * FNV-1a, never 0 so 0 can mean "not indexed".
+ */
+static uint32_t outbox_hash(const uint8_t *p_topic, int p_len) {
+	uint32_t l_hash = mqtt_text_hash(p_topic, p_len);
+	return l_hash ? l_hash : 1;
+}
+
+/*
+ * Probe the index for p_topic.
+ * Call with IndexLock held.
+ * @return the slot holding the topic, else the empty slot where it would go, else -1 if the index is full.
+ */
+static int outbox_index_probe(Outbox_t *p_outbox, uint32_t p_hash, const uint8_t *p_topic, int p_len) {
+	OutboxTopicSlot_t *l_slot;
+	const uint8_t *l_topic;
+	uint32_t l_ix = p_hash;
+	int l_tries;
+	for (l_tries = 0; l_tries < CONFIG_MQTT_OUTBOX_COALESCE_SLOTS; l_tries++, l_ix++) {
+		l_slot = &p_outbox->Index[l_ix & (CONFIG_MQTT_OUTBOX_COALESCE_SLOTS - 1)];
+		if (l_slot->Record == NULL) {
+			return l_ix & (CONFIG_MQTT_OUTBOX_COALESCE_SLOTS - 1);
+		}
+		if (l_slot->Hash == p_hash
+				&& outbox_topic((uint8_t *) (l_slot->Record + 1), l_slot->Record->Length, &l_topic) == p_len
+				&& memcmp(l_topic, p_topic, p_len) == 0) {
+			return l_ix & (CONFIG_MQTT_OUTBOX_COALESCE_SLOTS - 1);
+		}
+	}
+	return -1;
+}
+
+/*
+ * Empty slot p_ix, shifting later entries of the probe run back so no lookup stops short.
+ * Call with IndexLock held.
+ */
+static void outbox_index_remove(Outbox_t *p_outbox, uint32_t p_ix) {
+	const uint32_t l_mask = CONFIG_MQTT_OUTBOX_COALESCE_SLOTS - 1;
+	uint32_t l_next = p_ix, l_home;
+	while (1) {
+		p_outbox->Index[p_ix].Record = NULL;
+		do {
+			l_next = (l_next + 1) & l_mask;
+			if (p_outbox->Index[l_next].Record == NULL) {
+				return;
+			}
+			l_home = p_outbox->Index[l_next].Hash & l_mask;
+		} while (((l_next - l_home) & l_mask) < ((l_next - p_ix) & l_mask));
+		p_outbox->Index[p_ix] = p_outbox->Index[l_next];
+		p_ix = l_next;
+	}
+}
+
+/*
+ * A record is leaving its lane; take it out of the index if it is still there.
+ * @return non zero if a newer publish superseded it, so it should not be sent.
+ */
+static int outbox_unindex(Outbox_t *p_outbox, OutboxRecord_t *p_record) {
+	const uint32_t l_mask = CONFIG_MQTT_OUTBOX_COALESCE_SLOTS - 1;
+	uint32_t l_ix;
+	int l_superseded, l_tries;
+	if (p_record->TopicHash == 0) {
+		return 0;
+	}
+	xSemaphoreTake(p_outbox->IndexLock, portMAX_DELAY);
+	l_superseded = p_record->Flags & OUTBOX_RECORD_SUPERSEDED;
+	l_ix = p_record->TopicHash;
+	for (l_tries = 0; !l_superseded && l_tries < CONFIG_MQTT_OUTBOX_COALESCE_SLOTS; l_tries++, l_ix++) {
+		if (p_outbox->Index[l_ix & l_mask].Record == p_record) {
+			outbox_index_remove(p_outbox, l_ix & l_mask);
+			break;
+		}
+		if (p_outbox->Index[l_ix & l_mask].Record == NULL) {
+			break;
+		}
+	}
+	p_record->TopicHash = 0;
+	xSemaphoreGive(p_outbox->IndexLock);
+	return l_superseded;
+}
+
+/*
+ * Before a QoS 0 publish becomes visible, supersede any unsent publish to the same topic
+ *  and index this one in its place.
+ */
+static void outbox_coalesce(Outbox_t *p_outbox, OutboxRecord_t *p_record) {
+	const uint8_t *l_topic;
+	uint32_t l_hash;
+	int l_len, l_ix;
+	l_len = outbox_topic((uint8_t *) (p_record + 1), p_record->Length, &l_topic);
+	if (l_len < 0) {
+		return;
+	}
+	l_hash = outbox_hash(l_topic, l_len);
+	xSemaphoreTake(p_outbox->IndexLock, portMAX_DELAY);
+	l_ix = outbox_index_probe(p_outbox, l_hash, l_topic, l_len);
+	if (l_ix >= 0) {
+		if (p_outbox->Index[l_ix].Record != NULL) {
+			p_outbox->Index[l_ix].Record->Flags |= OUTBOX_RECORD_SUPERSEDED;
+			__atomic_add_fetch(&p_outbox->Stats.Coalesced, 1, __ATOMIC_RELAXED);
+		}
+		p_outbox->Index[l_ix].Hash = l_hash;
+		p_outbox->Index[l_ix].Record = p_record;
+		p_record->TopicHash = l_hash;
+	}
+	xSemaphoreGive(p_outbox->IndexLock);
+}
+
+/*
+ * Take the lane's oldest packet off the ring without sending it.
+ * Only the consumer, or a producer holding ConsumerLock, may do this.
+ */
+static void outbox_discard(OutboxLane_t *p_lane) {
+	OutboxRecord_t *l_record;
+	rb_peek(&p_lane->Rb, (uint8_t **) &l_record, 0);
+	rb_consume(&p_lane->Rb, outbox_record_size(l_record->Length));
+}
+
+/*
+ * Throw the lane's oldest packet away unsent, telling OnDrop first.
+ * The same rules as outbox_discard() apply.
+ */
+static void outbox_drop(Outbox_t *p_outbox, OutboxLane_t *p_lane) {
+	OutboxRecord_t *l_record;
+	if (p_outbox->OnDrop != NULL) {
+		rb_peek(&p_lane->Rb, (uint8_t **) &l_record, 0);
+		p_outbox->OnDrop(p_outbox->OnDropArg, (uint8_t *) (l_record + 1), l_record->Length);
+	}
+	outbox_discard(p_lane);
+}
+
+/*
+ * DROP_OLDEST - throw away the lane's oldest publishes until p_size bytes fit.
+ * Stops at a packet that is not expendable, or that the sending task is writing out (pinned);
+ *  the ring can only give up space from its head.
+ * While we hold ConsumerLock the sending task is not part way through any other lane packet,
+ *  so we can stand in for it as the lane's reader.
+ */
+static OutboxRecord_t *outbox_make_room(Outbox_t *p_outbox, OutboxLane_t *p_lane, uint32_t p_size) {
+	OutboxRecord_t *l_record = NULL;
+	if (xSemaphoreTake(p_outbox->ConsumerLock, p_outbox->BlockTicks) != pdTRUE) {
+		return NULL;
+	}
+	while ((l_record = (OutboxRecord_t *) rb_reserve(&p_lane->Rb, p_size, 0)) == NULL && rb_fill(&p_lane->Rb) > 0) {
+		rb_peek(&p_lane->Rb, (uint8_t **) &l_record, 0);
+		if ((l_record->Flags & (OUTBOX_RECORD_EXPENDABLE | OUTBOX_RECORD_PINNED)) != OUTBOX_RECORD_EXPENDABLE) {
+			l_record = NULL;
+			break;
+		}
+		outbox_unindex(p_outbox, l_record);
+		outbox_drop(p_outbox, p_lane);
+		__atomic_add_fetch(&p_outbox->Stats.Dropped, 1, __ATOMIC_RELAXED);
+	}
+	xSemaphoreGive(p_outbox->ConsumerLock);
+	return l_record;
+}
+
+/*
+ * Wake the consumer: by task notification, and through WakeSocket if it sleeps in select().
+ * Only the first commit after the consumer drained WakeSocket writes to it, so a burst costs one datagram.
+ */
+static void outbox_notify(Outbox_t *p_outbox) {
+	TaskHandle_t l_consumer = __atomic_load_n(&p_outbox->Consumer, __ATOMIC_ACQUIRE);
+	int l_wake = __atomic_load_n(&p_outbox->WakeSocket, __ATOMIC_ACQUIRE);
+	if (l_consumer) {
+		xTaskNotifyGive(l_consumer);
+	}
+	if (l_wake >= 0 && __atomic_exchange_n(&p_outbox->WakePending, 1, __ATOMIC_ACQ_REL) == 0) {
+		mqtt_transport_wakeup(l_wake);
+	}
+}
+
+
+
+/**
+ * Allocate every lane with p_lane_size bytes (a multiple of 4).
+ */
+esp_err_t mqtt_outbox_init(Outbox_t *p_outbox, int32_t p_lane_size) {
+	int l_ix;
+	memset(p_outbox, 0, sizeof(Outbox_t));
+	p_outbox->WakeSocket = -1;
+	p_lane_size &= ~3;
+	for (l_ix = 0; l_ix < CONFIG_MQTT_OUTBOX_LANES; l_ix++) {
+		p_outbox->Lanes[l_ix].Buffer = malloc(p_lane_size);
+		if (p_outbox->Lanes[l_ix].Buffer == NULL || rb_init(&p_outbox->Lanes[l_ix].Rb, p_outbox->Lanes[l_ix].Buffer, p_lane_size, 1) != ESP_OK) {
+			ESP_LOGE(TAG, "Init - Not Enough Memory for lane %d", l_ix);
+			mqtt_outbox_deinit(p_outbox);
+			return ESP_ERR_NO_MEM;
+		}
+	}
+	p_outbox->Lanes[OUTBOX_SHARED_LANE].Lock = xSemaphoreCreateMutex();
+	p_outbox->Control = xQueueCreate(CONFIG_MQTT_CONTROL_QUEUE_LENGTH, sizeof(ControlPacket_t));
+	p_outbox->ConsumerLock = xSemaphoreCreateMutex();
+	p_outbox->IndexLock = xSemaphoreCreateMutex();
+	if (p_outbox->Lanes[OUTBOX_SHARED_LANE].Lock == NULL || p_outbox->Control == NULL || p_outbox->ConsumerLock == NULL
+			|| p_outbox->IndexLock == NULL) {
+		mqtt_outbox_deinit(p_outbox);
+		return ESP_ERR_NO_MEM;
+	}
+#if defined(CONFIG_MQTT_OUTBOX_POLICY_DROP_OLDEST)
+	mqtt_outbox_set_policy(p_outbox, OUTBOX_POLICY_DROP_OLDEST, CONFIG_MQTT_OUTBOX_BLOCK_MS, CONFIG_MQTT_OUTBOX_TTL_MS);
+#elif defined(CONFIG_MQTT_OUTBOX_POLICY_REJECT_NEWEST)
+	mqtt_outbox_set_policy(p_outbox, OUTBOX_POLICY_REJECT_NEWEST, CONFIG_MQTT_OUTBOX_BLOCK_MS, CONFIG_MQTT_OUTBOX_TTL_MS);
+#else
+	mqtt_outbox_set_policy(p_outbox, OUTBOX_POLICY_BLOCK, CONFIG_MQTT_OUTBOX_BLOCK_MS, CONFIG_MQTT_OUTBOX_TTL_MS);
+#endif
+#ifdef CONFIG_MQTT_OUTBOX_COALESCE
+	p_outbox->Coalesce = 1;
+#endif
+	ESP_LOGI(TAG, "Init - %d lanes of %d bytes", CONFIG_MQTT_OUTBOX_LANES, p_lane_size);
+	return ESP_OK;
+}
+
+void mqtt_outbox_deinit(Outbox_t *p_outbox) {
+	int l_ix;
+	for (l_ix = 0; l_ix < CONFIG_MQTT_OUTBOX_LANES; l_ix++) {
+		rb_deinit(&p_outbox->Lanes[l_ix].Rb);
+		free(p_outbox->Lanes[l_ix].Buffer);
+		p_outbox->Lanes[l_ix].Buffer = NULL;
+		if (p_outbox->Lanes[l_ix].Lock) {
+			vSemaphoreDelete(p_outbox->Lanes[l_ix].Lock);
+			p_outbox->Lanes[l_ix].Lock = NULL;
+		}
+	}
+	if (p_outbox->Control) {
+		vQueueDelete(p_outbox->Control);
+		p_outbox->Control = NULL;
+	}
+	if (p_outbox->ConsumerLock) {
+		vSemaphoreDelete(p_outbox->ConsumerLock);
+		p_outbox->ConsumerLock = NULL;
+	}
+	if (p_outbox->IndexLock) {
+		vSemaphoreDelete(p_outbox->IndexLock);
+		p_outbox->IndexLock = NULL;
+	}
+}
+
+/**
+ * Choose what happens when a lane is full, and how long publishes stay worth sending.
+ * Set this before any task publishes.
+ *
+ * @param p_block_ms is how long OUTBOX_POLICY_BLOCK waits for room (and DROP_OLDEST for the sending task).
+ * @param p_ttl_ms is the age at which a queued publish is thrown away unsent; 0 for never.
+ */
+void mqtt_outbox_set_policy(Outbox_t *p_outbox, OutboxPolicy_t p_policy, uint32_t p_block_ms, uint32_t p_ttl_ms) {
+	p_outbox->Policy = p_policy;
+	p_outbox->BlockTicks = p_block_ms / portTICK_RATE_MS;
+	p_outbox->TtlTicks = p_ttl_ms / portTICK_RATE_MS;
+	if (p_ttl_ms > 0 && p_outbox->TtlTicks == 0) {
+		p_outbox->TtlTicks = 1;
+	}
+}
+
+/**
+ * Turn per topic coalescing of QoS 0 publishes on or off.
+ * Set this before any task publishes.
+ */
+void mqtt_outbox_set_coalesce(Outbox_t *p_outbox, uint32_t p_on) {
+	p_outbox->Coalesce = p_on;
+}
+
+/**
+ * Have p_fn told of every packet thrown away unsent, say to give up on its packet id.
+ * It may be called by a producer under DROP_OLDEST as well as by the consumer.
+ * Set this before any task publishes.
+ */
+void mqtt_outbox_set_drop(Outbox_t *p_outbox, outbox_drop_fn p_fn, void *p_arg) {
+	p_outbox->OnDrop = p_fn;
+	p_outbox->OnDropArg = p_arg;
+}
+
+/**
+ * Copy out the admission counters.
+ */
+void mqtt_outbox_get_stats(Outbox_t *p_outbox, OutboxStats_t *r_stats) {
+	r_stats->Accepted = __atomic_load_n(&p_outbox->Stats.Accepted, __ATOMIC_RELAXED);
+	r_stats->Rejected = __atomic_load_n(&p_outbox->Stats.Rejected, __ATOMIC_RELAXED);
+	r_stats->Dropped = __atomic_load_n(&p_outbox->Stats.Dropped, __ATOMIC_RELAXED);
+	r_stats->Expired = __atomic_load_n(&p_outbox->Stats.Expired, __ATOMIC_RELAXED);
+	r_stats->Coalesced = __atomic_load_n(&p_outbox->Stats.Coalesced, __ATOMIC_RELAXED);
+}
+
+
+
+/**
+ * Reserve room for a p_length byte packet in the calling task's lane, as the admission policy allows.
+ * p_flags is OUTBOX_RECORD_EXPENDABLE for a fresh publish, which may expire or be dropped for a newer one, else 0;
+ *  add OUTBOX_RESERVE_NOW to never wait, for the lane's lock or for room.
+ * On success p_packet->PacketBuffer is where the packet goes; the caller builds it in place and then calls mqtt_outbox_commit().
+ * On the shared lane the lock is held from here until the commit, so nothing may fail in between.
+ *
+ * @return ESP_OK,
+ *  ESP_ERR_TIMEOUT if the lane stayed full past the deadline (BLOCK, or DROP_OLDEST behind a stuck sending task),
+ *  ESP_ERR_NO_MEM if the lane is full (REJECT_NEWEST),
+ *  ESP_ERR_INVALID_SIZE if the packet could never fit in a lane.
+ */
+esp_err_t mqtt_outbox_reserve(Outbox_t *p_outbox, PacketInfo_t *p_packet, uint32_t p_length, uint32_t p_flags) {
+	OutboxLane_t *l_lane = outbox_lane(p_outbox);
+	OutboxRecord_t *l_record;
+	uint32_t l_size = outbox_record_size(p_length);
+	TickType_t l_lock_wait = (p_flags & OUTBOX_RESERVE_NOW) ? 0 : p_outbox->BlockTicks;
+	TickType_t l_wait = p_outbox->Policy == OUTBOX_POLICY_BLOCK ? l_lock_wait : 0;
+	if (l_size > l_lane->Rb.size / 2 || p_length > 0xffff) {
+		ESP_LOGE(TAG, "Reserve - %d byte packet is too big for a lane", p_length);
+		__atomic_add_fetch(&p_outbox->Stats.Rejected, 1, __ATOMIC_RELAXED);
+		return ESP_ERR_INVALID_SIZE;
+	}
+	if (l_lane->Lock && xSemaphoreTake(l_lane->Lock, l_lock_wait) != pdTRUE) {
+		__atomic_add_fetch(&p_outbox->Stats.Rejected, 1, __ATOMIC_RELAXED);
+		return ESP_ERR_TIMEOUT;
+	}
+	l_record = (OutboxRecord_t *) rb_reserve(&l_lane->Rb, l_size, l_wait);
+	if (l_record == NULL && p_outbox->Policy == OUTBOX_POLICY_DROP_OLDEST) {
+		l_record = outbox_make_room(p_outbox, l_lane, l_size);
+	}
+	if (l_record == NULL) {
+		if (l_lane->Lock) {
+			xSemaphoreGive(l_lane->Lock);
+		}
+		__atomic_add_fetch(&p_outbox->Stats.Rejected, 1, __ATOMIC_RELAXED);
+		return p_outbox->Policy == OUTBOX_POLICY_REJECT_NEWEST ? ESP_ERR_NO_MEM : ESP_ERR_TIMEOUT;
+	}
+	l_record->Length = p_length;
+	l_record->Flags = p_flags & OUTBOX_RECORD_EXPENDABLE;
+	l_record->TopicHash = 0;
+	if (p_outbox->TtlTicks && (p_flags & OUTBOX_RECORD_EXPENDABLE)) {
+		l_record->Flags |= OUTBOX_RECORD_TTL;
+		l_record->Expires = xTaskGetTickCount() + p_outbox->TtlTicks;
+	}
+	p_packet->Lane = l_lane;
+	p_packet->PacketBuffer = (uint8_t *) (l_record + 1);
+	p_packet->PacketBuffer_length = p_length;
+	p_packet->Packet_length = p_length;
+	return ESP_OK;
+}
+
+/**
+ * Make the packet visible to the sending task and wake it.
+ */
+void mqtt_outbox_commit(Outbox_t *p_outbox, PacketInfo_t *p_packet) {
+	OutboxLane_t *l_lane = p_packet->Lane;
+	if (p_outbox->Coalesce) {
+		outbox_coalesce(p_outbox, (OutboxRecord_t *) p_packet->PacketBuffer - 1);
+	}
+	rb_commit(&l_lane->Rb, outbox_record_size(p_packet->Packet_length));
+	p_packet->Lane = NULL;
+	__atomic_add_fetch(&p_outbox->Stats.Accepted, 1, __ATOMIC_RELAXED);
+	if (l_lane->Lock) {
+		xSemaphoreGive(l_lane->Lock);
+	}
+	outbox_notify(p_outbox);
+}
+
+/**
+ * The calling task will publish no more (it is about to exit): give its lane up for the next task to claim.
+ * Whatever it queued is still sent, in order; the next owner's packets follow.
+ * Without this a task that published once holds its lane for good, and once the private lanes are all taken
+ *  every other producer has to share the last one behind its lock.
+ */
+void mqtt_outbox_release_lane(Outbox_t *p_outbox) {
+	TaskHandle_t l_self = xTaskGetCurrentTaskHandle();
+	int l_ix;
+	for (l_ix = 0; l_ix < OUTBOX_SHARED_LANE; l_ix++) {
+		if (__atomic_load_n(&p_outbox->Lanes[l_ix].Owner, __ATOMIC_ACQUIRE) == l_self) {
+			__atomic_store_n(&p_outbox->Lanes[l_ix].Owner, NULL, __ATOMIC_RELEASE);
+			ESP_LOGI(TAG, "Lane - Task:%p released lane %d", l_self, l_ix);
+			return;
+		}
+	}
+}
+
+/**
+ * Queue a whole control packet (at most MQTT_CONTROL_PACKET_MAX bytes) on the high priority lane.
+ * The packet is copied once, into the queue; build it from one of the pre-encoded templates (mqtt_packet.c).
+ * Any task may call this, including the sending task itself with p_wait of 0.
+ */
+esp_err_t mqtt_outbox_control(Outbox_t *p_outbox, const ControlPacket_t *p_packet, TickType_t p_wait) {
+	if (p_packet->Length == 0 || p_packet->Length > MQTT_CONTROL_PACKET_MAX) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	if (xQueueSend(p_outbox->Control, p_packet, p_wait) != pdTRUE) {
+		ESP_LOGE(TAG, "Control - Queue full, dropped type %d", p_packet->Data[0] >> 4);
+		return ESP_ERR_TIMEOUT;
+	}
+	outbox_notify(p_outbox);
+	return ESP_OK;
+}
+
+/**
+ * How many more control packets the high priority lane will take right now.
+ */
+uint32_t mqtt_outbox_control_room(Outbox_t *p_outbox) {
+	return uxQueueSpacesAvailable(p_outbox->Control);
+}
+
+/**
+ * Is the calling task the consumer? It must not wait for room in the outbox: nobody else will make any.
+ */
+int mqtt_outbox_is_consumer(Outbox_t *p_outbox) {
+	return __atomic_load_n(&p_outbox->Consumer, __ATOMIC_ACQUIRE) == xTaskGetCurrentTaskHandle();
+}
+
+
+
+/**
+ * Set (or clear, with NULL) the task that is woken by commits.
+ */
+void mqtt_outbox_set_consumer(Outbox_t *p_outbox, TaskHandle_t p_task) {
+	__atomic_store_n(&p_outbox->Consumer, p_task, __ATOMIC_RELEASE);
+}
+
+/**
+ * Have commits also write to p_socket (-1 for none), for a consumer that waits in select() rather than on its notification.
+ */
+void mqtt_outbox_set_wakeup(Outbox_t *p_outbox, int p_socket) {
+	__atomic_store_n(&p_outbox->WakePending, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&p_outbox->WakeSocket, p_socket, __ATOMIC_RELEASE);
+}
+
+/**
+ * The consumer has drained the wakeup socket and is about to peek: the next commit must write to it again.
+ * Anything committed before this is found by that peek.
+ */
+void mqtt_outbox_rearm_wakeup(Outbox_t *p_outbox) {
+	__atomic_store_n(&p_outbox->WakePending, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Block the consumer for up to p_wait ticks until something is committed.
+ * @return non zero if there may be packets waiting.
+ */
+uint32_t mqtt_outbox_wait(Outbox_t *p_outbox, TickType_t p_wait) {
+	return ulTaskNotifyTake(pdTRUE, p_wait);
+}
+
+/**
+ * Look at the next packet - any control packet first, then the lanes in turn.
+ * The packet stays where it is until mqtt_outbox_consume(); peeking again before that returns the same packet.
+ * Expired and superseded publishes are thrown away here rather than handed out.
+ *
+ * @return the packet length, or 0 if every lane is empty.
+ */
+int32_t mqtt_outbox_peek(Outbox_t *p_outbox, uint8_t **r_packet) {
+	OutboxRecord_t *l_record;
+	OutboxLane_t *l_lane;
+	TickType_t l_now = xTaskGetTickCount();
+	int l_tries;
+	// A packet already peeked (perhaps partly written) always finishes first
+	if (p_outbox->Current != NULL) {
+		rb_peek(&p_outbox->Current->Rb, (uint8_t **) &l_record, 0);
+		*r_packet = (uint8_t *) (l_record + 1);
+		return l_record->Length;
+	}
+	if (p_outbox->ControlCurrent.Length > 0 || xQueueReceive(p_outbox->Control, &p_outbox->ControlCurrent, 0) == pdTRUE) {
+		*r_packet = p_outbox->ControlCurrent.Data;
+		return p_outbox->ControlCurrent.Length;
+	}
+	// Held until the packet is consumed, so DROP_OLDEST can never take it from under us
+	xSemaphoreTake(p_outbox->ConsumerLock, portMAX_DELAY);
+	for (l_tries = 0; l_tries < CONFIG_MQTT_OUTBOX_LANES; l_tries++) {
+		l_lane = &p_outbox->Lanes[p_outbox->NextLane];
+		p_outbox->NextLane = (p_outbox->NextLane + 1) % CONFIG_MQTT_OUTBOX_LANES;
+		while (rb_peek(&l_lane->Rb, (uint8_t **) &l_record, 0) > 0) {
+			if (outbox_unindex(p_outbox, l_record)) {
+				outbox_drop(p_outbox, l_lane);
+				continue;
+			}
+			if ((l_record->Flags & OUTBOX_RECORD_TTL) && (int32_t) (l_now - l_record->Expires) > 0) {
+				outbox_drop(p_outbox, l_lane);
+				__atomic_add_fetch(&p_outbox->Stats.Expired, 1, __ATOMIC_RELAXED);
+				continue;
+			}
+			p_outbox->Current = l_lane;
+			*r_packet = (uint8_t *) (l_record + 1);
+			return l_record->Length;
+		}
+	}
+	xSemaphoreGive(p_outbox->ConsumerLock);
+	p_outbox->Current = NULL;
+	return 0;
+}
+
+/**
+ * The consumer is about to block on the socket with a lane packet peeked: let producers have ConsumerLock meanwhile,
+ *  so DROP_OLDEST can still make room while the link stalls.
+ * The packet stays peeked and DROP_OLDEST will not touch it; mqtt_outbox_consume() or mqtt_outbox_release() unpins it.
+ */
+void mqtt_outbox_pin(Outbox_t *p_outbox) {
+	OutboxRecord_t *l_record;
+	if (p_outbox->Current == NULL || p_outbox->Pinned) {
+		return;
+	}
+	rb_peek(&p_outbox->Current->Rb, (uint8_t **) &l_record, 0);
+	l_record->Flags |= OUTBOX_RECORD_PINNED;
+	p_outbox->Pinned = 1;
+	xSemaphoreGive(p_outbox->ConsumerLock);
+}
+
+/*
+ * Get ConsumerLock back for a pinned packet and unpin it.
+ */
+static void outbox_unpin(Outbox_t *p_outbox) {
+	OutboxRecord_t *l_record;
+	if (!p_outbox->Pinned) {
+		return;
+	}
+	xSemaphoreTake(p_outbox->ConsumerLock, portMAX_DELAY);
+	rb_peek(&p_outbox->Current->Rb, (uint8_t **) &l_record, 0);
+	l_record->Flags &= ~OUTBOX_RECORD_PINNED;
+	p_outbox->Pinned = 0;
+}
+
+/**
+ * Drop the packet last returned by mqtt_outbox_peek().
+ */
+void mqtt_outbox_consume(Outbox_t *p_outbox) {
+	if (p_outbox->Current == NULL) {
+		p_outbox->ControlCurrent.Length = 0;
+		return;
+	}
+	outbox_unpin(p_outbox);
+	outbox_discard(p_outbox->Current);
+	p_outbox->Current = NULL;
+	xSemaphoreGive(p_outbox->ConsumerLock);
+}
+
+/**
+ * The consumer is going away (the connection is lost): let go of whatever it has peeked, unsent.
+ * A publish stays at the head of its lane for whichever task consumes next, to send whole on the new connection;
+ *  a control packet belonged to the old connection and is dropped.
+ * Must be called by the task that peeked, since that task holds ConsumerLock (or has the packet pinned).
+ */
+void mqtt_outbox_release(Outbox_t *p_outbox) {
+	p_outbox->ControlCurrent.Length = 0;
+	if (p_outbox->Current == NULL) {
+		return;
+	}
+	outbox_unpin(p_outbox);
+	p_outbox->Current = NULL;
+	xSemaphoreGive(p_outbox->ConsumerLock);
+}
+
+// ### END DBK
@@ -0,0 +1,46 @@
+/*
+ * mqtt_outbox.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#ifndef COMPONENTS_MQTT_MQTT_OUTBOX_H_
+#define COMPONENTS_MQTT_MQTT_OUTBOX_H_
+
+#include "mqtt_structs.h"
+
+/*
+ * Not a record flag: have mqtt_outbox_reserve() fail at once rather than wait.
+ * For the consumer, which would only be waiting on itself; it sends (mqtt_send_ready) and tries again.
+ */
+#define OUTBOX_RESERVE_NOW			0x10000
+
+esp_err_t mqtt_outbox_init(Outbox_t *p_outbox, int32_t p_lane_size);
+void mqtt_outbox_deinit(Outbox_t *p_outbox);
+void mqtt_outbox_set_policy(Outbox_t *p_outbox, OutboxPolicy_t p_policy, uint32_t p_block_ms, uint32_t p_ttl_ms);
+void mqtt_outbox_set_coalesce(Outbox_t *p_outbox, uint32_t p_on);
+void mqtt_outbox_set_drop(Outbox_t *p_outbox, outbox_drop_fn p_fn, void *p_arg);
+void mqtt_outbox_get_stats(Outbox_t *p_outbox, OutboxStats_t *r_stats);
+
+// Producer side - any task
+esp_err_t mqtt_outbox_reserve(Outbox_t *p_outbox, PacketInfo_t *p_packet, uint32_t p_length, uint32_t p_flags);
+void mqtt_outbox_commit(Outbox_t *p_outbox, PacketInfo_t *p_packet);
+void mqtt_outbox_release_lane(Outbox_t *p_outbox);
+esp_err_t mqtt_outbox_control(Outbox_t *p_outbox, const ControlPacket_t *p_packet, TickType_t p_wait);
+uint32_t mqtt_outbox_control_room(Outbox_t *p_outbox);
+int mqtt_outbox_is_consumer(Outbox_t *p_outbox);
+
+// Consumer side - the sending task only
+void mqtt_outbox_set_consumer(Outbox_t *p_outbox, TaskHandle_t p_task);
+void mqtt_outbox_set_wakeup(Outbox_t *p_outbox, int p_socket);
+void mqtt_outbox_rearm_wakeup(Outbox_t *p_outbox);
+uint32_t mqtt_outbox_wait(Outbox_t *p_outbox, TickType_t p_wait);
+int32_t mqtt_outbox_peek(Outbox_t *p_outbox, uint8_t **r_packet);
+void mqtt_outbox_pin(Outbox_t *p_outbox);
+void mqtt_outbox_consume(Outbox_t *p_outbox);
+void mqtt_outbox_release(Outbox_t *p_outbox);
+
+#endif /* COMPONENTS_MQTT_MQTT_OUTBOX_H_ */
+
+// ### END DBK
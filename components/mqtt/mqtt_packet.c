@@ -26,6 +26,9 @@
 
 #include "mqtt.h"
 #include "mqtt_packet.h"
+#include "mqtt_outbox.h"
+#include "mqtt_inflight.h"
+#include "mqtt_property.h"
 #include "mqtt_debug.h"
 
 
@@ -39,68 +42,145 @@ enum mqtt_connect_flag {
 	MQTT_CONNECT_FLAG_CLEAN_SESSION = 1 << 1
 };
 
-/**
- * Encode a utf-8 string and append it to the Payload.
- * |===============================================================|
- * | Bit         |    7     6     5     4     3     2     1     0  |
- * |-------------|-------------------------------------------------|
- * | byte 1      | String length MSB                               |
- * | byte 2      | String length LSB                               |
- * | byte 3 ...  | UTF-8 Encoded Character Data, if length > 0.    |
- * |===============================================================|
- *
- * @param p_packet is the structure containing the various
- * @param p_string is the Utf-8 encoded string to be appended.
- * @param p_len is the length of the encoded string.
- * @returns
+/*
+ * Next packet id, never 0 and never one still in flight.
+ * Any task may be building a packet so the counter is taken atomically.
  */
-static esp_err_t  append_string(PacketInfo_t* p_packet, const char* p_string, int p_len) {
-	ESP_LOGI(TAG, "Append_String - Buffer:%p;  Offset:%d;  String:%s;  Len:%d",
-			p_packet->PacketPayload, p_packet->PacketPayload_length, p_string, p_len);
-//	if (p_len + 2 > p_packet->PacketPayload_length) {
-//		ESP_LOGE(TAG, " 82 Append_String - Not enough room.")
-//		return ESP_ERR_NO_MEM;
-//	}
-	p_packet->PacketPayload[p_packet->PacketPayload_length++] = p_len >> 8;
-	p_packet->PacketPayload[p_packet->PacketPayload_length++] = p_len & 0xff;
-	memcpy(p_packet->PacketPayload + p_packet->PacketPayload_length, p_string, p_len);
-	p_packet->PacketPayload_length += p_len;
-	return ESP_OK;
+static uint16_t next_packet_id(Client_t *p_client) {
+	return mqtt_inflight_next_id(&p_client->State->inflight, &p_client->State->next_packet_id);
 }
 
-void packet_failure(Client_t *p_client) {
-	p_client->Packet->Packet_length = 0;
+/*
+ * Is the client speaking MQTT 5?  Its packets then carry property lists (empty, unless noted).
+ */
+static int packet_v5(Client_t *p_client) {
+	return p_client->State != NULL && p_client->State->protocol_level == MQTT_PROTOCOL_LEVEL_5;
 }
 
-/**
- * Put the Packet ID into the variable header and return the value put.
+/*
+ * Number of bytes the remaining length takes in the fixed header (1 to 4).
  */
-uint16_t put_packet_id(Client_t *p_client) {
-	p_client->Packet->PacketId++;
-	p_client->Packet->PacketVariableHeader_length = 2;
-	p_client->Packet->PacketVariableHeader[0] = p_client->Packet->PacketId >> 8;
-	p_client->Packet->PacketVariableHeader[1] = p_client->Packet->PacketId & 0xff;
-	return p_client->Packet->PacketId;
+static int remaining_length_size(uint32_t p_remaining_length) {
+	return mqtt_varint_size(p_remaining_length);
 }
 
-void get_packet_id() {
+static uint8_t *put_fixed_header(uint8_t *p_ptr, uint8_t p_type_and_flags, uint32_t p_remaining_length) {
+	*p_ptr++ = p_type_and_flags;
+	return mqtt_varint_put(p_ptr, p_remaining_length);
+}
+
+static uint8_t *put_u16(uint8_t *p_ptr, uint16_t p_value) {
+	*p_ptr++ = p_value >> 8;
+	*p_ptr++ = p_value & 0xff;
+	return p_ptr;
+}
 
+static uint8_t *put_string(uint8_t *p_ptr, const char *p_string, int p_len) {
+	p_ptr = put_u16(p_ptr, p_len);
+	memcpy(p_ptr, p_string, p_len);
+	return p_ptr + p_len;
 }
 
 /*
- * Since we are building packets to write,
+ * Reserve room for a whole packet in the calling task's outbox lane and write its fixed header there.
+ * The builder then writes the variable header and payload straight into the lane at *r_ptr.
+ * p_packet describes the reservation; mqtt_queue() commits it.
+ * p_flags is passed on to mqtt_outbox_reserve(): OUTBOX_RECORD_EXPENDABLE for a fresh publish only.
+ *
+ * @return ESP_OK, or the outbox's reason for refusing the packet (see mqtt_outbox_reserve).
  */
-void packet_finish(Client_t *p_client) {
-	int l_remaining_length = p_client->Packet->PacketVariableHeader_length + p_client->Packet->PacketPayload_length;
-	p_client->Buffers->out_buffer_length = p_client->Packet->Packet_length;
-	if (l_remaining_length > 127) {
-		p_client->Packet->PacketFixedHeader[1] = 0x80 | (l_remaining_length % 128);
-		p_client->Packet->PacketFixedHeader[2] = l_remaining_length / 128;
-		p_client->Packet->PacketFixedHeader_length = 3;
-	} else {
-		p_client->Packet->PacketFixedHeader[1] = l_remaining_length;
-		p_client->Packet->PacketFixedHeader_length = 2;
+static esp_err_t packet_reserve(Client_t *p_client, PacketInfo_t *p_packet, uint8_t p_type_and_flags, uint32_t p_remaining_length,
+		uint32_t p_flags, uint8_t **r_ptr) {
+	uint32_t l_length = 1 + remaining_length_size(p_remaining_length) + p_remaining_length;
+	int l_consumer = !(p_flags & OUTBOX_RECORD_EXPENDABLE) && mqtt_outbox_is_consumer(p_client->Outbox);
+	uint32_t l_flags = l_consumer ? p_flags | OUTBOX_RESERVE_NOW : p_flags;
+	esp_err_t l_err = mqtt_outbox_reserve(p_client->Outbox, p_packet, l_length, l_flags);
+	if (l_err != ESP_OK && l_err != ESP_ERR_INVALID_SIZE && l_consumer) {
+		// The consumer would wait on itself (the event loop resubscribing); send what is queued to make room
+		mqtt_send_ready(p_client);
+		l_err = mqtt_outbox_reserve(p_client->Outbox, p_packet, l_length, l_flags);
+	}
+	if (l_err != ESP_OK) {
+		ESP_LOGW(TAG, "PacketReserve - Outbox refused %d bytes, err:%d", l_length, l_err);
+		p_packet->Packet_length = 0;
+		return l_err;
+	}
+	*r_ptr = put_fixed_header(p_packet->PacketBuffer, p_type_and_flags, p_remaining_length);
+	return ESP_OK;
+}
+
+/*
+ * The fixed form control packets, encoded at compile time and indexed by packet type.
+ * The 4 byte ones carry a zero packet id for packet_control() to patch.
+ * PINGRESP and UNSUBACK only ever come from the broker; they are here so the table covers every fixed form packet.
+ */
+static const ControlPacket_t s_control_templates[MQTT_CONTROL_PACKET_TYPE_DISCONNECT + 1] = {
+	[MQTT_CONTROL_PACKET_TYPE_PUBACK]		= { 4, { MQTT_CONTROL_PACKET_TYPE_PUBACK << 4, 0x02, 0x00, 0x00 } },
+	[MQTT_CONTROL_PACKET_TYPE_PUBREC]		= { 4, { MQTT_CONTROL_PACKET_TYPE_PUBREC << 4, 0x02, 0x00, 0x00 } },
+	[MQTT_CONTROL_PACKET_TYPE_PUBREL]		= { 4, { MQTT_CONTROL_PACKET_TYPE_PUBREL << 4 | 2, 0x02, 0x00, 0x00 } },  // [MQTT-3.6.1-1]
+	[MQTT_CONTROL_PACKET_TYPE_PUBCOMP]		= { 4, { MQTT_CONTROL_PACKET_TYPE_PUBCOMP << 4, 0x02, 0x00, 0x00 } },
+	[MQTT_CONTROL_PACKET_TYPE_UNSUBACK]		= { 4, { MQTT_CONTROL_PACKET_TYPE_UNSUBACK << 4, 0x02, 0x00, 0x00 } },
+	[MQTT_CONTROL_PACKET_TYPE_PINGREQ]		= { 2, { MQTT_CONTROL_PACKET_TYPE_PINGREQ << 4, 0x00 } },
+	[MQTT_CONTROL_PACKET_TYPE_PINGRESP]		= { 2, { MQTT_CONTROL_PACKET_TYPE_PINGRESP << 4, 0x00 } },
+	[MQTT_CONTROL_PACKET_TYPE_DISCONNECT]	= { 2, { MQTT_CONTROL_PACKET_TYPE_DISCONNECT << 4, 0x00 } },
+};
+
+/*
+ * Put a fixed form control packet on the outbox's high priority lane: copy its template, patch in the id if it has one.
+ * The consumer (the event loop acking what it just read) never waits: nothing else empties the lane.
+ *  If the lane is full it sends what is queued first.
+ */
+static esp_err_t packet_control(Client_t *p_client, int p_type, uint16_t p_id, TickType_t p_wait) {
+	ControlPacket_t l_packet = s_control_templates[p_type];
+	if (l_packet.Length == 4) {
+		l_packet.Data[2] = p_id >> 8;
+		l_packet.Data[3] = p_id & 0xff;
+	}
+	if (mqtt_outbox_is_consumer(p_client->Outbox)) {
+		if (mqtt_outbox_control_room(p_client->Outbox) == 0) {
+			mqtt_send_ready(p_client);
+		}
+		p_wait = 0;
+	}
+	return mqtt_outbox_control(p_client->Outbox, &l_packet, p_wait);
+}
+
+/*
+ * Size a packet in the client's packet arena (p_client->Packet, allocated once by Mqtt_init_packet)
+ *  and write its fixed header there.
+ * For packets that go straight to the socket rather than through the outbox - CONNECT.
+ *
+ * @return ESP_OK, or ESP_ERR_INVALID_SIZE if the packet will not fit (see CONFIG_MQTT_PACKET_ARENA_BYTE).
+ */
+static esp_err_t packet_arena(Client_t *p_client, uint8_t p_type_and_flags, uint32_t p_remaining_length, uint8_t **r_ptr) {
+	PacketInfo_t *l_packet = p_client->Packet;
+	uint32_t l_length = 1 + remaining_length_size(p_remaining_length) + p_remaining_length;
+	if (l_packet->PacketBuffer == NULL || l_length > l_packet->PacketBuffer_length) {
+		ESP_LOGE(TAG, "PacketArena - %d bytes will not fit the %d byte arena", l_length, l_packet->PacketBuffer_length);
+		l_packet->Packet_length = 0;
+		return ESP_ERR_INVALID_SIZE;
+	}
+	l_packet->PacketType = p_type_and_flags >> 4;
+	l_packet->PacketFixedHeader = l_packet->PacketBuffer;
+	*r_ptr = put_fixed_header(l_packet->PacketBuffer, p_type_and_flags, p_remaining_length);
+	l_packet->PacketFixedHeader_length = *r_ptr - l_packet->PacketBuffer;
+	l_packet->PacketVariableHeader_length = 0;
+	l_packet->PacketPayload_length = 0;
+	l_packet->Packet_length = l_length;
+	return ESP_OK;
+}
+
+/*
+ * Length of an optional string field; 0 if absent.
+ * @return -1 if it is too long to encode.
+ */
+static int string_length(const char *p_string) {
+	size_t l_len;
+	if (p_string == NULL) {
+		return 0;
 	}
+	l_len = strlen(p_string);
+	return l_len > 0xffff ? -1 : (int) l_len;
 }
 
 // ====== The 14 control packets follow ========
@@ -117,90 +197,90 @@ void packet_finish(Client_t *p_client) {
  * All but the Client identifier are optional and their presence is determined based on flags in the variable header.
  */
 esp_err_t mqtt_build_connect_packet(Client_t* p_client) {
-	ESP_LOGI(TAG, "BuildConnectPacket - Begin.");
+	PacketInfo_t *l_packet = p_client->Packet;
+	int l_id_len, l_topic_len, l_message_len, l_user_len, l_pass_len;
+	uint32_t l_remaining_length, l_props_len = 0;
+	uint8_t l_flags = 0;
+	uint8_t *l_ptr;
+	esp_err_t l_err;
 
-	// Fixed Header
-	ESP_LOGI(TAG, "BuildConnectPacket - Fixed Header.");
-	p_client->Packet->PacketFixedHeader[0] = MQTT_CONTROL_PACKET_TYPE_CONNECT << 4 | 0;
-	p_client->Packet->PacketFixedHeader[1] = 0;
-	p_client->Packet->PacketFixedHeader[2] = 0;
-	p_client->Packet->PacketFixedHeader[3] = 0;
-
-	// Build the variable header (10 bytes)
-	ESP_LOGI(TAG, "BuildConnectPacket - Variable.");
-	p_client->Packet->PacketVariableHeader = calloc(10, sizeof(uint8_t));
-	p_client->Packet->PacketVariableHeader_length = 10;
-	p_client->Packet->PacketVariableHeader[0] = 0;
-	p_client->Packet->PacketVariableHeader[1] = 4;
-	memcpy(&p_client->Packet->PacketVariableHeader[2], "MQTT", 4);
-	p_client->Packet->PacketVariableHeader[6] = 4;
-	p_client->Packet->PacketVariableHeader[7] = 0;
-	if (p_client->Will->CleanSession) {
-		p_client->Packet->PacketVariableHeader[7] |= 1 << 1; // Clean session flag
-	}
-	p_client->Packet->PacketVariableHeader[8] = p_client->Will->Keepalive >> 8;
-	p_client->Packet->PacketVariableHeader[9] = p_client->Will->Keepalive & 0xff;
-
-	// Build the Payload
-	ESP_LOGI(TAG, "BuildConnectPacket - Payload.");
-	p_client->Packet->PacketPayload_length = 0;
-	p_client->Packet->PacketPayload = calloc(1024, sizeof(uint8_t));
-
-	if (p_client->Broker->ClientId != 0 && p_client->Broker->ClientId[0] != '\0') {
-		if (append_string(p_client->Packet, p_client->Broker->ClientId, strlen(p_client->Broker->ClientId)) != ESP_OK) {
-			ESP_LOGE(TAG, "BuildConnectPacket - Failed - Wrong ID");
-			packet_failure(p_client);
-			return ESP_ERR_INVALID_ARG;
-		}
-	} else {
+	ESP_LOGI(TAG, "BuildConnectPacket - Begin.");
+	l_id_len = string_length(p_client->Broker->ClientId);
+	l_topic_len = string_length(p_client->Will->WillTopic);
+	l_message_len = l_topic_len > 0 ? string_length(p_client->Will->WillMessage) : 0;
+	l_user_len = string_length(p_client->Broker->Username);
+	l_pass_len = string_length(p_client->Broker->Password);
+	if (l_id_len <= 0) {
 		ESP_LOGE(TAG, "BuildConnectPacket - Bad ID");
-		print_packet(p_client->Packet);
-		packet_failure(p_client);
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (l_topic_len < 0 || l_message_len < 0 || l_user_len < 0 || l_pass_len < 0) {
+		ESP_LOGE(TAG, "BuildConnectPacket - Failed - Field too long");
 		return ESP_ERR_INVALID_ARG;
 	}
 
-	ESP_LOGI(TAG, "BuildConnectPacket - Will Topic.");
-	if (p_client->Will->WillTopic != 0 && p_client->Will->WillTopic[0] != '\0') {
-		if (append_string(p_client->Packet, p_client->Will->WillTopic, strlen(p_client->Will->WillTopic)) != ESP_OK) {
-			ESP_LOGE(TAG, "BuildConnectPacket - Failed - Will topic bad")
-			packet_failure(p_client);
-			return ESP_ERR_INVALID_ARG;
-		}
-		if (append_string(p_client->Packet, p_client->Will->WillMessage, strlen(p_client->Will->WillMessage)) != ESP_OK) {
-			ESP_LOGE(TAG, "BuildConnectPacket - Failed - Will message bad");
-			packet_failure(p_client);
-			return ESP_ERR_INVALID_ARG;
-		}
-		p_client->Packet->PacketVariableHeader[7] |= MQTT_CONNECT_FLAG_WILL;
+	// Variable header (10 bytes), then the payload fields the flags say are there
+	l_remaining_length = 10 + 2 + l_id_len;
+	if (p_client->Will->CleanSession) {
+		l_flags |= MQTT_CONNECT_FLAG_CLEAN_SESSION;
+	}
+	if (packet_v5(p_client)) {
+		// Receive Maximum, and a Session Expiry Interval to keep the session as 3.1.1 does without CleanSession
+		l_props_len = 3 + (p_client->Will->CleanSession ? 0 : 5);
+		l_remaining_length += 1 + l_props_len;
+	}
+	if (l_topic_len > 0) {
+		l_remaining_length += 2 + l_topic_len + 2 + l_message_len + (packet_v5(p_client) ? 1 : 0);
+		l_flags |= MQTT_CONNECT_FLAG_WILL | (p_client->Will->WillQos & 3) << 3;
 		if (p_client->Will->WillRetain) {
-			p_client->Packet->PacketVariableHeader[7] |= MQTT_CONNECT_FLAG_WILL_RETAIN;
+			l_flags |= MQTT_CONNECT_FLAG_WILL_RETAIN;
 		}
-		p_client->Packet->PacketVariableHeader[7] |= (p_client->Will->WillQos & 3) << 3;
+	}
+	if (l_user_len > 0) {
+		l_remaining_length += 2 + l_user_len;
+		l_flags |= MQTT_CONNECT_FLAG_USERNAME;
+	}
+	if (l_pass_len > 0) {
+		l_remaining_length += 2 + l_pass_len;
+		l_flags |= MQTT_CONNECT_FLAG_PASSWORD;
+	}
+	l_err = packet_arena(p_client, MQTT_CONTROL_PACKET_TYPE_CONNECT << 4, l_remaining_length, &l_ptr);
+	if (l_err != ESP_OK) {
+		return l_err;
 	}
 
-	ESP_LOGI(TAG, "BuildConnectPacket - Username.");
-	if (p_client->Broker->Username != 0 && p_client->Broker->Username[0] != '\0') {
-		if (append_string(p_client->Packet, p_client->Broker->Username, strlen(p_client->Broker->Username)) < 0) {
-			ESP_LOGE(TAG, "BuildConnectPacket - Failed - Username");
-			packet_failure(p_client);
-			return ESP_ERR_INVALID_ARG;
+	l_packet->PacketVariableHeader = l_ptr;
+	l_ptr = put_string(l_ptr, "MQTT", 4);
+	*l_ptr++ = packet_v5(p_client) ? MQTT_PROTOCOL_LEVEL_5 : MQTT_PROTOCOL_LEVEL_311;
+	*l_ptr++ = l_flags;
+	l_ptr = put_u16(l_ptr, p_client->Will->Keepalive);
+	if (packet_v5(p_client)) {
+		*l_ptr++ = l_props_len;
+		// We can hold as many unreleased QoS 2 publishes as the inbound set takes; QoS 1 is acked at once
+		l_ptr = mqtt_property_put_u16(l_ptr, MQTT_PROPERTY_RECEIVE_MAXIMUM, CONFIG_MQTT_INBOUND_QOS2_SLOTS * 3 / 4);
+		if (!p_client->Will->CleanSession) {
+			l_ptr = mqtt_property_put_u32(l_ptr, MQTT_PROPERTY_SESSION_EXPIRY, 0xffffffff);  // Never expires
 		}
-		p_client->Packet->PacketVariableHeader[7] |= MQTT_CONNECT_FLAG_USERNAME;
 	}
+	l_packet->PacketVariableHeader_length = l_ptr - l_packet->PacketVariableHeader;
 
-	ESP_LOGI(TAG, "BuildConnectPacket - Password.");
-	if (p_client->Broker->Password != 0 && p_client->Broker->Password[0] != '\0') {
-		if (append_string(p_client->Packet, p_client->Broker->Password, strlen(p_client->Broker->Password)) < 0) {
-			ESP_LOGE(TAG, "BuildConnectPacket - Failed - Password");
-			packet_failure(p_client);
-			return ESP_ERR_INVALID_ARG;
+	l_packet->PacketPayload = l_ptr;
+	l_ptr = put_string(l_ptr, p_client->Broker->ClientId, l_id_len);
+	if (l_topic_len > 0) {
+		if (packet_v5(p_client)) {
+			*l_ptr++ = 0;  // Will properties
 		}
-		p_client->Packet->PacketVariableHeader[7] |= MQTT_CONNECT_FLAG_PASSWORD;
+		l_ptr = put_string(l_ptr, p_client->Will->WillTopic, l_topic_len);
+		l_ptr = put_string(l_ptr, p_client->Will->WillMessage, l_message_len);
 	}
-
-	ESP_LOGI(TAG, "BuildConnectPacket - Finish.");
-	packet_finish(p_client);
-	print_packet(p_client->Packet);
+	if (l_user_len > 0) {
+		l_ptr = put_string(l_ptr, p_client->Broker->Username, l_user_len);
+	}
+	if (l_pass_len > 0) {
+		l_ptr = put_string(l_ptr, p_client->Broker->Password, l_pass_len);
+	}
+	l_packet->PacketPayload_length = l_ptr - l_packet->PacketPayload;
+	print_packet(l_packet);
 	ESP_LOGI(TAG, "BuildConnectPacket - Succeeded")
 	return ESP_OK;
 }
@@ -219,61 +299,191 @@ esp_err_t mqtt_build_connack_packet(Client_t* p_client) {
 	return ESP_FAIL;
 }
 
+/*
+ * Build a PUBLISH whose topic is either interned (p_handle) or given by name (p_topic, p_topic_len).
+ * A QoS 1 or 2 publish first takes a place in the in-flight window, waiting as the outbox policy allows,
+ *  and a copy of it is kept there until it is acknowledged.
+ */
+static esp_err_t packet_publish(Client_t* p_client, PacketInfo_t *p_packet, TopicHandle_t p_handle, const char *p_topic, uint32_t p_topic_len,
+		char *p_data, int p_len, int p_qos, int p_retain, uint16_t *r_id) {
+	Inflight_t *l_inflight = &p_client->State->inflight;
+	Outbox_t *l_outbox = p_client->Outbox;
+	uint32_t l_remaining_length;
+	uint8_t *l_ptr;
+	esp_err_t l_err;
+
+	l_remaining_length = p_topic_len + (p_qos > 0 ? 2 : 0) + (packet_v5(p_client) ? 1 : 0) + p_len;
+	*r_id = 0;
+	if (p_qos > 0) {
+		l_err = mqtt_inflight_open(l_inflight, &p_client->State->next_packet_id, p_qos,
+				l_outbox->Policy == OUTBOX_POLICY_BLOCK ? l_outbox->BlockTicks : 0, r_id);
+		if (l_err != ESP_OK) {
+			return l_err;
+		}
+	}
+	l_err = packet_reserve(p_client, p_packet, MQTT_CONTROL_PACKET_TYPE_PUBLISH << 4 | (p_qos & 3) << 1 | (p_retain & 1), l_remaining_length,
+			OUTBOX_RECORD_EXPENDABLE, &l_ptr);
+	if (l_err != ESP_OK) {
+		if (p_qos > 0) {
+			mqtt_inflight_close(l_inflight, *r_id);
+		}
+		return l_err;
+	}
+	if (p_handle != 0) {
+		l_ptr = mqtt_topic_put(p_client->Topics, p_handle, l_ptr);
+	} else {
+		l_ptr = put_string(l_ptr, p_topic, p_topic_len - 2);
+	}
+	if (p_qos > 0) {
+		l_ptr = put_u16(l_ptr, *r_id);
+	}
+	if (packet_v5(p_client)) {
+		*l_ptr++ = 0;  // Properties; the sending task adds a topic alias (see mqtt_alias_rewrite)
+	}
+	memcpy(l_ptr, p_data, p_len);
+	if (p_qos > 0) {
+		mqtt_inflight_store(l_inflight, *r_id, p_packet->PacketBuffer, p_packet->Packet_length);
+	}
+	return ESP_OK;
+}
+
 /**
  * PUBLISH (3) – Publish message
  * A PUBLISH Control Packet is sent from a Client to a Server or from Server to a Client to transport an Application Message.
  */
-esp_err_t mqtt_build_publish_packet(Client_t* p_client) {
+esp_err_t mqtt_build_publish_packet(Client_t* p_client, PacketInfo_t *p_packet, char *p_topic, char *p_data, int p_len, int p_qos, int p_retain, uint16_t *r_id) {
+	esp_err_t l_err;
+
 	ESP_LOGI(TAG, "3 BuildPublishPacket - Begin.");
-	print_packet(p_client->Packet);
-	ESP_LOGI(TAG, "3-Z BuildPublishPacket - Succeeded")
-	return ESP_OK;
+	*r_id = 0;
+	if (p_topic == NULL || p_topic[0] == '\0') {
+		ESP_LOGE(TAG, "3 BuildPublishPacket - Topic Missing.");
+		return ESP_ERR_INVALID_ARG;
+	}
+	l_err = packet_publish(p_client, p_packet, 0, p_topic, 2 + strlen(p_topic), p_data, p_len, p_qos, p_retain, r_id);
+	if (l_err == ESP_OK) {
+		ESP_LOGI(TAG, "3-Z BuildPublishPacket - Succeeded")
+	}
+	return l_err;
+}
+
+/**
+ * PUBLISH (3) to a topic interned with mqtt_topic_intern(); the topic is copied in already encoded.
+ */
+esp_err_t mqtt_build_publish_handle_packet(Client_t* p_client, PacketInfo_t *p_packet, TopicHandle_t p_handle, char *p_data, int p_len, int p_qos, int p_retain, uint16_t *r_id) {
+	uint32_t l_topic_len = p_client->Topics ? mqtt_topic_encoded_length(p_client->Topics, p_handle) : 0;
+
+	ESP_LOGD(TAG, "3 BuildPublishHandlePacket - Handle:%d", p_handle);
+	*r_id = 0;
+	if (l_topic_len == 0) {
+		ESP_LOGE(TAG, "3 BuildPublishHandlePacket - No topic with handle %d.", p_handle);
+		return ESP_ERR_INVALID_ARG;
+	}
+	return packet_publish(p_client, p_packet, p_handle, NULL, l_topic_len, p_data, p_len, p_qos, p_retain, r_id);
 }
 
 /**
  * PUBACK (4) – Publish acknowledgement
  * A PUBACK Packet is the response to a PUBLISH Packet with QoS level 1.
+ * Queued on the high priority lane.
  */
-esp_err_t mqtt_build_puback_packet(Client_t* p_client) {
-	ESP_LOGI(TAG, "4 BuildPubackPacket - Begin.");
-	print_packet(p_client->Packet);
-	ESP_LOGI(TAG, "4-Z BuildAckackPacket - Succeeded")
-	return ESP_OK;
+esp_err_t mqtt_build_puback_packet(Client_t* p_client, uint16_t p_id) {
+	ESP_LOGD(TAG, "4 BuildPubackPacket - Id:%d", p_id);
+	return packet_control(p_client, MQTT_CONTROL_PACKET_TYPE_PUBACK, p_id, MQTT_MS_TO_TICKS(MQTT_QUEUE_WAIT_MS));
 }
 
 /**
  * PUBREC (5) – Publish received (QoS 2 publish received, part 1)
  * A PUBREC Packet is the response to a PUBLISH Packet with QoS 2.
  * It is the second packet of the QoS 2 protocol exchange.
+ * Queued on the high priority lane.
  */
-esp_err_t mqtt_build_pubrec_packet(Client_t* p_client) {
-	ESP_LOGI(TAG, "5 BuildPubrecPacket - Begin.");
-	print_packet(p_client->Packet);
-	ESP_LOGI(TAG, "15-Z BuildPubrecPacket - Succeeded")
-	return ESP_OK;
+esp_err_t mqtt_build_pubrec_packet(Client_t* p_client, uint16_t p_id) {
+	ESP_LOGD(TAG, "5 BuildPubrecPacket - Id:%d", p_id);
+	return packet_control(p_client, MQTT_CONTROL_PACKET_TYPE_PUBREC, p_id, MQTT_MS_TO_TICKS(MQTT_QUEUE_WAIT_MS));
 }
 
 /**
  * PUBREL (6) – Publish release (QoS 2 publish received, part 2)
  * A PUBREL Packet is the response to a PUBREC Packet.
  * It is the third packet of the QoS 2 protocol exchange.
+ * Bits 3,2,1 and 0 of the fixed header are reserved and MUST be set to 0,0,1 and 0 [MQTT-3.6.1-1].
+ * Queued on the high priority lane.
  */
-esp_err_t mqtt_build_pubrel_packet(Client_t* p_client) {
-	ESP_LOGI(TAG, "6 BuildPubrelPacket - Begin.");
-	print_packet(p_client->Packet);
-	ESP_LOGI(TAG, "6-Z BuildPubrelPacket - Succeeded")
-	return ESP_OK;
+esp_err_t mqtt_build_pubrel_packet(Client_t* p_client, uint16_t p_id) {
+	ESP_LOGD(TAG, "6 BuildPubrelPacket - Id:%d", p_id);
+	return packet_control(p_client, MQTT_CONTROL_PACKET_TYPE_PUBREL, p_id, MQTT_MS_TO_TICKS(MQTT_QUEUE_WAIT_MS));
 }
 
 /**
  * PUBCOMP (7) – Publish complete (QoS 2 publish received, part 3)
  * The PUBCOMP Packet is the response to a PUBREL Packet.
  * It is the fourth and final packet of the QoS 2 protocol exchange.
+ * Queued on the high priority lane.
+ */
+esp_err_t mqtt_build_pubcomp_packet(Client_t* p_client, uint16_t p_id) {
+	ESP_LOGD(TAG, "7 BuildPubcompPacket - Id:%d", p_id);
+	return packet_control(p_client, MQTT_CONTROL_PACKET_TYPE_PUBCOMP, p_id, MQTT_MS_TO_TICKS(MQTT_QUEUE_WAIT_MS));
+}
+
+/*
+ * How many of p_filters, from the first, go in one SUBSCRIBE or UNSUBSCRIBE (p_with_qos 0) of no more than
+ *  CONFIG_MQTT_SUBSCRIBE_PACKET_BYTE.  The first always goes, however long it is.
+ *
+ * @return the count, and its remaining length in *r_remaining; 0 if a filter it reached is empty.
  */
-esp_err_t mqtt_build_pubcomp_packet(Client_t* p_client) {
-	ESP_LOGI(TAG, "7 BuildPubcompPacket - Begin.");
-	print_packet(p_client->Packet);
-	ESP_LOGI(TAG, "7-Z BuildPubcompPacket - Succeeded")
+static uint32_t packet_filters_fit(Client_t *p_client, const SubscribeFilter_t *p_filters, uint32_t p_count, int p_with_qos, uint32_t *r_remaining) {
+	uint32_t l_remaining = 2 + (packet_v5(p_client) ? 1 : 0);
+	uint32_t l_next, l_ix;
+
+	for (l_ix = 0; l_ix < p_count; l_ix++) {
+		if (p_filters[l_ix].Filter == NULL || p_filters[l_ix].Length == 0) {
+			return 0;
+		}
+		l_next = l_remaining + 2 + p_filters[l_ix].Length + (p_with_qos ? 1 : 0);
+		if (l_ix > 0 && 1 + remaining_length_size(l_next) + l_next > CONFIG_MQTT_SUBSCRIBE_PACKET_BYTE) {
+			break;
+		}
+		l_remaining = l_next;
+	}
+	*r_remaining = l_remaining;
+	return l_ix;
+}
+
+/*
+ * Build a SUBSCRIBE or UNSUBSCRIBE carrying as many of p_filters, in order, as packet_filters_fit() allows.
+ * Bits 3,2,1 and 0 of the fixed header are reserved and MUST be set to 0,0,1 and 0 [MQTT-3.8.1-1] [MQTT-3.10.1-1].
+ */
+static esp_err_t packet_filters(Client_t* p_client, PacketInfo_t *p_packet, int p_type, const SubscribeFilter_t *p_filters, uint32_t p_count,
+		uint16_t *r_id, uint32_t *r_packed) {
+	int l_with_qos = p_type == MQTT_CONTROL_PACKET_TYPE_SUBSCRIBE;
+	uint32_t l_remaining, l_packed, l_ix;
+	uint8_t *l_ptr;
+	esp_err_t l_err;
+
+	*r_packed = 0;
+	if (p_count == 0 || (l_packed = packet_filters_fit(p_client, p_filters, p_count, l_with_qos, &l_remaining)) == 0) {
+		ESP_LOGE(TAG, "%d BuildSubscribePacket - Topic Missing.", p_type);
+		return ESP_ERR_INVALID_ARG;
+	}
+	l_err = packet_reserve(p_client, p_packet, p_type << 4 | 2, l_remaining, 0, &l_ptr);
+	if (l_err != ESP_OK) {
+		return l_err;
+	}
+	// Build the variable header (2 bytes, and the empty property list for MQTT 5)
+	*r_id = next_packet_id(p_client);
+	l_ptr = put_u16(l_ptr, *r_id);
+	if (packet_v5(p_client)) {
+		*l_ptr++ = 0;
+	}
+	// Build the Payload
+	for (l_ix = 0; l_ix < l_packed; l_ix++) {
+		l_ptr = put_string(l_ptr, p_filters[l_ix].Filter, p_filters[l_ix].Length);
+		if (l_with_qos) {
+			*l_ptr++ = p_filters[l_ix].Qos;
+		}
+	}
+	*r_packed = l_packed;
 	return ESP_OK;
 }
 
@@ -286,26 +496,22 @@ esp_err_t mqtt_build_pubcomp_packet(Client_t* p_client) {
  * The SUBSCRIBE Packet also specifies (for each Subscription) the maximum QoS with which the Server can send
  *  Application Messages to the Client.
  *
- * @param p_client
+ * Packs p_filters, in order, into one packet of up to CONFIG_MQTT_SUBSCRIBE_PACKET_BYTE;
+ *  *r_packed is how many went in and the caller builds another for the rest.
  */
-esp_err_t mqtt_build_subscribe_packet(Client_t* p_client, char *p_topic, uint8_t p_qos, uint16_t *r_id) {
-	ESP_LOGI(TAG, "8 BuildSubscribePacket - Begin.");
-	// Fixed Header
-	ESP_LOGI(TAG, "BuildSubscribePacket - Fixed Header.");
-	p_client->Packet->PacketFixedHeader[0] = MQTT_CONTROL_PACKET_TYPE_SUBSCRIBE << 4 | 2;
-	p_client->Packet->PacketFixedHeader[1] = 0;
-	p_client->Packet->PacketFixedHeader[2] = 0;
-	p_client->Packet->PacketFixedHeader[3] = 0;
-	// Build the variable header (2 bytes)
-	*r_id = put_packet_id(p_client);
-	// Build the Payload
-	ESP_LOGI(TAG, "BuildSubscribePacket - Payload.");
-	append_string(p_client->Packet, p_topic, strlen(p_topic));
-	p_client->Packet->PacketPayload[p_client->Packet->PacketPayload_length] = p_qos;
-	p_client->Packet->PacketPayload_length++;
-	print_packet(p_client->Packet);
-	ESP_LOGI(TAG, "8-Z BuildSubscribePacket - Succeeded")
-	return ESP_OK;
+esp_err_t mqtt_build_subscribe_list_packet(Client_t* p_client, PacketInfo_t *p_packet, const SubscribeFilter_t *p_filters, uint32_t p_count,
+		uint16_t *r_id, uint32_t *r_packed) {
+	ESP_LOGI(TAG, "8 BuildSubscribePacket - Begin, %d filters.", p_count);
+	return packet_filters(p_client, p_packet, MQTT_CONTROL_PACKET_TYPE_SUBSCRIBE, p_filters, p_count, r_id, r_packed);
+}
+
+/**
+ * A SUBSCRIBE for one topic filter.
+ */
+esp_err_t mqtt_build_subscribe_packet(Client_t* p_client, PacketInfo_t *p_packet, char *p_topic, uint8_t p_qos, uint16_t *r_id) {
+	SubscribeFilter_t l_filter = { p_topic, p_topic ? strlen(p_topic) : 0, p_qos, 0 };
+	uint32_t l_packed;
+	return mqtt_build_subscribe_list_packet(p_client, p_packet, &l_filter, 1, r_id, &l_packed);
 }
 
 /**
@@ -324,24 +530,21 @@ esp_err_t mqtt_build_suback_packet(Client_t* p_client) {
 /**
  * UNSUBSCRIBE (10) – Unsubscribe from topics
  * An UNSUBSCRIBE Packet is sent by the Client to the Server, to unsubscribe from topics.
+ * Packs p_filters as mqtt_build_subscribe_list_packet() does; their Qos is not used.
  */
-esp_err_t mqtt_build_unsubscribe_packet(Client_t* p_client) {
-	ESP_LOGI(TAG, "10 BuildUnsubscribePacket - Begin.");
-	// Fixed Header
-	p_client->Packet->PacketFixedHeader_length = 2;
-	*p_client->Packet->PacketFixedHeader = MQTT_CONTROL_PACKET_TYPE_PINGREQ << 4;
-	ESP_LOGI(TAG, "10-A BuildUnsubscribePacket - Fixed.");
-	p_client->Packet->PacketFixedHeader[1] = 0;
-	p_client->Packet->PacketFixedHeader[2] = 0;
-	p_client->Packet->PacketFixedHeader[3] = 0;
-	// Build the variable header (2 bytes)
-	uint16_t l_packet_id = put_packet_id(p_client);
-	// Build the Payload
-	ESP_LOGI(TAG, "BuildUnspuubscribePacket - Payload.");
+esp_err_t mqtt_build_unsubscribe_list_packet(Client_t* p_client, PacketInfo_t *p_packet, const SubscribeFilter_t *p_filters, uint32_t p_count,
+		uint16_t *r_id, uint32_t *r_packed) {
+	ESP_LOGI(TAG, "10 BuildUnsubscribePacket - Begin, %d filters.", p_count);
+	return packet_filters(p_client, p_packet, MQTT_CONTROL_PACKET_TYPE_UNSUBSCRIBE, p_filters, p_count, r_id, r_packed);
+}
 
-	print_packet(p_client->Packet);
-	ESP_LOGI(TAG, "10-Z BuildUnsubscribePacket - Succeeded")
-	return ESP_OK;
+/**
+ * An UNSUBSCRIBE for one topic filter.
+ */
+esp_err_t mqtt_build_unsubscribe_packet(Client_t* p_client, PacketInfo_t *p_packet, char *p_topic, uint16_t *r_id) {
+	SubscribeFilter_t l_filter = { p_topic, p_topic ? strlen(p_topic) : 0, 0, 0 };
+	uint32_t l_packed;
+	return mqtt_build_unsubscribe_list_packet(p_client, p_packet, &l_filter, 1, r_id, &l_packed);
 }
 
 /** done
@@ -363,24 +566,12 @@ esp_err_t mqtt_build_unsuback_packet(Client_t* p_client) {
  *   2. Request that the Server responds to confirm that it is alive.
  *   3. Exercise the network to indicate that the Network Connection is active.
  * This Packet is used in Keep Alive processing.
+ *
+ * Queued on the high priority lane without waiting, since the sending task that drains it is the caller.
  */
 esp_err_t mqtt_build_pingreq_packet(Client_t* p_client) {
-	ESP_LOGI(TAG, "12 BuildPingreqPacket - Begin.");
-
-	// Fixed Header
-	p_client->Packet->PacketFixedHeader_length = 2;
-	*p_client->Packet->PacketFixedHeader = MQTT_CONTROL_PACKET_TYPE_PINGREQ << 4;
-	ESP_LOGI(TAG, "12-A BuildPingreqPacket - Fixed.");
-	p_client->Packet->PacketFixedHeader[1] = 0;
-	// Variable Header
-	ESP_LOGI(TAG, "12-B BuildPingreqPacket - Variable.");
-	p_client->Packet->PacketVariableHeader_length = 0;
-	// Build the Payload
-	ESP_LOGI(TAG, "12-C BuildPingreqPacket - Payload.");
-	p_client->Packet->PacketPayload_length = 0;
-//	print_packet(p_client->Packet);
-	ESP_LOGI(TAG, "12-Z BuildPingreqPacket - Succeeded")
-	return ESP_OK;
+	ESP_LOGD(TAG, "12 BuildPingreqPacket - Begin.");
+	return packet_control(p_client, MQTT_CONTROL_PACKET_TYPE_PINGREQ, 0, 0);
 }
 
 /** done
@@ -400,19 +591,11 @@ esp_err_t mqtt_build_pingresp_packet(Client_t* p_client) {
  * DISCONNECT (14) – Disconnect notification
  * The DISCONNECT Packet is the final Control Packet sent from the Client to the Server.
  * It indicates that the Client is disconnecting cleanly.
+ * Queued on the high priority lane.
  */
 esp_err_t mqtt_build_disconnect_packet(Client_t* p_client) {
 	ESP_LOGI(TAG, "14 BuildDisconnectPacket - Begin.");
-	// Fixed Header
-	p_client->Packet->PacketFixedHeader[0] = MQTT_CONTROL_PACKET_TYPE_DISCONNECT << 4 | 0;
-	p_client->Packet->PacketFixedHeader[1] = 0;
-	// Variable Header
-	p_client->Packet->PacketVariableHeader_length = 0;
-// Build the Payload
-	p_client->Packet->PacketPayload_length = 0;
-//	print_packet(p_client->Packet);
-	ESP_LOGI(TAG, "14-Z BuildDisconnectPacket - Succeeded")
-	return ESP_OK;
+	return packet_control(p_client, MQTT_CONTROL_PACKET_TYPE_DISCONNECT, 0, MQTT_MS_TO_TICKS(MQTT_QUEUE_WAIT_MS));
 }
 
 
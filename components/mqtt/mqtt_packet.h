@@ -10,6 +10,12 @@
 
 #include "mqtt_structs.h"
 
+/*
+ * How long a task will wait for room on the outbox's control lane before giving up on an ack.
+ * Publishes follow the outbox admission policy instead (CONFIG_MQTT_OUTBOX_POLICY_*).
+ */
+#define MQTT_QUEUE_WAIT_MS	5000
+
 enum mqtt_ctl_packet_type {
 	MQTT_CONTROL_PACKET_TYPE_CONNECT = 1,
 	MQTT_CONTROL_PACKET_TYPE_CONNACK = 2,
@@ -38,14 +44,17 @@ enum mqtt_connect_return_code {
 
 esp_err_t mqtt_build_connect_packet(Client_t* p_client);     // 1
 esp_err_t mqtt_build_connack_packet(Client_t* p_client);     // 2
-esp_err_t mqtt_build_publish_packet(Client_t* p_client);     // 3
-esp_err_t mqtt_build_puback_packet(Client_t* p_client);      // 4
-esp_err_t mqtt_build_pubrec_packet(Client_t* p_client);      // 5
-esp_err_t mqtt_build_pubrel_packet(Client_t* p_client);      // 6
-esp_err_t mqtt_build_pubcomp_packet(Client_t* p_client);     // 7
-esp_err_t mqtt_build_subscribe_packet(Client_t* p_client, char *p_topic, uint8_t p_qos, uint16_t *r_id); // 8
+esp_err_t mqtt_build_publish_packet(Client_t* p_client, PacketInfo_t *p_packet, char *p_topic, char *p_data, int p_len, int p_qos, int p_retain, uint16_t *r_id); // 3
+esp_err_t mqtt_build_publish_handle_packet(Client_t* p_client, PacketInfo_t *p_packet, TopicHandle_t p_handle, char *p_data, int p_len, int p_qos, int p_retain, uint16_t *r_id); // 3
+esp_err_t mqtt_build_puback_packet(Client_t* p_client, uint16_t p_id);      // 4
+esp_err_t mqtt_build_pubrec_packet(Client_t* p_client, uint16_t p_id);      // 5
+esp_err_t mqtt_build_pubrel_packet(Client_t* p_client, uint16_t p_id);      // 6
+esp_err_t mqtt_build_pubcomp_packet(Client_t* p_client, uint16_t p_id);     // 7
+esp_err_t mqtt_build_subscribe_packet(Client_t* p_client, PacketInfo_t *p_packet, char *p_topic, uint8_t p_qos, uint16_t *r_id); // 8
+esp_err_t mqtt_build_subscribe_list_packet(Client_t* p_client, PacketInfo_t *p_packet, const SubscribeFilter_t *p_filters, uint32_t p_count, uint16_t *r_id, uint32_t *r_packed); // 8
 esp_err_t mqtt_build_suback_packet(Client_t* p_client);      // 9
-esp_err_t mqtt_build_unsubscribe_packet(Client_t* p_client); // 10
+esp_err_t mqtt_build_unsubscribe_packet(Client_t* p_client, PacketInfo_t *p_packet, char *p_topic, uint16_t *r_id); // 10
+esp_err_t mqtt_build_unsubscribe_list_packet(Client_t* p_client, PacketInfo_t *p_packet, const SubscribeFilter_t *p_filters, uint32_t p_count, uint16_t *r_id, uint32_t *r_packed); // 10
 esp_err_t mqtt_build_unsuback_packet(Client_t* p_client);    // 11
 esp_err_t mqtt_build_pingreq_packet(Client_t* p_client);     // 12
 esp_err_t mqtt_build_pingresp_packet(Client_t* p_client);    // 13
@@ -0,0 +1,204 @@
+/*
+ * mqtt_property.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * MQTT 5 properties and the variable byte integers that size them.
+ * See:  https://docs.oasis-open.org/mqtt/mqtt/v5.0/mqtt-v5.0.html  sections 1.5.5 and 2.2.2
+ *
+ * A property is a one byte identifier followed by a value whose form the identifier fixes:
+ *  a byte, a two or four byte integer, a variable byte integer, a string or binary data (two byte length first),
+ *  or a pair of strings.
+ */
+
+#include <string.h>
+
+#include "mqtt_property.h"
+
+/*
+ * Forms a property value can take.
+ */
+enum property_form {
+	PROPERTY_NONE = 0,
+	PROPERTY_BYTE,
+	PROPERTY_U16,
+	PROPERTY_U32,
+	PROPERTY_VARINT,
+	PROPERTY_BINARY,  // Strings are the same on the wire
+	PROPERTY_PAIR
+};
+
+static const uint8_t s_property_forms[MQTT_PROPERTY_SHARED_SUB_AVAILABLE + 1] = {
+	[MQTT_PROPERTY_PAYLOAD_FORMAT]			= PROPERTY_BYTE,
+	[MQTT_PROPERTY_MESSAGE_EXPIRY]			= PROPERTY_U32,
+	[MQTT_PROPERTY_CONTENT_TYPE]			= PROPERTY_BINARY,
+	[MQTT_PROPERTY_RESPONSE_TOPIC]			= PROPERTY_BINARY,
+	[MQTT_PROPERTY_CORRELATION_DATA]		= PROPERTY_BINARY,
+	[MQTT_PROPERTY_SUBSCRIPTION_ID]			= PROPERTY_VARINT,
+	[MQTT_PROPERTY_SESSION_EXPIRY]			= PROPERTY_U32,
+	[MQTT_PROPERTY_ASSIGNED_CLIENT_ID]		= PROPERTY_BINARY,
+	[MQTT_PROPERTY_SERVER_KEEP_ALIVE]		= PROPERTY_U16,
+	[MQTT_PROPERTY_AUTH_METHOD]				= PROPERTY_BINARY,
+	[MQTT_PROPERTY_AUTH_DATA]				= PROPERTY_BINARY,
+	[MQTT_PROPERTY_REQUEST_PROBLEM_INFO]	= PROPERTY_BYTE,
+	[MQTT_PROPERTY_WILL_DELAY]				= PROPERTY_U32,
+	[MQTT_PROPERTY_REQUEST_RESPONSE_INFO]	= PROPERTY_BYTE,
+	[MQTT_PROPERTY_RESPONSE_INFO]			= PROPERTY_BINARY,
+	[MQTT_PROPERTY_SERVER_REFERENCE]		= PROPERTY_BINARY,
+	[MQTT_PROPERTY_REASON_STRING]			= PROPERTY_BINARY,
+	[MQTT_PROPERTY_RECEIVE_MAXIMUM]			= PROPERTY_U16,
+	[MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM]		= PROPERTY_U16,
+	[MQTT_PROPERTY_TOPIC_ALIAS]				= PROPERTY_U16,
+	[MQTT_PROPERTY_MAXIMUM_QOS]				= PROPERTY_BYTE,
+	[MQTT_PROPERTY_RETAIN_AVAILABLE]		= PROPERTY_BYTE,
+	[MQTT_PROPERTY_USER_PROPERTY]			= PROPERTY_PAIR,
+	[MQTT_PROPERTY_MAXIMUM_PACKET_SIZE]		= PROPERTY_U32,
+	[MQTT_PROPERTY_WILDCARD_SUB_AVAILABLE]	= PROPERTY_BYTE,
+	[MQTT_PROPERTY_SUB_ID_AVAILABLE]		= PROPERTY_BYTE,
+	[MQTT_PROPERTY_SHARED_SUB_AVAILABLE]	= PROPERTY_BYTE,
+};
+
+/**
+ * Bytes p_value takes as a variable byte integer (1 to 4).
+ */
+uint32_t mqtt_varint_size(uint32_t p_value) {
+	if (p_value < 128) {
+		return 1;
+	} else if (p_value < 16384) {
+		return 2;
+	} else if (p_value < 2097152) {
+		return 3;
+	}
+	return 4;
+}
+
+/**
+ * @return the byte after it.
+ */
+uint8_t *mqtt_varint_put(uint8_t *p_ptr, uint32_t p_value) {
+	do {
+		*p_ptr = p_value % 128;
+		p_value /= 128;
+		if (p_value > 0) {
+			*p_ptr |= 0x80;
+		}
+		p_ptr++;
+	} while (p_value > 0);
+	return p_ptr;
+}
+
+/**
+ * Read a variable byte integer from the p_length bytes at p_ptr.
+ * @return the bytes it took, 0 if p_length ends first, or -1 if it is longer than 4 bytes.
+ */
+int mqtt_varint_get(const uint8_t *p_ptr, uint32_t p_length, uint32_t *r_value) {
+	uint32_t l_multiplier = 1;
+	int l_ix = 0;
+	*r_value = 0;
+	do {
+		if (l_ix >= 4) {
+			return -1;
+		}
+		if (l_ix >= p_length) {
+			return 0;
+		}
+		*r_value += (p_ptr[l_ix] & 0x7f) * l_multiplier;
+		l_multiplier *= 128;
+	} while (p_ptr[l_ix++] & 0x80);
+	return l_ix;
+}
+
+/**
+ * Write a two byte integer property.
+ * @return the byte after it.
+ */
+uint8_t *mqtt_property_put_u16(uint8_t *p_ptr, uint8_t p_id, uint16_t p_value) {
+	*p_ptr++ = p_id;
+	*p_ptr++ = p_value >> 8;
+	*p_ptr++ = p_value & 0xff;
+	return p_ptr;
+}
+
+/**
+ * Write a four byte integer property.
+ * @return the byte after it.
+ */
+uint8_t *mqtt_property_put_u32(uint8_t *p_ptr, uint8_t p_id, uint32_t p_value) {
+	*p_ptr++ = p_id;
+	*p_ptr++ = p_value >> 24;
+	*p_ptr++ = (p_value >> 16) & 0xff;
+	*p_ptr++ = (p_value >> 8) & 0xff;
+	*p_ptr++ = p_value & 0xff;
+	return p_ptr;
+}
+
+/**
+ * Read the property at *p_ptr, which must be before p_end, and move *p_ptr past it.
+ * Walk a property list with:  while (l_ptr < l_end) { mqtt_property_next(&l_ptr, l_end, &l_property) ... }
+ *
+ * @return ESP_OK, or ESP_ERR_INVALID_RESPONSE for an unknown identifier or a value that runs past p_end.
+ */
+esp_err_t mqtt_property_next(const uint8_t **p_ptr, const uint8_t *p_end, Property_t *r_property) {
+	const uint8_t *l_ptr = *p_ptr;
+	uint32_t l_left = p_end - l_ptr;
+	uint32_t l_second;
+	int l_form, l_size;
+
+	memset(r_property, 0, sizeof(Property_t));
+	if (l_left < 1) {
+		return ESP_ERR_INVALID_RESPONSE;
+	}
+	r_property->Id = *l_ptr++;
+	l_left--;
+	l_form = r_property->Id < sizeof(s_property_forms) ? s_property_forms[r_property->Id] : PROPERTY_NONE;
+	switch (l_form) {
+		case PROPERTY_BYTE:
+			l_size = 1;
+			break;
+		case PROPERTY_U16:
+			l_size = 2;
+			break;
+		case PROPERTY_U32:
+			l_size = 4;
+			break;
+		case PROPERTY_VARINT:
+			if ((l_size = mqtt_varint_get(l_ptr, l_left, &r_property->Value)) <= 0) {
+				return ESP_ERR_INVALID_RESPONSE;
+			}
+			*p_ptr = l_ptr + l_size;
+			return ESP_OK;
+		case PROPERTY_BINARY:
+			if (l_left < 2 || l_left - 2 < (l_ptr[0] << 8 | l_ptr[1])) {
+				return ESP_ERR_INVALID_RESPONSE;
+			}
+			r_property->Length = l_ptr[0] << 8 | l_ptr[1];
+			r_property->Data = l_ptr + 2;
+			*p_ptr = l_ptr + 2 + r_property->Length;
+			return ESP_OK;
+		case PROPERTY_PAIR:
+			if (l_left < 2 || l_left - 2 < (l_ptr[0] << 8 | l_ptr[1])) {
+				return ESP_ERR_INVALID_RESPONSE;
+			}
+			l_second = 2 + (l_ptr[0] << 8 | l_ptr[1]);
+			if (l_left - l_second < 2 || l_left - l_second - 2 < (l_ptr[l_second] << 8 | l_ptr[l_second + 1])) {
+				return ESP_ERR_INVALID_RESPONSE;
+			}
+			r_property->Length = l_second + 2 + (l_ptr[l_second] << 8 | l_ptr[l_second + 1]);
+			r_property->Data = l_ptr;
+			*p_ptr = l_ptr + r_property->Length;
+			return ESP_OK;
+		default:
+			return ESP_ERR_INVALID_RESPONSE;
+	}
+	if (l_left < l_size) {
+		return ESP_ERR_INVALID_RESPONSE;
+	}
+	while (l_size-- > 0) {
+		r_property->Value = r_property->Value << 8 | *l_ptr++;
+	}
+	*p_ptr = l_ptr;
+	return ESP_OK;
+}
+
+// ### END DBK
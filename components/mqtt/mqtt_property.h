@@ -0,0 +1,69 @@
+/*
+ * mqtt_property.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#ifndef COMPONENTS_MQTT_MQTT_PROPERTY_H_
+#define COMPONENTS_MQTT_MQTT_PROPERTY_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * MQTT 5 property identifiers (section 2.2.2.2 of the MQTT 5 spec).
+ */
+enum mqtt_property_id {
+	MQTT_PROPERTY_PAYLOAD_FORMAT = 0x01,
+	MQTT_PROPERTY_MESSAGE_EXPIRY = 0x02,
+	MQTT_PROPERTY_CONTENT_TYPE = 0x03,
+	MQTT_PROPERTY_RESPONSE_TOPIC = 0x08,
+	MQTT_PROPERTY_CORRELATION_DATA = 0x09,
+	MQTT_PROPERTY_SUBSCRIPTION_ID = 0x0B,
+	MQTT_PROPERTY_SESSION_EXPIRY = 0x11,
+	MQTT_PROPERTY_ASSIGNED_CLIENT_ID = 0x12,
+	MQTT_PROPERTY_SERVER_KEEP_ALIVE = 0x13,
+	MQTT_PROPERTY_AUTH_METHOD = 0x15,
+	MQTT_PROPERTY_AUTH_DATA = 0x16,
+	MQTT_PROPERTY_REQUEST_PROBLEM_INFO = 0x17,
+	MQTT_PROPERTY_WILL_DELAY = 0x18,
+	MQTT_PROPERTY_REQUEST_RESPONSE_INFO = 0x19,
+	MQTT_PROPERTY_RESPONSE_INFO = 0x1A,
+	MQTT_PROPERTY_SERVER_REFERENCE = 0x1C,
+	MQTT_PROPERTY_REASON_STRING = 0x1F,
+	MQTT_PROPERTY_RECEIVE_MAXIMUM = 0x21,
+	MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM = 0x22,
+	MQTT_PROPERTY_TOPIC_ALIAS = 0x23,
+	MQTT_PROPERTY_MAXIMUM_QOS = 0x24,
+	MQTT_PROPERTY_RETAIN_AVAILABLE = 0x25,
+	MQTT_PROPERTY_USER_PROPERTY = 0x26,
+	MQTT_PROPERTY_MAXIMUM_PACKET_SIZE = 0x27,
+	MQTT_PROPERTY_WILDCARD_SUB_AVAILABLE = 0x28,
+	MQTT_PROPERTY_SUB_ID_AVAILABLE = 0x29,
+	MQTT_PROPERTY_SHARED_SUB_AVAILABLE = 0x2A
+};
+
+/**
+ * One property, as mqtt_property_next() finds it.
+ * Integer properties fill Value; string and binary ones point Data into the packet (Length bytes, not NUL terminated).
+ * A user property's Data is its whole name/value pair, length prefixes included.
+ */
+typedef struct Property {
+	uint8_t				Id;
+	uint32_t			Value;
+	const uint8_t		*Data;
+	uint32_t			Length;
+} Property_t;
+
+uint32_t mqtt_varint_size(uint32_t p_value);
+uint8_t *mqtt_varint_put(uint8_t *p_ptr, uint32_t p_value);
+int mqtt_varint_get(const uint8_t *p_ptr, uint32_t p_length, uint32_t *r_value);
+uint8_t *mqtt_property_put_u16(uint8_t *p_ptr, uint8_t p_id, uint16_t p_value);
+uint8_t *mqtt_property_put_u32(uint8_t *p_ptr, uint8_t p_id, uint32_t p_value);
+esp_err_t mqtt_property_next(const uint8_t **p_ptr, const uint8_t *p_end, Property_t *r_property);
+
+#endif /* COMPONENTS_MQTT_MQTT_PROPERTY_H_ */
+
+// ### END DBK
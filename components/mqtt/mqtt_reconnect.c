@@ -0,0 +1,143 @@
+/*
+ * mqtt_reconnect.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Getting back to the broker quickly without every device doing it at the same moment
+ *  (see Reconnect_t in mqtt_reconnect.h).
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+
+#include "mqtt_config.h"
+#include "mqtt_reconnect.h"
+
+static const char *TAG = "MqttReconnect ";
+
+/*
+ * Next jitter value.
+ */
+static uint32_t reconnect_random(Reconnect_t *p_reconnect) {
+	uint32_t l_x = p_reconnect->Seed;
+	l_x ^= l_x << 13;
+	l_x ^= l_x >> 17;
+	l_x ^= l_x << 5;
+	p_reconnect->Seed = l_x;
+	return l_x;
+}
+
+/**
+ * Retries wait between p_min_ms and p_max_ms; a resolved address is kept for p_cache_ms.
+ * p_seed (esp_random() on the device) keeps each device's jitter its own.
+ */
+void mqtt_reconnect_init(Reconnect_t *p_reconnect, uint32_t p_min_ms, uint32_t p_max_ms, uint32_t p_cache_ms, uint32_t p_seed) {
+	memset(p_reconnect, 0, sizeof(Reconnect_t));
+	p_reconnect->MinMs = p_min_ms > 0 ? p_min_ms : 1;
+	p_reconnect->MaxMs = p_max_ms > p_reconnect->MinMs ? p_max_ms : p_reconnect->MinMs;
+	p_reconnect->CacheTicks = MQTT_MS_TO_TICKS(p_cache_ms);
+	p_reconnect->Seed = p_seed != 0 ? p_seed : 0x9e3779b9;
+	p_reconnect->DownSince = xTaskGetTickCount();
+}
+
+/**
+ * The broker's address: p_host itself if it is a dotted quad, else the cached lookup, else a fresh one.
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if the name does not resolve.
+ */
+esp_err_t mqtt_reconnect_resolve(Reconnect_t *p_reconnect, const char *p_host, struct in_addr *r_address) {
+	struct hostent *l_he;
+	TickType_t l_now = xTaskGetTickCount();
+
+	if (inet_aton(p_host, r_address) != 0) {
+		return ESP_OK;
+	}
+	if (p_reconnect->Cached && (int32_t) (l_now - p_reconnect->Expires) < 0) {
+		p_reconnect->Stats.CacheHits++;
+		*r_address = p_reconnect->Address;
+		return ESP_OK;
+	}
+	ESP_LOGI(TAG, "Resolve - Looking up %s", p_host);
+	p_reconnect->Stats.Lookups++;
+	p_reconnect->Cached = 0;
+	l_he = gethostbyname(p_host);
+	if (l_he == NULL || l_he->h_addr_list[0] == NULL) {
+		ESP_LOGW(TAG, "Resolve - No address for %s", p_host);
+		return ESP_ERR_NOT_FOUND;
+	}
+	memcpy(r_address, l_he->h_addr_list[0], sizeof(struct in_addr));
+	if (p_reconnect->CacheTicks > 0) {
+		p_reconnect->Address = *r_address;
+		p_reconnect->Expires = l_now + p_reconnect->CacheTicks;
+		p_reconnect->Cached = 1;
+	}
+	return ESP_OK;
+}
+
+/**
+ * Drop the cached address, so the next attempt looks the broker up again - after a connect to it has failed,
+ *  in case it has moved.
+ */
+void mqtt_reconnect_forget(Reconnect_t *p_reconnect) {
+	p_reconnect->Cached = 0;
+}
+
+/**
+ * Count a failed attempt and say how long to wait before the next one.
+ * @return milliseconds, between half the ceiling and the ceiling; the ceiling doubles with each failure up to MaxMs.
+ */
+uint32_t mqtt_reconnect_backoff(Reconnect_t *p_reconnect) {
+	uint32_t l_ceiling = p_reconnect->MinMs;
+	uint32_t l_ix;
+
+	for (l_ix = 0; l_ix < p_reconnect->Failures && l_ceiling < p_reconnect->MaxMs; l_ix++) {
+		l_ceiling *= 2;
+	}
+	if (l_ceiling > p_reconnect->MaxMs) {
+		l_ceiling = p_reconnect->MaxMs;
+	}
+	p_reconnect->Failures++;
+	return l_ceiling / 2 + reconnect_random(p_reconnect) % (l_ceiling - l_ceiling / 2 + 1);
+}
+
+/**
+ * The connection has just been lost; start timing how long it stays down.
+ */
+void mqtt_reconnect_down(Reconnect_t *p_reconnect) {
+	p_reconnect->DownSince = xTaskGetTickCount();
+}
+
+/**
+ * The connection just lost was found dead by keepalive, p_detect_ms after the broker was last heard from.
+ */
+void mqtt_reconnect_dead(Reconnect_t *p_reconnect, uint32_t p_detect_ms) {
+	p_reconnect->Stats.DeadLinks++;
+	p_reconnect->Stats.LastDetectMs = p_detect_ms;
+	if (p_detect_ms > p_reconnect->Stats.MaxDetectMs) {
+		p_reconnect->Stats.MaxDetectMs = p_detect_ms;
+	}
+}
+
+/**
+ * The broker has accepted a connection: record how long it took and start the backoff over.
+ */
+void mqtt_reconnect_up(Reconnect_t *p_reconnect) {
+	uint32_t l_down_ms = (xTaskGetTickCount() - p_reconnect->DownSince) * portTICK_RATE_MS;
+
+	p_reconnect->Failures = 0;
+	p_reconnect->Stats.Connects++;
+	p_reconnect->Stats.LastDownMs = l_down_ms;
+	p_reconnect->Stats.TotalDownMs += l_down_ms;
+	if (l_down_ms > p_reconnect->Stats.MaxDownMs) {
+		p_reconnect->Stats.MaxDownMs = l_down_ms;
+	}
+	ESP_LOGI(TAG, "Up - Connected after %" PRIu32 " ms down", l_down_ms);
+}
+
+// ### END DBK
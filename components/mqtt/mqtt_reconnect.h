@@ -0,0 +1,67 @@
+/*
+ * mqtt_reconnect.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#ifndef COMPONENTS_MQTT_MQTT_RECONNECT_H_
+#define COMPONENTS_MQTT_MQTT_RECONNECT_H_
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "lwip/sockets.h"
+
+#include "esp_err.h"
+
+/**
+ * How reconnecting has gone; see mqtt_get_reconnect_stats().
+ * "Down" is from losing the connection (or starting) to the broker's CONNACK.
+ */
+typedef struct ReconnectStats {
+	uint32_t			Attempts;  // TCP connects started
+	uint32_t			Connects;  // CONNACKs accepted
+	uint32_t			Lookups;  // DNS queries made
+	uint32_t			CacheHits;  // DNS queries saved by the cache
+	uint32_t			Timeouts;  // TCP connects that missed the deadline
+	uint32_t			LastDownMs;
+	uint32_t			MaxDownMs;
+	uint32_t			TotalDownMs;  // Over all Connects; divide for the mean
+	uint32_t			DeadLinks;  // Connections given up on for want of a PINGRESP
+	uint32_t			LastDetectMs;  // From the last thing the broker sent to giving up on it
+	uint32_t			MaxDetectMs;
+} ReconnectStats_t;
+
+/**
+ * Reconnect state for the one broker the client uses.
+ *
+ * The broker's address is resolved once and kept for CacheTicks, and forgotten sooner if a connect to it fails.
+ * Retries back off exponentially from MinMs to MaxMs with "equal jitter" - a random wait between half
+ *  the current ceiling and all of it - so a fleet of devices that lost the broker together does not come back together.
+ * Transport task only.
+ */
+typedef struct Reconnect {
+	struct in_addr		Address;  // Cached broker address
+	TickType_t			Expires;  // Tick the cached address is good until
+	uint8_t				Cached;
+	uint32_t			CacheTicks;  // 0 = resolve every time
+	uint32_t			MinMs;
+	uint32_t			MaxMs;
+	uint32_t			Failures;  // Since the last connect; sets the backoff ceiling
+	uint32_t			Seed;  // Jitter; xorshift32, never 0
+	TickType_t			DownSince;
+	ReconnectStats_t	Stats;
+} Reconnect_t;
+
+void mqtt_reconnect_init(Reconnect_t *p_reconnect, uint32_t p_min_ms, uint32_t p_max_ms, uint32_t p_cache_ms, uint32_t p_seed);
+esp_err_t mqtt_reconnect_resolve(Reconnect_t *p_reconnect, const char *p_host, struct in_addr *r_address);
+void mqtt_reconnect_forget(Reconnect_t *p_reconnect);
+uint32_t mqtt_reconnect_backoff(Reconnect_t *p_reconnect);
+void mqtt_reconnect_down(Reconnect_t *p_reconnect);
+void mqtt_reconnect_dead(Reconnect_t *p_reconnect, uint32_t p_detect_ms);
+void mqtt_reconnect_up(Reconnect_t *p_reconnect);
+
+#endif /* COMPONENTS_MQTT_MQTT_RECONNECT_H_ */
+
+// ### END DBK
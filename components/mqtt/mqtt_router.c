@@ -0,0 +1,242 @@
+/*
+ * mqtt_router.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Route received publishes to a handler per topic filter, instead of every publish to the one data_cb.
+ *
+ * Filters are split into levels and kept as a trie (see Router_t in mqtt_router.h).
+ * A topic is matched by walking it a level at a time: at each node the exact child is found by one hash probe,
+ *  and the '+' child, if there is one, is walked as well.  A '#' filter hangs its handler on the node above it.
+ *
+ * See section 4.7 of the spec for the matching rules:
+ *  http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/mqtt-v3.1.1.pdf
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "mqtt_router.h"
+
+static const char *TAG = "MqttRouter    ";
+
+static uint32_t router_edge(Router_t *p_router, uint16_t p_parent, uint32_t p_hash) {
+	return (p_hash ^ (p_parent * 0x9e3779b1u)) & p_router->EdgeMask;
+}
+
+/*
+ * @return the child of p_parent named p_level, or 0.
+ */
+static uint16_t router_child(Router_t *p_router, uint16_t p_parent, const char *p_level, uint32_t p_length, uint32_t p_hash) {
+	uint32_t l_ix = router_edge(p_router, p_parent, p_hash);
+	RouterNode_t *l_node;
+	uint16_t l_child;
+	while ((l_child = __atomic_load_n(&p_router->Edges[l_ix], __ATOMIC_ACQUIRE)) != 0) {
+		l_node = &p_router->Nodes[l_child];
+		if (l_node->Parent == p_parent && l_node->Hash == p_hash && l_node->Length == p_length
+				&& mqtt_text_equal(&p_router->Pool, l_node->Text, p_level, p_length)) {
+			return l_child;
+		}
+		l_ix = (l_ix + 1) & p_router->EdgeMask;
+	}
+	return 0;
+}
+
+/*
+ * Append a node; the caller links it in.  Lock must be held.
+ * @return its index, or 0 if the router is full.
+ */
+static uint16_t router_new_node(Router_t *p_router, uint16_t p_parent, const char *p_level, uint32_t p_length, uint32_t p_hash) {
+	RouterNode_t *l_node;
+	int32_t l_offset;
+	if (p_router->NodeCount >= p_router->NodeMax || (l_offset = mqtt_text_add(&p_router->Pool, p_level, p_length)) < 0) {
+		return 0;
+	}
+	l_node = &p_router->Nodes[p_router->NodeCount];
+	memset(l_node, 0, sizeof(RouterNode_t));
+	l_node->Hash = p_hash;
+	l_node->Text = l_offset;
+	l_node->Length = p_length;
+	l_node->Parent = p_parent;
+	return p_router->NodeCount++;
+}
+
+/*
+ * '+' and '#' must fill a level, and '#' must be the last one [MQTT-4.7.1-2] [MQTT-4.7.1-3].
+ */
+static int router_valid_filter(const char *p_filter) {
+	const char *l_ptr;
+	if (p_filter == NULL || p_filter[0] == '\0') {
+		return 0;
+	}
+	for (l_ptr = p_filter; *l_ptr != '\0'; l_ptr++) {
+		if (*l_ptr != '+' && *l_ptr != '#') {
+			continue;
+		}
+		if ((l_ptr != p_filter && l_ptr[-1] != '/') || (l_ptr[1] != '\0' && (l_ptr[0] == '#' || l_ptr[1] != '/'))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Match the levels of p_topic below p_node and call every handler whose filter matches.
+ * @param p_wild is 0 while on the first level of a topic starting with '$', which wildcards must not match [MQTT-4.7.2-1].
+ */
+static uint32_t router_match(Router_t *p_router, uint16_t p_node, const uint8_t *p_topic, uint32_t p_length, int p_wild,
+		void *p_client, void *p_event) {
+	RouterNode_t *l_node = &p_router->Nodes[p_node];
+	const uint8_t *l_slash = memchr(p_topic, '/', p_length);
+	uint32_t l_level = l_slash ? (uint32_t) (l_slash - p_topic) : p_length;
+	uint32_t l_calls = 0;
+	uint16_t l_children[2];
+	router_handler_fn l_handler;
+	int l_ix;
+
+	if (p_wild && (l_handler = __atomic_load_n(&l_node->Rest, __ATOMIC_ACQUIRE)) != NULL) {
+		l_handler(p_client, p_event);
+		l_calls++;
+	}
+	l_children[0] = router_child(p_router, p_node, (const char *) p_topic, l_level, mqtt_text_hash((const char *) p_topic, l_level));
+	l_children[1] = p_wild ? __atomic_load_n(&l_node->Plus, __ATOMIC_ACQUIRE) : 0;
+	for (l_ix = 0; l_ix < 2; l_ix++) {
+		if (l_children[l_ix] == 0) {
+			continue;
+		}
+		if (l_slash != NULL) {
+			l_calls += router_match(p_router, l_children[l_ix], l_slash + 1, p_length - l_level - 1, 1, p_client, p_event);
+			continue;
+		}
+		// Last level: the filter that ends here, and "<here>/#", which matches its parent level too
+		l_node = &p_router->Nodes[l_children[l_ix]];
+		if ((l_handler = __atomic_load_n(&l_node->Exact, __ATOMIC_ACQUIRE)) != NULL) {
+			l_handler(p_client, p_event);
+			l_calls++;
+		}
+		if ((l_handler = __atomic_load_n(&l_node->Rest, __ATOMIC_ACQUIRE)) != NULL) {
+			l_handler(p_client, p_event);
+			l_calls++;
+		}
+	}
+	return l_calls;
+}
+
+
+
+/**
+ * Allocate room for p_nodes topic levels, whose names take up to p_text_size bytes in all.
+ * A p_nodes of 0 leaves the router empty; every publish then goes to data_cb.
+ */
+esp_err_t mqtt_router_init(Router_t *p_router, uint32_t p_nodes, uint32_t p_text_size) {
+	uint32_t l_edges = 1;
+
+	memset(p_router, 0, sizeof(Router_t));
+	if (p_nodes == 0) {
+		return ESP_OK;
+	}
+	if (p_nodes > 0xffff) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	while (l_edges < 2 * p_nodes) {
+		l_edges <<= 1;
+	}
+	p_router->Nodes = calloc(p_nodes, sizeof(RouterNode_t));
+	p_router->Edges = calloc(l_edges, sizeof(uint16_t));
+	p_router->Lock = xSemaphoreCreateMutex();
+	if (p_router->Nodes == NULL || p_router->Edges == NULL || p_router->Lock == NULL || mqtt_text_init(&p_router->Pool, p_text_size) != ESP_OK) {
+		ESP_LOGE(TAG, "Init - Not enough memory for %d nodes", p_nodes);
+		mqtt_router_deinit(p_router);
+		return ESP_ERR_NO_MEM;
+	}
+	p_router->NodeCount = 1;  // The root
+	p_router->NodeMax = p_nodes;
+	p_router->EdgeMask = l_edges - 1;
+	return ESP_OK;
+}
+
+void mqtt_router_deinit(Router_t *p_router) {
+	free(p_router->Nodes);
+	free(p_router->Edges);
+	mqtt_text_deinit(&p_router->Pool);
+	if (p_router->Lock != NULL) {
+		vSemaphoreDelete(p_router->Lock);
+	}
+	memset(p_router, 0, sizeof(Router_t));
+}
+
+/**
+ * Send publishes whose topic matches p_filter to p_handler, in place of any handler it had.
+ * A NULL p_handler removes the filter.  Safe to call from any task, including from a handler.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for a malformed filter, ESP_ERR_NO_MEM if the router is full,
+ *  or ESP_ERR_INVALID_STATE if the router was set up with no room at all.
+ */
+esp_err_t mqtt_router_add(Router_t *p_router, const char *p_filter, router_handler_fn p_handler) {
+	const char *l_level = p_filter;
+	const char *l_end;
+	uint32_t l_length, l_hash, l_ix;
+	uint16_t l_node = 0, l_child;
+
+	if (p_router->Nodes == NULL) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (!router_valid_filter(p_filter)) {
+		ESP_LOGE(TAG, "Add - Bad filter \"%s\"", p_filter ? p_filter : "");
+		return ESP_ERR_INVALID_ARG;
+	}
+	xSemaphoreTake(p_router->Lock, portMAX_DELAY);
+	while (1) {
+		l_end = strchr(l_level, '/');
+		l_length = l_end ? (uint32_t) (l_end - l_level) : strlen(l_level);
+		if (l_length == 1 && l_level[0] == '#') {
+			__atomic_store_n(&p_router->Nodes[l_node].Rest, p_handler, __ATOMIC_RELEASE);
+			break;
+		}
+		if (l_length == 1 && l_level[0] == '+') {
+			l_child = p_router->Nodes[l_node].Plus;
+			if (l_child == 0 && (l_child = router_new_node(p_router, l_node, "", 0, 0)) != 0) {
+				__atomic_store_n(&p_router->Nodes[l_node].Plus, l_child, __ATOMIC_RELEASE);
+			}
+		} else {
+			l_hash = mqtt_text_hash(l_level, l_length);
+			l_child = router_child(p_router, l_node, l_level, l_length, l_hash);
+			if (l_child == 0 && (l_child = router_new_node(p_router, l_node, l_level, l_length, l_hash)) != 0) {
+				l_ix = router_edge(p_router, l_node, l_hash);
+				while (p_router->Edges[l_ix] != 0) {
+					l_ix = (l_ix + 1) & p_router->EdgeMask;
+				}
+				__atomic_store_n(&p_router->Edges[l_ix], l_child, __ATOMIC_RELEASE);
+			}
+		}
+		if (l_child == 0) {
+			xSemaphoreGive(p_router->Lock);
+			ESP_LOGE(TAG, "Add - No room for \"%s\"", p_filter);
+			return ESP_ERR_NO_MEM;
+		}
+		l_node = l_child;
+		if (l_end == NULL) {
+			__atomic_store_n(&p_router->Nodes[l_node].Exact, p_handler, __ATOMIC_RELEASE);
+			break;
+		}
+		l_level = l_end + 1;
+	}
+	xSemaphoreGive(p_router->Lock);
+	return ESP_OK;
+}
+
+/**
+ * Call the handler of every filter that matches the topic (p_topic, p_length - not NUL terminated) with p_client, p_event.
+ * @return how many handlers were called.
+ */
+uint32_t mqtt_router_dispatch(Router_t *p_router, const uint8_t *p_topic, uint32_t p_length, void *p_client, void *p_event) {
+	if (p_router->Nodes == NULL || p_length == 0) {
+		return 0;
+	}
+	return router_match(p_router, 0, p_topic, p_length, p_topic[0] != '$', p_client, p_event);
+}
+
+// ### END DBK
@@ -0,0 +1,67 @@
+/*
+ * mqtt_router.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#ifndef COMPONENTS_MQTT_MQTT_ROUTER_H_
+#define COMPONENTS_MQTT_MQTT_ROUTER_H_
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_err.h"
+
+#include "mqtt_text.h"
+
+/**
+ * Same shape as mqtt_callback: (Client_t *, DataEvent_t *).
+ */
+typedef void (*router_handler_fn)(void *p_client, void *p_event);
+
+/**
+ * One topic level of a registered filter.  Node 0 is the root, above the first level.
+ */
+typedef struct RouterNode {
+	uint32_t			Hash;  // Of this level's name
+	uint32_t			Text;  // Where the name is in Router.Pool
+	uint16_t			Length;
+	uint16_t			Parent;
+	uint16_t			Plus;  // Node for a '+' level below this one; 0 for none
+	router_handler_fn	Exact;  // For the filter that ends at this level
+	router_handler_fn	Rest;  // For the filter that ends with '#' below this level
+} RouterNode_t;
+
+/**
+ * Topic filters, '+' and '#' included, mapped to handlers.
+ *
+ * A trie of topic levels held flat in arrays: Nodes, the level names packed into Pool, and Edges,
+ *  an open addressed table from (parent node, level name) to child node.
+ * Finding an exact child is one hash probe, so matching a topic costs O(levels) plus the '+' branches
+ *  that are actually registered, whatever the number of filters.
+ *
+ * Everything is allocated once by mqtt_router_init(); a dispatch allocates nothing and takes no lock.
+ * Nodes are only ever appended, and each is published with release ordering once it is complete,
+ *  so filters may be added while the receive task is matching.
+ */
+typedef struct Router {
+	RouterNode_t		*Nodes;
+	uint16_t			*Edges;  // Node index; 0 = empty
+	TextPool_t			Pool;
+	uint32_t			NodeCount;
+	uint32_t			NodeMax;
+	uint32_t			EdgeMask;
+	SemaphoreHandle_t	Lock;  // Held by mqtt_router_add() only
+} Router_t;
+
+esp_err_t mqtt_router_init(Router_t *p_router, uint32_t p_nodes, uint32_t p_text_size);
+void mqtt_router_deinit(Router_t *p_router);
+esp_err_t mqtt_router_add(Router_t *p_router, const char *p_filter, router_handler_fn p_handler);
+uint32_t mqtt_router_dispatch(Router_t *p_router, const uint8_t *p_topic, uint32_t p_length, void *p_client, void *p_event);
+
+#endif /* COMPONENTS_MQTT_MQTT_ROUTER_H_ */
+
+// ### END DBK
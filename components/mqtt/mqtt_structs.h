@@ -12,7 +12,19 @@
 #include <stdint.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "mqtt_config.h"
 #include "ringbuf.h"
+#include "mqtt_decoder.h"
+#include "mqtt_inflight.h"
+#include "mqtt_router.h"
+#include "mqtt_topic.h"
+#include "mqtt_alias.h"
+#include "mqtt_subscription.h"
+#include "mqtt_reconnect.h"
+#include "mqtt_loop.h"
+#include "mqtt_keepalive.h"
 
 /*
  *
@@ -92,8 +104,144 @@ typedef struct PacketInfo {
 	uint8_t				*PacketPayload;
 	uint16_t			PacketPayload_length;
 
+	struct OutboxLane	*Lane;  // Outbox lane holding the reservation, while it is being built
 } PacketInfo_t;
 
+/**
+ * A received packet, decoded in one pass by mqtt_parse_packet().
+ * Topic and Payload point into the receive buffer; nothing is copied.
+ */
+typedef struct PacketView {
+	uint8_t				Type;
+	uint8_t				Flags;  // Low nibble of the first byte - DUP, QoS, RETAIN for a PUBLISH
+	uint8_t				Qos;
+	uint16_t			PacketId;  // 0 if the packet has none
+	const uint8_t		*Topic;  // PUBLISH only
+	uint16_t			Topic_length;
+	uint8_t				ReasonCode;  // CONNACK return code; MQTT 5 acks and DISCONNECT too (0 if absent)
+	const uint8_t		*Properties;  // MQTT 5 only; NULL if the packet has none
+	uint32_t			Properties_length;
+	const uint8_t		*Payload;  // What follows the variable header
+	uint32_t			Payload_length;
+	uint32_t			Total_length;  // Fixed header + remaining length
+} PacketView_t;
+
+/**
+ * What data_cb gets for each piece of a received PUBLISH.
+ * A payload that fits the receive buffer comes as one chunk (Offset 0, Data_length == Total_length);
+ *  a bigger one comes as a run of chunks in order, each straight from the receive buffer.
+ * Topic and Data are only valid during the callback.
+ */
+typedef struct DataEvent {
+	const uint8_t		*Topic;  // Not NUL terminated
+	uint16_t			Topic_length;
+	uint16_t			PacketId;
+	uint8_t				Qos;
+	uint8_t				Retain;
+	const uint8_t		*Data;  // This chunk
+	uint32_t			Data_length;
+	uint32_t			Offset;  // Of this chunk in the payload
+	uint32_t			Total_length;  // Of the whole payload
+} DataEvent_t;
+
+/**
+ * Each packet in an outbox lane is preceded by one of these.
+ * Records are padded to 4 bytes so the headers stay aligned.
+ */
+typedef struct OutboxRecord {
+	uint16_t			Length;  // Packet bytes following the record header
+	uint16_t			Flags;
+	TickType_t			Expires;  // Tick after which the packet is not worth sending, if Flags has OUTBOX_RECORD_TTL
+	uint32_t			TopicHash;  // Non zero if the packet is in the coalescing index
+} OutboxRecord_t;
+
+#define OUTBOX_RECORD_TTL			0x0001
+#define OUTBOX_RECORD_SUPERSEDED	0x0002  // A newer publish to the same topic was queued; do not send this one
+#define OUTBOX_RECORD_EXPENDABLE	0x0004  // A fresh publish, which TTL and DROP_OLDEST may throw away
+#define OUTBOX_RECORD_PINNED		0x0008  // The consumer is writing it out without ConsumerLock; DROP_OLDEST must leave it
+
+/**
+ * Coalescing index entry - the newest unsent QoS 0 publish to one topic.
+ */
+typedef struct OutboxTopicSlot {
+	uint32_t			Hash;
+	OutboxRecord_t		*Record;  // NULL if the slot is empty
+} OutboxTopicSlot_t;
+
+/**
+ * One producer's staging ring.
+ * The first task to publish claims a free lane and is its only writer from then on.
+ * The last lane is shared by any tasks that find the others taken, under Lock.
+ */
+typedef struct OutboxLane {
+	TaskHandle_t		Owner;
+	SemaphoreHandle_t	Lock;  // Only for the shared lane
+	Ringbuff_t			Rb;
+	uint8_t				*Buffer;
+} OutboxLane_t;
+
+/**
+ * A whole control packet - PINGREQ, DISCONNECT (2 bytes) or PUBACK, PUBREC, PUBREL, PUBCOMP (4 bytes).
+ * These are small enough to be copied through a FreeRTOS queue.
+ */
+#define MQTT_CONTROL_PACKET_MAX		4
+typedef struct ControlPacket {
+	uint8_t				Length;
+	uint8_t				Data[MQTT_CONTROL_PACKET_MAX];
+} ControlPacket_t;
+
+/**
+ * What the outbox does with a new packet when the producer's lane is full.
+ */
+typedef enum OutboxPolicy {
+	OUTBOX_POLICY_BLOCK = 0,  // Wait up to BlockTicks for room, then fail with ESP_ERR_TIMEOUT
+	OUTBOX_POLICY_REJECT_NEWEST,  // Fail at once with ESP_ERR_NO_MEM
+	OUTBOX_POLICY_DROP_OLDEST  // Throw away the lane's oldest fresh publishes to make room
+} OutboxPolicy_t;
+
+/**
+ * Admission counters, in packets.
+ */
+typedef struct OutboxStats {
+	uint32_t			Accepted;
+	uint32_t			Rejected;  // Refused by BLOCK (timed out) or REJECT_NEWEST
+	uint32_t			Dropped;  // Thrown away by DROP_OLDEST
+	uint32_t			Expired;  // Outlived their TTL before the sending task got to them
+	uint32_t			Coalesced;  // Replaced by a newer publish to the same topic before they were sent
+} OutboxStats_t;
+
+/**
+ * Called with a packet the outbox throws away unsent - by DROP_OLDEST, TTL or coalescing - just before it goes.
+ */
+typedef void (*outbox_drop_fn)(void *p_arg, const uint8_t *p_packet, uint32_t p_length);
+
+/**
+ * Multiple producer, single consumer outbound queue.
+ * mqtt_sending_task (or mqtt_event_loop) is the consumer; producers notify it after each commit.
+ * The Control queue is the high priority lane and is always emptied before the next packet is taken from a Lane.
+ */
+typedef struct Outbox {
+	OutboxLane_t		Lanes[CONFIG_MQTT_OUTBOX_LANES];
+	QueueHandle_t		Control;
+	OutboxPolicy_t		Policy;
+	TickType_t			BlockTicks;
+	TickType_t			TtlTicks;  // For fresh publishes; 0 for no expiry
+	OutboxStats_t		Stats;
+	outbox_drop_fn		OnDrop;  // NULL if nobody needs telling
+	void				*OnDropArg;
+	SemaphoreHandle_t	ConsumerLock;  // Held by the consumer from peek to consume, unless pinned; lets DROP_OLDEST act as consumer
+	uint32_t			Coalesce;  // Non zero to have a new QoS 0 publish replace an unsent one on the same topic
+	SemaphoreHandle_t	IndexLock;
+	OutboxTopicSlot_t	Index[CONFIG_MQTT_OUTBOX_COALESCE_SLOTS];  // Open addressed, linear probing
+	TaskHandle_t		Consumer;
+	int					WakeSocket;  // Also written to by commits, for a consumer waiting in select(); -1 if none
+	uint32_t			WakePending;  // A byte has been written to WakeSocket since the consumer last drained it
+	uint32_t			NextLane;  // Consumer's round robin position
+	OutboxLane_t		*Current;  // Lane of the packet the consumer has peeked
+	uint32_t			Pinned;  // Current is pinned (mqtt_outbox_pin) and ConsumerLock is not held
+	ControlPacket_t		ControlCurrent;  // Control packet the consumer has peeked, if Length > 0
+} Outbox_t;
+
 /**
  * Last Will And Testament for the client
  * If we miss a timeout from the broker, this is what the broker will act on.
@@ -105,8 +253,7 @@ typedef struct Will {
 	uint32_t			WillQos;
 	uint32_t			WillRetain;
 	uint32_t			CleanSession;
-	uint32_t			Keepalive;
-	uint32_t			Keepalive_tick;
+	uint32_t			Keepalive;  // Seconds
 } Will_t;
 
 /**
@@ -117,6 +264,10 @@ typedef struct Buffers {
 	uint8_t				*out_buffer;
 	int					in_buffer_length;
 	int					out_buffer_length;
+	uint8_t				*batch_buffer;  // Small packets gathered here by the sending task for one write
+	int					batch_size;  // 0 turns batching off
+	int					batch_fill;  // Bytes waiting in batch_buffer; kept if a write fails
+	MqttDecoder_t		in_decoder;  // Splits what is read into in_buffer into packets
 } Buffers_t;
 
 /*
@@ -142,6 +293,12 @@ typedef struct BrokerConfig {
 	char 				ClientId[64];
 } BrokerConfig_t;
 
+/*
+ * Protocol levels CONNECT can ask for.
+ */
+#define MQTT_PROTOCOL_LEVEL_311	4
+#define MQTT_PROTOCOL_LEVEL_5	5
+
 /*
  *
  */
@@ -150,9 +307,14 @@ typedef struct State {
 	uint16_t			message_length_read;
 	mqtt_message_t		*outbound_message;
 	mqtt_connection_t	*Connection;
-	uint16_t			pending_msg_id;
-	int					pending_msg_type;
-	int					pending_publish_qos;
+	uint32_t			next_packet_id;  // Shared by all producers; taken atomically
+	Inflight_t			inflight;  // Our QoS 1 and 2 publishes not yet acknowledged
+	InboundQos2_t		inbound_qos2;  // Broker's QoS 2 publishes delivered and waiting for PUBREL; receive task only
+	DataEvent_t			inbound;  // The PUBLISH being streamed to data_cb; receive task only
+	int					inbound_skip;  // Drop the rest of the packet being streamed
+	uint8_t				protocol_level;  // MQTT_PROTOCOL_LEVEL_*; 0 is taken as 3.1.1
+	TopicAlias_t		outbound_alias;  // MQTT 5 topic aliases of this connection; sending task only
+	Keepalive_t			keepalive;  // When to ping, and when to give the connection up
 } State_t;
 
 /*
@@ -163,10 +325,14 @@ typedef struct Client {
 	Buffers_t			*Buffers;
 	Callback_t			*Cb;
 	PacketInfo_t		*Packet;  // mqtt_msg.h
-	QueueHandle_t		*SendingQueue;
-	Ringbuff_t			*Send_rb;
+	Outbox_t			*Outbox;
 	State_t				*State;
 	Will_t				*Will;
+	Router_t			*Router;  // Topic filters to handlers; NULL sends everything to data_cb
+	TopicTable_t		*Topics;  // Interned publish topics
+	SubscriptionSet_t	*Subscriptions;  // Sent again on every connect; NULL keeps none
+	Reconnect_t			*Reconnect;  // Transport task only
+	EventLoop_t			*Loop;  // CONFIG_MQTT_EVENT_LOOP only
 } Client_t;
 
 #endif /* COMPONENTS_MQTT_MQTT_STRUCTS_H_ */
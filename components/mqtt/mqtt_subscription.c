@@ -0,0 +1,219 @@
+/*
+ * mqtt_subscription.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * The client's subscriptions (see SubscriptionSet_t in mqtt_subscription.h).
+ *
+ * Each filter remembers the SUBSCRIBE that last carried it and where in that packet it was,
+ *  so the SUBACK's return codes, which come in the same order as the filters [MQTT-3.9.3-1], can be matched up.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "mqtt_subscription.h"
+
+static const char *TAG = "MqttSubscribe ";
+
+/**
+ * Allocate room for p_filters filters taking up to p_text_size bytes in all.
+ * A p_filters of 0 leaves the set empty; nothing is then sent again on reconnect.
+ */
+esp_err_t mqtt_subscription_init(SubscriptionSet_t *p_set, uint32_t p_filters, uint32_t p_text_size) {
+	memset(p_set, 0, sizeof(SubscriptionSet_t));
+	if (p_filters == 0) {
+		return ESP_OK;
+	}
+	if (p_filters >= 0xffff || p_text_size > 0xffff) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	p_set->Entries = calloc(p_filters + 1, sizeof(SubscriptionEntry_t));
+	p_set->Lock = xSemaphoreCreateMutex();
+	if (p_set->Entries == NULL || p_set->Lock == NULL || mqtt_text_init(&p_set->Pool, p_text_size) != ESP_OK) {
+		ESP_LOGE(TAG, "Init - Not enough memory for %d filters", p_filters);
+		mqtt_subscription_deinit(p_set);
+		return ESP_ERR_NO_MEM;
+	}
+	p_set->Count = 1;
+	p_set->Max = p_filters + 1;
+	return ESP_OK;
+}
+
+void mqtt_subscription_deinit(SubscriptionSet_t *p_set) {
+	free(p_set->Entries);
+	mqtt_text_deinit(&p_set->Pool);
+	if (p_set->Lock != NULL) {
+		vSemaphoreDelete(p_set->Lock);
+	}
+	memset(p_set, 0, sizeof(SubscriptionSet_t));
+}
+
+/*
+ * @return the entry holding p_filter, or 0.  Lock held.
+ */
+static uint32_t subscription_find(SubscriptionSet_t *p_set, const char *p_filter, uint32_t p_length) {
+	SubscriptionEntry_t *l_entry;
+	uint32_t l_ix;
+	for (l_ix = 1; l_ix < p_set->Count; l_ix++) {
+		l_entry = &p_set->Entries[l_ix];
+		if (l_entry->Length == p_length && mqtt_text_equal(&p_set->Pool, l_entry->Text, p_filter, p_length)) {
+			return l_ix;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Describe entry p_ix for a packet builder.  Lock held.
+ */
+static void subscription_filter(SubscriptionSet_t *p_set, uint32_t p_ix, SubscribeFilter_t *r_filter) {
+	SubscriptionEntry_t *l_entry = &p_set->Entries[p_ix];
+	r_filter->Filter = p_set->Pool.Text + l_entry->Text;
+	r_filter->Length = l_entry->Length;
+	r_filter->Qos = l_entry->Qos;
+	r_filter->Entry = p_ix;
+}
+
+/**
+ * Keep p_filter at p_qos, replacing the QoS if it is already kept, and describe it in r_filter for the SUBSCRIBE.
+ * r_filter points at the set's copy of the filter, which stays put.
+ * Safe to call from any task.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for an empty or over long filter, ESP_ERR_NO_MEM if the set is full,
+ *  or ESP_ERR_INVALID_STATE if the set was set up with no room at all.
+ */
+esp_err_t mqtt_subscription_add(SubscriptionSet_t *p_set, const char *p_filter, uint8_t p_qos, SubscribeFilter_t *r_filter) {
+	size_t l_length;
+	uint32_t l_ix;
+	int32_t l_offset;
+
+	memset(r_filter, 0, sizeof(SubscribeFilter_t));
+	if (p_set->Entries == NULL) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (p_filter == NULL || (l_length = strlen(p_filter)) == 0 || l_length > 0xffff) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	xSemaphoreTake(p_set->Lock, portMAX_DELAY);
+	if ((l_ix = subscription_find(p_set, p_filter, l_length)) == 0) {
+		if (p_set->Count >= p_set->Max || (l_offset = mqtt_text_add(&p_set->Pool, p_filter, l_length)) < 0) {
+			xSemaphoreGive(p_set->Lock);
+			ESP_LOGE(TAG, "Add - No room for \"%s\"", p_filter);
+			return ESP_ERR_NO_MEM;
+		}
+		l_ix = p_set->Count++;
+		p_set->Entries[l_ix].Text = l_offset;
+		p_set->Entries[l_ix].Length = l_length;
+	}
+	p_set->Entries[l_ix].Qos = p_qos;
+	p_set->Entries[l_ix].Active = 1;
+	subscription_filter(p_set, l_ix, r_filter);
+	xSemaphoreGive(p_set->Lock);
+	return ESP_OK;
+}
+
+/**
+ * Stop sending p_filter again on reconnect.
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if it was not kept.
+ */
+esp_err_t mqtt_subscription_remove(SubscriptionSet_t *p_set, const char *p_filter) {
+	uint32_t l_ix;
+
+	if (p_set->Entries == NULL || p_filter == NULL) {
+		return ESP_ERR_NOT_FOUND;
+	}
+	xSemaphoreTake(p_set->Lock, portMAX_DELAY);
+	l_ix = subscription_find(p_set, p_filter, strlen(p_filter));
+	if (l_ix != 0) {
+		p_set->Entries[l_ix].Active = 0;
+		p_set->Entries[l_ix].PacketId = 0;
+	}
+	xSemaphoreGive(p_set->Lock);
+	return l_ix != 0 ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+/**
+ * Describe up to p_max of the kept filters, starting at entry *p_cursor (1 for the first), in r_filters
+ *  and move *p_cursor past them.
+ * A caller that packs fewer than it was given carries on from the Entry of the first one left out.
+ *
+ * @return the number described; 0 once there are no more.
+ */
+uint32_t mqtt_subscription_collect(SubscriptionSet_t *p_set, uint32_t *p_cursor, SubscribeFilter_t *r_filters, uint32_t p_max) {
+	uint32_t l_count = 0;
+	uint32_t l_ix;
+
+	if (p_set->Entries == NULL) {
+		return 0;
+	}
+	xSemaphoreTake(p_set->Lock, portMAX_DELAY);
+	for (l_ix = *p_cursor < 1 ? 1 : *p_cursor; l_ix < p_set->Count && l_count < p_max; l_ix++) {
+		if (p_set->Entries[l_ix].Active) {
+			subscription_filter(p_set, l_ix, &r_filters[l_count++]);
+		}
+	}
+	*p_cursor = l_ix;
+	xSemaphoreGive(p_set->Lock);
+	return l_count;
+}
+
+/**
+ * Note that the first p_count of p_filters went in the SUBSCRIBE with packet id p_id, in that order.
+ * Filters that are not kept (Entry 0) are passed over, but still take their place in the packet.
+ */
+void mqtt_subscription_sent(SubscriptionSet_t *p_set, const SubscribeFilter_t *p_filters, uint32_t p_count, uint16_t p_id) {
+	SubscriptionEntry_t *l_entry;
+	uint32_t l_ix;
+
+	if (p_set->Entries == NULL) {
+		return;
+	}
+	xSemaphoreTake(p_set->Lock, portMAX_DELAY);
+	for (l_ix = 0; l_ix < p_count; l_ix++) {
+		if (p_filters[l_ix].Entry == 0 || p_filters[l_ix].Entry >= p_set->Count) {
+			continue;
+		}
+		l_entry = &p_set->Entries[p_filters[l_ix].Entry];
+		l_entry->PacketId = p_id;
+		l_entry->Position = l_ix;
+		l_entry->Granted = MQTT_SUBSCRIPTION_PENDING;
+	}
+	xSemaphoreGive(p_set->Lock);
+}
+
+/**
+ * Take the p_count return codes of the SUBACK for packet id p_id.
+ * Receive task only.
+ *
+ * @return the number of kept filters they answered; refusals are logged.
+ */
+uint32_t mqtt_subscription_granted(SubscriptionSet_t *p_set, uint16_t p_id, const uint8_t *p_codes, uint32_t p_count) {
+	SubscriptionEntry_t *l_entry;
+	uint32_t l_matched = 0;
+	uint32_t l_ix;
+
+	if (p_set->Entries == NULL || p_id == 0) {
+		return 0;
+	}
+	xSemaphoreTake(p_set->Lock, portMAX_DELAY);
+	for (l_ix = 1; l_ix < p_set->Count; l_ix++) {
+		l_entry = &p_set->Entries[l_ix];
+		if (l_entry->PacketId != p_id || l_entry->Position >= p_count) {
+			continue;
+		}
+		l_entry->Granted = p_codes[l_entry->Position];
+		l_entry->PacketId = 0;
+		l_matched++;
+		if (l_entry->Granted >= 0x80) {
+			ESP_LOGW(TAG, "Granted - Broker refused \"%.*s\", code 0x%02x", l_entry->Length, p_set->Pool.Text + l_entry->Text, l_entry->Granted);
+		}
+	}
+	xSemaphoreGive(p_set->Lock);
+	return l_matched;
+}
+
+// ### END DBK
@@ -0,0 +1,73 @@
+/*
+ * mqtt_subscription.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#ifndef COMPONENTS_MQTT_MQTT_SUBSCRIPTION_H_
+#define COMPONENTS_MQTT_MQTT_SUBSCRIPTION_H_
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_err.h"
+
+#include "mqtt_text.h"
+
+/*
+ * Granted until the SUBACK for the filter comes back.
+ */
+#define MQTT_SUBSCRIPTION_PENDING	0xff
+
+/**
+ * One filter of a SUBSCRIBE or UNSUBSCRIBE being built.
+ */
+typedef struct SubscribeFilter {
+	const char			*Filter;  // Not NUL terminated
+	uint16_t			Length;
+	uint8_t				Qos;  // SUBSCRIBE only
+	uint16_t			Entry;  // In the client's SubscriptionSet_t; 0 if it is not kept there
+} SubscribeFilter_t;
+
+/**
+ * A filter the client is subscribed to.
+ */
+typedef struct SubscriptionEntry {
+	uint16_t			Text;  // Where the filter is in SubscriptionSet.Pool
+	uint16_t			Length;
+	uint16_t			PacketId;  // Of the SUBSCRIBE that last carried it
+	uint16_t			Position;  // Of the filter in that SUBSCRIBE, which is where its SUBACK return code is
+	uint8_t				Qos;  // Asked for
+	uint8_t				Granted;  // SUBACK return code: the QoS granted, 0x80 (or an MQTT 5 reason >= 0x80) if refused
+	uint8_t				Active;  // 0 once unsubscribed
+} SubscriptionEntry_t;
+
+/**
+ * Every filter the client has subscribed to, so the lot can be sent again, packed into as few SUBSCRIBEs
+ *  as will hold them, each time the client connects.
+ *
+ * Filters are only ever appended; an unsubscribed one is marked inactive and comes back if it is subscribed again.
+ * Everything is allocated once by mqtt_subscription_init(); Lock covers every change.
+ */
+typedef struct SubscriptionSet {
+	SubscriptionEntry_t	*Entries;  // Entry 0 is unused
+	TextPool_t			Pool;
+	uint32_t			Count;  // Entries used, entry 0 included
+	uint32_t			Max;
+	SemaphoreHandle_t	Lock;
+} SubscriptionSet_t;
+
+esp_err_t mqtt_subscription_init(SubscriptionSet_t *p_set, uint32_t p_filters, uint32_t p_text_size);
+void mqtt_subscription_deinit(SubscriptionSet_t *p_set);
+esp_err_t mqtt_subscription_add(SubscriptionSet_t *p_set, const char *p_filter, uint8_t p_qos, SubscribeFilter_t *r_filter);
+esp_err_t mqtt_subscription_remove(SubscriptionSet_t *p_set, const char *p_filter);
+uint32_t mqtt_subscription_collect(SubscriptionSet_t *p_set, uint32_t *p_cursor, SubscribeFilter_t *r_filters, uint32_t p_max);
+void mqtt_subscription_sent(SubscriptionSet_t *p_set, const SubscribeFilter_t *p_filters, uint32_t p_count, uint16_t p_id);
+uint32_t mqtt_subscription_granted(SubscriptionSet_t *p_set, uint16_t p_id, const uint8_t *p_codes, uint32_t p_count);
+
+#endif /* COMPONENTS_MQTT_MQTT_SUBSCRIPTION_H_ */
+
+// ### END DBK
@@ -0,0 +1,65 @@
+/*
+ * mqtt_text.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * The name store and hash shared by the topic, alias, subscription and router tables (see TextPool_t in mqtt_text.h).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mqtt_text.h"
+
+/**
+ * FNV-1a of p_length bytes.
+ */
+uint32_t mqtt_text_hash(const void *p_text, uint32_t p_length) {
+	const uint8_t *l_ptr = p_text;
+	uint32_t l_hash = 2166136261u;
+	while (p_length--) {
+		l_hash = (l_hash ^ *l_ptr++) * 16777619u;
+	}
+	return l_hash;
+}
+
+/**
+ * Allocate room for p_size bytes of names.
+ */
+esp_err_t mqtt_text_init(TextPool_t *p_pool, uint32_t p_size) {
+	memset(p_pool, 0, sizeof(TextPool_t));
+	if ((p_pool->Text = malloc(p_size ? p_size : 1)) == NULL) {
+		return ESP_ERR_NO_MEM;
+	}
+	p_pool->Size = p_size;
+	return ESP_OK;
+}
+
+void mqtt_text_deinit(TextPool_t *p_pool) {
+	free(p_pool->Text);
+	memset(p_pool, 0, sizeof(TextPool_t));
+}
+
+/**
+ * Copy p_length bytes of p_text in.  Not NUL terminated; the caller keeps the length.
+ * @return where it went in Text, or -1 if there is no room.
+ */
+int32_t mqtt_text_add(TextPool_t *p_pool, const void *p_text, uint32_t p_length) {
+	uint32_t l_offset = p_pool->Fill;
+	if (p_length > p_pool->Size - l_offset) {
+		return -1;
+	}
+	memcpy(p_pool->Text + l_offset, p_text, p_length);
+	p_pool->Fill += p_length;
+	return l_offset;
+}
+
+/**
+ * Forget every name; offsets handed out before are no longer good.
+ */
+void mqtt_text_clear(TextPool_t *p_pool) {
+	p_pool->Fill = 0;
+}
+
+// ### END DBK
@@ -0,0 +1,46 @@
+/*
+ * mqtt_text.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#ifndef COMPONENTS_MQTT_MQTT_TEXT_H_
+#define COMPONENTS_MQTT_MQTT_TEXT_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_err.h"
+
+/**
+ * Append only store for the names the client's tables keep - interned topics, aliased topics, subscription filters
+ *  and router levels.
+ *
+ * A name is added once and then found by its offset in Text; nothing is ever removed, short of mqtt_text_clear().
+ * Text is allocated once by mqtt_text_init(), so an offset, and a pointer made from it, stays good.
+ * Takes no lock: the table the pool belongs to serializes adds.
+ */
+typedef struct TextPool {
+	char				*Text;
+	uint32_t			Fill;
+	uint32_t			Size;
+} TextPool_t;
+
+uint32_t mqtt_text_hash(const void *p_text, uint32_t p_length);
+
+esp_err_t mqtt_text_init(TextPool_t *p_pool, uint32_t p_size);
+void mqtt_text_deinit(TextPool_t *p_pool);
+int32_t mqtt_text_add(TextPool_t *p_pool, const void *p_text, uint32_t p_length);
+void mqtt_text_clear(TextPool_t *p_pool);
+
+/*
+ * @return 1 if the p_length bytes at p_offset are p_text.
+ */
+static inline int mqtt_text_equal(const TextPool_t *p_pool, uint32_t p_offset, const void *p_text, uint32_t p_length) {
+	return memcmp(p_pool->Text + p_offset, p_text, p_length) == 0;
+}
+
+#endif /* COMPONENTS_MQTT_MQTT_TEXT_H_ */
+
+// ### END DBK
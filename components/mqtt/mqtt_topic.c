@@ -0,0 +1,196 @@
+/*
+ * mqtt_topic.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * Interned publish topics (see TopicTable_t in mqtt_topic.h).
+ *
+ * A topic is checked and encoded once, when it is interned; publishing by its handle then has nothing to scan.
+ * Topic names must be UTF-8 of 1 to 65535 bytes without wildcards [MQTT-4.7.3-1] [MQTT-3.3.2-2].
+ * The UTF-8 must be well formed, with no surrogates and no U+0000 [MQTT-1.5.3-1] [MQTT-1.5.3-2]; a C string
+ *  cannot hold a plain U+0000, and its overlong form is refused with the rest.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "mqtt_topic.h"
+
+static const char *TAG = "MqttTopic     ";
+
+/*
+ * @return the entry for p_handle, or NULL if it was never handed out.
+ */
+static TopicEntry_t *topic_entry(TopicTable_t *p_table, TopicHandle_t p_handle) {
+	if (p_handle == 0 || p_handle >= __atomic_load_n(&p_table->Count, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+	return &p_table->Entries[p_handle];
+}
+
+/*
+ * @return 1 if p_text is well formed UTF-8: shortest form, no surrogates, nothing above U+10FFFF.
+ */
+static int topic_utf8_valid(const uint8_t *p_text, size_t p_length) {
+	size_t l_ix = 0, l_more;
+	uint32_t l_code, l_min;
+
+	while (l_ix < p_length) {
+		l_code = p_text[l_ix++];
+		if (l_code < 0x80) {
+			continue;
+		} else if (l_code >= 0xc2 && l_code <= 0xdf) {
+			l_more = 1;
+			l_min = 0x80;
+			l_code &= 0x1f;
+		} else if (l_code >= 0xe0 && l_code <= 0xef) {
+			l_more = 2;
+			l_min = 0x800;
+			l_code &= 0x0f;
+		} else if (l_code >= 0xf0 && l_code <= 0xf4) {
+			l_more = 3;
+			l_min = 0x10000;
+			l_code &= 0x07;
+		} else {
+			return 0;
+		}
+		if (l_ix + l_more > p_length) {
+			return 0;
+		}
+		while (l_more-- > 0) {
+			if ((p_text[l_ix] & 0xc0) != 0x80) {
+				return 0;
+			}
+			l_code = l_code << 6 | (p_text[l_ix++] & 0x3f);
+		}
+		if (l_code < l_min || (l_code >= 0xd800 && l_code <= 0xdfff) || l_code > 0x10ffff) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Allocate room for p_handles topics, whose text (less the shared prefix) takes up to p_text_size bytes in all.
+ * p_prefix, which may be NULL, is the start most topics share; it is stored once.
+ * A p_handles of 0 leaves the table empty; topics are then only published by name.
+ */
+esp_err_t mqtt_topic_table_init(TopicTable_t *p_table, const char *p_prefix, uint32_t p_handles, uint32_t p_text_size) {
+	uint32_t l_prefix = p_prefix ? strlen(p_prefix) : 0;
+
+	memset(p_table, 0, sizeof(TopicTable_t));
+	if (p_handles == 0) {
+		return ESP_OK;
+	}
+	if (p_handles >= 0xffff || p_text_size > 0xffff || l_prefix > p_text_size) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	p_table->Entries = calloc(p_handles + 1, sizeof(TopicEntry_t));
+	p_table->Lock = xSemaphoreCreateMutex();
+	if (p_table->Entries == NULL || p_table->Lock == NULL || mqtt_text_init(&p_table->Pool, p_text_size) != ESP_OK) {
+		ESP_LOGE(TAG, "Init - Not enough memory for %d topics", p_handles);
+		mqtt_topic_table_deinit(p_table);
+		return ESP_ERR_NO_MEM;
+	}
+	mqtt_text_add(&p_table->Pool, p_prefix, l_prefix);
+	p_table->PrefixLength = l_prefix;
+	p_table->Count = 1;
+	p_table->Max = p_handles + 1;
+	return ESP_OK;
+}
+
+void mqtt_topic_table_deinit(TopicTable_t *p_table) {
+	free(p_table->Entries);
+	mqtt_text_deinit(&p_table->Pool);
+	if (p_table->Lock != NULL) {
+		vSemaphoreDelete(p_table->Lock);
+	}
+	memset(p_table, 0, sizeof(TopicTable_t));
+}
+
+/**
+ * Register p_topic and hand back its handle.  Interning the same topic again hands back the same handle.
+ * Safe to call from any task.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for an empty, over long, wildcard or malformed UTF-8 topic, ESP_ERR_NO_MEM if the table is full,
+ *  or ESP_ERR_INVALID_STATE if the table was set up with no room at all.
+ */
+esp_err_t mqtt_topic_intern(TopicTable_t *p_table, const char *p_topic, TopicHandle_t *r_handle) {
+	size_t l_topic_len;
+	const char *l_text;
+	uint32_t l_length, l_ix;
+	int32_t l_offset;
+	uint8_t l_prefixed;
+	TopicEntry_t *l_entry;
+
+	*r_handle = 0;
+	if (p_table->Entries == NULL) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (p_topic == NULL || (l_topic_len = strlen(p_topic)) == 0 || l_topic_len > 0xffff || strpbrk(p_topic, "+#") != NULL
+			|| !topic_utf8_valid((const uint8_t *) p_topic, l_topic_len)) {
+		ESP_LOGE(TAG, "Intern - Bad topic \"%s\"", p_topic ? p_topic : "");
+		return ESP_ERR_INVALID_ARG;
+	}
+	l_prefixed = p_table->PrefixLength > 0 && l_topic_len > p_table->PrefixLength
+			&& mqtt_text_equal(&p_table->Pool, 0, p_topic, p_table->PrefixLength);
+	l_text = l_prefixed ? p_topic + p_table->PrefixLength : p_topic;
+	l_length = l_prefixed ? l_topic_len - p_table->PrefixLength : l_topic_len;
+
+	xSemaphoreTake(p_table->Lock, portMAX_DELAY);
+	for (l_ix = 1; l_ix < p_table->Count; l_ix++) {
+		l_entry = &p_table->Entries[l_ix];
+		if (l_entry->Prefixed == l_prefixed && l_entry->Length == l_length && mqtt_text_equal(&p_table->Pool, l_entry->Text, l_text, l_length)) {
+			xSemaphoreGive(p_table->Lock);
+			*r_handle = l_ix;
+			return ESP_OK;
+		}
+	}
+	if (p_table->Count >= p_table->Max || (l_offset = mqtt_text_add(&p_table->Pool, l_text, l_length)) < 0) {
+		xSemaphoreGive(p_table->Lock);
+		ESP_LOGE(TAG, "Intern - No room for \"%s\"", p_topic);
+		return ESP_ERR_NO_MEM;
+	}
+	l_entry = &p_table->Entries[p_table->Count];
+	l_entry->Encoded[0] = l_topic_len >> 8;
+	l_entry->Encoded[1] = l_topic_len & 0xff;
+	l_entry->Prefixed = l_prefixed;
+	l_entry->Length = l_length;
+	l_entry->Text = l_offset;
+	*r_handle = p_table->Count;
+	__atomic_store_n(&p_table->Count, p_table->Count + 1, __ATOMIC_RELEASE);
+	xSemaphoreGive(p_table->Lock);
+	return ESP_OK;
+}
+
+/**
+ * @return the bytes the topic takes in a packet, its two byte length included; 0 for a bad handle.
+ */
+uint32_t mqtt_topic_encoded_length(TopicTable_t *p_table, TopicHandle_t p_handle) {
+	TopicEntry_t *l_entry = topic_entry(p_table, p_handle);
+	if (l_entry == NULL) {
+		return 0;
+	}
+	return 2 + (l_entry->Encoded[0] << 8 | l_entry->Encoded[1]);
+}
+
+/**
+ * Write the topic, as a length prefixed string, at p_ptr.  The handle must have been checked with mqtt_topic_encoded_length().
+ * @return the byte after it.
+ */
+uint8_t *mqtt_topic_put(TopicTable_t *p_table, TopicHandle_t p_handle, uint8_t *p_ptr) {
+	TopicEntry_t *l_entry = &p_table->Entries[p_handle];
+	*p_ptr++ = l_entry->Encoded[0];
+	*p_ptr++ = l_entry->Encoded[1];
+	if (l_entry->Prefixed) {
+		memcpy(p_ptr, p_table->Pool.Text, p_table->PrefixLength);
+		p_ptr += p_table->PrefixLength;
+	}
+	memcpy(p_ptr, p_table->Pool.Text + l_entry->Text, l_entry->Length);
+	return p_ptr + l_entry->Length;
+}
+
+// ### END DBK
@@ -0,0 +1,62 @@
+/*
+ * mqtt_topic.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#ifndef COMPONENTS_MQTT_MQTT_TOPIC_H_
+#define COMPONENTS_MQTT_MQTT_TOPIC_H_
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_err.h"
+
+#include "mqtt_text.h"
+
+/**
+ * A topic registered with mqtt_topic_intern(); 0 is never a valid handle.
+ */
+typedef uint16_t TopicHandle_t;
+
+/**
+ * One interned topic, as it goes on the wire: the two byte length, then the prefix if it has it, then its own text.
+ */
+typedef struct TopicEntry {
+	uint16_t			Text;  // Where the stored text is in TopicTable.Pool
+	uint16_t			Length;  // Of the stored text
+	uint8_t				Encoded[2];  // Length of the whole topic, big endian, ready to copy
+	uint8_t				Prefixed;  // 1 if the topic is the prefix followed by the stored text
+} TopicEntry_t;
+
+/**
+ * Publish topics encoded once, when they are registered, instead of measured and copied on every publish.
+ *
+ * The prefix every topic of the house shares ("pyhouse/<house>/") is kept once, at the front of Pool;
+ *  each topic that starts with it stores only the rest.
+ * Putting a topic into a packet is then its two length bytes and one or two memcpy()s.
+ *
+ * Everything is allocated once by mqtt_topic_table_init().  Entries are only ever appended, and Count is
+ *  published with release ordering once an entry is complete, so any task may publish by handle without a lock.
+ */
+typedef struct TopicTable {
+	TopicEntry_t		*Entries;  // Entry 0 is unused
+	TextPool_t			Pool;
+	uint32_t			PrefixLength;  // The first PrefixLength bytes of Pool
+	uint32_t			Count;
+	uint32_t			Max;
+	SemaphoreHandle_t	Lock;  // Held by mqtt_topic_intern() only
+} TopicTable_t;
+
+esp_err_t mqtt_topic_table_init(TopicTable_t *p_table, const char *p_prefix, uint32_t p_handles, uint32_t p_text_size);
+void mqtt_topic_table_deinit(TopicTable_t *p_table);
+esp_err_t mqtt_topic_intern(TopicTable_t *p_table, const char *p_topic, TopicHandle_t *r_handle);
+uint32_t mqtt_topic_encoded_length(TopicTable_t *p_table, TopicHandle_t p_handle);
+uint8_t *mqtt_topic_put(TopicTable_t *p_table, TopicHandle_t p_handle, uint8_t *p_ptr);
+
+#endif /* COMPONENTS_MQTT_MQTT_TOPIC_H_ */
+
+// ### END DBK
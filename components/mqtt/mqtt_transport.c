@@ -5,10 +5,13 @@
  *      Author: briank
  */
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esp_log.h"
 #include "esp_system.h"
 #include "lwip/sockets.h"
@@ -21,6 +24,8 @@
 
 static const char *TAG = "Mqtt_Transport";
 
+static TransportStats_t s_stats;
+
 
 /*
  *  Set the socket timeout (in seconds)
@@ -34,18 +39,117 @@ void mqtt_transport_set_timeout(uint32_t p_socket, int p_timeout) {
 }
 
 /*
- * In order to avoid coppying stuff all over, we can write the 3 parts of the packet
+ * Turn Nagle's algorithm off (p_on = 1) so each packet goes out as soon as it is written.
+ */
+esp_err_t mqtt_transport_set_nodelay(uint32_t p_socket, int p_on) {
+	if (setsockopt(p_socket, IPPROTO_TCP, TCP_NODELAY, &p_on, sizeof(p_on)) != 0) {
+		ESP_LOGW(TAG, "SetNodelay - Failed, errno:%d", errno);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+/*
+ * Ask for a p_bytes socket send buffer.
+ * lwIP builds without SO_SNDBUF support refuse this; the send buffer is then fixed by TCP_SND_BUF.
+ */
+esp_err_t mqtt_transport_set_send_buffer(uint32_t p_socket, int p_bytes) {
+	if (setsockopt(p_socket, SOL_SOCKET, SO_SNDBUF, &p_bytes, sizeof(p_bytes)) != 0) {
+		ESP_LOGW(TAG, "SetSendBuffer - Not supported, errno:%d", errno);
+		return ESP_ERR_NOT_SUPPORTED;
+	}
+	return ESP_OK;
+}
+
+/*
+ * Wait up to MQTT_TRANSPORT_WRITE_WAIT_MS for room in the socket's send buffer.
+ */
+static int transport_wait_writable(uint32_t p_socket) {
+	fd_set l_fds;
+	struct timeval l_timeout;
+	FD_ZERO(&l_fds);
+	FD_SET(p_socket, &l_fds);
+	l_timeout.tv_sec = MQTT_TRANSPORT_WRITE_WAIT_MS / 1000;
+	l_timeout.tv_usec = (MQTT_TRANSPORT_WRITE_WAIT_MS % 1000) * 1000;
+	return select(p_socket + 1, NULL, &l_fds, NULL, &l_timeout) > 0;
+}
+
+/*
+ * Write every byte of the p_count buffers in p_iov, in as few syscalls as the socket allows.
+ * A partial write carries on from where it stopped; EAGAIN waits for the socket to drain.
+ * p_iov is used as scratch and is not valid afterwards.
+ *
+ * @return the bytes written (all of them), or -1 on error or if the socket stayed full.
+ */
+int mqtt_transport_writev(uint32_t p_socket, struct iovec *p_iov, int p_count) {
+	int l_total = 0;
+	int l_written;
+	while (p_count > 0) {
+		l_written = writev(p_socket, p_iov, p_count);
+		s_stats.Syscalls++;
+		if (l_written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) && transport_wait_writable(p_socket)) {
+				s_stats.Retries++;
+				continue;
+			}
+			ESP_LOGE(TAG, "TransportWrite - Failed after %d bytes, errno:%d", l_total, errno);
+			return -1;
+		}
+		l_total += l_written;
+		// Step over whatever went out, which may end part way into a buffer
+		while (p_count > 0 && l_written >= (int) p_iov->iov_len) {
+			l_written -= p_iov->iov_len;
+			p_iov++;
+			p_count--;
+		}
+		if (p_count > 0) {
+			p_iov->iov_base = (uint8_t *) p_iov->iov_base + l_written;
+			p_iov->iov_len -= l_written;
+			s_stats.Retries++;
+		}
+	}
+	s_stats.Packets++;
+	s_stats.Bytes += l_total;
+	return l_total;
+}
+
+/*
+ * Write one whole packet from a single buffer.
+ */
+int mqtt_transport_write_buffer(uint32_t p_socket, uint8_t *p_data, int p_length) {
+	struct iovec l_iov;
+	l_iov.iov_base = p_data;
+	l_iov.iov_len = p_length;
+	return mqtt_transport_writev(p_socket, &l_iov, 1);
+}
+
+/*
+ * In order to avoid coppying stuff all over, we gather the 3 parts of the packet into one writev.
  */
 int mqtt_transport_write(uint32_t p_socket, PacketInfo_t *p_packet) {
-	int l_write_length = 0;
-	ESP_LOGI(TAG, "TransportWrite - Begin");
-	l_write_length += write(p_socket, p_packet->PacketFixedHeader, p_packet->PacketFixedHeader_length);
-	ESP_LOGI(TAG, "TransportWrite - Fixed:%d", l_write_length);
-	l_write_length += write(p_socket, p_packet->PacketVariableHeader, p_packet->PacketVariableHeader_length);
-	ESP_LOGI(TAG, "TransportWrite - Variable:%d", l_write_length);
-	l_write_length += write(p_socket, p_packet->PacketPayload, p_packet->PacketPayload_length);
-	ESP_LOGI(TAG, "TransportWrite - Payload:%d", l_write_length);
-	return l_write_length;
+	struct iovec l_iov[3];
+	int l_count = 0;
+	if (p_packet->PacketFixedHeader_length) {
+		l_iov[l_count].iov_base = p_packet->PacketFixedHeader;
+		l_iov[l_count++].iov_len = p_packet->PacketFixedHeader_length;
+	}
+	if (p_packet->PacketVariableHeader_length) {
+		l_iov[l_count].iov_base = p_packet->PacketVariableHeader;
+		l_iov[l_count++].iov_len = p_packet->PacketVariableHeader_length;
+	}
+	if (p_packet->PacketPayload_length) {
+		l_iov[l_count].iov_base = p_packet->PacketPayload;
+		l_iov[l_count++].iov_len = p_packet->PacketPayload_length;
+	}
+	ESP_LOGD(TAG, "TransportWrite - %d parts", l_count);
+	return mqtt_transport_writev(p_socket, l_iov, l_count);
+}
+
+void mqtt_transport_get_stats(TransportStats_t *r_stats) {
+	*r_stats = s_stats;
 }
 
 int mqtt_transport_read(uint32_t p_socket, uint8_t *p_buffer){
@@ -56,56 +160,140 @@ int mqtt_transport_read(uint32_t p_socket, uint8_t *p_buffer){
 	return l_read_length;
 }
 
+/**
+ * Read up to p_length bytes - whatever the socket has, which may be part of a packet or several packets.
+ * Retries an interrupted read.
+ * @return bytes read, 0 if the broker closed the connection, < 0 on error or timeout.
+ */
+int mqtt_transport_read_some(uint32_t p_socket, uint8_t *p_buffer, int p_length) {
+	int l_read_length;
+	do {
+		l_read_length = read(p_socket, p_buffer, p_length);
+	} while (l_read_length < 0 && errno == EINTR);
+	ESP_LOGD(TAG, "TransportReadSome - Length:%d", l_read_length);
+	return l_read_length;
+}
+
+
+/*
+ * Put the socket in or out of non-blocking mode.
+ */
+static void transport_set_nonblocking(int p_socket, int p_on) {
+	int l_flags = fcntl(p_socket, F_GETFL, 0);
+	fcntl(p_socket, F_SETFL, p_on ? (l_flags | O_NONBLOCK) : (l_flags & ~O_NONBLOCK));
+}
 
 /**
+ * Start a TCP connection to the broker at p_address without waiting for the handshake,
+ *  so the caller can get on with building CONNECT while it is in flight.
+ * @return the socket, or -1.
+ */
+int mqtt_transport_connect_start(const struct in_addr *p_address, int p_port) {
+	struct sockaddr_in l_remote_ip;
+	int l_sock;
+
+	l_sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (l_sock < 0) {
+		ESP_LOGE(TAG, " 45 Client_Connect - No socket, errno:%d", errno);
+		return -1;
+	}
+	bzero(&l_remote_ip, sizeof(struct sockaddr_in));
+	l_remote_ip.sin_family = AF_INET;
+	l_remote_ip.sin_addr = *p_address;
+	l_remote_ip.sin_port = htons(p_port);
+	ESP_LOGI(TAG, " 62 Client_Connect - Connecting to server %s: port:%d", inet_ntoa(l_remote_ip.sin_addr), p_port);
+	transport_set_nonblocking(l_sock, 1);
+	if (connect(l_sock, (struct sockaddr *) &l_remote_ip, sizeof(l_remote_ip)) != 0 && errno != EINPROGRESS) {
+		ESP_LOGE(TAG, " 65 Client_Connect - Network Connection error, errno:%d", errno);
+		close(l_sock);
+		return -1;
+	}
+	return l_sock;
+}
+
+/**
+ * Wait up to p_timeout_ms for the handshake mqtt_transport_connect_start() began,
+ *  then put the socket back in blocking mode with the client's socket options.
+ * The caller closes the socket if this fails.
  *
+ * @return ESP_OK, ESP_ERR_TIMEOUT if the deadline passed, or ESP_FAIL if the broker refused.
  */
-static int resolve_dns(const char *p_host, struct sockaddr_in *p_ip) {
-	struct hostent *l_he;
-	struct in_addr **l_addr_list;
-	ESP_LOGI(TAG, "Resolve_Dns - All");
-	l_he = gethostbyname(p_host);
-	if (l_he == NULL)
-		return 0;
-	l_addr_list = (struct in_addr **) l_he->h_addr_list;
-	if (l_addr_list[0] == NULL)
-		return 0;
-	p_ip->sin_family = AF_INET;
-	memcpy(&p_ip->sin_addr, l_addr_list[0], sizeof(p_ip->sin_addr));
-	return 1;
+esp_err_t mqtt_transport_connect_wait(int p_socket, uint32_t p_timeout_ms) {
+	struct timeval l_timeout;
+	fd_set l_fds;
+	int l_error = 0;
+	socklen_t l_len = sizeof(l_error);
+	int l_ready;
+
+	FD_ZERO(&l_fds);
+	FD_SET(p_socket, &l_fds);
+	l_timeout.tv_sec = p_timeout_ms / 1000;
+	l_timeout.tv_usec = (p_timeout_ms % 1000) * 1000;
+	do {
+		l_ready = select(p_socket + 1, NULL, &l_fds, NULL, &l_timeout);
+	} while (l_ready < 0 && errno == EINTR);
+	if (l_ready == 0) {
+		ESP_LOGW(TAG, " 66 Client_Connect - No answer in %" PRIu32 " ms", p_timeout_ms);
+		return ESP_ERR_TIMEOUT;
+	}
+	if (l_ready < 0 || getsockopt(p_socket, SOL_SOCKET, SO_ERROR, &l_error, &l_len) != 0 || l_error != 0) {
+		ESP_LOGE(TAG, " 67 Client_Connect - Network Connection error, errno:%d", l_ready < 0 ? errno : l_error);
+		return ESP_FAIL;
+	}
+	transport_set_nonblocking(p_socket, 0);
+#ifdef CONFIG_MQTT_TCP_NODELAY
+	mqtt_transport_set_nodelay(p_socket, 1);
+#endif
+	if (CONFIG_MQTT_TCP_SEND_BUFFER_BYTE > 0) {
+		mqtt_transport_set_send_buffer(p_socket, CONFIG_MQTT_TCP_SEND_BUFFER_BYTE);
+	}
+	return ESP_OK;
 }
 
 /**
- * Establish a network connection to the broker.
+ * A loopback UDP socket connected to itself, for waking a task that waits in select():
+ *  mqtt_transport_wakeup() from any task makes it readable.
+ * lwIP has no socketpair() or pipe(), so this is the cheapest thing select() can watch for another task.
+ * @return the socket, non-blocking, or -1.
  */
-int mqtt_transport_connect(const char *p_host, int p_port) {
-	int   l_sock;
-	struct sockaddr_in   l_remote_ip;
-	ESP_LOGI(TAG, " 45 Client_Connect - Begin     ");
-	while (1) {
-		bzero(&l_remote_ip, sizeof(struct sockaddr_in));
-		l_remote_ip.sin_family = AF_INET;
-		//if stream_host is not ip address, resolve it
-		if (inet_aton(p_host, &(l_remote_ip.sin_addr)) == 0) {
-			ESP_LOGI(TAG, " 51 Client_Connect - Resolve dns for domain: %s", p_host);
-			if (!resolve_dns(p_host, &l_remote_ip)) {
-				vTaskDelay(1000 / portTICK_RATE_MS);
-				continue;
-			}
-		}
-		l_sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
-		if (l_sock == -1) {
-			continue;
-		}
-		l_remote_ip.sin_port = htons(p_port);
-		ESP_LOGI(TAG, " 62 Client_Connect - Connecting to server %s: port:%d, From Local port:%d", inet_ntoa((l_remote_ip.sin_addr)), p_port, l_remote_ip.sin_port);
-		if (connect(l_sock, (struct sockaddr * )(&l_remote_ip), sizeof(struct sockaddr)) != 00) {
-			close(l_sock);
-			ESP_LOGE(TAG, " 65 Client_Connect - Network Connection error.");
-			vTaskDelay(1000 / portTICK_RATE_MS);
-			continue;
-		}
-		return l_sock;
+int mqtt_transport_wakeup_open(void) {
+	struct sockaddr_in l_addr;
+	socklen_t l_len = sizeof(l_addr);
+	int l_sock;
+
+	l_sock = socket(PF_INET, SOCK_DGRAM, 0);
+	if (l_sock < 0) {
+		ESP_LOGE(TAG, " 70 Wakeup - No socket, errno:%d", errno);
+		return -1;
+	}
+	bzero(&l_addr, sizeof(l_addr));
+	l_addr.sin_family = AF_INET;
+	l_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(l_sock, (struct sockaddr *) &l_addr, sizeof(l_addr)) != 0
+			|| getsockname(l_sock, (struct sockaddr *) &l_addr, &l_len) != 0
+			|| connect(l_sock, (struct sockaddr *) &l_addr, sizeof(l_addr)) != 0) {
+		ESP_LOGE(TAG, " 71 Wakeup - Could not bind to loopback, errno:%d", errno);
+		close(l_sock);
+		return -1;
+	}
+	transport_set_nonblocking(l_sock, 1);
+	return l_sock;
+}
+
+/**
+ * Make the wakeup socket readable. Safe from any task.
+ */
+void mqtt_transport_wakeup(int p_socket) {
+	uint8_t l_byte = 0;
+	send(p_socket, &l_byte, 1, 0);
+}
+
+/**
+ * Read every wakeup datagram waiting, so select() sleeps again.
+ */
+void mqtt_transport_wakeup_drain(int p_socket) {
+	uint8_t l_bytes[16];
+	while (recv(p_socket, l_bytes, sizeof(l_bytes), 0) > 0) {
 	}
 }
 
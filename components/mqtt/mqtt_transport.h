@@ -10,19 +10,44 @@
 
 #include <stdint.h>
 #include <string.h>
+#include "lwip/sockets.h"
 
+#include "esp_err.h"
+#include "mqtt_structs.h"
 
-// Public interfaces
+/*
+ * How long a write waits for room in a full socket send buffer before giving up.
+ */
+#define MQTT_TRANSPORT_WRITE_WAIT_MS	5000
 
 /*
- * @param host is the hostname
- * @param port is the port number
- * @return a socket handle.
+ * Write side counters, for working out syscalls per packet.
+ * Only the sending task (or mqtt_connect, before it starts) writes, so these are not atomic.
  */
-int mqtt_transport_connect(const char *host, int port);
+typedef struct TransportStats {
+	uint32_t			Packets;
+	uint32_t			Bytes;
+	uint32_t			Syscalls;  // writev calls, including retries
+	uint32_t			Retries;  // Partial writes and EAGAIN waits
+} TransportStats_t;
+
+
+// Public interfaces
+
+int mqtt_transport_connect_start(const struct in_addr *p_address, int p_port);
+esp_err_t mqtt_transport_connect_wait(int p_socket, uint32_t p_timeout_ms);
 void mqtt_transport_set_timeout(uint32_t p_socket, int p_timeout);
+esp_err_t mqtt_transport_set_nodelay(uint32_t p_socket, int p_on);
+esp_err_t mqtt_transport_set_send_buffer(uint32_t p_socket, int p_bytes);
 int mqtt_transport_write(uint32_t p_socket, PacketInfo_t *p_packet);
+int mqtt_transport_writev(uint32_t p_socket, struct iovec *p_iov, int p_count);
+int mqtt_transport_write_buffer(uint32_t p_socket, uint8_t *p_data, int p_length);
+void mqtt_transport_get_stats(TransportStats_t *r_stats);
 int mqtt_transport_read(uint32_t p_socket, uint8_t *p_buffers);
+int mqtt_transport_read_some(uint32_t p_socket, uint8_t *p_buffer, int p_length);
+int mqtt_transport_wakeup_open(void);
+void mqtt_transport_wakeup(int p_socket);
+void mqtt_transport_wakeup_drain(int p_socket);
 
 
 
@@ -2,9 +2,23 @@
  * @file ringbuf,c
  *
  *   Ring Buffer library
+ *
+ *   One task writes and one task reads.
+ *   Neither side takes a lock; the indices are published with release stores and picked up with acquire loads.
+ *   A side that finds the ring full (or empty) blocks on a semaphore, with a timeout, until the other side moves.
+ *
+ *   There are two ways to use it:
+ *     rb_write / rb_read copy in and out of caller buffers.
+ *     rb_reserve / rb_commit and rb_peek / rb_consume work in place, so packets can be built in,
+ *      and sent from, the ring itself.
  */
 #include <stdio.h>
 #include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
 #include "ringbuf.h"
 
 #include "esp_log.h"
@@ -13,6 +27,60 @@ static const char *TAG = "RingBuff      ";
 
 
 
+static inline uint32_t rb_load(uint32_t *p_ix) {
+	return __atomic_load_n(p_ix, __ATOMIC_ACQUIRE);
+}
+
+static inline void rb_store(uint32_t *p_ix, uint32_t p_value) {
+	__atomic_store_n(p_ix, p_value, __ATOMIC_RELEASE);
+}
+
+/*
+ * Indices run from 0 to 2 * size.
+ */
+static inline uint32_t rb_advance(Ringbuff_t *r, uint32_t p_ix, int32_t p_len) {
+	p_ix += p_len;
+	if (p_ix >= 2 * r->size) {
+		p_ix -= 2 * r->size;
+	}
+	return p_ix;
+}
+
+static inline uint32_t rb_pos(Ringbuff_t *r, uint32_t p_ix) {
+	return p_ix >= r->size ? p_ix - r->size : p_ix;
+}
+
+static inline uint8_t *rb_ptr(Ringbuff_t *r, uint32_t p_ix) {
+	return r->p_o + rb_pos(r, p_ix);
+}
+
+/*
+ * Bytes from p_from up to p_to.
+ */
+static inline int32_t rb_distance(Ringbuff_t *r, uint32_t p_to, uint32_t p_from) {
+	if (p_to >= p_from) {
+		return p_to - p_from;
+	}
+	return p_to + 2 * r->size - p_from;
+}
+
+/*
+ * Wait on one of the ring semaphores for whatever is left of p_wait ticks since p_start.
+ */
+static BaseType_t rb_wait(SemaphoreHandle_t p_sem, TickType_t p_start, TickType_t p_wait) {
+	TickType_t l_elapsed;
+	if (p_wait == portMAX_DELAY) {
+		return xSemaphoreTake(p_sem, portMAX_DELAY);
+	}
+	l_elapsed = xTaskGetTickCount() - p_start;
+	if (l_elapsed >= p_wait) {
+		return pdFALSE;
+	}
+	return xSemaphoreTake(p_sem, p_wait - l_elapsed);
+}
+
+
+
 /**
  * @brief init a Ringbuff_t object
  * @param r pointer to a Ringbuff_t object
@@ -29,87 +97,172 @@ esp_err_t rb_init(Ringbuff_t *p_rb, uint8_t *p_buf, int32_t p_size, int32_t p_bl
 	if (p_size % p_block_size != 0) {
 		return ESP_FAIL;
 	}
-	p_rb->p_o = p_rb->read_ptr = p_rb->write_ptr = p_buf;
-	p_rb->fill_cnt = 0;
+	p_rb->p_o = p_buf;
+	p_rb->read_ix = 0;
+	p_rb->write_ix = 0;
+	p_rb->wrap_ix = RB_NO_WRAP;
+	p_rb->reserve_pad = 0;
 	p_rb->size = p_size;
 	p_rb->block_size = p_block_size;
+	p_rb->data_sem = xSemaphoreCreateBinary();
+	p_rb->space_sem = xSemaphoreCreateBinary();
+	if (p_rb->data_sem == NULL || p_rb->space_sem == NULL) {
+		ESP_LOGE(TAG, " 34 rb_init - No memory for semaphores.");
+		rb_deinit(p_rb);
+		return ESP_ERR_NO_MEM;
+	}
 	ESP_LOGI(TAG, " 34 rb_init - Finished.");
 	return ESP_OK;
 }
 
+/**
+ * @brief Release the semaphores; the byte array belongs to the caller.
+ */
+void rb_deinit(Ringbuff_t *p_rb) {
+	if (p_rb->data_sem) {
+		vSemaphoreDelete(p_rb->data_sem);
+		p_rb->data_sem = NULL;
+	}
+	if (p_rb->space_sem) {
+		vSemaphoreDelete(p_rb->space_sem);
+		p_rb->space_sem = NULL;
+	}
+}
+
+
+
+/*
+ * Copy len bytes in at write index p_ix, in at most two memcpy's, one either side of the physical wrap point.
+ * The caller has already checked there is room.
+ */
+static void rb_copy_in(Ringbuff_t *r, uint32_t p_ix, const uint8_t *buf, int32_t len) {
+	uint8_t *l_dst = rb_ptr(r, p_ix);
+	int32_t l_first = (r->p_o + r->size) - l_dst;
+	if (l_first > len) {
+		l_first = len;
+	}
+	memcpy(l_dst, buf, l_first);
+	memcpy(r->p_o, buf + l_first, len - l_first);
+}
+
+/*
+ * Copy len bytes out from read index p_ix, in at most two memcpy's, one either side of the physical wrap point.
+ * The caller has already checked the data is there.
+ */
+static void rb_copy_out(Ringbuff_t *r, uint32_t p_ix, uint8_t *buf, int32_t len) {
+	uint8_t *l_src = rb_ptr(r, p_ix);
+	int32_t l_first = (r->p_o + r->size) - l_src;
+	if (l_first > len) {
+		l_first = len;
+	}
+	memcpy(buf, l_src, l_first);
+	memcpy(buf + l_first, r->p_o, len - l_first);
+}
+
+
+
+/*
+ * The reader has reached the tail the writer skipped; move on to the start of the buffer.
+ * wrap_ix is cleared before read_ix is published so the writer never sees a stale one.
+ */
+static void rb_skip_wrap(Ringbuff_t *r, uint32_t p_read) {
+	rb_store(&r->wrap_ix, RB_NO_WRAP);
+	rb_store(&r->read_ix, rb_advance(r, p_read, r->size - rb_pos(r, p_read)));
+	xSemaphoreGive(r->space_sem);
+}
+
 
 
 /**
- * \brief put a character into ring buffer
+ * \brief put a block into ring buffer, without waiting
  * \param r pointer to a ringbuf object
- * \param c character to be put
+ * \param c block_size bytes to be put
  * \return 0 if successfull, otherwise failed
  */
 int32_t rb_put(Ringbuff_t *r, uint8_t *c) {
-	int32_t i;
-	uint8_t *data = c;
-	if (r->fill_cnt >= r->size) {
-		return -1; // ring buffer is full, this should be atomic operation
-	}
-	r->fill_cnt += r->block_size; // increase filled slots count, this should be atomic operation
-	for (i = 0; i < r->block_size; i++) {
-		*r->write_ptr = *data;              // put character into buffer
-
-		r->write_ptr++;
-		data++;
-	}
-	if (r->write_ptr >= r->p_o + r->size) {
-		// rollback if write pointer go pass
-		r->write_ptr = r->p_o;          // the physical boundary
+	uint32_t l_write = r->write_ix;
+	if (rb_available(r) < r->block_size) {
+		return -1; // ring buffer is full
 	}
+	rb_copy_in(r, l_write, c, r->block_size);
+	rb_store(&r->write_ix, rb_advance(r, l_write, r->block_size));
+	xSemaphoreGive(r->data_sem);
 	return 0;
 }
 
 
 
 /**
- * @brief  get a character from ring buffer
+ * @brief  get a block from ring buffer, without waiting
  *
  * \param r pointer to a ringbuf object
- * \param c read character
+ * \param c block_size bytes read
  * \return 0 if successfull, otherwise failed
  */
 int32_t rb_get(Ringbuff_t *r, uint8_t *c) {
-	int32_t i;
-	uint8_t *data = c;
-	if (r->fill_cnt <= 0) {
-		return -1;     // ring buffer is empty, this should be atomic operation
+	uint32_t l_read;
+	if (rb_fill(r) > 0 && rb_load(&r->wrap_ix) == r->read_ix) {
+		rb_skip_wrap(r, r->read_ix);
 	}
-	r->fill_cnt -= r->block_size;              // decrease filled slots count
-
-	for (i = 0; i < r->block_size; i++) {
-		*data++ = *r->read_ptr++;               // get the character out
-	}
-	if (r->read_ptr >= r->p_o + r->size) {      // rollback if write pointer go pass
-		r->read_ptr = r->p_o;            // the physical boundary
+	l_read = r->read_ix;
+	if (rb_fill(r) < r->block_size) {
+		return -1;     // ring buffer is empty
 	}
+	rb_copy_out(r, l_read, c, r->block_size);
+	rb_store(&r->read_ix, rb_advance(r, l_read, r->block_size));
+	xSemaphoreGive(r->space_sem);
 	return 0;
 }
 
 
 
+/*
+ * Number of bytes waiting to be read.
+ */
+int32_t rb_fill(Ringbuff_t *r) {
+	uint32_t l_write = rb_load(&r->write_ix);
+	uint32_t l_read = rb_load(&r->read_ix);
+	if (l_write >= l_read) {
+		return l_write - l_read;
+	}
+	return l_write + 2 * r->size - l_read;
+}
+
+/*
+ * Number of bytes free for writing.
+ */
 int32_t rb_available(Ringbuff_t *r) {
-	return (r->size - r->fill_cnt);
+	return (r->size - rb_fill(r));
 }
 
 
+
 /*
+ * Read up to len bytes from the ring.
+ * If they are not all there yet, block for up to wait ticks for the writer.
+ * len should be a multiple of block_size.
  *
+ * @return the number of bytes read; less than len only if wait ran out.
  */
-uint32_t rb_read(Ringbuff_t *r, uint8_t *buf, int len) {
-	int  n = 0;
-	uint8_t  data;
-	while (len > 0) {
-		while (rb_get(r, &data) != 0)
-			;
-		*buf++ = data;
-		n++;
-		len--;
+uint32_t rb_read(Ringbuff_t *r, uint8_t *buf, int len, TickType_t wait) {
+	TickType_t l_start = xTaskGetTickCount();
+	TickType_t l_elapsed;
+	uint8_t *l_data;
+	int32_t l_got;
+	int n = 0;
+	while (n < len) {
+		// What is already there is read whatever the time; only waiting for more is limited
+		l_elapsed = xTaskGetTickCount() - l_start;
+		l_got = rb_peek(r, &l_data, wait == portMAX_DELAY ? portMAX_DELAY : (l_elapsed >= wait ? 0 : wait - l_elapsed));
+		if (l_got == 0) {
+			break;
+		}
+		if (l_got > len - n) {
+			l_got = len - n;
+		}
+		memcpy(buf + n, l_data, l_got);
+		rb_consume(r, l_got);
+		n += l_got;
 	}
 	return n;
 }
@@ -117,15 +270,123 @@ uint32_t rb_read(Ringbuff_t *r, uint8_t *buf, int len) {
 
 
 /*
- * Put each byte of the buffer
+ * Write all len bytes to the ring or none of them.
+ * If there is not enough room, block for up to wait ticks for the reader.
+ * len should be a multiple of block_size.
+ *
+ * @return len, or 0 if the room did not appear in time.
  */
-uint32_t rb_write(Ringbuff_t *r, uint8_t *buf, int len) {
-	uint32_t wi;
-	for (wi = 0; wi < len; wi++) {
-		while (rb_put(r, &buf[wi]) != 0) {
+uint32_t rb_write(Ringbuff_t *r, uint8_t *buf, int len, TickType_t wait) {
+	TickType_t l_start = xTaskGetTickCount();
+	uint32_t l_write;
+	if (len <= 0 || len > r->size) {
+		return 0;
+	}
+	while (rb_available(r) < len) {
+		if (rb_wait(r->space_sem, l_start, wait) != pdTRUE) {
+			return 0;
 		}
 	}
-	return 0;
+	l_write = r->write_ix;
+	rb_copy_in(r, l_write, buf, len);
+	rb_store(&r->write_ix, rb_advance(r, l_write, len));
+	xSemaphoreGive(r->data_sem);
+	return len;
+}
+
+
+
+/*
+ * Reserve len contiguous bytes for the writer to fill in place.
+ * If they do not fit before the end of the buffer the tail is skipped and the space comes from the start.
+ * Blocks for up to wait ticks for the reader to make room.
+ * Nothing is visible to the reader until rb_commit().
+ *
+ * @return a pointer to the space, or NULL if it could not be had in time.
+ */
+uint8_t *rb_reserve(Ringbuff_t *r, int32_t len, TickType_t wait) {
+	TickType_t l_start = xTaskGetTickCount();
+	uint32_t l_pos = rb_pos(r, r->write_ix);
+	int32_t l_tail = r->size - l_pos;
+	r->reserve_pad = (l_tail >= len) ? 0 : l_tail;
+	if (len <= 0 || r->reserve_pad + len > r->size) {
+		r->reserve_pad = 0;
+		return NULL;
+	}
+	while (rb_available(r) < r->reserve_pad + len) {
+		if (rb_wait(r->space_sem, l_start, wait) != pdTRUE) {
+			return NULL;
+		}
+	}
+	return r->reserve_pad ? r->p_o : r->p_o + l_pos;
+}
+
+/*
+ * Publish the first len bytes of the open reservation to the reader.
+ * A reservation that is abandoned instead is simply never committed.
+ */
+void rb_commit(Ringbuff_t *r, int32_t len) {
+	uint32_t l_write = r->write_ix;
+	if (len <= 0) {
+		return;
+	}
+	if (r->reserve_pad) {
+		rb_store(&r->wrap_ix, l_write);
+	}
+	rb_store(&r->write_ix, rb_advance(r, l_write, r->reserve_pad + len));
+	r->reserve_pad = 0;
+	xSemaphoreGive(r->data_sem);
+}
+
+
+
+/*
+ * Find the next contiguous run of committed bytes without copying them.
+ * Blocks for up to wait ticks for the writer if the ring is empty.
+ * The bytes stay in the ring until rb_consume().
+ *
+ * @return the length of the run at *data, or 0 if nothing arrived in time.
+ */
+int32_t rb_peek(Ringbuff_t *r, uint8_t **data, TickType_t wait) {
+	TickType_t l_start = xTaskGetTickCount();
+	uint32_t l_read = r->read_ix;
+	uint32_t l_wrap;
+	int32_t l_fill, l_run;
+	while (1) {
+		l_fill = rb_fill(r);
+		if (l_fill > 0 && rb_load(&r->wrap_ix) == l_read) {
+			rb_skip_wrap(r, l_read);
+			l_read = r->read_ix;
+			continue;
+		}
+		if (l_fill > 0) {
+			break;
+		}
+		if (rb_wait(r->data_sem, l_start, wait) != pdTRUE) {
+			return 0;
+		}
+	}
+	l_run = r->size - rb_pos(r, l_read);
+	if (l_run > l_fill) {
+		l_run = l_fill;
+	}
+	l_wrap = rb_load(&r->wrap_ix);
+	if (l_wrap != RB_NO_WRAP && rb_distance(r, l_wrap, l_read) < l_run) {
+		l_run = rb_distance(r, l_wrap, l_read);
+	}
+	*data = rb_ptr(r, l_read);
+	return l_run;
+}
+
+/*
+ * Give back len bytes obtained from rb_peek().
+ */
+void rb_consume(Ringbuff_t *r, int32_t len) {
+	if (len <= 0) {
+		return;
+	}
+	rb_store(&r->read_ix, rb_advance(r, r->read_ix, len));
+	xSemaphoreGive(r->space_sem);
 }
 
 // ### END DBK
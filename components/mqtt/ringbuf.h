@@ -3,22 +3,50 @@
 
 #include <stdint.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
 #include "esp_err.h"
 
+/**
+ * Single producer / single consumer byte ring.
+ *
+ * read_ix and write_ix run from 0 to 2 * size so a full ring can be told from an empty one
+ *  without giving up a slot.
+ * Only the writer stores write_ix and only the reader stores read_ix; each side publishes its
+ *  index with release ordering and loads the other side's with acquire ordering.
+ *
+ * rb_reserve() hands out contiguous space.
+ * When a reservation does not fit before the physical end of the buffer the writer skips the
+ *  tail and records where it did so in wrap_ix; the reader jumps over the skipped bytes when it
+ *  gets there and clears wrap_ix again before it publishes its new read_ix.
+ */
 typedef struct   Ringbuff {
 	uint8_t*            p_o; /**< Original pointer */
-	uint8_t* volatile   read_ptr; /**< Read pointer */
-	uint8_t* volatile   write_ptr; /**< Write pointer */
-	volatile int32_t    fill_cnt; /**< Number of filled slots */
+	uint32_t            read_ix; /**< Read index, owned by the reader */
+	uint32_t            write_ix; /**< Write index, owned by the writer */
 	int32_t             size; /**< Buffer size */
 	int32_t             block_size;
+	SemaphoreHandle_t   data_sem; /**< Given by the writer after it adds data */
+	SemaphoreHandle_t   space_sem; /**< Given by the reader after it frees space */
+	uint32_t            wrap_ix; /**< Write index of skipped tail bytes, or RB_NO_WRAP */
+	int32_t             reserve_pad; /**< Tail bytes the open reservation skips */
 } Ringbuff_t;
 
+#define RB_NO_WRAP		0xFFFFFFFF
+
 esp_err_t rb_init(Ringbuff_t *r, uint8_t* buf, int32_t size, int32_t block_size);
+void rb_deinit(Ringbuff_t *r);
 int32_t rb_put(Ringbuff_t *r, uint8_t* c);
 int32_t rb_get(Ringbuff_t *r, uint8_t* c);
 int32_t rb_available(Ringbuff_t *r);
-uint32_t rb_read(Ringbuff_t *r, uint8_t *buf, int len);
-uint32_t rb_write(Ringbuff_t *r, uint8_t *buf, int len);
+int32_t rb_fill(Ringbuff_t *r);
+uint32_t rb_read(Ringbuff_t *r, uint8_t *buf, int len, TickType_t wait);
+uint32_t rb_write(Ringbuff_t *r, uint8_t *buf, int len, TickType_t wait);
+
+uint8_t *rb_reserve(Ringbuff_t *r, int32_t len, TickType_t wait);
+void rb_commit(Ringbuff_t *r, int32_t len);
+int32_t rb_peek(Ringbuff_t *r, uint8_t **data, TickType_t wait);
+void rb_consume(Ringbuff_t *r, int32_t len);
 
 #endif
@@ -0,0 +1,147 @@
+/*
+ * test_alias.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "unity.h"
+
+#include "mqtt_structs.h"
+#include "mqtt_packet.h"
+#include "mqtt_outbox.h"
+#include "mqtt_alias.h"
+#include "mqtt_property.h"
+
+#include "test_client.h"
+
+#define TEST_PREFIX				"pyhouse/House 1/"
+#define TEST_LANE_SIZE			1024
+#define TEST_BENCH_TOPICS		16
+#define TEST_BENCH_PUBLISHES	1000
+
+/*
+ * Build a PUBLISH, rewrite it into p_out and hand its lane space back.
+ */
+static uint32_t test_rewrite(Client_t *p_client, TopicAlias_t *p_alias, char *p_topic, int p_qos, uint8_t *p_out, uint32_t p_room) {
+	PacketInfo_t l_packet;
+	uint32_t l_length;
+	uint8_t *l_data;
+	uint16_t l_id;
+
+	mqtt_build_publish_packet(p_client, &l_packet, p_topic, "on", 2, p_qos, 0, &l_id);
+	l_length = mqtt_alias_rewrite(p_alias, l_packet.PacketBuffer, l_packet.Packet_length, p_out, p_room);
+	mqtt_outbox_commit(p_client->Outbox, &l_packet);
+	mqtt_outbox_peek(p_client->Outbox, &l_data);
+	mqtt_outbox_consume(p_client->Outbox);
+	return l_length;
+}
+
+TEST_CASE("alias a topic the first time and send only the alias after", "[mqtt][alias]") {
+	static const uint8_t l_first[] = { 0x30, 0x0d, 0x00, 0x05, 'a', '/', 'b', '/', 'c', 0x03, 0x23, 0x00, 0x01, 'o', 'n' };
+	static const uint8_t l_again[] = { 0x30, 0x08, 0x00, 0x00, 0x03, 0x23, 0x00, 0x01, 'o', 'n' };
+	static const uint8_t l_qos1[] = { 0x32, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x03, 0x23, 0x00, 0x01, 'o', 'n' };
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	TopicAlias_t l_alias;
+	uint8_t l_out[64];
+
+	test_client_init(&l_client, &l_outbox, &l_state, TEST_LANE_SIZE, NULL, NULL);
+	l_state.protocol_level = MQTT_PROTOCOL_LEVEL_5;
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_alias_init(&l_alias, 4, 64));
+	// No aliases until a CONNACK allows them
+	TEST_ASSERT_EQUAL(0, test_rewrite(&l_client, &l_alias, "a/b/c", 0, l_out, sizeof(l_out)));
+	mqtt_alias_reset(&l_alias, 10);
+	TEST_ASSERT_EQUAL(4, l_alias.Max);
+
+	TEST_ASSERT_EQUAL(sizeof(l_first), test_rewrite(&l_client, &l_alias, "a/b/c", 0, l_out, sizeof(l_out)));
+	TEST_ASSERT_EQUAL_MEMORY(l_first, l_out, sizeof(l_first));
+	TEST_ASSERT_EQUAL(sizeof(l_again), test_rewrite(&l_client, &l_alias, "a/b/c", 0, l_out, sizeof(l_out)));
+	TEST_ASSERT_EQUAL_MEMORY(l_again, l_out, sizeof(l_again));
+	// The packet id stays in front of the properties
+	TEST_ASSERT_EQUAL(sizeof(l_qos1), test_rewrite(&l_client, &l_alias, "a/b/c", 1, l_out, sizeof(l_out)));
+	TEST_ASSERT_EQUAL_MEMORY(l_qos1, l_out, 4);
+	TEST_ASSERT_EQUAL_MEMORY(l_qos1 + 6, l_out + 6, sizeof(l_qos1) - 6);
+	TEST_ASSERT_EQUAL(1, l_alias.Count);
+
+	// Not enough room leaves the packet to go as it is
+	TEST_ASSERT_EQUAL(0, test_rewrite(&l_client, &l_alias, "a/b/c", 0, l_out, sizeof(l_again) - 1));
+	// A new connection starts the numbering again
+	mqtt_alias_reset(&l_alias, 2);
+	TEST_ASSERT_EQUAL(sizeof(l_first), test_rewrite(&l_client, &l_alias, "a/b/c", 0, l_out, sizeof(l_out)));
+	TEST_ASSERT_EQUAL_MEMORY(l_first, l_out, sizeof(l_first));
+	mqtt_alias_deinit(&l_alias);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+TEST_CASE("alias only publishes and only as many topics as allowed", "[mqtt][alias]") {
+	static const uint8_t l_subscribe[] = { 0x82, 0x09, 0x00, 0x01, 0x00, 0x00, 0x03, 'a', '/', '#', 0x01 };
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	TopicAlias_t l_alias;
+	uint8_t l_out[64];
+
+	test_client_init(&l_client, &l_outbox, &l_state, TEST_LANE_SIZE, NULL, NULL);
+	l_state.protocol_level = MQTT_PROTOCOL_LEVEL_5;
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_alias_init(&l_alias, 4, 64));
+	mqtt_alias_reset(&l_alias, 2);
+	TEST_ASSERT_EQUAL(0, mqtt_alias_rewrite(&l_alias, l_subscribe, sizeof(l_subscribe), l_out, sizeof(l_out)));
+	TEST_ASSERT_NOT_EQUAL(0, test_rewrite(&l_client, &l_alias, "a", 0, l_out, sizeof(l_out)));
+	TEST_ASSERT_NOT_EQUAL(0, test_rewrite(&l_client, &l_alias, "b", 0, l_out, sizeof(l_out)));
+	// The broker allowed two; a third topic goes in full
+	TEST_ASSERT_EQUAL(0, test_rewrite(&l_client, &l_alias, "c", 0, l_out, sizeof(l_out)));
+	TEST_ASSERT_EQUAL(10, test_rewrite(&l_client, &l_alias, "b", 0, l_out, sizeof(l_out)));
+	TEST_ASSERT_EQUAL(2, l_out[6] << 8 | l_out[7]);
+	mqtt_alias_deinit(&l_alias);
+
+	// No aliases configured
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_alias_init(&l_alias, 0, 0));
+	mqtt_alias_reset(&l_alias, 10);
+	TEST_ASSERT_EQUAL(0, test_rewrite(&l_client, &l_alias, "a", 0, l_out, sizeof(l_out)));
+	mqtt_alias_deinit(&l_alias);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+/*
+ * Bytes on the wire for a stream of device status publishes, with and without aliases.
+ */
+TEST_CASE("bytes per publish with and without topic aliases", "[mqtt][alias][bench]") {
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	TopicAlias_t l_alias;
+	PacketInfo_t l_packet;
+	char l_topic[48];
+	uint8_t l_out[128];
+	uint32_t l_ix, l_length, l_plain = 0, l_aliased = 0;
+	uint8_t *l_data;
+	uint16_t l_id;
+
+	test_client_init(&l_client, &l_outbox, &l_state, TEST_LANE_SIZE, NULL, NULL);
+	l_state.protocol_level = MQTT_PROTOCOL_LEVEL_5;
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_alias_init(&l_alias, TEST_BENCH_TOPICS, 1024));
+	mqtt_alias_reset(&l_alias, TEST_BENCH_TOPICS);
+	for (l_ix = 0; l_ix < TEST_BENCH_PUBLISHES; l_ix++) {
+		snprintf(l_topic, sizeof(l_topic), TEST_PREFIX "lighting/status/room%d", l_ix % TEST_BENCH_TOPICS);
+		mqtt_build_publish_packet(&l_client, &l_packet, l_topic, "{\"Level\":100}", 13, 0, 0, &l_id);
+		l_length = mqtt_alias_rewrite(&l_alias, l_packet.PacketBuffer, l_packet.Packet_length, l_out, sizeof(l_out));
+		TEST_ASSERT_NOT_EQUAL(0, l_length);
+		l_plain += l_packet.Packet_length;
+		l_aliased += l_length;
+		mqtt_outbox_commit(&l_outbox, &l_packet);
+		mqtt_outbox_peek(&l_outbox, &l_data);
+		mqtt_outbox_consume(&l_outbox);
+	}
+	printf("alias %d topics: %3d bytes/publish plain  %3d bytes/publish aliased\n", TEST_BENCH_TOPICS,
+			l_plain / TEST_BENCH_PUBLISHES, l_aliased / TEST_BENCH_PUBLISHES);
+	TEST_ASSERT_TRUE(l_aliased < l_plain);
+	mqtt_alias_deinit(&l_alias);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+// ### END DBK
@@ -0,0 +1,35 @@
+/*
+ * test_client.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ *
+ * The bare client the packet builder tests share: an outbox and a zeroed State, no broker or socket.
+ */
+
+#ifndef COMPONENTS_MQTT_TEST_TEST_CLIENT_H_
+#define COMPONENTS_MQTT_TEST_TEST_CLIENT_H_
+
+#include <string.h>
+
+#include "mqtt_structs.h"
+#include "mqtt_outbox.h"
+
+/*
+ * Set up p_client with a p_lane_size outbox; p_topics and p_subscriptions may be NULL.
+ * The caller frees the outbox with mqtt_outbox_deinit().
+ */
+static inline void test_client_init(Client_t *p_client, Outbox_t *p_outbox, State_t *p_state, int32_t p_lane_size,
+		TopicTable_t *p_topics, SubscriptionSet_t *p_subscriptions) {
+	memset(p_client, 0, sizeof(Client_t));
+	memset(p_state, 0, sizeof(State_t));
+	mqtt_outbox_init(p_outbox, p_lane_size);
+	p_client->Outbox = p_outbox;
+	p_client->State = p_state;
+	p_client->Topics = p_topics;
+	p_client->Subscriptions = p_subscriptions;
+}
+
+#endif /* COMPONENTS_MQTT_TEST_TEST_CLIENT_H_ */
+
+// ### END DBK
@@ -0,0 +1,209 @@
+/*
+ * test_decoder.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "unity.h"
+
+#include "mqtt_decoder.h"
+
+#define TEST_DECODER_SIZE		(24 * 1024)
+#define TEST_STREAM_PACKETS		100
+
+/*
+ * The stream and the fragment sizes come from the same pseudo random sequence each run.
+ */
+static uint32_t decoder_random(uint32_t *p_seed) {
+	*p_seed = *p_seed * 1103515245 + 12345;
+	return *p_seed >> 16;
+}
+
+static int decoder_put_length(uint8_t *p_ptr, uint32_t p_length) {
+	int l_ix = 0;
+	do {
+		p_ptr[l_ix] = p_length % 128;
+		p_length /= 128;
+		if (p_length > 0) {
+			p_ptr[l_ix] |= 0x80;
+		}
+		l_ix++;
+	} while (p_length > 0);
+	return l_ix;
+}
+
+/*
+ * Packet n has type byte 0x30 | n % 16 and a body of bytes (n + offset) % 251.
+ * Most are small; some need 2 and 3 byte remaining lengths.
+ */
+static uint32_t decoder_body_length(uint32_t *p_seed) {
+	uint32_t l_pick = decoder_random(p_seed);
+	if (l_pick % 10 == 0) {
+		return 16384 + l_pick % 4096;
+	}
+	if (l_pick % 10 < 3) {
+		return 128 + l_pick % 2048;
+	}
+	return l_pick % 128;
+}
+
+/*
+ * Check the bytes of a frame or part against the packet they came from.
+ * Packet n has type byte 0x30 | n % 16 and a body of bytes (n + offset) % 251.
+ */
+static void decoder_check_frame(MqttFrame_t *p_frame, int p_packet, uint32_t p_length, int *r_errors) {
+	uint32_t l_header = p_frame->Length - p_length;
+	uint32_t l_ix, l_at;
+	if ((p_frame->Type != (0x30 | p_packet % 16)) || (p_frame->Offset == 0 && p_frame->Body != p_frame->Packet + l_header)) {
+		(*r_errors)++;
+		return;
+	}
+	for (l_ix = 0; l_ix < p_frame->Available; l_ix++) {
+		l_at = p_frame->Offset + l_ix;
+		if (l_at >= l_header && p_frame->Packet[l_ix] != (p_packet + l_at - l_header) % 251) {
+			(*r_errors)++;
+			return;
+		}
+	}
+}
+
+/*
+ * Build the stream, then feed it through a p_size decoder in pseudo random fragments.
+ * Packets bigger than p_size must come out as parts that add up to the packet.
+ */
+static void decoder_stream(uint32_t p_size) {
+	MqttDecoder_t l_decoder;
+	MqttFrame_t l_frame;
+	uint8_t *l_buffer = malloc(p_size);
+	uint8_t *l_stream = malloc(TEST_STREAM_PACKETS * (5 + 16384 + 4096));
+	uint32_t l_lengths[TEST_STREAM_PACKETS];
+	uint32_t l_seed = 7;
+	uint32_t l_stream_len = 0, l_offset = 0, l_chunk, l_ix, l_got = 0;
+	int l_packet, l_next = 0, l_errors = 0, l_parts = 0, l_result;
+
+	TEST_ASSERT_NOT_NULL(l_buffer);
+	TEST_ASSERT_NOT_NULL(l_stream);
+	for (l_packet = 0; l_packet < TEST_STREAM_PACKETS; l_packet++) {
+		l_lengths[l_packet] = decoder_body_length(&l_seed);
+		l_stream[l_stream_len++] = 0x30 | l_packet % 16;
+		l_stream_len += decoder_put_length(l_stream + l_stream_len, l_lengths[l_packet]);
+		for (l_ix = 0; l_ix < l_lengths[l_packet]; l_ix++) {
+			l_stream[l_stream_len++] = (l_packet + l_ix) % 251;
+		}
+	}
+
+	mqtt_decoder_init(&l_decoder, l_buffer, p_size);
+	while (l_offset < l_stream_len) {
+		// From single bytes, which split the fixed header, up to several packets at once
+		l_chunk = decoder_random(&l_seed) % 4 ? 1 + decoder_random(&l_seed) % 64 : 1 + decoder_random(&l_seed) % 8192;
+		if (l_chunk > l_stream_len - l_offset) {
+			l_chunk = l_stream_len - l_offset;
+		}
+		l_offset += mqtt_decoder_feed(&l_decoder, l_stream + l_offset, l_chunk);
+		while ((l_result = mqtt_decoder_next(&l_decoder, &l_frame)) > 0) {
+			TEST_ASSERT_TRUE(l_next < TEST_STREAM_PACKETS);
+			TEST_ASSERT_EQUAL(l_got, l_frame.Offset);
+			decoder_check_frame(&l_frame, l_next, l_lengths[l_next], &l_errors);
+			l_parts += l_result == MQTT_DECODE_PART;
+			l_got += l_frame.Available;
+			if (l_got == l_frame.Length) {
+				l_got = 0;
+				l_next++;
+			}
+		}
+		TEST_ASSERT_EQUAL(MQTT_DECODE_MORE, l_result);
+	}
+	TEST_ASSERT_EQUAL(0, l_errors);
+	TEST_ASSERT_EQUAL(TEST_STREAM_PACKETS, l_next);
+	TEST_ASSERT_EQUAL(l_decoder.Start, l_decoder.Fill);
+	if (p_size < 16384) {
+		TEST_ASSERT_TRUE(l_parts > 0);
+	} else {
+		TEST_ASSERT_EQUAL(0, l_parts);
+	}
+	free(l_stream);
+	free(l_buffer);
+}
+
+TEST_CASE("decoder splits a randomly fragmented stream into packets", "[mqtt][decoder]") {
+	decoder_stream(TEST_DECODER_SIZE);
+}
+
+TEST_CASE("decoder streams packets larger than its buffer in parts", "[mqtt][decoder]") {
+	decoder_stream(1024);
+}
+
+TEST_CASE("decoder rejects a remaining length over 4 bytes", "[mqtt][decoder]") {
+	MqttDecoder_t l_decoder;
+	MqttFrame_t l_frame;
+	uint8_t l_buffer[64];
+	uint8_t l_bad[6] = { 0x30, 0xff, 0xff, 0xff, 0xff, 0x01 };
+	int l_ix;
+
+	mqtt_decoder_init(&l_decoder, l_buffer, sizeof(l_buffer));
+	for (l_ix = 0; l_ix < 5; l_ix++) {
+		TEST_ASSERT_EQUAL(MQTT_DECODE_MORE, mqtt_decoder_next(&l_decoder, &l_frame));
+		TEST_ASSERT_EQUAL(1, mqtt_decoder_feed(&l_decoder, l_bad + l_ix, 1));
+	}
+	TEST_ASSERT_EQUAL(MQTT_DECODE_MALFORMED, mqtt_decoder_next(&l_decoder, &l_frame));
+}
+
+/*
+ * A 2 MB publish (4 byte remaining length) between two small ones, through a 64 byte buffer.
+ * The fixed header and topic are kept in place while the payload streams past them.
+ */
+TEST_CASE("decoder keeps the header of a streamed packet", "[mqtt][decoder]") {
+	MqttDecoder_t l_decoder;
+	MqttFrame_t l_frame;
+	uint8_t l_buffer[64];
+	uint8_t l_small[4] = { 0x40, 0x02, 0x12, 0x34 };  // PUBACK 0x1234
+	uint8_t l_big[10] = { 0x30, 0x80, 0x80, 0x80, 0x01, 0x00, 0x03, 'a', '/', 'b' };
+	uint8_t l_chunk[48];
+	uint32_t l_left = 2097152 - 5, l_taken, l_got;
+	int l_result;
+
+	memset(l_chunk, 0x40, sizeof(l_chunk));  // Would look like PUBACKs if they were not payload
+	mqtt_decoder_init(&l_decoder, l_buffer, sizeof(l_buffer));
+	mqtt_decoder_feed(&l_decoder, l_small, sizeof(l_small));
+	mqtt_decoder_feed(&l_decoder, l_big, sizeof(l_big));
+	TEST_ASSERT_EQUAL(MQTT_DECODE_FRAME, mqtt_decoder_next(&l_decoder, &l_frame));
+	TEST_ASSERT_EQUAL(4, l_frame.Length);
+	TEST_ASSERT_EQUAL(MQTT_DECODE_MORE, mqtt_decoder_next(&l_decoder, &l_frame));
+	// Nothing comes out until the buffer is full
+	do {
+		l_left -= mqtt_decoder_feed(&l_decoder, l_chunk, sizeof(l_chunk));
+	} while ((l_result = mqtt_decoder_next(&l_decoder, &l_frame)) == MQTT_DECODE_MORE);
+	TEST_ASSERT_EQUAL(MQTT_DECODE_PART, l_result);
+	TEST_ASSERT_EQUAL(0, l_frame.Offset);
+	TEST_ASSERT_EQUAL(2097152 + 5, l_frame.Length);
+	TEST_ASSERT_EQUAL(sizeof(l_buffer), l_frame.Available);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_decoder_keep(&l_decoder, sizeof(l_big)));
+	l_got = l_frame.Available;
+	while (l_left > 0) {
+		l_taken = mqtt_decoder_feed(&l_decoder, l_chunk, l_left < sizeof(l_chunk) ? l_left : sizeof(l_chunk));
+		TEST_ASSERT_TRUE(l_taken > 0);
+		l_left -= l_taken;
+		while ((l_result = mqtt_decoder_next(&l_decoder, &l_frame)) == MQTT_DECODE_PART) {
+			TEST_ASSERT_EQUAL(l_got, l_frame.Offset);
+			TEST_ASSERT_TRUE(l_frame.Packet >= l_buffer + sizeof(l_big));
+			l_got += l_frame.Available;
+		}
+		TEST_ASSERT_EQUAL(MQTT_DECODE_MORE, l_result);
+		TEST_ASSERT_EQUAL(0, memcmp(l_buffer + 7, "a/b", 3));
+	}
+	TEST_ASSERT_EQUAL(2097152 + 5, l_got);
+	TEST_ASSERT_EQUAL(0, l_decoder.Keep);
+	mqtt_decoder_feed(&l_decoder, l_small, sizeof(l_small));
+	TEST_ASSERT_EQUAL(MQTT_DECODE_FRAME, mqtt_decoder_next(&l_decoder, &l_frame));
+	TEST_ASSERT_EQUAL(0x40, l_frame.Type);
+	TEST_ASSERT_EQUAL(0x12, l_frame.Body[0]);
+	TEST_ASSERT_EQUAL(0x34, l_frame.Body[1]);
+	TEST_ASSERT_EQUAL(MQTT_DECODE_MORE, mqtt_decoder_next(&l_decoder, &l_frame));
+}
+
+// ### END DBK
@@ -0,0 +1,360 @@
+/*
+ * test_inflight.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "unity.h"
+
+#include "mqtt.h"
+#include "mqtt_outbox.h"
+#include "mqtt_inflight.h"
+
+#define TEST_WINDOW				8
+#define TEST_BLOCK				32
+#define TEST_CHURN_ROUNDS		200000
+#define TEST_BENCH_PUBLISHES	2000
+#define TEST_BENCH_RTT_MS		5
+
+static int64_t now_us(void) {
+	struct timeval l_tv;
+	gettimeofday(&l_tv, NULL);
+	return (int64_t) l_tv.tv_sec * 1000000 + l_tv.tv_usec;
+}
+
+TEST_CASE("inflight window matches acks out of order and skips ids in flight", "[mqtt][inflight]") {
+	Inflight_t l_inflight;
+	uint32_t l_counter = 0xfffc;  // Wraps past 0 on the way
+	uint16_t l_ids[TEST_WINDOW], l_id;
+	int l_ix;
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_init(&l_inflight, TEST_WINDOW, TEST_BLOCK));
+	for (l_ix = 0; l_ix < TEST_WINDOW; l_ix++) {
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_open(&l_inflight, &l_counter, l_ix % 2 + 1, 0, &l_ids[l_ix]));
+		TEST_ASSERT_NOT_EQUAL(0, l_ids[l_ix]);
+	}
+	TEST_ASSERT_EQUAL(0xfffd, l_ids[0]);
+	TEST_ASSERT_EQUAL(1, l_ids[3]);
+	TEST_ASSERT_EQUAL(TEST_WINDOW, mqtt_inflight_count(&l_inflight));
+	TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, mqtt_inflight_open(&l_inflight, &l_counter, 1, 0, &l_id));
+
+	// The counter comes round to ids still in flight; they are passed over, for subscribes too
+	l_counter = 0xfffc;
+	TEST_ASSERT_EQUAL(6, mqtt_inflight_next_id(&l_inflight, &l_counter));
+
+	// QoS 1 slots (even) want PUBACK, QoS 2 slots (odd) PUBREC then PUBCOMP
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, mqtt_inflight_ack(&l_inflight, l_ids[1], INFLIGHT_PUBACK));
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, mqtt_inflight_ack(&l_inflight, l_ids[1], INFLIGHT_PUBCOMP));
+	for (l_ix = TEST_WINDOW - 1; l_ix >= 0; l_ix--) {
+		if (l_ix % 2) {
+			TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_ack(&l_inflight, l_ids[l_ix], INFLIGHT_PUBREC));
+		} else {
+			TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_ack(&l_inflight, l_ids[l_ix], INFLIGHT_PUBACK));
+		}
+	}
+	TEST_ASSERT_EQUAL(TEST_WINDOW / 2, mqtt_inflight_count(&l_inflight));
+	TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, mqtt_inflight_ack(&l_inflight, l_ids[0], INFLIGHT_PUBACK));
+	for (l_ix = 1; l_ix < TEST_WINDOW; l_ix += 2) {
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_ack(&l_inflight, l_ids[l_ix], INFLIGHT_PUBCOMP));
+	}
+	TEST_ASSERT_EQUAL(0, mqtt_inflight_count(&l_inflight));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_open(&l_inflight, &l_counter, 1, 0, &l_id));
+	mqtt_inflight_deinit(&l_inflight);
+}
+
+/*
+ * Random opens and acks, with the counter jumping about so ids pile up on the same home slots,
+ *  checked against a plain list of what should be in flight.
+ */
+TEST_CASE("inflight table stays consistent under churn", "[mqtt][inflight]") {
+	Inflight_t l_inflight;
+	uint16_t l_live[TEST_WINDOW];
+	uint32_t l_counter = 0, l_seed = 11, l_round;
+	int l_count = 0, l_ix, l_errors = 0;
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_init(&l_inflight, TEST_WINDOW, TEST_BLOCK));
+	for (l_round = 0; l_round < TEST_CHURN_ROUNDS; l_round++) {
+		l_seed = l_seed * 1103515245 + 12345;
+		if (l_count < TEST_WINDOW && (l_count == 0 || (l_seed >> 16) % 2)) {
+			l_counter = (l_seed >> 8) % 4 == 0 ? (l_seed >> 12) % 64 * 16 : l_counter;
+			if (mqtt_inflight_open(&l_inflight, &l_counter, 1, 0, &l_live[l_count]) != ESP_OK) {
+				l_errors++;
+				continue;
+			}
+			for (l_ix = 0; l_ix < l_count; l_ix++) {
+				l_errors += l_live[l_ix] == l_live[l_count];
+			}
+			l_count++;
+		} else {
+			l_ix = (l_seed >> 4) % l_count;
+			l_errors += mqtt_inflight_ack(&l_inflight, l_live[l_ix], INFLIGHT_PUBACK) != ESP_OK;
+			l_errors += mqtt_inflight_ack(&l_inflight, l_live[l_ix], INFLIGHT_PUBACK) != ESP_ERR_NOT_FOUND;
+			l_live[l_ix] = l_live[--l_count];
+		}
+	}
+	TEST_ASSERT_EQUAL(0, l_errors);
+	TEST_ASSERT_EQUAL(l_count, mqtt_inflight_count(&l_inflight));
+	for (l_ix = 0; l_ix < l_count; l_ix++) {
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_ack(&l_inflight, l_live[l_ix], INFLIGHT_PUBACK));
+	}
+	mqtt_inflight_deinit(&l_inflight);
+}
+
+TEST_CASE("inflight window keeps to the broker's receive maximum", "[mqtt][inflight]") {
+	Inflight_t l_inflight;
+	uint32_t l_counter = 0;
+	uint16_t l_ids[TEST_WINDOW], l_id;
+	int l_ix;
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_init(&l_inflight, TEST_WINDOW, TEST_BLOCK));
+	for (l_ix = 0; l_ix < 5; l_ix++) {
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_open(&l_inflight, &l_counter, 1, 0, &l_ids[l_ix]));
+	}
+	// Five out and the broker now takes two: no more go until three have been acked
+	mqtt_inflight_limit(&l_inflight, 2);
+	TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, mqtt_inflight_open(&l_inflight, &l_counter, 1, 0, &l_id));
+	for (l_ix = 0; l_ix < 3; l_ix++) {
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_ack(&l_inflight, l_ids[l_ix], INFLIGHT_PUBACK));
+		TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, mqtt_inflight_open(&l_inflight, &l_counter, 1, 0, &l_id));
+	}
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_ack(&l_inflight, l_ids[3], INFLIGHT_PUBACK));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_open(&l_inflight, &l_counter, 1, 0, &l_ids[3]));
+	TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, mqtt_inflight_open(&l_inflight, &l_counter, 1, 0, &l_id));
+
+	// A later connection with a bigger (or no) limit gets the whole window back
+	mqtt_inflight_limit(&l_inflight, 0xffff);
+	for (l_ix = 2; l_ix < TEST_WINDOW; l_ix++) {
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_open(&l_inflight, &l_counter, 1, 0, &l_id));
+		mqtt_inflight_sent(&l_inflight, l_id);
+	}
+	TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, mqtt_inflight_open(&l_inflight, &l_counter, 1, 0, &l_id));
+	// As does clearing the window for a clean session after the limit came down
+	mqtt_inflight_sent(&l_inflight, l_ids[3]);
+	mqtt_inflight_sent(&l_inflight, l_ids[4]);
+	mqtt_inflight_limit(&l_inflight, 4);
+	mqtt_inflight_clear(&l_inflight);
+	for (l_ix = 0; l_ix < 4; l_ix++) {
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_open(&l_inflight, &l_counter, 1, 0, &l_id));
+	}
+	TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, mqtt_inflight_open(&l_inflight, &l_counter, 1, 0, &l_id));
+	mqtt_inflight_deinit(&l_inflight);
+}
+
+typedef struct ResendLog {
+	int					Count;
+	uint16_t			Ids[TEST_WINDOW];
+	uint8_t				First[TEST_WINDOW];  // First byte of the packet, 0 for a PUBREL
+} ResendLog_t;
+
+static void test_resend(void *p_arg, uint16_t p_id, uint8_t *p_packet, uint32_t p_length) {
+	ResendLog_t *l_log = p_arg;
+	l_log->Ids[l_log->Count] = p_id;
+	l_log->First[l_log->Count++] = p_packet ? p_packet[0] : 0;
+}
+
+TEST_CASE("inflight resends in the order sent with dup set", "[mqtt][inflight]") {
+	Inflight_t l_inflight;
+	ResendLog_t l_log;
+	uint8_t l_packet[TEST_BLOCK + 1];
+	uint32_t l_counter = 100;
+	uint16_t l_ids[5];
+	int l_ix;
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_init(&l_inflight, TEST_WINDOW, TEST_BLOCK));
+	for (l_ix = 0; l_ix < 5; l_ix++) {
+		// Ids opened out of id order, so resending must go by the order they were sent
+		l_counter = l_ix == 2 ? 15 : l_counter;
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_open(&l_inflight, &l_counter, l_ix == 1 ? 2 : 1, 0, &l_ids[l_ix]));
+		memset(l_packet, l_ix, sizeof(l_packet));
+		l_packet[0] = l_ix == 1 ? 0x34 : 0x32;
+		mqtt_inflight_store(&l_inflight, l_ids[l_ix], l_packet, l_ix == 4 ? TEST_BLOCK + 1 : TEST_BLOCK);
+		mqtt_inflight_sent(&l_inflight, l_ids[l_ix]);
+	}
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_ack(&l_inflight, l_ids[1], INFLIGHT_PUBREC));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_ack(&l_inflight, l_ids[3], INFLIGHT_PUBACK));
+
+	memset(&l_log, 0, sizeof(l_log));
+	mqtt_inflight_resend(&l_inflight, test_resend, &l_log);
+	// The one too big to keep is dropped, the PUBREC'd one only gets its PUBREL again
+	TEST_ASSERT_EQUAL(3, l_log.Count);
+	TEST_ASSERT_EQUAL(l_ids[0], l_log.Ids[0]);
+	TEST_ASSERT_EQUAL(0x3a, l_log.First[0]);
+	TEST_ASSERT_EQUAL(l_ids[1], l_log.Ids[1]);
+	TEST_ASSERT_EQUAL(0, l_log.First[1]);
+	TEST_ASSERT_EQUAL(l_ids[2], l_log.Ids[2]);
+	TEST_ASSERT_EQUAL(3, mqtt_inflight_count(&l_inflight));
+
+	// Until the copies just queued leave the outbox, another reconnect only sends the PUBREL again
+	l_log.Count = 0;
+	mqtt_inflight_resend(&l_inflight, test_resend, &l_log);
+	TEST_ASSERT_EQUAL(1, l_log.Count);
+	TEST_ASSERT_EQUAL(l_ids[1], l_log.Ids[0]);
+	mqtt_inflight_sent(&l_inflight, l_ids[0]);
+	mqtt_inflight_sent(&l_inflight, l_ids[2]);
+
+	mqtt_inflight_clear(&l_inflight);
+	TEST_ASSERT_EQUAL(0, mqtt_inflight_count(&l_inflight));
+	l_log.Count = 0;
+	mqtt_inflight_resend(&l_inflight, test_resend, &l_log);
+	TEST_ASSERT_EQUAL(0, l_log.Count);
+	mqtt_inflight_deinit(&l_inflight);
+}
+
+TEST_CASE("inflight leaves publishes still in the outbox to go out from there", "[mqtt][inflight]") {
+	Inflight_t l_inflight;
+	ResendLog_t l_log;
+	uint8_t l_packet[TEST_BLOCK];
+	uint32_t l_counter = 0;
+	uint16_t l_ids[3];
+	int l_ix;
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_init(&l_inflight, TEST_WINDOW, TEST_BLOCK));
+	memset(l_packet, 0, sizeof(l_packet));
+	l_packet[0] = 0x32;
+	for (l_ix = 0; l_ix < 3; l_ix++) {
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_open(&l_inflight, &l_counter, 1, 0, &l_ids[l_ix]));
+		mqtt_inflight_store(&l_inflight, l_ids[l_ix], l_packet, sizeof(l_packet));
+	}
+	// Only the middle one got out before the connection went
+	mqtt_inflight_sent(&l_inflight, l_ids[1]);
+	memset(&l_log, 0, sizeof(l_log));
+	mqtt_inflight_resend(&l_inflight, test_resend, &l_log);
+	TEST_ASSERT_EQUAL(1, l_log.Count);
+	TEST_ASSERT_EQUAL(l_ids[1], l_log.Ids[0]);
+
+	// A clean session forgets what was sent but keeps the ids still queued
+	mqtt_inflight_sent(&l_inflight, l_ids[1]);
+	mqtt_inflight_clear(&l_inflight);
+	TEST_ASSERT_EQUAL(2, mqtt_inflight_count(&l_inflight));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_ack(&l_inflight, l_ids[0], INFLIGHT_PUBACK));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_ack(&l_inflight, l_ids[2], INFLIGHT_PUBACK));
+	TEST_ASSERT_EQUAL(0, mqtt_inflight_count(&l_inflight));
+	mqtt_inflight_deinit(&l_inflight);
+}
+
+TEST_CASE("publish waits for a place in the window", "[mqtt][inflight]") {
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	OutboxStats_t l_stats;
+	int l_ix;
+
+	memset(&l_client, 0, sizeof(l_client));
+	memset(&l_state, 0, sizeof(l_state));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_outbox_init(&l_outbox, 4096));
+	mqtt_outbox_set_policy(&l_outbox, OUTBOX_POLICY_REJECT_NEWEST, 0, 0);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_init(&l_state.inflight, 4, TEST_BLOCK));
+	l_client.Outbox = &l_outbox;
+	l_client.State = &l_state;
+	for (l_ix = 0; l_ix < 4; l_ix++) {
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_publish(&l_client, "a/b", "1", 1, 1, 0));
+	}
+	TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, mqtt_publish(&l_client, "a/b", "1", 1, 2, 0));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_publish(&l_client, "a/b", "0", 1, 0, 0));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_ack(&l_state.inflight, 3, INFLIGHT_PUBACK));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_publish(&l_client, "a/b", "1", 1, 2, 0));
+	mqtt_outbox_get_stats(&l_outbox, &l_stats);
+	TEST_ASSERT_EQUAL(0, l_stats.Rejected);
+	mqtt_inflight_deinit(&l_state.inflight);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+/*
+ * Ids that share home slots, so releases have to shift the rest of the run back.
+ */
+TEST_CASE("inbound qos 2 ids are held until their pubrel", "[mqtt][inflight]") {
+	InboundQos2_t l_inbound;
+	uint32_t l_max = CONFIG_MQTT_INBOUND_QOS2_SLOTS * 3 / 4;
+	uint16_t l_id;
+
+	mqtt_inbound_qos2_clear(&l_inbound);
+	for (l_id = 1; l_id <= l_max; l_id++) {
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_inbound_qos2_receive(&l_inbound, l_id * CONFIG_MQTT_INBOUND_QOS2_SLOTS / 2));
+	}
+	TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, mqtt_inbound_qos2_receive(&l_inbound, 0x7777));
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, mqtt_inbound_qos2_receive(&l_inbound, CONFIG_MQTT_INBOUND_QOS2_SLOTS / 2));
+	for (l_id = 1; l_id <= l_max; l_id += 2) {
+		mqtt_inbound_qos2_release(&l_inbound, l_id * CONFIG_MQTT_INBOUND_QOS2_SLOTS / 2);
+	}
+	mqtt_inbound_qos2_release(&l_inbound, 0x7777);
+	for (l_id = 1; l_id <= l_max; l_id++) {
+		TEST_ASSERT_EQUAL(l_id % 2 ? ESP_OK : ESP_ERR_INVALID_STATE, mqtt_inbound_qos2_receive(&l_inbound, l_id * CONFIG_MQTT_INBOUND_QOS2_SLOTS / 2));
+	}
+	TEST_ASSERT_EQUAL(l_max, l_inbound.Count);
+}
+
+typedef struct BenchBroker {
+	Inflight_t			*Inflight;
+	QueueHandle_t		Sent;  // Ids, in the order the publishes went out
+	SemaphoreHandle_t	Done;
+	int					Count;
+} BenchBroker_t;
+
+/*
+ * Acknowledge each publish TEST_BENCH_RTT_MS after it was sent.
+ */
+static void bench_broker(void *pvParameters) {
+	BenchBroker_t *l_broker = pvParameters;
+	struct { uint16_t Id; int64_t At; } l_sent;
+	int64_t l_wait;
+	int l_ix;
+
+	for (l_ix = 0; l_ix < l_broker->Count; l_ix++) {
+		xQueueReceive(l_broker->Sent, &l_sent, portMAX_DELAY);
+		l_wait = l_sent.At + TEST_BENCH_RTT_MS * 1000 - now_us();
+		if (l_wait > 0) {
+			vTaskDelay(l_wait / 1000 / portTICK_RATE_MS + 1);
+		}
+		mqtt_inflight_ack(l_broker->Inflight, l_sent.Id, INFLIGHT_PUBACK);
+	}
+	xSemaphoreGive(l_broker->Done);
+	vTaskDelete(NULL);
+}
+
+/*
+ * QoS 1 publishes per second against a broker that answers each one a round trip later.
+ * A window of 1 is the old stop and wait.
+ */
+TEST_CASE("inflight qos 1 throughput per window size", "[mqtt][inflight][bench]") {
+	static const uint32_t l_windows[] = { 1, 4, 16, 64 };
+	Inflight_t l_inflight;
+	BenchBroker_t l_broker;
+	struct { uint16_t Id; int64_t At; } l_sent;
+	uint32_t l_counter = 0, l_w;
+	int l_ix, l_count;
+	int64_t l_start, l_elapsed;
+
+	for (l_w = 0; l_w < sizeof(l_windows) / sizeof(l_windows[0]); l_w++) {
+		// Enough publishes to fill the pipe several times over, without a slow run at window 1
+		l_count = l_windows[l_w] * 20 < TEST_BENCH_PUBLISHES ? l_windows[l_w] * 20 : TEST_BENCH_PUBLISHES;
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_init(&l_inflight, l_windows[l_w], TEST_BLOCK));
+		l_broker = (BenchBroker_t) { &l_inflight, xQueueCreate(l_windows[l_w], sizeof(l_sent)), xSemaphoreCreateBinary(), l_count };
+		xTaskCreate(&bench_broker, "bench_broker", 2048, &l_broker, 5, NULL);
+		l_start = now_us();
+		for (l_ix = 0; l_ix < l_count; l_ix++) {
+			TEST_ASSERT_EQUAL(ESP_OK, mqtt_inflight_open(&l_inflight, &l_counter, 1, portMAX_DELAY, &l_sent.Id));
+			l_sent.At = now_us();
+			xQueueSend(l_broker.Sent, &l_sent, portMAX_DELAY);
+		}
+		TEST_ASSERT_TRUE(xSemaphoreTake(l_broker.Done, 10000 / portTICK_RATE_MS));
+		l_elapsed = now_us() - l_start + 1;
+		printf("inflight window %2d: %8lld publishes/s at %d ms rtt\n", l_windows[l_w], (long long) l_count * 1000000 / l_elapsed, TEST_BENCH_RTT_MS);
+		TEST_ASSERT_EQUAL(0, mqtt_inflight_count(&l_inflight));
+		vQueueDelete(l_broker.Sent);
+		vSemaphoreDelete(l_broker.Done);
+		mqtt_inflight_deinit(&l_inflight);
+	}
+}
+
+// ### END DBK
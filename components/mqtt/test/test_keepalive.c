@@ -0,0 +1,84 @@
+/*
+ * test_keepalive.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "unity.h"
+
+#include "mqtt_keepalive.h"
+
+#define TEST_TIMEOUT_MS		2000
+
+TEST_CASE("keepalive pings after half the keepalive of quiet either way", "[mqtt][keepalive]") {
+	Keepalive_t l_keepalive;
+	TickType_t l_now = (TickType_t) -1000;  // Wraps part way through
+	TickType_t l_wait;
+
+	mqtt_keepalive_init(&l_keepalive, TEST_TIMEOUT_MS);
+	mqtt_keepalive_start(&l_keepalive, 10, l_now);
+	TEST_ASSERT_EQUAL(KEEPALIVE_IDLE, mqtt_keepalive_check(&l_keepalive, l_now, &l_wait));
+	TEST_ASSERT_EQUAL(5000 / portTICK_RATE_MS, l_wait);
+
+	// Sending alone does not put the ping off: the broker has been quiet as long
+	mqtt_keepalive_sent(&l_keepalive, l_now + 3000);
+	TEST_ASSERT_EQUAL(KEEPALIVE_IDLE, mqtt_keepalive_check(&l_keepalive, l_now + 4000, &l_wait));
+	TEST_ASSERT_EQUAL(1000, l_wait);
+	mqtt_keepalive_received(&l_keepalive, l_now + 4000);
+	TEST_ASSERT_EQUAL(KEEPALIVE_IDLE, mqtt_keepalive_check(&l_keepalive, l_now + 4000, &l_wait));
+	TEST_ASSERT_EQUAL(4000, l_wait);
+	TEST_ASSERT_EQUAL(KEEPALIVE_PING, mqtt_keepalive_check(&l_keepalive, l_now + 8000, &l_wait));
+
+	// An answer, or anything else from the broker, clears the ping
+	mqtt_keepalive_ping_sent(&l_keepalive, l_now + 8000);
+	mqtt_keepalive_sent(&l_keepalive, l_now + 8000);
+	TEST_ASSERT_EQUAL(KEEPALIVE_IDLE, mqtt_keepalive_check(&l_keepalive, l_now + 8500, &l_wait));
+	TEST_ASSERT_EQUAL(1500, l_wait);
+	mqtt_keepalive_received(&l_keepalive, l_now + 8600);
+	TEST_ASSERT_EQUAL(KEEPALIVE_IDLE, mqtt_keepalive_check(&l_keepalive, l_now + 9000, &l_wait));
+	TEST_ASSERT_EQUAL(0, l_keepalive.Outstanding);
+	TEST_ASSERT_EQUAL(1, l_keepalive.Pings);
+
+	// No keepalive, no pings
+	mqtt_keepalive_start(&l_keepalive, 0, l_now);
+	TEST_ASSERT_EQUAL(KEEPALIVE_IDLE, mqtt_keepalive_check(&l_keepalive, l_now + 100000, &l_wait));
+	TEST_ASSERT_EQUAL(portMAX_DELAY, l_wait);
+}
+
+TEST_CASE("keepalive gives up once on an unanswered ping and times the detection", "[mqtt][keepalive]") {
+	Keepalive_t l_keepalive;
+	TickType_t l_wait;
+
+	mqtt_keepalive_init(&l_keepalive, TEST_TIMEOUT_MS);
+	mqtt_keepalive_start(&l_keepalive, 10, 0);
+	mqtt_keepalive_received(&l_keepalive, 1000);
+	mqtt_keepalive_sent(&l_keepalive, 5000);
+	TEST_ASSERT_EQUAL(KEEPALIVE_PING, mqtt_keepalive_check(&l_keepalive, 6000, &l_wait));
+	mqtt_keepalive_ping_sent(&l_keepalive, 6000);
+	TEST_ASSERT_EQUAL(KEEPALIVE_IDLE, mqtt_keepalive_check(&l_keepalive, 7999, &l_wait));
+	TEST_ASSERT_EQUAL(1, l_wait);
+	TEST_ASSERT_EQUAL(KEEPALIVE_DEAD, mqtt_keepalive_check(&l_keepalive, 8000, &l_wait));
+	TEST_ASSERT_EQUAL(7000, l_keepalive.DetectMs);
+	TEST_ASSERT_EQUAL(portMAX_DELAY, l_wait);
+	TEST_ASSERT_EQUAL(KEEPALIVE_IDLE, mqtt_keepalive_check(&l_keepalive, 20000, &l_wait));
+
+	// A new connection starts over
+	mqtt_keepalive_start(&l_keepalive, 10, 20000);
+	TEST_ASSERT_EQUAL(0, l_keepalive.Dead);
+	TEST_ASSERT_EQUAL(KEEPALIVE_PING, mqtt_keepalive_check(&l_keepalive, 25000, &l_wait));
+
+	// A timeout of 0 waits for ever
+	mqtt_keepalive_init(&l_keepalive, 0);
+	mqtt_keepalive_start(&l_keepalive, 10, 0);
+	mqtt_keepalive_ping_sent(&l_keepalive, 5000);
+	TEST_ASSERT_EQUAL(KEEPALIVE_IDLE, mqtt_keepalive_check(&l_keepalive, 1000000, &l_wait));
+	TEST_ASSERT_EQUAL(portMAX_DELAY, l_wait);
+}
+
+// ### END DBK
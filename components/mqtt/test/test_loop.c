@@ -0,0 +1,371 @@
+/*
+ * test_loop.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+
+#include "unity.h"
+
+#include "mqtt_structs.h"
+#include "mqtt.h"
+#include "mqtt_loop.h"
+#include "mqtt_keepalive.h"
+#include "mqtt_outbox.h"
+#include "mqtt_transport.h"
+
+#define TEST_LANE_SIZE		1024
+#define TEST_ACK_MS			200
+
+static const uint8_t s_connack[] = { 0x20, 0x02, 0x00, 0x00 };
+static const uint8_t s_connack_session[] = { 0x20, 0x02, 0x01, 0x00 };
+
+static volatile int s_connected;
+static volatile int s_loop_done;
+
+static int64_t now_ms(void) {
+	struct timeval l_tv;
+	gettimeofday(&l_tv, NULL);
+	return (int64_t) l_tv.tv_sec * 1000 + l_tv.tv_usec / 1000;
+}
+
+static void loop_connected_cb(void *p_client, void *p_event) {
+	s_connected++;
+}
+
+static void loop_task(void *pvParameters) {
+	mqtt_event_loop((Client_t *) pvParameters);
+	s_loop_done = 1;
+	vTaskDelete(NULL);
+}
+
+/*
+ * Accept the client's next connection, with reads that give up after a few seconds.
+ * @return the socket, or -1.
+ */
+static int broker_accept(int p_listener) {
+	struct timeval l_timeout = { 3, 0 };
+	int l_sock = accept(p_listener, NULL, NULL);
+	if (l_sock >= 0) {
+		setsockopt(l_sock, SOL_SOCKET, SO_RCVTIMEO, &l_timeout, sizeof(l_timeout));
+	}
+	return l_sock;
+}
+
+/*
+ * Read one whole packet (remaining length under 128) from the client.
+ * @return its length, 0 if the client closed the connection, or -1.
+ */
+static int broker_read(int p_sock, uint8_t *r_packet) {
+	int l_len = recv(p_sock, r_packet, 2, MSG_WAITALL);
+	if (l_len != 2) {
+		return l_len == 0 ? 0 : -1;
+	}
+	if (r_packet[1] > 0 && recv(p_sock, r_packet + 2, r_packet[1], MSG_WAITALL) != r_packet[1]) {
+		return -1;
+	}
+	return 2 + r_packet[1];
+}
+
+TEST_CASE("loop timers give the nearest deadline and expire across the tick wrap", "[mqtt][loop]") {
+	Timers_t l_timers;
+	TickType_t l_now = (TickType_t) -50;
+
+	mqtt_timer_init(&l_timers);
+	TEST_ASSERT_EQUAL(portMAX_DELAY, mqtt_timer_next(&l_timers, l_now));
+	mqtt_timer_arm(&l_timers, MQTT_TIMER_KEEPALIVE, l_now, 300);
+	mqtt_timer_arm(&l_timers, MQTT_TIMER_ACK, l_now, 100);
+	mqtt_timer_arm(&l_timers, MQTT_TIMER_RECONNECT, l_now, 20);
+	TEST_ASSERT_EQUAL(20, mqtt_timer_next(&l_timers, l_now));
+	mqtt_timer_cancel(&l_timers, MQTT_TIMER_RECONNECT);
+	TEST_ASSERT_FALSE(mqtt_timer_armed(&l_timers, MQTT_TIMER_RECONNECT));
+	TEST_ASSERT_EQUAL(100, mqtt_timer_next(&l_timers, l_now));
+	TEST_ASSERT_EQUAL(0, mqtt_timer_expired(&l_timers, l_now + 99));
+
+	// The tick count wraps between now and the ack deadline
+	TEST_ASSERT_EQUAL(MQTT_TIMER_BIT(MQTT_TIMER_ACK), mqtt_timer_expired(&l_timers, l_now + 100));
+	TEST_ASSERT_FALSE(mqtt_timer_armed(&l_timers, MQTT_TIMER_ACK));
+	TEST_ASSERT_TRUE(mqtt_timer_armed(&l_timers, MQTT_TIMER_KEEPALIVE));
+	TEST_ASSERT_EQUAL(200, mqtt_timer_next(&l_timers, l_now + 100));
+	// Overdue is due now, not in 4 billion ticks
+	TEST_ASSERT_EQUAL(0, mqtt_timer_next(&l_timers, l_now + 1000));
+	TEST_ASSERT_EQUAL(MQTT_TIMER_BIT(MQTT_TIMER_KEEPALIVE), mqtt_timer_expired(&l_timers, l_now + 1000));
+	TEST_ASSERT_EQUAL(portMAX_DELAY, mqtt_timer_next(&l_timers, l_now + 1000));
+}
+
+TEST_CASE("outbox writes to its wakeup socket once per drain", "[mqtt][loop]") {
+	Outbox_t l_outbox;
+	ControlPacket_t l_ping = { 2, { 0xc0, 0x00 } };
+	uint8_t l_bytes[4];
+	int l_wake;
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_outbox_init(&l_outbox, TEST_LANE_SIZE));
+	l_wake = mqtt_transport_wakeup_open();
+	TEST_ASSERT_TRUE(l_wake >= 0);
+	mqtt_outbox_set_wakeup(&l_outbox, l_wake);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_outbox_control(&l_outbox, &l_ping, 0));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_outbox_control(&l_outbox, &l_ping, 0));
+	// One datagram for the pair
+	TEST_ASSERT_EQUAL(1, recv(l_wake, l_bytes, sizeof(l_bytes), 0));
+	TEST_ASSERT_TRUE(recv(l_wake, l_bytes, sizeof(l_bytes), 0) < 0);
+	mqtt_outbox_rearm_wakeup(&l_outbox);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_outbox_control(&l_outbox, &l_ping, 0));
+	mqtt_transport_wakeup_drain(l_wake);
+	TEST_ASSERT_TRUE(recv(l_wake, l_bytes, sizeof(l_bytes), 0) < 0);
+	mqtt_outbox_set_wakeup(&l_outbox, -1);
+	close(l_wake);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+/*
+ * A client, run by mqtt_event_loop() in its own task, and the listening socket of the broker the test plays.
+ */
+typedef struct LoopFixture {
+	Client_t			Client;
+	BrokerConfig_t		Broker;
+	Buffers_t			Buffers;
+	Callback_t			Cb;
+	PacketInfo_t		Arena;
+	Outbox_t			Outbox;
+	State_t				State;
+	Will_t				Will;
+	Reconnect_t			Reconnect;
+	EventLoop_t			Loop;
+	int					Listener;
+} LoopFixture_t;
+
+static LoopFixture_t s_fixture;
+
+static void fixture_start(LoopFixture_t *p_fix, uint32_t p_keepalive_s, uint32_t p_pingresp_ms) {
+	struct sockaddr_in l_addr;
+	socklen_t l_addr_len = sizeof(l_addr);
+
+	memset(p_fix, 0, sizeof(LoopFixture_t));
+	s_connected = 0;
+	s_loop_done = 0;
+	p_fix->Listener = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&l_addr, 0, sizeof(l_addr));
+	l_addr.sin_family = AF_INET;
+	l_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(p_fix->Listener, (struct sockaddr *) &l_addr, sizeof(l_addr));
+	listen(p_fix->Listener, 1);
+	getsockname(p_fix->Listener, (struct sockaddr *) &l_addr, &l_addr_len);
+
+	strcpy(p_fix->Broker.Host, "127.0.0.1");
+	p_fix->Broker.Port = ntohs(l_addr.sin_port);
+	strcpy(p_fix->Broker.ClientId, "loop");
+	p_fix->Buffers.in_buffer_length = 256;
+	p_fix->Buffers.in_buffer = malloc(p_fix->Buffers.in_buffer_length);
+	p_fix->Buffers.batch_size = 256;
+	p_fix->Buffers.batch_buffer = malloc(p_fix->Buffers.batch_size);
+	p_fix->Arena.PacketBuffer_length = 64;
+	p_fix->Arena.PacketBuffer = malloc(p_fix->Arena.PacketBuffer_length);
+	p_fix->Cb.connected_cb = loop_connected_cb;
+	p_fix->Will.Keepalive = p_keepalive_s;
+	p_fix->Loop.Wake = -1;
+	p_fix->Loop.AckTicks = TEST_ACK_MS / portTICK_RATE_MS;
+	mqtt_outbox_init(&p_fix->Outbox, TEST_LANE_SIZE);
+	mqtt_inflight_init(&p_fix->State.inflight, 4, 64);
+	mqtt_keepalive_init(&p_fix->State.keepalive, p_pingresp_ms);
+	mqtt_reconnect_init(&p_fix->Reconnect, 20, 40, 0, 1);
+	p_fix->Client.Broker = &p_fix->Broker;
+	p_fix->Client.Buffers = &p_fix->Buffers;
+	p_fix->Client.Cb = &p_fix->Cb;
+	p_fix->Client.Packet = &p_fix->Arena;
+	p_fix->Client.Outbox = &p_fix->Outbox;
+	p_fix->Client.State = &p_fix->State;
+	p_fix->Client.Will = &p_fix->Will;
+	p_fix->Client.Reconnect = &p_fix->Reconnect;
+	p_fix->Client.Loop = &p_fix->Loop;
+	xTaskCreate(&loop_task, "loop_task", 4096, &p_fix->Client, 5, NULL);
+}
+
+/*
+ * Accept the next connection, read its CONNECT and answer with p_connack.
+ * @return the socket, or -1.
+ */
+static int fixture_accept(LoopFixture_t *p_fix, const uint8_t *p_connack) {
+	uint8_t l_packet[128];
+	int l_sock = broker_accept(p_fix->Listener);
+	int l_ix;
+
+	if (l_sock < 0 || broker_read(l_sock, l_packet) <= 0 || l_packet[0] != 0x10) {
+		return -1;
+	}
+	write(l_sock, p_connack, 4);
+	for (l_ix = 0; l_ix < 100 && s_connected == 0; l_ix++) {
+		vTaskDelay(10 / portTICK_RATE_MS);
+	}
+	return l_sock;
+}
+
+/*
+ * Stop the loop and free everything.
+ * @return non zero if the loop returned.
+ */
+static int fixture_finish(LoopFixture_t *p_fix) {
+	int l_ix;
+
+	mqtt_event_loop_stop(&p_fix->Client);
+	for (l_ix = 0; l_ix < 100 && !s_loop_done; l_ix++) {
+		vTaskDelay(10 / portTICK_RATE_MS);
+	}
+	close(p_fix->Listener);
+	mqtt_inflight_deinit(&p_fix->State.inflight);
+	mqtt_outbox_deinit(&p_fix->Outbox);
+	free(p_fix->Buffers.in_buffer);
+	free(p_fix->Buffers.batch_buffer);
+	free(p_fix->Arena.PacketBuffer);
+	return s_loop_done;
+}
+
+/*
+ * The test plays the broker on a loopback socket: CONNACK, a publish woken straight out, a PINGREQ
+ *  after keepalive/2 of quiet, a QoS 1 publish left unacked until the loop gives up on the connection,
+ *  and its resend with DUP on the next one.
+ */
+TEST_CASE("event loop sends on commit, pings when idle and reconnects on a missing ack", "[mqtt][loop]") {
+	LoopFixture_t *l_fix = &s_fixture;
+	uint8_t l_packet[128];
+	int64_t l_start, l_wait;
+	int l_sock, l_ix;
+
+	fixture_start(l_fix, 1, 0);
+	l_sock = fixture_accept(l_fix, s_connack);
+	TEST_ASSERT_TRUE(l_sock >= 0);
+	TEST_ASSERT_EQUAL(1, s_connected);
+
+	// Out as soon as it is committed, not on a poll
+	l_start = now_ms();
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_publish(&l_fix->Client, "a", "x", 1, 0, 0));
+	TEST_ASSERT_EQUAL(6, broker_read(l_sock, l_packet));
+	TEST_ASSERT_EQUAL(0x30, l_packet[0]);
+	TEST_ASSERT_TRUE(now_ms() - l_start < 100);
+
+	// Quiet for keepalive/2 after the last write
+	l_start = now_ms();
+	TEST_ASSERT_EQUAL(2, broker_read(l_sock, l_packet));
+	TEST_ASSERT_EQUAL(0xc0, l_packet[0]);
+	l_wait = now_ms() - l_start;
+	TEST_ASSERT_TRUE(l_wait >= 400 && l_wait < 700);
+
+	// Never acked: the loop drops the connection after TEST_ACK_MS
+	l_start = now_ms();
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_publish(&l_fix->Client, "a", "y", 1, 1, 0));
+	TEST_ASSERT_EQUAL(8, broker_read(l_sock, l_packet));
+	TEST_ASSERT_EQUAL(0x32, l_packet[0]);
+	TEST_ASSERT_EQUAL(0, broker_read(l_sock, l_packet));
+	l_wait = now_ms() - l_start;
+	TEST_ASSERT_TRUE(l_wait >= TEST_ACK_MS && l_wait < TEST_ACK_MS + 200);
+	close(l_sock);
+
+	// The session was kept, so the publish comes again, with DUP, and this time it is acked
+	s_connected = 0;
+	l_sock = fixture_accept(l_fix, s_connack_session);
+	TEST_ASSERT_TRUE(l_sock >= 0);
+	TEST_ASSERT_EQUAL(8, broker_read(l_sock, l_packet));
+	TEST_ASSERT_EQUAL(0x3a, l_packet[0]);
+	l_packet[0] = 0x40;
+	l_packet[1] = 0x02;
+	l_packet[2] = 0x00;
+	l_packet[3] = 0x01;
+	write(l_sock, l_packet, 4);
+	for (l_ix = 0; l_ix < 100 && mqtt_inflight_count(&l_fix->State.inflight) > 0; l_ix++) {
+		vTaskDelay(10 / portTICK_RATE_MS);
+	}
+	TEST_ASSERT_EQUAL(0, mqtt_inflight_count(&l_fix->State.inflight));
+	TEST_ASSERT_EQUAL(1, s_connected);
+	TEST_ASSERT_EQUAL(2, l_fix->Reconnect.Stats.Connects);
+
+	TEST_ASSERT_TRUE(fixture_finish(l_fix));
+	TEST_ASSERT_EQUAL(0, broker_read(l_sock, l_packet));
+	close(l_sock);
+}
+
+/*
+ * A broker that answers one PINGREQ and then goes silent, as over a half open link.
+ */
+TEST_CASE("event loop gives up on a broker that stops answering pings", "[mqtt][loop][keepalive]") {
+	static const uint8_t l_pingresp[] = { 0xd0, 0x00 };
+	LoopFixture_t *l_fix = &s_fixture;
+	uint8_t l_packet[128];
+	int64_t l_start, l_wait;
+	int l_sock;
+
+	fixture_start(l_fix, 1, TEST_ACK_MS);
+	l_sock = fixture_accept(l_fix, s_connack);
+	TEST_ASSERT_TRUE(l_sock >= 0);
+	TEST_ASSERT_EQUAL(2, broker_read(l_sock, l_packet));
+	TEST_ASSERT_EQUAL(0xc0, l_packet[0]);
+	write(l_sock, l_pingresp, sizeof(l_pingresp));
+
+	// Answered, so the connection stands until the next ping goes unanswered
+	l_start = now_ms();
+	TEST_ASSERT_EQUAL(2, broker_read(l_sock, l_packet));
+	TEST_ASSERT_EQUAL(0xc0, l_packet[0]);
+	TEST_ASSERT_EQUAL(0, broker_read(l_sock, l_packet));
+	l_wait = now_ms() - l_start;
+	TEST_ASSERT_TRUE(l_wait >= 500 + TEST_ACK_MS - 50 && l_wait < 500 + TEST_ACK_MS + 200);
+	close(l_sock);
+
+	// Found within keepalive/2 plus the PINGRESP timeout of last hearing from the broker
+	s_connected = 0;
+	l_sock = fixture_accept(l_fix, s_connack);
+	TEST_ASSERT_TRUE(l_sock >= 0);
+	TEST_ASSERT_EQUAL(1, l_fix->Reconnect.Stats.DeadLinks);
+	TEST_ASSERT_TRUE(l_fix->Reconnect.Stats.LastDetectMs >= 500 + TEST_ACK_MS - 50);
+	TEST_ASSERT_TRUE(l_fix->Reconnect.Stats.LastDetectMs < 500 + TEST_ACK_MS + 100);
+	TEST_ASSERT_EQUAL(2, l_fix->Reconnect.Stats.Connects);
+	TEST_ASSERT_TRUE(fixture_finish(l_fix));
+	close(l_sock);
+}
+
+/*
+ * More QoS 1 publishes in one read than the control lane holds (CONFIG_MQTT_CONTROL_QUEUE_LENGTH):
+ *  the loop is the lane's only consumer, so it has to send acks out to make room rather than wait on itself.
+ */
+TEST_CASE("event loop acks a burst of QoS 1 publishes bigger than the control lane", "[mqtt][loop]") {
+	LoopFixture_t *l_fix = &s_fixture;
+	uint8_t l_burst[(CONFIG_MQTT_CONTROL_QUEUE_LENGTH + 4) * 8];
+	uint8_t l_packet[128];
+	int64_t l_start;
+	int l_sock, l_ix, l_count = CONFIG_MQTT_CONTROL_QUEUE_LENGTH + 4;
+
+	fixture_start(l_fix, 10, 0);
+	l_sock = fixture_accept(l_fix, s_connack);
+	TEST_ASSERT_TRUE(l_sock >= 0);
+
+	for (l_ix = 0; l_ix < l_count; l_ix++) {
+		uint8_t *l_ptr = l_burst + l_ix * 8;
+		l_ptr[0] = 0x32;
+		l_ptr[1] = 0x06;
+		l_ptr[2] = 0x00;
+		l_ptr[3] = 0x01;
+		l_ptr[4] = 'a';
+		l_ptr[5] = 0x00;
+		l_ptr[6] = l_ix + 1;
+		l_ptr[7] = 'x';
+	}
+	l_start = now_ms();
+	write(l_sock, l_burst, l_count * 8);
+	for (l_ix = 0; l_ix < l_count; l_ix++) {
+		TEST_ASSERT_EQUAL(4, broker_read(l_sock, l_packet));
+		TEST_ASSERT_EQUAL(0x40, l_packet[0]);
+		TEST_ASSERT_EQUAL(l_ix + 1, l_packet[3]);
+	}
+	TEST_ASSERT_TRUE(now_ms() - l_start < 1000);
+
+	TEST_ASSERT_TRUE(fixture_finish(l_fix));
+	close(l_sock);
+}
+
+// ### END DBK
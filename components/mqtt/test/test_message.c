@@ -6,3 +6,173 @@
  */
 
 #include "unity.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "mqtt.h"
+#include "mqtt_message.h"
+#include "mqtt_property.h"
+
+#define TEST_PARSE_PACKETS	1000000
+
+static int64_t now_us(void) {
+	struct timeval l_tv;
+	gettimeofday(&l_tv, NULL);
+	return (int64_t) l_tv.tv_sec * 1000000 + l_tv.tv_usec;
+}
+
+/*
+ * QoS 1 PUBLISH to "a/b", id 0x0102, with a 200 byte payload - a 2 byte remaining length.
+ */
+static int message_publish(uint8_t *p_buffer) {
+	int l_ix;
+	p_buffer[0] = 0x32;
+	p_buffer[1] = 0x80 | (207 % 128);
+	p_buffer[2] = 207 / 128;
+	memcpy(p_buffer + 3, "\0\3a/b\1\2", 7);
+	for (l_ix = 0; l_ix < 200; l_ix++) {
+		p_buffer[10 + l_ix] = l_ix;
+	}
+	return 210;
+}
+
+TEST_CASE("message parses a publish in one pass", "[mqtt][message]") {
+	uint8_t l_buffer[256];
+	PacketView_t l_view;
+	int l_len = message_publish(l_buffer);
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_parse_packet(l_buffer, l_len, &l_view));
+	TEST_ASSERT_EQUAL(MQTT_MSG_TYPE_PUBLISH, l_view.Type);
+	TEST_ASSERT_EQUAL(1, l_view.Qos);
+	TEST_ASSERT_EQUAL(0x0102, l_view.PacketId);
+	TEST_ASSERT_EQUAL(3, l_view.Topic_length);
+	TEST_ASSERT_EQUAL(0, memcmp(l_view.Topic, "a/b", 3));
+	TEST_ASSERT_EQUAL(l_buffer + 10, l_view.Payload);
+	TEST_ASSERT_EQUAL(200, l_view.Payload_length);
+	TEST_ASSERT_EQUAL(210, l_view.Total_length);
+	TEST_ASSERT_EQUAL(0x0102, mqtt_get_id(l_buffer, l_len));
+
+	// Cut short: the header still gives the total length
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, mqtt_parse_packet(l_buffer, 100, &l_view));
+	TEST_ASSERT_EQUAL(210, l_view.Total_length);
+	// Topic length running past the packet
+	l_buffer[4] = 250;
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_RESPONSE, mqtt_parse_packet(l_buffer, l_len, &l_view));
+}
+
+TEST_CASE("message parses acks", "[mqtt][message]") {
+	uint8_t l_suback[5] = { 0x90, 0x03, 0x00, 0x07, 0x01 };
+	uint8_t l_pubrel[4] = { 0x62, 0x02, 0xab, 0xcd };
+	uint8_t l_short[3] = { 0x40, 0x01, 0x00 };
+	PacketView_t l_view;
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_parse_packet(l_suback, sizeof(l_suback), &l_view));
+	TEST_ASSERT_EQUAL(7, l_view.PacketId);
+	TEST_ASSERT_EQUAL(1, l_view.Payload_length);
+	TEST_ASSERT_EQUAL(1, l_view.Payload[0]);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_parse_packet(l_pubrel, sizeof(l_pubrel), &l_view));
+	TEST_ASSERT_EQUAL(0x02, l_view.Flags);
+	TEST_ASSERT_EQUAL(0xabcd, l_view.PacketId);
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_RESPONSE, mqtt_parse_packet(l_short, sizeof(l_short), &l_view));
+}
+
+TEST_CASE("message parses mqtt 5 reason codes and properties", "[mqtt][message]") {
+	// Session present, success; Receive Maximum 10, Topic Alias Maximum 5, a user property
+	static const uint8_t l_connack[] = { 0x20, 0x13, 0x01, 0x00, 0x10, 0x21, 0x00, 0x0a, 0x22, 0x00, 0x05,
+			0x26, 0x00, 0x01, 'k', 0x00, 0x04, 'v', 'a', 'l', 'u' };
+	// QoS 1 to "a/b", id 9, a Topic Alias property, payload "hi"
+	static const uint8_t l_publish[] = { 0x32, 0x0d, 0x00, 0x03, 'a', '/', 'b', 0x00, 0x09, 0x03, 0x23, 0x00, 0x02, 'h', 'i' };
+	static const uint8_t l_puback[] = { 0x40, 0x03, 0x00, 0x09, 0x10 };  // No matching subscribers, no properties
+	static const uint8_t l_puback_short[] = { 0x40, 0x02, 0x00, 0x09 };
+	static const uint8_t l_disconnect[] = { 0xe0, 0x02, 0x8e, 0x00 };
+	uint8_t l_bad[sizeof(l_connack)];
+	PacketView_t l_view;
+	Property_t l_property;
+	const uint8_t *l_ptr, *l_end;
+	uint32_t l_seen = 0;
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_parse_packet_level(l_connack, sizeof(l_connack), MQTT_PROTOCOL_LEVEL_5, &l_view));
+	TEST_ASSERT_EQUAL(0, l_view.ReasonCode);
+	TEST_ASSERT_EQUAL(16, l_view.Properties_length);
+	l_ptr = l_view.Properties;
+	l_end = l_ptr + l_view.Properties_length;
+	while (l_ptr < l_end) {
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_property_next(&l_ptr, l_end, &l_property));
+		if (l_property.Id == MQTT_PROPERTY_RECEIVE_MAXIMUM) {
+			TEST_ASSERT_EQUAL(10, l_property.Value);
+		} else if (l_property.Id == MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM) {
+			TEST_ASSERT_EQUAL(5, l_property.Value);
+		} else {
+			TEST_ASSERT_EQUAL(MQTT_PROPERTY_USER_PROPERTY, l_property.Id);
+			TEST_ASSERT_EQUAL(9, l_property.Length);
+		}
+		l_seen++;
+	}
+	TEST_ASSERT_EQUAL(3, l_seen);
+	TEST_ASSERT_TRUE(l_ptr == l_end);
+	// A user property value running past the list, and an unknown identifier
+	memcpy(l_bad, l_connack, sizeof(l_bad));
+	l_bad[16] = 0x09;
+	l_ptr = l_bad + 16 - 5;
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_RESPONSE, mqtt_property_next(&l_ptr, l_bad + sizeof(l_bad), &l_property));
+	l_bad[5] = 0x7f;
+	l_ptr = l_bad + 5;
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_RESPONSE, mqtt_property_next(&l_ptr, l_bad + sizeof(l_bad), &l_property));
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_parse_packet_level(l_publish, sizeof(l_publish), MQTT_PROTOCOL_LEVEL_5, &l_view));
+	TEST_ASSERT_EQUAL(9, l_view.PacketId);
+	TEST_ASSERT_EQUAL(3, l_view.Properties_length);
+	TEST_ASSERT_EQUAL(2, l_view.Payload_length);
+	TEST_ASSERT_EQUAL(0, memcmp(l_view.Payload, "hi", 2));
+	// Read as 3.1.1 the property list would be taken for payload
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_parse_packet(l_publish, sizeof(l_publish), &l_view));
+	TEST_ASSERT_EQUAL(6, l_view.Payload_length);
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_parse_packet_level(l_puback, sizeof(l_puback), MQTT_PROTOCOL_LEVEL_5, &l_view));
+	TEST_ASSERT_EQUAL(0x10, l_view.ReasonCode);
+	TEST_ASSERT_NULL(l_view.Properties);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_parse_packet_level(l_puback_short, sizeof(l_puback_short), MQTT_PROTOCOL_LEVEL_5, &l_view));
+	TEST_ASSERT_EQUAL(0, l_view.ReasonCode);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_parse_packet_level(l_disconnect, sizeof(l_disconnect), MQTT_PROTOCOL_LEVEL_5, &l_view));
+	TEST_ASSERT_EQUAL(0x8e, l_view.ReasonCode);
+	TEST_ASSERT_EQUAL(0, l_view.Properties_length);
+
+	// Cut short in the properties, and a property length running past the packet
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, mqtt_parse_packet_level(l_connack, 8, MQTT_PROTOCOL_LEVEL_5, &l_view));
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_RESPONSE, mqtt_parse_packet_level((const uint8_t *) "\x20\x03\x00\x00\x05", 5, MQTT_PROTOCOL_LEVEL_5, &l_view));
+}
+
+TEST_CASE("message publishes parsed per second", "[mqtt][message][bench]") {
+	uint8_t l_buffer[256];
+	PacketView_t l_view;
+	const uint8_t *l_topic, *l_data;
+	uint16_t l_topic_len, l_data_len;
+	uint32_t l_sum = 0;
+	int l_len = message_publish(l_buffer);
+	int l_ix;
+	int64_t l_start, l_elapsed;
+
+	l_start = now_us();
+	for (l_ix = 0; l_ix < TEST_PARSE_PACKETS; l_ix++) {
+		l_topic_len = l_data_len = l_len;
+		l_topic = mqtt_get_publish_topic(l_buffer, &l_topic_len);
+		l_data = mqtt_get_publish_data(l_buffer, &l_data_len);
+		l_sum += l_topic[0] + l_data_len + mqtt_get_id(l_buffer, l_len) + mqtt_get_total_length(l_buffer, l_len);
+	}
+	l_elapsed = now_us() - l_start + 1;
+	printf("message field getters: %10lld packets/s\n", (long long) TEST_PARSE_PACKETS * 1000000 / l_elapsed);
+
+	l_start = now_us();
+	for (l_ix = 0; l_ix < TEST_PARSE_PACKETS; l_ix++) {
+		mqtt_parse_packet(l_buffer, l_len, &l_view);
+		l_sum -= l_view.Topic[0] + l_view.Payload_length + l_view.PacketId + l_view.Total_length;
+	}
+	l_elapsed = now_us() - l_start + 1;
+	printf("message parse:         %10lld packets/s\n", (long long) TEST_PARSE_PACKETS * 1000000 / l_elapsed);
+	TEST_ASSERT_EQUAL(0, l_sum);
+	(void) l_data;
+}
+
+// ### END DBK
@@ -0,0 +1,537 @@
+/*
+ * test_outbox.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "unity.h"
+
+#include "mqtt.h"
+#include "mqtt_packet.h"
+#include "mqtt_outbox.h"
+
+#define TEST_LANE_SIZE		2048
+#define TEST_PRODUCERS		6
+#define TEST_MESSAGES		20000
+#define TEST_BENCH_MESSAGES	50000
+
+static int64_t now_us(void) {
+	struct timeval l_tv;
+	gettimeofday(&l_tv, NULL);
+	return (int64_t) l_tv.tv_sec * 1000000 + l_tv.tv_usec;
+}
+
+typedef struct ProducerArgs {
+	Client_t			*Client;
+	SemaphoreHandle_t	Done;
+	int					Id;
+	int					Count;
+	int					Errors;
+} ProducerArgs_t;
+
+/*
+ * Each payload is "<producer> <sequence>" padded out to a length that varies with the sequence.
+ */
+static void outbox_producer(void *pvParameters) {
+	ProducerArgs_t *l_args = pvParameters;
+	char l_payload[64];
+	int l_seq, l_len;
+
+	for (l_seq = 0; l_seq < l_args->Count; l_seq++) {
+		memset(l_payload, '.', sizeof(l_payload));
+		l_len = sprintf(l_payload, "%d %d", l_args->Id, l_seq);
+		l_payload[l_len] = '.';
+		l_len += l_seq % 32;
+		if (mqtt_publish(l_args->Client, "test/outbox", l_payload, l_len, 0, 0) != ESP_OK) {
+			l_args->Errors++;
+		}
+	}
+	xSemaphoreGive(l_args->Done);
+	vTaskDelete(NULL);
+}
+
+/*
+ * Run the sending task's drain loop here until p_total packets have been seen.
+ * @return the number of packets that were out of order or damaged.
+ */
+static int outbox_drain(Client_t *p_client, int p_total, int *p_next_seq) {
+	uint8_t *l_data;
+	char l_payload[64];
+	int32_t l_len;
+	int l_seen = 0, l_errors = 0, l_id, l_seq;
+
+	while (l_seen < p_total) {
+		if (!mqtt_outbox_wait(p_client->Outbox, 5000 / portTICK_RATE_MS)) {
+			return l_errors + p_total - l_seen;
+		}
+		while ((l_len = mqtt_outbox_peek(p_client->Outbox, &l_data)) > 0) {
+			// 0x30, remaining length, 00 0b "test/outbox", payload
+			if (l_data[0] != 0x30 || l_data[1] != l_len - 2 || memcmp(&l_data[4], "test/outbox", 11) != 0) {
+				l_errors++;
+			} else if (p_next_seq != NULL) {
+				memset(l_payload, 0, sizeof(l_payload));
+				memcpy(l_payload, &l_data[15], l_len - 15 < sizeof(l_payload) ? l_len - 15 : sizeof(l_payload) - 1);
+				if (sscanf(l_payload, "%d %d", &l_id, &l_seq) != 2 || l_id < 0 || l_id >= TEST_PRODUCERS
+						|| l_seq != p_next_seq[l_id]++ || l_len != 15 + (l_seq % 32) + snprintf(NULL, 0, "%d %d", l_id, l_seq)) {
+					l_errors++;
+				}
+			}
+			mqtt_outbox_consume(p_client->Outbox);
+			l_seen++;
+		}
+	}
+	return l_errors;
+}
+
+static void outbox_client_init(Client_t *p_client, Outbox_t *p_outbox, State_t *p_state) {
+	memset(p_client, 0, sizeof(Client_t));
+	memset(p_state, 0, sizeof(State_t));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_outbox_init(p_outbox, TEST_LANE_SIZE));
+	p_client->Outbox = p_outbox;
+	p_client->State = p_state;
+	mqtt_outbox_set_consumer(p_outbox, xTaskGetCurrentTaskHandle());
+}
+
+/*
+ * More producers than lanes, so some of them have to share the last lane.
+ */
+TEST_CASE("outbox keeps every producer in order with no interleaving", "[mqtt][outbox]") {
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	ProducerArgs_t l_args[TEST_PRODUCERS];
+	int l_next_seq[TEST_PRODUCERS] = { 0 };
+	SemaphoreHandle_t l_done = xSemaphoreCreateCounting(TEST_PRODUCERS, 0);
+	int l_ix;
+
+	outbox_client_init(&l_client, &l_outbox, &l_state);
+	for (l_ix = 0; l_ix < TEST_PRODUCERS; l_ix++) {
+		l_args[l_ix] = (ProducerArgs_t) { &l_client, l_done, l_ix, TEST_MESSAGES, 0 };
+		xTaskCreate(&outbox_producer, "outbox_producer", 2048, &l_args[l_ix], 5, NULL);
+	}
+	TEST_ASSERT_EQUAL(0, outbox_drain(&l_client, TEST_PRODUCERS * TEST_MESSAGES, l_next_seq));
+	for (l_ix = 0; l_ix < TEST_PRODUCERS; l_ix++) {
+		TEST_ASSERT_TRUE(xSemaphoreTake(l_done, 5000 / portTICK_RATE_MS));
+		TEST_ASSERT_EQUAL(0, l_args[l_ix].Errors);
+		TEST_ASSERT_EQUAL(TEST_MESSAGES, l_next_seq[l_ix]);
+	}
+	mqtt_outbox_set_consumer(&l_outbox, NULL);
+	mqtt_outbox_deinit(&l_outbox);
+	vSemaphoreDelete(l_done);
+}
+
+TEST_CASE("outbox control packets go ahead of queued publishes", "[mqtt][outbox]") {
+	static const uint8_t l_puback[] = { 0x40, 0x02, 0x12, 0x34 };
+	static const uint8_t l_pubrel[] = { 0x62, 0x02, 0x00, 0x07 };
+	static const uint8_t l_pingreq[] = { 0xc0, 0x00 };
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	uint8_t *l_data;
+	int l_ix;
+
+	outbox_client_init(&l_client, &l_outbox, &l_state);
+	for (l_ix = 0; l_ix < 20; l_ix++) {
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_publish(&l_client, "test/outbox", "backlog", 7, 0, 0));
+	}
+	// A publish already peeked is finished before anything else goes out
+	TEST_ASSERT_EQUAL(22, mqtt_outbox_peek(&l_outbox, &l_data));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_puback_packet(&l_client, 0x1234));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_pubrel_packet(&l_client, 7));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_pingreq_packet(&l_client));
+	TEST_ASSERT_EQUAL(22, mqtt_outbox_peek(&l_outbox, &l_data));
+	TEST_ASSERT_EQUAL(0x30, l_data[0]);
+	mqtt_outbox_consume(&l_outbox);
+	// Then the control packets, in order, ahead of the other 19
+	TEST_ASSERT_EQUAL(sizeof(l_puback), mqtt_outbox_peek(&l_outbox, &l_data));
+	TEST_ASSERT_EQUAL_MEMORY(l_puback, l_data, sizeof(l_puback));
+	mqtt_outbox_consume(&l_outbox);
+	TEST_ASSERT_EQUAL(sizeof(l_pubrel), mqtt_outbox_peek(&l_outbox, &l_data));
+	TEST_ASSERT_EQUAL_MEMORY(l_pubrel, l_data, sizeof(l_pubrel));
+	mqtt_outbox_consume(&l_outbox);
+	TEST_ASSERT_EQUAL(sizeof(l_pingreq), mqtt_outbox_peek(&l_outbox, &l_data));
+	TEST_ASSERT_EQUAL_MEMORY(l_pingreq, l_data, sizeof(l_pingreq));
+	mqtt_outbox_consume(&l_outbox);
+	for (l_ix = 0; l_ix < 19; l_ix++) {
+		TEST_ASSERT_EQUAL(22, mqtt_outbox_peek(&l_outbox, &l_data));
+		mqtt_outbox_consume(&l_outbox);
+	}
+	TEST_ASSERT_EQUAL(0, mqtt_outbox_peek(&l_outbox, &l_data));
+	mqtt_outbox_set_consumer(&l_outbox, NULL);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+/*
+ * A consumer that takes over after mqtt_outbox_release(): gets the next packet whole.
+ */
+static void outbox_next_consumer(void *pvParameters) {
+	ProducerArgs_t *l_args = pvParameters;
+	uint8_t *l_data;
+
+	l_args->Count = mqtt_outbox_peek(l_args->Client->Outbox, &l_data);
+	l_args->Id = l_args->Count > 0 ? l_data[0] : 0;
+	mqtt_outbox_consume(l_args->Client->Outbox);
+	xSemaphoreGive(l_args->Done);
+	vTaskDelete(NULL);
+}
+
+TEST_CASE("outbox release hands a peeked publish to the next consumer", "[mqtt][outbox]") {
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	ProducerArgs_t l_args;
+	uint8_t *l_data;
+
+	outbox_client_init(&l_client, &l_outbox, &l_state);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_publish(&l_client, "test/outbox", "unsent", 6, 0, 0));
+	TEST_ASSERT_EQUAL(21, mqtt_outbox_peek(&l_outbox, &l_data));
+	mqtt_outbox_release(&l_outbox);
+	TEST_ASSERT_NULL(l_outbox.Current);
+	TEST_ASSERT_TRUE(xSemaphoreTake(l_outbox.ConsumerLock, 0));
+	xSemaphoreGive(l_outbox.ConsumerLock);
+
+	// A control packet of the old connection is not sent on the next
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_pingreq_packet(&l_client));
+	TEST_ASSERT_EQUAL(2, mqtt_outbox_peek(&l_outbox, &l_data));
+	mqtt_outbox_release(&l_outbox);
+
+	l_args = (ProducerArgs_t) { &l_client, xSemaphoreCreateBinary(), 0, 0, 0 };
+	xTaskCreate(&outbox_next_consumer, "outbox_consumer", 2048, &l_args, 5, NULL);
+	TEST_ASSERT_TRUE(xSemaphoreTake(l_args.Done, 5000 / portTICK_RATE_MS));
+	TEST_ASSERT_EQUAL(21, l_args.Count);
+	TEST_ASSERT_EQUAL(0x30, l_args.Id);
+	TEST_ASSERT_EQUAL(0, mqtt_outbox_peek(&l_outbox, &l_data));
+	vSemaphoreDelete(l_args.Done);
+	mqtt_outbox_set_consumer(&l_outbox, NULL);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+/*
+ * Fill the calling task's lane with numbered 22 byte publishes until the outbox says no.
+ * @return how many went in.
+ */
+static int outbox_fill(Client_t *p_client, int p_max, esp_err_t *r_err) {
+	char l_payload[8];
+	int l_count;
+	for (l_count = 0; l_count < p_max; l_count++) {
+		sprintf(l_payload, "%07d", l_count);
+		*r_err = mqtt_publish(p_client, "test/outbox", l_payload, 7, 0, 0);
+		if (*r_err != ESP_OK) {
+			break;
+		}
+	}
+	return l_count;
+}
+
+TEST_CASE("outbox reject newest and block with a deadline", "[mqtt][outbox]") {
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	OutboxStats_t l_stats;
+	esp_err_t l_err;
+	int l_count;
+	TickType_t l_start;
+
+	outbox_client_init(&l_client, &l_outbox, &l_state);
+	mqtt_outbox_set_policy(&l_outbox, OUTBOX_POLICY_REJECT_NEWEST, 0, 0);
+	l_count = outbox_fill(&l_client, 1000, &l_err);
+	TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, l_err);
+	TEST_ASSERT_TRUE(l_count > 0 && l_count < 1000);
+	mqtt_outbox_set_policy(&l_outbox, OUTBOX_POLICY_BLOCK, 50, 0);
+	l_start = xTaskGetTickCount();
+	TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, mqtt_publish(&l_client, "test/outbox", "1234567", 7, 0, 0));
+	TEST_ASSERT_TRUE(xTaskGetTickCount() - l_start >= 50 / portTICK_RATE_MS);
+	mqtt_outbox_get_stats(&l_outbox, &l_stats);
+	TEST_ASSERT_EQUAL(l_count, l_stats.Accepted);
+	TEST_ASSERT_EQUAL(2, l_stats.Rejected);
+	TEST_ASSERT_EQUAL(0, l_stats.Dropped);
+	mqtt_outbox_set_consumer(&l_outbox, NULL);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+static void outbox_count_drop(void *p_arg, const uint8_t *p_packet, uint32_t p_length) {
+	(*(int *) p_arg)++;
+}
+
+TEST_CASE("outbox drop oldest and ttl expiry", "[mqtt][outbox]") {
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	OutboxStats_t l_stats;
+	uint8_t *l_data;
+	char l_payload[8] = { 0 };
+	esp_err_t l_err;
+	int l_count, l_sent = 0, l_first, l_drops = 0;
+
+	outbox_client_init(&l_client, &l_outbox, &l_state);
+	mqtt_outbox_set_policy(&l_outbox, OUTBOX_POLICY_DROP_OLDEST, 100, 0);
+	mqtt_outbox_set_drop(&l_outbox, outbox_count_drop, &l_drops);
+	TEST_ASSERT_EQUAL(1000, outbox_fill(&l_client, 1000, &l_err));
+	mqtt_outbox_get_stats(&l_outbox, &l_stats);
+	TEST_ASSERT_EQUAL(1000, l_stats.Accepted);
+	TEST_ASSERT_TRUE(l_stats.Dropped > 0);
+	TEST_ASSERT_EQUAL(l_stats.Dropped, l_drops);
+	// What is left is the newest, still in order
+	l_first = l_stats.Dropped;
+	while (mqtt_outbox_peek(&l_outbox, &l_data) == 22) {
+		memcpy(l_payload, &l_data[15], 7);
+		TEST_ASSERT_EQUAL(l_first + l_sent, atoi(l_payload));
+		mqtt_outbox_consume(&l_outbox);
+		l_sent++;
+	}
+	TEST_ASSERT_EQUAL(1000, l_stats.Dropped + l_sent);
+
+	mqtt_outbox_set_policy(&l_outbox, OUTBOX_POLICY_DROP_OLDEST, 100, 20);
+	l_count = outbox_fill(&l_client, 5, &l_err);
+	vTaskDelay(50 / portTICK_RATE_MS);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_publish(&l_client, "test/outbox", "fresh!!", 7, 0, 0));
+	TEST_ASSERT_EQUAL(22, mqtt_outbox_peek(&l_outbox, &l_data));
+	TEST_ASSERT_EQUAL_MEMORY("fresh!!", &l_data[15], 7);
+	mqtt_outbox_consume(&l_outbox);
+	TEST_ASSERT_EQUAL(0, mqtt_outbox_peek(&l_outbox, &l_data));
+	mqtt_outbox_get_stats(&l_outbox, &l_stats);
+	TEST_ASSERT_EQUAL(l_count, l_stats.Expired);
+	TEST_ASSERT_EQUAL(l_stats.Dropped + l_stats.Expired, l_drops);
+	mqtt_outbox_set_consumer(&l_outbox, NULL);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+/*
+ * Queue a stand in for a SUBSCRIBE or a resend: a packet that is not expendable.
+ */
+static void outbox_keep(Outbox_t *p_outbox, uint8_t p_first) {
+	PacketInfo_t l_packet;
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_outbox_reserve(p_outbox, &l_packet, 4, 0));
+	l_packet.PacketBuffer[0] = p_first;
+	l_packet.PacketBuffer[1] = 0x02;
+	l_packet.PacketBuffer[2] = 0x00;
+	l_packet.PacketBuffer[3] = 0x01;
+	mqtt_outbox_commit(p_outbox, &l_packet);
+}
+
+TEST_CASE("outbox never expires or drops a subscribe or resend", "[mqtt][outbox]") {
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	OutboxStats_t l_stats;
+	uint8_t *l_data;
+	esp_err_t l_err;
+	int l_count;
+
+	outbox_client_init(&l_client, &l_outbox, &l_state);
+	mqtt_outbox_set_policy(&l_outbox, OUTBOX_POLICY_DROP_OLDEST, 100, 20);
+	outbox_keep(&l_outbox, 0x82);
+	l_count = outbox_fill(&l_client, 5, &l_err);
+	vTaskDelay(50 / portTICK_RATE_MS);
+	TEST_ASSERT_EQUAL(4, mqtt_outbox_peek(&l_outbox, &l_data));
+	TEST_ASSERT_EQUAL(0x82, l_data[0]);
+	mqtt_outbox_consume(&l_outbox);
+	TEST_ASSERT_EQUAL(0, mqtt_outbox_peek(&l_outbox, &l_data));
+	mqtt_outbox_get_stats(&l_outbox, &l_stats);
+	TEST_ASSERT_EQUAL(l_count, l_stats.Expired);
+
+	// With a resend at the head of a full lane there is nothing to drop: the new publish is refused, at once
+	mqtt_outbox_set_policy(&l_outbox, OUTBOX_POLICY_DROP_OLDEST, 100, 0);
+	outbox_keep(&l_outbox, 0x3a);
+	l_count = outbox_fill(&l_client, 1000, &l_err);
+	TEST_ASSERT_TRUE(l_count < 1000);
+	TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, l_err);
+	mqtt_outbox_get_stats(&l_outbox, &l_stats);
+	TEST_ASSERT_EQUAL(0, l_stats.Dropped);
+	TEST_ASSERT_EQUAL(4, mqtt_outbox_peek(&l_outbox, &l_data));
+	TEST_ASSERT_EQUAL(0x3a, l_data[0]);
+	mqtt_outbox_consume(&l_outbox);
+	mqtt_outbox_set_consumer(&l_outbox, NULL);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+/*
+ * A second producer under DROP_OLDEST: fills its own lane, which has to drop to take the lot.
+ */
+static void outbox_dropping_producer(void *pvParameters) {
+	ProducerArgs_t *l_args = pvParameters;
+	esp_err_t l_err = ESP_OK;
+	l_args->Count = outbox_fill(l_args->Client, 1000, &l_err);
+	l_args->Errors = l_err != ESP_OK;
+	xSemaphoreGive(l_args->Done);
+	vTaskDelete(NULL);
+}
+
+TEST_CASE("outbox drop oldest does not wait on a packet being written", "[mqtt][outbox]") {
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	OutboxStats_t l_stats;
+	ProducerArgs_t l_args;
+	uint8_t *l_data;
+	esp_err_t l_err;
+	TickType_t l_start;
+
+	outbox_client_init(&l_client, &l_outbox, &l_state);
+	mqtt_outbox_set_policy(&l_outbox, OUTBOX_POLICY_DROP_OLDEST, 1000, 0);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_publish(&l_client, "test/outbox", "writing", 7, 0, 0));
+	TEST_ASSERT_EQUAL(22, mqtt_outbox_peek(&l_outbox, &l_data));
+	// As the sending task does before a socket write that may stall
+	mqtt_outbox_pin(&l_outbox);
+
+	// Another task's lane can drop its oldest meanwhile
+	l_args = (ProducerArgs_t) { &l_client, xSemaphoreCreateBinary(), 0, 0, 0 };
+	xTaskCreate(&outbox_dropping_producer, "outbox_producer", 4096, &l_args, 5, NULL);
+	TEST_ASSERT_TRUE(xSemaphoreTake(l_args.Done, 500 / portTICK_RATE_MS));
+	TEST_ASSERT_EQUAL(1000, l_args.Count);
+	TEST_ASSERT_EQUAL(0, l_args.Errors);
+	mqtt_outbox_get_stats(&l_outbox, &l_stats);
+	TEST_ASSERT_TRUE(l_stats.Dropped > 0);
+
+	// Behind the pinned packet in its own lane nothing can go, and it says so straight away
+	l_start = xTaskGetTickCount();
+	TEST_ASSERT_TRUE(outbox_fill(&l_client, 1000, &l_err) < 1000);
+	TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, l_err);
+	TEST_ASSERT_TRUE((TickType_t) (xTaskGetTickCount() - l_start) < 500 / portTICK_RATE_MS);
+	TEST_ASSERT_EQUAL(22, mqtt_outbox_peek(&l_outbox, &l_data));
+	TEST_ASSERT_EQUAL_MEMORY("writing", &l_data[15], 7);
+	mqtt_outbox_consume(&l_outbox);
+	TEST_ASSERT_TRUE(xSemaphoreTake(l_outbox.ConsumerLock, 0));
+	xSemaphoreGive(l_outbox.ConsumerLock);
+	vSemaphoreDelete(l_args.Done);
+	mqtt_outbox_set_consumer(&l_outbox, NULL);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+/*
+ * A short lived publisher: one publish, then give the lane back if Errors says to, and exit.
+ */
+static void outbox_one_shot(void *pvParameters) {
+	ProducerArgs_t *l_args = pvParameters;
+	mqtt_publish(l_args->Client, "test/outbox", "once", 4, 0, 0);
+	if (l_args->Errors) {
+		mqtt_publisher_done(l_args->Client);
+	}
+	xSemaphoreGive(l_args->Done);
+	vTaskDelete(NULL);
+}
+
+TEST_CASE("outbox lanes given back by exiting tasks are claimed again", "[mqtt][outbox]") {
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	ProducerArgs_t l_args;
+	OutboxLane_t *l_shared = &l_outbox.Lanes[CONFIG_MQTT_OUTBOX_LANES - 1];
+	uint8_t *l_data;
+	int l_ix, l_sent = 0;
+
+	outbox_client_init(&l_client, &l_outbox, &l_state);
+	l_args = (ProducerArgs_t) { &l_client, xSemaphoreCreateBinary(), 0, 0, 1 };
+	// Many more short lived tasks than lanes, each tidying up after itself: none is pushed onto the shared lane
+	for (l_ix = 0; l_ix < 3 * CONFIG_MQTT_OUTBOX_LANES; l_ix++) {
+		xTaskCreate(&outbox_one_shot, "outbox_one_shot", 2048, &l_args, 5, NULL);
+		TEST_ASSERT_TRUE(xSemaphoreTake(l_args.Done, 1000 / portTICK_RATE_MS));
+		TEST_ASSERT_EQUAL(0, rb_fill(&l_shared->Rb));
+	}
+	for (l_ix = 0; l_ix < CONFIG_MQTT_OUTBOX_LANES - 1; l_ix++) {
+		TEST_ASSERT_NULL(l_outbox.Lanes[l_ix].Owner);
+	}
+	// Tasks that keep their lanes use them up
+	l_args.Errors = 0;
+	for (l_ix = 0; l_ix < CONFIG_MQTT_OUTBOX_LANES; l_ix++) {
+		xTaskCreate(&outbox_one_shot, "outbox_one_shot", 2048, &l_args, 5, NULL);
+		TEST_ASSERT_TRUE(xSemaphoreTake(l_args.Done, 1000 / portTICK_RATE_MS));
+	}
+	TEST_ASSERT_TRUE(rb_fill(&l_shared->Rb) > 0);
+	// Every publish is still sent
+	while (mqtt_outbox_peek(&l_outbox, &l_data) > 0) {
+		mqtt_outbox_consume(&l_outbox);
+		l_sent++;
+	}
+	TEST_ASSERT_EQUAL(4 * CONFIG_MQTT_OUTBOX_LANES, l_sent);
+	vSemaphoreDelete(l_args.Done);
+	mqtt_outbox_set_consumer(&l_outbox, NULL);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+TEST_CASE("outbox coalesces unsent qos 0 publishes per topic", "[mqtt][outbox]") {
+	static const char *l_expect[] = { "a3", "q1", "c1", "b2" };
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	OutboxStats_t l_stats;
+	uint8_t *l_data;
+	char l_topic[16];
+	int32_t l_len;
+	int l_ix, l_sent;
+
+	outbox_client_init(&l_client, &l_outbox, &l_state);
+	mqtt_outbox_set_coalesce(&l_outbox, 1);
+	mqtt_publish(&l_client, "t/a", "a1", 2, 0, 0);
+	mqtt_publish(&l_client, "t/b", "b1", 2, 0, 0);
+	mqtt_publish(&l_client, "t/a", "a2", 2, 0, 0);
+	mqtt_publish(&l_client, "t/a", "a3", 2, 0, 0);
+	mqtt_publish(&l_client, "t/a", "q1", 2, 1, 0);  // QoS 1 is never coalesced
+	mqtt_publish(&l_client, "t/c", "c1", 2, 0, 0);
+	mqtt_publish(&l_client, "t/b", "b2", 2, 0, 0);
+	for (l_ix = 0; l_ix < 4; l_ix++) {
+		l_len = mqtt_outbox_peek(&l_outbox, &l_data);
+		TEST_ASSERT_TRUE(l_len > 2);
+		TEST_ASSERT_EQUAL_MEMORY(l_expect[l_ix], &l_data[l_len - 2], 2);
+		mqtt_outbox_consume(&l_outbox);
+	}
+	TEST_ASSERT_EQUAL(0, mqtt_outbox_peek(&l_outbox, &l_data));
+	mqtt_outbox_get_stats(&l_outbox, &l_stats);
+	TEST_ASSERT_EQUAL(3, l_stats.Coalesced);
+
+	// More topics than index slots, twice over - the last round of every topic still goes out
+	for (l_ix = 0; l_ix < 2 * (CONFIG_MQTT_OUTBOX_COALESCE_SLOTS + 8); l_ix++) {
+		sprintf(l_topic, "t/%d", l_ix % (CONFIG_MQTT_OUTBOX_COALESCE_SLOTS + 8));
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_publish(&l_client, l_topic, l_ix < CONFIG_MQTT_OUTBOX_COALESCE_SLOTS + 8 ? "old" : "new", 3, 0, 0));
+	}
+	for (l_sent = 0; (l_len = mqtt_outbox_peek(&l_outbox, &l_data)) > 0; l_sent++) {
+		if (memcmp(&l_data[l_len - 3], "old", 3) == 0) {
+			TEST_ASSERT_TRUE(l_sent < 8);
+		}
+		mqtt_outbox_consume(&l_outbox);
+	}
+	TEST_ASSERT_EQUAL(CONFIG_MQTT_OUTBOX_COALESCE_SLOTS + 16, l_sent);
+	mqtt_outbox_set_consumer(&l_outbox, NULL);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+TEST_CASE("outbox publish throughput per producer count", "[mqtt][outbox][bench]") {
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	ProducerArgs_t l_args[4];
+	SemaphoreHandle_t l_done = xSemaphoreCreateCounting(4, 0);
+	int l_producers, l_ix;
+	int64_t l_start, l_elapsed;
+
+	for (l_producers = 1; l_producers <= 4; l_producers++) {
+		outbox_client_init(&l_client, &l_outbox, &l_state);
+		l_start = now_us();
+		for (l_ix = 0; l_ix < l_producers; l_ix++) {
+			l_args[l_ix] = (ProducerArgs_t) { &l_client, l_done, l_ix, TEST_BENCH_MESSAGES / l_producers, 0 };
+			xTaskCreate(&outbox_producer, "outbox_producer", 2048, &l_args[l_ix], 5, NULL);
+		}
+		TEST_ASSERT_EQUAL(0, outbox_drain(&l_client, l_producers * (TEST_BENCH_MESSAGES / l_producers), NULL));
+		l_elapsed = now_us() - l_start + 1;
+		for (l_ix = 0; l_ix < l_producers; l_ix++) {
+			TEST_ASSERT_TRUE(xSemaphoreTake(l_done, 5000 / portTICK_RATE_MS));
+		}
+		printf("outbox %d producer(s): %10lld msgs/s\n", l_producers,
+				(long long) l_producers * (TEST_BENCH_MESSAGES / l_producers) * 1000000 / l_elapsed);
+		mqtt_outbox_set_consumer(&l_outbox, NULL);
+		mqtt_outbox_deinit(&l_outbox);
+	}
+	vSemaphoreDelete(l_done);
+}
+
+// ### END DBK
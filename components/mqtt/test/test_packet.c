@@ -0,0 +1,339 @@
+/*
+ * test_packet.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "unity.h"
+
+#include "lwip/sockets.h"
+
+#include "mqtt_structs.h"
+#include "mqtt.h"
+#include "mqtt_packet.h"
+#include "mqtt_outbox.h"
+#include "mqtt_transport.h"
+
+#include "test_client.h"
+
+#define TEST_LANE_SIZE	1024
+#define TEST_ALLOC_CYCLES	10000
+#define TEST_CONTROL_PACKETS	1000000
+
+static int64_t now_us(void) {
+	struct timeval l_tv;
+	gettimeofday(&l_tv, NULL);
+	return (int64_t) l_tv.tv_sec * 1000000 + l_tv.tv_usec;
+}
+
+TEST_CASE("publish packet is built in place in the send ring", "[mqtt][packet]") {
+	static const uint8_t l_expected[] = { 0x32, 0x0c, 0x00, 0x05, 'a', '/', 'b', '/', 'c', 0x00, 0x01, 'o', 'n', '!' };
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	PacketInfo_t l_packet;
+	uint8_t *l_data;
+	uint16_t l_id;
+
+	test_client_init(&l_client, &l_outbox, &l_state, TEST_LANE_SIZE, NULL, NULL);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_publish_packet(&l_client, &l_packet, "a/b/c", "on!", 3, 1, 0, &l_id));
+	TEST_ASSERT_EQUAL(1, l_id);
+	TEST_ASSERT_EQUAL(sizeof(l_expected), l_packet.Packet_length);
+	TEST_ASSERT_EQUAL(0, mqtt_outbox_peek(&l_outbox, &l_data));
+	mqtt_outbox_commit(&l_outbox, &l_packet);
+	TEST_ASSERT_EQUAL(sizeof(l_expected), mqtt_outbox_peek(&l_outbox, &l_data));
+	TEST_ASSERT_TRUE(l_data == l_packet.PacketBuffer);
+	TEST_ASSERT_EQUAL_MEMORY(l_expected, l_data, sizeof(l_expected));
+	mqtt_outbox_consume(&l_outbox);
+	TEST_ASSERT_EQUAL(0, mqtt_outbox_peek(&l_outbox, &l_data));
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+TEST_CASE("publish packet uses a two byte remaining length above 127", "[mqtt][packet]") {
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	PacketInfo_t l_packet;
+	char l_payload[200];
+	uint16_t l_id;
+
+	test_client_init(&l_client, &l_outbox, &l_state, TEST_LANE_SIZE, NULL, NULL);
+	memset(l_payload, 'x', sizeof(l_payload));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_publish_packet(&l_client, &l_packet, "t", l_payload, sizeof(l_payload), 0, 1, &l_id));
+	TEST_ASSERT_EQUAL(0, l_id);
+	TEST_ASSERT_EQUAL(0x31, l_packet.PacketBuffer[0]);
+	TEST_ASSERT_EQUAL(0x80 | (203 % 128), l_packet.PacketBuffer[1]);
+	TEST_ASSERT_EQUAL(203 / 128, l_packet.PacketBuffer[2]);
+	TEST_ASSERT_EQUAL(3 + 203, l_packet.Packet_length);
+	mqtt_outbox_commit(&l_outbox, &l_packet);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+TEST_CASE("subscribe packet is built in place in the send ring", "[mqtt][packet]") {
+	static const uint8_t l_expected[] = { 0x82, 0x08, 0x00, 0x01, 0x00, 0x03, 'a', '/', '#', 0x01 };
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	PacketInfo_t l_packet;
+	uint16_t l_id;
+
+	test_client_init(&l_client, &l_outbox, &l_state, TEST_LANE_SIZE, NULL, NULL);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_subscribe_packet(&l_client, &l_packet, "a/#", 1, &l_id));
+	TEST_ASSERT_EQUAL(1, l_id);
+	TEST_ASSERT_EQUAL(sizeof(l_expected), l_packet.Packet_length);
+	TEST_ASSERT_EQUAL_MEMORY(l_expected, l_packet.PacketBuffer, sizeof(l_expected));
+	mqtt_outbox_commit(&l_outbox, &l_packet);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+TEST_CASE("unsubscribe packet is built in place in the send ring", "[mqtt][packet]") {
+	static const uint8_t l_expected[] = { 0xa2, 0x07, 0x00, 0x01, 0x00, 0x03, 'a', '/', '#' };
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	PacketInfo_t l_packet;
+	uint16_t l_id;
+
+	test_client_init(&l_client, &l_outbox, &l_state, TEST_LANE_SIZE, NULL, NULL);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_unsubscribe_packet(&l_client, &l_packet, "a/#", &l_id));
+	TEST_ASSERT_EQUAL(1, l_id);
+	TEST_ASSERT_EQUAL(sizeof(l_expected), l_packet.Packet_length);
+	TEST_ASSERT_EQUAL_MEMORY(l_expected, l_packet.PacketBuffer, sizeof(l_expected));
+	mqtt_outbox_commit(&l_outbox, &l_packet);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+TEST_CASE("connect packet is built in the packet arena", "[mqtt][packet]") {
+	static const uint8_t l_expected[] = { 0x10, 0x1a, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0xee, 0x00, 0x3c,
+			0x00, 0x02, 'i', 'd', 0x00, 0x01, 'w', 0x00, 0x01, '!', 0x00, 0x01, 'u', 0x00, 0x01, 'p' };
+	Client_t l_client;
+	BrokerConfig_t l_broker;
+	Will_t l_will;
+	PacketInfo_t l_arena;
+	uint8_t l_buffer[30];
+
+	memset(&l_client, 0, sizeof(l_client));
+	memset(&l_broker, 0, sizeof(l_broker));
+	memset(&l_will, 0, sizeof(l_will));
+	memset(&l_arena, 0, sizeof(l_arena));
+	l_client.Broker = &l_broker;
+	l_client.Will = &l_will;
+	l_client.Packet = &l_arena;
+	strcpy(l_broker.ClientId, "id");
+	strcpy(l_broker.Username, "u");
+	strcpy(l_broker.Password, "p");
+	l_will.WillTopic = "w";
+	l_will.WillMessage = "!";
+	l_will.WillQos = 1;
+	l_will.WillRetain = 1;
+	l_will.CleanSession = 1;
+	l_will.Keepalive = 60;
+	l_arena.PacketBuffer = l_buffer;
+	l_arena.PacketBuffer_length = sizeof(l_buffer);
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_connect_packet(&l_client));
+	TEST_ASSERT_EQUAL(sizeof(l_expected), l_arena.Packet_length);
+	TEST_ASSERT_EQUAL(2 + 10 + l_arena.PacketPayload_length, l_arena.Packet_length);
+	TEST_ASSERT_EQUAL_MEMORY(l_expected, l_buffer, sizeof(l_expected));
+	// One byte short
+	l_arena.PacketBuffer_length = sizeof(l_expected) - 1;
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, mqtt_build_connect_packet(&l_client));
+	l_broker.ClientId[0] = '\0';
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, mqtt_build_connect_packet(&l_client));
+}
+
+TEST_CASE("mqtt 5 packets carry their property lists", "[mqtt][packet]") {
+	static const uint8_t l_connect[] = { 0x10, 0x24, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x05, 0xec, 0x00, 0x3c,
+			0x08, 0x21, 0x00, CONFIG_MQTT_INBOUND_QOS2_SLOTS * 3 / 4, 0x11, 0xff, 0xff, 0xff, 0xff,
+			0x00, 0x02, 'i', 'd', 0x00, 0x00, 0x01, 'w', 0x00, 0x01, '!', 0x00, 0x01, 'u', 0x00, 0x01, 'p' };
+	static const uint8_t l_publish[] = { 0x32, 0x0d, 0x00, 0x05, 'a', '/', 'b', '/', 'c', 0x00, 0x01, 0x00, 'o', 'n', '!' };
+	static const uint8_t l_subscribe[] = { 0x82, 0x09, 0x00, 0x02, 0x00, 0x00, 0x03, 'a', '/', '#', 0x01 };
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	BrokerConfig_t l_broker;
+	Will_t l_will;
+	PacketInfo_t l_arena, l_packet;
+	uint8_t l_buffer[64];
+	uint16_t l_id;
+
+	test_client_init(&l_client, &l_outbox, &l_state, TEST_LANE_SIZE, NULL, NULL);
+	memset(&l_broker, 0, sizeof(l_broker));
+	memset(&l_will, 0, sizeof(l_will));
+	memset(&l_arena, 0, sizeof(l_arena));
+	l_state.protocol_level = MQTT_PROTOCOL_LEVEL_5;
+	l_client.Broker = &l_broker;
+	l_client.Will = &l_will;
+	l_client.Packet = &l_arena;
+	strcpy(l_broker.ClientId, "id");
+	strcpy(l_broker.Username, "u");
+	strcpy(l_broker.Password, "p");
+	l_will.WillTopic = "w";
+	l_will.WillMessage = "!";
+	l_will.WillQos = 1;
+	l_will.WillRetain = 1;
+	l_will.Keepalive = 60;
+	l_arena.PacketBuffer = l_buffer;
+	l_arena.PacketBuffer_length = sizeof(l_buffer);
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_connect_packet(&l_client));
+	TEST_ASSERT_EQUAL(sizeof(l_connect), l_arena.Packet_length);
+	TEST_ASSERT_EQUAL_MEMORY(l_connect, l_buffer, sizeof(l_connect));
+	// A clean start asks for no session to be kept
+	l_will.CleanSession = 1;
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_connect_packet(&l_client));
+	TEST_ASSERT_EQUAL(sizeof(l_connect) - 5, l_arena.Packet_length);
+	TEST_ASSERT_EQUAL(0x03, l_buffer[12]);
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_publish_packet(&l_client, &l_packet, "a/b/c", "on!", 3, 1, 0, &l_id));
+	TEST_ASSERT_EQUAL(sizeof(l_publish), l_packet.Packet_length);
+	TEST_ASSERT_EQUAL_MEMORY(l_publish, l_packet.PacketBuffer, sizeof(l_publish));
+	mqtt_outbox_commit(&l_outbox, &l_packet);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_subscribe_packet(&l_client, &l_packet, "a/#", 1, &l_id));
+	TEST_ASSERT_EQUAL(sizeof(l_subscribe), l_packet.Packet_length);
+	TEST_ASSERT_EQUAL_MEMORY(l_subscribe, l_packet.PacketBuffer, sizeof(l_subscribe));
+	mqtt_outbox_commit(&l_outbox, &l_packet);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+static void test_expect_control(Outbox_t *p_outbox, const uint8_t *p_expected, int32_t p_length) {
+	uint8_t *l_data;
+	TEST_ASSERT_EQUAL(p_length, mqtt_outbox_peek(p_outbox, &l_data));
+	TEST_ASSERT_EQUAL_MEMORY(p_expected, l_data, p_length);
+	mqtt_outbox_consume(p_outbox);
+}
+
+TEST_CASE("control packets come from their templates with the id patched in", "[mqtt][packet]") {
+	static const uint8_t l_puback[] = { 0x40, 0x02, 0xfe, 0x01 };
+	static const uint8_t l_pubrec[] = { 0x50, 0x02, 0x00, 0x02 };
+	static const uint8_t l_pubrel[] = { 0x62, 0x02, 0x01, 0x00 };
+	static const uint8_t l_pubcomp[] = { 0x70, 0x02, 0xff, 0xff };
+	static const uint8_t l_pingreq[] = { 0xc0, 0x00 };
+	static const uint8_t l_disconnect[] = { 0xe0, 0x00 };
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	uint8_t *l_data;
+
+	test_client_init(&l_client, &l_outbox, &l_state, TEST_LANE_SIZE, NULL, NULL);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_puback_packet(&l_client, 0xfe01));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_pubrec_packet(&l_client, 2));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_pubrel_packet(&l_client, 0x100));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_pubcomp_packet(&l_client, 0xffff));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_pingreq_packet(&l_client));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_disconnect_packet(&l_client));
+	test_expect_control(&l_outbox, l_puback, sizeof(l_puback));
+	test_expect_control(&l_outbox, l_pubrec, sizeof(l_pubrec));
+	test_expect_control(&l_outbox, l_pubrel, sizeof(l_pubrel));
+	test_expect_control(&l_outbox, l_pubcomp, sizeof(l_pubcomp));
+	test_expect_control(&l_outbox, l_pingreq, sizeof(l_pingreq));
+	test_expect_control(&l_outbox, l_disconnect, sizeof(l_disconnect));
+	TEST_ASSERT_EQUAL(0, mqtt_outbox_peek(&l_outbox, &l_data));
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+/*
+ * One PUBACK queued and taken off again per round, as under a steady stream of QoS 1 publishes.
+ */
+TEST_CASE("control packets queued and sent per second", "[mqtt][packet][bench]") {
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	uint8_t *l_data;
+	uint32_t l_sum = 0;
+	int l_ix;
+	int64_t l_start, l_elapsed;
+
+	test_client_init(&l_client, &l_outbox, &l_state, TEST_LANE_SIZE, NULL, NULL);
+	l_start = now_us();
+	for (l_ix = 0; l_ix < TEST_CONTROL_PACKETS; l_ix++) {
+		mqtt_build_puback_packet(&l_client, l_ix & 0xffff);
+		l_sum += mqtt_outbox_peek(&l_outbox, &l_data) + l_data[3];
+		mqtt_outbox_consume(&l_outbox);
+	}
+	l_elapsed = now_us() - l_start + 1;
+	printf("control packets: %10lld packets/s\n", (long long) TEST_CONTROL_PACKETS * 1000000 / l_elapsed);
+	TEST_ASSERT_TRUE(l_sum >= 4 * TEST_CONTROL_PACKETS);
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+#ifdef HOST_BUILD
+/*
+ * Build every packet the client sends, queue it, and have the sending side write it out, over and over.
+ * Once set up, none of that may touch the heap.
+ * Host build only: the runner counts allocations by wrapping the allocator (host/test_main.c).
+ */
+TEST_CASE("packet builders make no heap allocations", "[mqtt][packet]") {
+	Client_t l_client;
+	BrokerConfig_t l_broker;
+	Buffers_t l_buffers;
+	Will_t l_will;
+	State_t l_state;
+	Outbox_t l_outbox;
+	PacketInfo_t l_arena;
+	TransportStats_t l_before, l_after;
+	uint8_t l_drain[4096];
+	uint32_t l_drained = 0;
+	int l_pair[2], l_len, l_cycle;
+
+	memset(&l_client, 0, sizeof(l_client));
+	memset(&l_broker, 0, sizeof(l_broker));
+	memset(&l_buffers, 0, sizeof(l_buffers));
+	memset(&l_will, 0, sizeof(l_will));
+	memset(&l_state, 0, sizeof(l_state));
+	memset(&l_arena, 0, sizeof(l_arena));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_outbox_init(&l_outbox, 4096));
+	l_client.Broker = &l_broker;
+	l_client.Buffers = &l_buffers;
+	l_client.Will = &l_will;
+	l_client.State = &l_state;
+	l_client.Outbox = &l_outbox;
+	l_client.Packet = &l_arena;
+	strcpy(l_broker.ClientId, "alloc-test");
+	l_will.WillTopic = "status/alloc-test";
+	l_will.WillMessage = "offline";
+	l_arena.PacketBuffer_length = CONFIG_MQTT_PACKET_ARENA_BYTE;
+	l_arena.PacketBuffer = malloc(l_arena.PacketBuffer_length);
+	l_buffers.batch_size = 1460;
+	l_buffers.batch_buffer = malloc(l_buffers.batch_size);
+	TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, l_pair));
+	fcntl(l_pair[1], F_SETFL, fcntl(l_pair[1], F_GETFL, 0) | O_NONBLOCK);
+	l_broker.Socket = l_pair[0];
+	mqtt_transport_get_stats(&l_before);
+
+	host_count_allocations(1);
+	for (l_cycle = 0; l_cycle < TEST_ALLOC_CYCLES; l_cycle++) {
+		if (mqtt_build_connect_packet(&l_client) != ESP_OK || mqtt_transport_write(l_broker.Socket, &l_arena) <= 0
+				|| mqtt_publish(&l_client, "sensor/temp", "21.5", 4, 1, 0) != ESP_OK
+				|| mqtt_subscribe(&l_client, "cmd/#", 1) != ESP_OK
+				|| mqtt_unsubscribe(&l_client, "cmd/#") != ESP_OK
+				|| mqtt_build_puback_packet(&l_client, l_cycle + 1) != ESP_OK
+				|| mqtt_build_pingreq_packet(&l_client) != ESP_OK) {
+			break;
+		}
+		mqtt_send_ready(&l_client);
+		while ((l_len = read(l_pair[1], l_drain, sizeof(l_drain))) > 0) {
+			l_drained += l_len;
+		}
+	}
+	host_count_allocations(0);
+
+	mqtt_transport_get_stats(&l_after);
+	TEST_ASSERT_EQUAL(TEST_ALLOC_CYCLES, l_cycle);
+	TEST_ASSERT_EQUAL(0, host_allocations());
+	TEST_ASSERT_EQUAL(l_after.Bytes - l_before.Bytes, l_drained);
+	close(l_pair[0]);
+	close(l_pair[1]);
+	mqtt_outbox_deinit(&l_outbox);
+	free(l_buffers.batch_buffer);
+	free(l_arena.PacketBuffer);
+}
+#endif
+
+// ### END DBK
@@ -0,0 +1,118 @@
+/*
+ * test_reconnect.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+
+#include "unity.h"
+
+#include "mqtt_reconnect.h"
+#include "mqtt_transport.h"
+
+#define TEST_MIN_MS		100
+#define TEST_MAX_MS		3000
+
+/*
+ * A listening socket on a free loopback port.
+ */
+static int test_listen(struct in_addr *r_address, int *r_port) {
+	struct sockaddr_in l_addr;
+	socklen_t l_len = sizeof(l_addr);
+	int l_sock = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&l_addr, 0, sizeof(l_addr));
+	l_addr.sin_family = AF_INET;
+	l_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(l_sock, (struct sockaddr *) &l_addr, sizeof(l_addr));
+	listen(l_sock, 1);
+	getsockname(l_sock, (struct sockaddr *) &l_addr, &l_len);
+	*r_address = l_addr.sin_addr;
+	*r_port = ntohs(l_addr.sin_port);
+	return l_sock;
+}
+
+TEST_CASE("reconnect backs off exponentially with jitter and starts over once up", "[mqtt][reconnect]") {
+	Reconnect_t l_reconnect, l_other;
+	uint32_t l_ceiling = TEST_MIN_MS;
+	uint32_t l_wait, l_ix, l_same = 0;
+
+	mqtt_reconnect_init(&l_reconnect, TEST_MIN_MS, TEST_MAX_MS, 0, 1);
+	mqtt_reconnect_init(&l_other, TEST_MIN_MS, TEST_MAX_MS, 0, 2);
+	for (l_ix = 0; l_ix < 10; l_ix++) {
+		l_wait = mqtt_reconnect_backoff(&l_reconnect);
+		TEST_ASSERT_TRUE(l_wait >= l_ceiling / 2 && l_wait <= l_ceiling);
+		l_same += l_wait == mqtt_reconnect_backoff(&l_other);
+		l_ceiling = l_ceiling * 2 > TEST_MAX_MS ? TEST_MAX_MS : l_ceiling * 2;
+	}
+	// Two devices with their own seeds do not retry in step
+	TEST_ASSERT_TRUE(l_same < 3);
+	mqtt_reconnect_up(&l_reconnect);
+	TEST_ASSERT_TRUE(mqtt_reconnect_backoff(&l_reconnect) <= TEST_MIN_MS);
+}
+
+TEST_CASE("reconnect keeps the broker's address until it expires or fails", "[mqtt][reconnect]") {
+	Reconnect_t l_reconnect;
+	struct in_addr l_address;
+
+	mqtt_reconnect_init(&l_reconnect, TEST_MIN_MS, TEST_MAX_MS, 60000, 1);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_reconnect_resolve(&l_reconnect, "192.168.1.10", &l_address));
+	TEST_ASSERT_EQUAL(htonl(0xc0a8010a), l_address.s_addr);
+	TEST_ASSERT_EQUAL(0, l_reconnect.Stats.Lookups);
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_reconnect_resolve(&l_reconnect, "localhost", &l_address));
+	TEST_ASSERT_EQUAL(htonl(INADDR_LOOPBACK), l_address.s_addr);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_reconnect_resolve(&l_reconnect, "localhost", &l_address));
+	TEST_ASSERT_EQUAL(1, l_reconnect.Stats.Lookups);
+	TEST_ASSERT_EQUAL(1, l_reconnect.Stats.CacheHits);
+	mqtt_reconnect_forget(&l_reconnect);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_reconnect_resolve(&l_reconnect, "localhost", &l_address));
+	TEST_ASSERT_EQUAL(2, l_reconnect.Stats.Lookups);
+
+	// A 20 ms cache has run out by the next attempt
+	mqtt_reconnect_init(&l_reconnect, TEST_MIN_MS, TEST_MAX_MS, 20, 1);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_reconnect_resolve(&l_reconnect, "localhost", &l_address));
+	vTaskDelay(30 / portTICK_RATE_MS);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_reconnect_resolve(&l_reconnect, "localhost", &l_address));
+	TEST_ASSERT_EQUAL(2, l_reconnect.Stats.Lookups);
+	TEST_ASSERT_EQUAL(0, l_reconnect.Stats.CacheHits);
+}
+
+TEST_CASE("reconnect connects without blocking and times the drop to connack", "[mqtt][reconnect]") {
+	Reconnect_t l_reconnect;
+	struct in_addr l_address;
+	int l_listener, l_port, l_sock, l_flags;
+
+	l_listener = test_listen(&l_address, &l_port);
+	mqtt_reconnect_init(&l_reconnect, TEST_MIN_MS, TEST_MAX_MS, 0, 1);
+	mqtt_reconnect_down(&l_reconnect);
+	l_sock = mqtt_transport_connect_start(&l_address, l_port);
+	TEST_ASSERT_TRUE(l_sock >= 0);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_transport_connect_wait(l_sock, 1000));
+	// Back in blocking mode for the reader and writer
+	l_flags = fcntl(l_sock, F_GETFL, 0);
+	TEST_ASSERT_EQUAL(0, l_flags & O_NONBLOCK);
+	vTaskDelay(20 / portTICK_RATE_MS);
+	mqtt_reconnect_up(&l_reconnect);
+	TEST_ASSERT_EQUAL(1, l_reconnect.Stats.Connects);
+	TEST_ASSERT_TRUE(l_reconnect.Stats.LastDownMs >= 20);
+	TEST_ASSERT_EQUAL(l_reconnect.Stats.LastDownMs, l_reconnect.Stats.MaxDownMs);
+	close(l_sock);
+
+	// Nothing listening: refused, not left hanging
+	close(l_listener);
+	l_sock = mqtt_transport_connect_start(&l_address, l_port);
+	if (l_sock >= 0) {
+		TEST_ASSERT_EQUAL(ESP_FAIL, mqtt_transport_connect_wait(l_sock, 1000));
+		close(l_sock);
+	}
+}
+
+// ### END DBK
@@ -0,0 +1,245 @@
+/*
+ * test_ringbuf.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "unity.h"
+
+#include "ringbuf.h"
+
+#define TEST_RB_SIZE		8192
+#define TEST_BENCH_BYTES	(4 * 1024 * 1024)
+#define TEST_STRESS_RECORDS	200000
+
+static int64_t now_us(void) {
+	struct timeval l_tv;
+	gettimeofday(&l_tv, NULL);
+	return (int64_t) l_tv.tv_sec * 1000000 + l_tv.tv_usec;
+}
+
+TEST_CASE("ringbuf bulk write and read across the wrap point", "[mqtt][ringbuf]") {
+	Ringbuff_t l_rb;
+	uint8_t l_store[64];
+	uint8_t l_in[48], l_out[48];
+	int l_ix, l_pass;
+
+	TEST_ASSERT_EQUAL(ESP_OK, rb_init(&l_rb, l_store, sizeof(l_store), 1));
+	for (l_pass = 0; l_pass < 10; l_pass++) {
+		for (l_ix = 0; l_ix < sizeof(l_in); l_ix++) {
+			l_in[l_ix] = (uint8_t) (l_pass * 31 + l_ix);
+		}
+		TEST_ASSERT_EQUAL(sizeof(l_in), rb_write(&l_rb, l_in, sizeof(l_in), 0));
+		TEST_ASSERT_EQUAL(sizeof(l_store) - sizeof(l_in), rb_available(&l_rb));
+		memset(l_out, 0, sizeof(l_out));
+		TEST_ASSERT_EQUAL(sizeof(l_out), rb_read(&l_rb, l_out, sizeof(l_out), 0));
+		TEST_ASSERT_EQUAL_MEMORY(l_in, l_out, sizeof(l_in));
+		TEST_ASSERT_EQUAL(sizeof(l_store), rb_available(&l_rb));
+	}
+	TEST_ASSERT_EQUAL(sizeof(l_store), rb_write(&l_rb, l_store, sizeof(l_store), 0));
+	TEST_ASSERT_EQUAL(0, rb_write(&l_rb, l_in, 1, 0));
+	TEST_ASSERT_EQUAL(sizeof(l_store), rb_read(&l_rb, l_store, sizeof(l_store), 0));
+	TEST_ASSERT_EQUAL(0, rb_read(&l_rb, l_out, 1, 0));
+	rb_deinit(&l_rb);
+}
+
+TEST_CASE("ringbuf read with no wait takes all of a wrapped block whenever the tick moves", "[mqtt][ringbuf]") {
+	Ringbuff_t l_rb;
+	uint8_t l_store[64];
+	uint8_t l_in[48], l_out[48];
+	TickType_t l_start = xTaskGetTickCount();
+	int l_ix, l_reads = 0;
+
+	TEST_ASSERT_EQUAL(ESP_OK, rb_init(&l_rb, l_store, sizeof(l_store), 1));
+	for (l_ix = 0; l_ix < sizeof(l_in); l_ix++) {
+		l_in[l_ix] = (uint8_t) l_ix;
+	}
+	// 48 of 64 bytes each pass, so nearly every read is split at the end of the buffer;
+	//  run through enough ticks that some of them move between the two halves
+	while (l_reads < 1000 || (TickType_t) (xTaskGetTickCount() - l_start) < 20) {
+		TEST_ASSERT_EQUAL(sizeof(l_in), rb_write(&l_rb, l_in, sizeof(l_in), 0));
+		memset(l_out, 0, sizeof(l_out));
+		TEST_ASSERT_EQUAL(sizeof(l_out), rb_read(&l_rb, l_out, sizeof(l_out), 0));
+		TEST_ASSERT_EQUAL_MEMORY(l_in, l_out, sizeof(l_in));
+		l_reads++;
+	}
+	TEST_ASSERT_EQUAL(sizeof(l_store), rb_available(&l_rb));
+	rb_deinit(&l_rb);
+}
+
+TEST_CASE("ringbuf reserve and peek stay contiguous across the wrap point", "[mqtt][ringbuf]") {
+	Ringbuff_t l_rb;
+	uint8_t l_store[100];
+	uint8_t *l_space, *l_data;
+	int l_ix;
+
+	TEST_ASSERT_EQUAL(ESP_OK, rb_init(&l_rb, l_store, sizeof(l_store), 1));
+	// Leave the write index 30 bytes short of the end
+	l_space = rb_reserve(&l_rb, 70, 0);
+	TEST_ASSERT_TRUE(l_space == l_store);
+	rb_commit(&l_rb, 70);
+	TEST_ASSERT_EQUAL(70, rb_peek(&l_rb, &l_data, 0));
+	rb_consume(&l_rb, 70);
+	// 40 bytes do not fit in the last 30 so they must come from the start
+	l_space = rb_reserve(&l_rb, 40, 0);
+	TEST_ASSERT_TRUE(l_space == l_store);
+	for (l_ix = 0; l_ix < 40; l_ix++) {
+		l_space[l_ix] = l_ix;
+	}
+	TEST_ASSERT_EQUAL(0, rb_peek(&l_rb, &l_data, 0));
+	rb_commit(&l_rb, 40);
+	TEST_ASSERT_EQUAL(40, rb_peek(&l_rb, &l_data, 0));
+	TEST_ASSERT_TRUE(l_data == l_store);
+	for (l_ix = 0; l_ix < 40; l_ix++) {
+		TEST_ASSERT_EQUAL(l_ix, l_data[l_ix]);
+	}
+	// Too big to ever fit from here
+	TEST_ASSERT_NULL(rb_reserve(&l_rb, 61, 0));
+	rb_consume(&l_rb, 40);
+	TEST_ASSERT_EQUAL(0, rb_fill(&l_rb));
+	TEST_ASSERT_EQUAL(0, rb_peek(&l_rb, &l_data, 0));
+	rb_deinit(&l_rb);
+}
+
+/*
+ * Compare the old one byte at a time rb_put/rb_get path with the block copy rb_write/rb_read.
+ */
+TEST_CASE("ringbuf throughput per message size", "[mqtt][ringbuf][bench]") {
+	static const int l_sizes[] = { 16, 64, 256, 1024, 4096 };
+	Ringbuff_t l_rb;
+	uint8_t *l_store = malloc(TEST_RB_SIZE);
+	uint8_t *l_msg = malloc(4096);
+	int l_ix, l_iter, l_iters, l_byte;
+	int64_t l_start, l_bytewise_us, l_bulk_us;
+
+	TEST_ASSERT_NOT_NULL(l_store);
+	TEST_ASSERT_NOT_NULL(l_msg);
+	memset(l_msg, 0x5a, 4096);
+	for (l_ix = 0; l_ix < sizeof(l_sizes) / sizeof(l_sizes[0]); l_ix++) {
+		l_iters = TEST_BENCH_BYTES / l_sizes[l_ix];
+		rb_init(&l_rb, l_store, TEST_RB_SIZE, 1);
+
+		l_start = now_us();
+		for (l_iter = 0; l_iter < l_iters; l_iter++) {
+			for (l_byte = 0; l_byte < l_sizes[l_ix]; l_byte++) {
+				rb_put(&l_rb, &l_msg[l_byte]);
+			}
+			for (l_byte = 0; l_byte < l_sizes[l_ix]; l_byte++) {
+				rb_get(&l_rb, &l_msg[l_byte]);
+			}
+		}
+		l_bytewise_us = now_us() - l_start + 1;
+
+		l_start = now_us();
+		for (l_iter = 0; l_iter < l_iters; l_iter++) {
+			rb_write(&l_rb, l_msg, l_sizes[l_ix], 0);
+			rb_read(&l_rb, l_msg, l_sizes[l_ix], 0);
+		}
+		l_bulk_us = now_us() - l_start + 1;
+
+		printf("ringbuf %5d B: per-byte %10lld B/s  bulk %10lld B/s\n", l_sizes[l_ix],
+				(long long) TEST_BENCH_BYTES * 1000000 / l_bytewise_us,
+				(long long) TEST_BENCH_BYTES * 1000000 / l_bulk_us);
+		rb_deinit(&l_rb);
+	}
+	free(l_msg);
+	free(l_store);
+}
+
+typedef struct StressArgs {
+	Ringbuff_t			*Rb;
+	SemaphoreHandle_t	Done;
+	int					Errors;
+} StressArgs_t;
+
+/*
+ * Both tasks walk the same pseudo random sequence of record lengths.
+ */
+static int stress_length(uint32_t *p_seed) {
+	*p_seed = *p_seed * 1103515245 + 12345;
+	return 1 + (*p_seed >> 16) % 40;
+}
+
+static void stress_producer(void *pvParameters) {
+	StressArgs_t *l_args = pvParameters;
+	uint8_t l_record[40];
+	uint8_t *l_space;
+	uint32_t l_seed = 1;
+	uint8_t l_next = 0;
+	int l_ix, l_len, l_rec;
+
+	for (l_rec = 0; l_rec < TEST_STRESS_RECORDS; l_rec++) {
+		l_len = stress_length(&l_seed);
+		// Alternate between copying in and building in place
+		l_space = (l_rec & 1) ? rb_reserve(l_args->Rb, l_len, 1000 / portTICK_RATE_MS) : l_record;
+		if (l_space == NULL) {
+			l_args->Errors++;
+			break;
+		}
+		for (l_ix = 0; l_ix < l_len; l_ix++) {
+			l_space[l_ix] = l_next++;
+		}
+		if (l_rec & 1) {
+			rb_commit(l_args->Rb, l_len);
+		} else if (rb_write(l_args->Rb, l_record, l_len, 1000 / portTICK_RATE_MS) != l_len) {
+			l_args->Errors++;
+			break;
+		}
+	}
+	xSemaphoreGive(l_args->Done);
+	vTaskDelete(NULL);
+}
+
+static void stress_consumer(void *pvParameters) {
+	StressArgs_t *l_args = pvParameters;
+	uint8_t l_record[40];
+	uint32_t l_seed = 1;
+	uint8_t l_next = 0;
+	int l_ix, l_len, l_rec;
+
+	for (l_rec = 0; l_rec < TEST_STRESS_RECORDS; l_rec++) {
+		l_len = stress_length(&l_seed);
+		if (rb_read(l_args->Rb, l_record, l_len, 1000 / portTICK_RATE_MS) != l_len) {
+			l_args->Errors++;
+			break;
+		}
+		for (l_ix = 0; l_ix < l_len; l_ix++) {
+			if (l_record[l_ix] != l_next++) {
+				l_args->Errors++;
+			}
+		}
+	}
+	xSemaphoreGive(l_args->Done);
+	vTaskDelete(NULL);
+}
+
+/*
+ * A deliberately small, odd sized ring so both tasks spend much of their time blocked on each other.
+ */
+TEST_CASE("ringbuf single producer single consumer stress", "[mqtt][ringbuf]") {
+	Ringbuff_t l_rb;
+	uint8_t l_store[97];
+	StressArgs_t l_args = { &l_rb, xSemaphoreCreateCounting(2, 0), 0 };
+
+	TEST_ASSERT_EQUAL(ESP_OK, rb_init(&l_rb, l_store, sizeof(l_store), 1));
+	xTaskCreate(&stress_consumer, "rb_consumer", 2048, &l_args, 5, NULL);
+	xTaskCreate(&stress_producer, "rb_producer", 2048, &l_args, 5, NULL);
+	TEST_ASSERT_TRUE(xSemaphoreTake(l_args.Done, 60000 / portTICK_RATE_MS));
+	TEST_ASSERT_TRUE(xSemaphoreTake(l_args.Done, 60000 / portTICK_RATE_MS));
+	TEST_ASSERT_EQUAL(0, l_args.Errors);
+	TEST_ASSERT_EQUAL(0, rb_fill(&l_rb));
+	vSemaphoreDelete(l_args.Done);
+	rb_deinit(&l_rb);
+}
+
+// ### END DBK
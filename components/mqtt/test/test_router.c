@@ -0,0 +1,195 @@
+/*
+ * test_router.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "unity.h"
+
+#include "mqtt_router.h"
+
+#define TEST_ROUTES				8
+#define TEST_BENCH_DISPATCHES	200000
+
+static int64_t now_us(void) {
+	struct timeval l_tv;
+	gettimeofday(&l_tv, NULL);
+	return (int64_t) l_tv.tv_sec * 1000000 + l_tv.tv_usec;
+}
+
+/*
+ * Each handler records that it was called in the bit for its filter.
+ */
+static uint32_t s_hits;
+
+#define ROUTER_HANDLER(n) static void router_handler_##n(void *p_client, void *p_event) { s_hits |= 1 << n; }
+ROUTER_HANDLER(0) ROUTER_HANDLER(1) ROUTER_HANDLER(2) ROUTER_HANDLER(3)
+ROUTER_HANDLER(4) ROUTER_HANDLER(5) ROUTER_HANDLER(6) ROUTER_HANDLER(7)
+
+static const router_handler_fn s_handlers[TEST_ROUTES] = {
+	router_handler_0, router_handler_1, router_handler_2, router_handler_3,
+	router_handler_4, router_handler_5, router_handler_6, router_handler_7 };
+
+static uint32_t router_hits(Router_t *p_router, const char *p_topic) {
+	s_hits = 0;
+	mqtt_router_dispatch(p_router, (const uint8_t *) p_topic, strlen(p_topic), NULL, NULL);
+	return s_hits;
+}
+
+/*
+ * The examples of section 4.7 of the spec.
+ */
+TEST_CASE("router matches filters with wildcards", "[mqtt][router]") {
+	static const char *l_filters[TEST_ROUTES] = {
+		"sport/tennis/player1", "sport/tennis/player1/#", "sport/#", "sport/tennis/+",
+		"+/+", "/+", "#", "+/monitor/Clients" };
+	Router_t l_router;
+	int l_ix;
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_router_init(&l_router, 64, 256));
+	for (l_ix = 0; l_ix < TEST_ROUTES; l_ix++) {
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_router_add(&l_router, l_filters[l_ix], s_handlers[l_ix]));
+	}
+	TEST_ASSERT_EQUAL(0x01 | 0x02 | 0x04 | 0x08 | 0x40, router_hits(&l_router, "sport/tennis/player1"));
+	TEST_ASSERT_EQUAL(0x02 | 0x04 | 0x40, router_hits(&l_router, "sport/tennis/player1/ranking"));
+	TEST_ASSERT_EQUAL(0x04 | 0x40, router_hits(&l_router, "sport"));  // "sport/#" takes in its parent level
+	TEST_ASSERT_EQUAL(0x04 | 0x10 | 0x40, router_hits(&l_router, "sport/"));
+	TEST_ASSERT_EQUAL(0x10 | 0x20 | 0x40, router_hits(&l_router, "/finance"));
+	TEST_ASSERT_EQUAL(0x04 | 0x40, router_hits(&l_router, "sport/tennis/player2/ranking"));
+	// Wildcards at the first level never match a topic starting with '$'
+	TEST_ASSERT_EQUAL(0, router_hits(&l_router, "$SYS/monitor/Clients"));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_router_add(&l_router, "$SYS/#", s_handlers[5]));
+	TEST_ASSERT_EQUAL(0x20, router_hits(&l_router, "$SYS/monitor/Clients"));
+	TEST_ASSERT_EQUAL(0x80 | 0x40, router_hits(&l_router, "x/monitor/Clients"));
+
+	// A filter can be pointed somewhere else, or removed
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_router_add(&l_router, "#", NULL));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_router_add(&l_router, "sport/tennis/+", s_handlers[0]));
+	TEST_ASSERT_EQUAL(0x01 | 0x02 | 0x04, router_hits(&l_router, "sport/tennis/player1"));
+	TEST_ASSERT_EQUAL(0, router_hits(&l_router, "weather"));
+	mqtt_router_deinit(&l_router);
+}
+
+TEST_CASE("router rejects malformed filters and runs out of room cleanly", "[mqtt][router]") {
+	static const char *l_bad[] = { "", "sport+", "sport/#/ranking", "sport/tennis#", "+sport", "a/b+/c" };
+	Router_t l_router;
+	char l_filter[16];
+	int l_ix;
+	esp_err_t l_err = ESP_OK;
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_router_init(&l_router, 16, 64));
+	for (l_ix = 0; l_ix < sizeof(l_bad) / sizeof(l_bad[0]); l_ix++) {
+		TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, mqtt_router_add(&l_router, l_bad[l_ix], s_handlers[0]));
+	}
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, mqtt_router_add(&l_router, NULL, s_handlers[0]));
+	for (l_ix = 0; l_ix < 32 && l_err == ESP_OK; l_ix++) {
+		snprintf(l_filter, sizeof(l_filter), "room%d/+", l_ix);
+		l_err = mqtt_router_add(&l_router, l_filter, s_handlers[l_ix % TEST_ROUTES]);
+	}
+	TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, l_err);
+	// What went in before it filled up still routes
+	TEST_ASSERT_EQUAL(0x02, router_hits(&l_router, "room1/temp"));
+	mqtt_router_deinit(&l_router);
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_router_init(&l_router, 0, 0));
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, mqtt_router_add(&l_router, "a", s_handlers[0]));
+	TEST_ASSERT_EQUAL(0, router_hits(&l_router, "a"));
+	mqtt_router_deinit(&l_router);
+}
+
+/*
+ * What each handler would do without a router: compare the topic with its filter, level by level.
+ */
+static int bench_filter_matches(const char *p_filter, const char *p_topic) {
+	while (*p_filter != '\0') {
+		if (p_filter[0] == '#') {
+			return 1;
+		}
+		if (p_filter[0] == '+') {
+			p_filter++;
+			while (*p_topic != '\0' && *p_topic != '/') {
+				p_topic++;
+			}
+		} else {
+			while (*p_filter != '\0' && *p_filter != '/' && *p_filter == *p_topic) {
+				p_filter++;
+				p_topic++;
+			}
+			if ((*p_filter != '\0' && *p_filter != '/') || (*p_topic != '\0' && *p_topic != '/')) {
+				return 0;
+			}
+		}
+		if (*p_filter == '\0' || *p_topic == '\0') {
+			return *p_filter == *p_topic || (p_filter[0] == '/' && p_filter[1] == '#');
+		}
+		p_filter++;
+		p_topic++;
+	}
+	return *p_topic == '\0';
+}
+
+static uint32_t s_bench_calls;
+
+static void bench_handler(void *p_client, void *p_event) {
+	s_bench_calls++;
+}
+
+/*
+ * Filters as a house would have them: per room state, per room commands, and a few catch-alls.
+ */
+TEST_CASE("router dispatch cost per filter count", "[mqtt][router][bench]") {
+	static const uint32_t l_counts[] = { 10, 50, 100, 500 };
+	Router_t l_router;
+	char (*l_filters)[48] = malloc(500 * 48);
+	char l_topics[16][48];
+	uint32_t l_c, l_ix, l_f, l_calls, l_naive;
+	int64_t l_start, l_routed_ns, l_linear_ns;
+
+	TEST_ASSERT_NOT_NULL(l_filters);
+	for (l_ix = 0; l_ix < 16; l_ix++) {
+		snprintf(l_topics[l_ix], sizeof(l_topics[0]), "pyhouse/home/room%d/%s", l_ix * 7, l_ix % 2 ? "temp" : "light/set");
+	}
+	for (l_c = 0; l_c < sizeof(l_counts) / sizeof(l_counts[0]); l_c++) {
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_router_init(&l_router, 4 * l_counts[l_c], 16 * l_counts[l_c]));
+		for (l_ix = 0; l_ix < l_counts[l_c]; l_ix++) {
+			switch (l_ix % 4) {
+			case 0: snprintf(l_filters[l_ix], 48, "pyhouse/home/room%d/+", l_ix / 4); break;
+			case 1: snprintf(l_filters[l_ix], 48, "pyhouse/home/room%d/light/#", l_ix / 4); break;
+			case 2: snprintf(l_filters[l_ix], 48, "pyhouse/home/+/sensor%d", l_ix / 4); break;
+			default: snprintf(l_filters[l_ix], 48, "pyhouse/home/room%d/temp", l_ix / 4); break;
+			}
+			TEST_ASSERT_EQUAL(ESP_OK, mqtt_router_add(&l_router, l_filters[l_ix], bench_handler));
+		}
+
+		s_bench_calls = 0;
+		l_start = now_us();
+		for (l_ix = 0; l_ix < TEST_BENCH_DISPATCHES; l_ix++) {
+			mqtt_router_dispatch(&l_router, (const uint8_t *) l_topics[l_ix % 16], strlen(l_topics[l_ix % 16]), NULL, NULL);
+		}
+		l_routed_ns = (now_us() - l_start) * 1000 / TEST_BENCH_DISPATCHES;
+		l_calls = s_bench_calls;
+
+		l_naive = 0;
+		l_start = now_us();
+		for (l_ix = 0; l_ix < TEST_BENCH_DISPATCHES / 10; l_ix++) {
+			for (l_f = 0; l_f < l_counts[l_c]; l_f++) {
+				l_naive += bench_filter_matches(l_filters[l_f], l_topics[l_ix % 16]);
+			}
+		}
+		l_linear_ns = (now_us() - l_start) * 10000 / TEST_BENCH_DISPATCHES;
+		printf("router %3d filters: %6lld ns/dispatch (trie)  %7lld ns/dispatch (every handler compares)\n",
+				l_counts[l_c], (long long) l_routed_ns, (long long) l_linear_ns);
+		// Both ways find the same handlers
+		TEST_ASSERT_EQUAL(l_calls, l_naive * 10);
+		mqtt_router_deinit(&l_router);
+	}
+	free(l_filters);
+}
+
+// ### END DBK
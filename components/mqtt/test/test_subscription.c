@@ -0,0 +1,206 @@
+/*
+ * test_subscription.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "unity.h"
+
+#include "mqtt_structs.h"
+#include "mqtt_packet.h"
+#include "mqtt_outbox.h"
+#include "mqtt_subscription.h"
+#include "mqtt.h"
+
+#include "test_client.h"
+
+#define TEST_PREFIX				"pyhouse/House 1/"
+#define TEST_LANE_SIZE			4096
+#define TEST_FILTERS			40
+
+/*
+ * Take the next packet from the outbox.
+ * @return the number of filters it carries, 0 if the outbox is empty, or -1 if they do not fill it exactly;
+ *  its type and id in *r_type and *r_id.
+ */
+static int test_take_filters(Outbox_t *p_outbox, int *r_type, uint16_t *r_id) {
+	uint8_t *l_data;
+	int32_t l_length = mqtt_outbox_peek(p_outbox, &l_data);
+	uint32_t l_remaining, l_ix, l_end;
+	int l_size, l_filters = 0;
+
+	if (l_length == 0) {
+		return 0;
+	}
+	*r_type = l_data[0] >> 4;
+	l_size = l_data[1] & 0x80 ? 2 : 1;
+	l_remaining = l_size == 2 ? (l_data[1] & 0x7f) + 128 * l_data[2] : l_data[1];
+	l_end = 1 + l_size + l_remaining;
+	*r_id = l_data[1 + l_size] << 8 | l_data[2 + l_size];
+	for (l_ix = 3 + l_size; l_ix < l_end; l_filters++) {
+		l_ix += 2 + (l_data[l_ix] << 8 | l_data[l_ix + 1]) + (*r_type == MQTT_CONTROL_PACKET_TYPE_SUBSCRIBE ? 1 : 0);
+	}
+	mqtt_outbox_consume(p_outbox);
+	return l_ix == l_end && l_length == l_end ? l_filters : -1;
+}
+
+TEST_CASE("subscription set keeps, updates and forgets filters", "[mqtt][subscription]") {
+	SubscriptionSet_t l_set;
+	SubscribeFilter_t l_a, l_b, l_c, l_again, l_collected[4];
+	uint8_t l_codes[] = { 0x01, 0x80 };
+	uint32_t l_cursor = 0;
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_subscription_init(&l_set, 4, 64));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_subscription_add(&l_set, "a/#", 1, &l_a));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_subscription_add(&l_set, "b/+", 0, &l_b));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_subscription_add(&l_set, "c", 2, &l_c));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_subscription_add(&l_set, "a/#", 2, &l_again));
+	TEST_ASSERT_EQUAL(l_a.Entry, l_again.Entry);
+	TEST_ASSERT_EQUAL(2, l_again.Qos);
+	TEST_ASSERT_EQUAL(3, l_a.Length);
+	TEST_ASSERT_EQUAL_MEMORY("a/#", l_a.Filter, 3);
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, mqtt_subscription_add(&l_set, "", 0, &l_again));
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_subscription_remove(&l_set, "b/+"));
+	TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, mqtt_subscription_remove(&l_set, "d"));
+	TEST_ASSERT_EQUAL(2, mqtt_subscription_collect(&l_set, &l_cursor, l_collected, 4));
+	TEST_ASSERT_EQUAL(l_a.Entry, l_collected[0].Entry);
+	TEST_ASSERT_EQUAL(2, l_collected[0].Qos);
+	TEST_ASSERT_EQUAL(l_c.Entry, l_collected[1].Entry);
+	TEST_ASSERT_EQUAL(0, mqtt_subscription_collect(&l_set, &l_cursor, l_collected, 4));
+
+	// SUBACK return codes go by place in the packet, not by place in the set
+	l_collected[0] = l_c;
+	l_collected[1] = l_a;
+	mqtt_subscription_sent(&l_set, l_collected, 2, 7);
+	TEST_ASSERT_EQUAL(MQTT_SUBSCRIPTION_PENDING, l_set.Entries[l_a.Entry].Granted);
+	TEST_ASSERT_EQUAL(0, mqtt_subscription_granted(&l_set, 8, l_codes, 2));
+	TEST_ASSERT_EQUAL(2, mqtt_subscription_granted(&l_set, 7, l_codes, 2));
+	TEST_ASSERT_EQUAL(0x01, l_set.Entries[l_c.Entry].Granted);
+	TEST_ASSERT_EQUAL(0x80, l_set.Entries[l_a.Entry].Granted);
+	TEST_ASSERT_EQUAL(0, mqtt_subscription_granted(&l_set, 7, l_codes, 2));
+
+	// Subscribing again brings a forgotten filter back in its old place
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_subscription_add(&l_set, "b/+", 1, &l_again));
+	TEST_ASSERT_EQUAL(l_b.Entry, l_again.Entry);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_subscription_add(&l_set, "d", 0, &l_again));
+	TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, mqtt_subscription_add(&l_set, "e", 0, &l_again));
+	mqtt_subscription_deinit(&l_set);
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_subscription_init(&l_set, 0, 0));
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, mqtt_subscription_add(&l_set, "a", 0, &l_again));
+	mqtt_subscription_deinit(&l_set);
+}
+
+TEST_CASE("subscribe and unsubscribe pack many filters into one packet", "[mqtt][subscription][packet]") {
+	static const uint8_t l_subscribe[] = { 0x82, 0x12, 0x00, 0x01, 0x00, 0x03, 'a', '/', '#', 0x01,
+			0x00, 0x03, 'b', '/', '+', 0x00, 0x00, 0x01, 'c', 0x02 };
+	static const uint8_t l_unsubscribe[] = { 0xa2, 0x0c, 0x00, 0x02, 0x00, 0x03, 'a', '/', '#', 0x00, 0x03, 'b', '/', '+' };
+	SubscribeFilter_t l_filters[TEST_FILTERS] = {
+		{ "a/#", 3, 1, 0 }, { "b/+", 3, 0, 0 }, { "c", 1, 2, 0 }
+	};
+	char l_text[TEST_FILTERS][32];
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	PacketInfo_t l_packet;
+	uint32_t l_packed, l_ix;
+	uint8_t *l_data;
+	uint16_t l_id;
+
+	test_client_init(&l_client, &l_outbox, &l_state, TEST_LANE_SIZE, NULL, NULL);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_subscribe_list_packet(&l_client, &l_packet, l_filters, 3, &l_id, &l_packed));
+	TEST_ASSERT_EQUAL(3, l_packed);
+	TEST_ASSERT_EQUAL(sizeof(l_subscribe), l_packet.Packet_length);
+	TEST_ASSERT_EQUAL_MEMORY(l_subscribe, l_packet.PacketBuffer, sizeof(l_subscribe));
+	mqtt_outbox_commit(&l_outbox, &l_packet);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_unsubscribe_list_packet(&l_client, &l_packet, l_filters, 2, &l_id, &l_packed));
+	TEST_ASSERT_EQUAL(2, l_packed);
+	TEST_ASSERT_EQUAL_MEMORY(l_unsubscribe, l_packet.PacketBuffer, sizeof(l_unsubscribe));
+	mqtt_outbox_commit(&l_outbox, &l_packet);
+	mqtt_outbox_peek(&l_outbox, &l_data);
+	mqtt_outbox_consume(&l_outbox);
+	mqtt_outbox_peek(&l_outbox, &l_data);
+	mqtt_outbox_consume(&l_outbox);
+
+	// More than one packet holds: as many as fit, and the rest left for the next
+	for (l_ix = 0; l_ix < TEST_FILTERS; l_ix++) {
+		snprintf(l_text[l_ix], sizeof(l_text[l_ix]), TEST_PREFIX "room%02d/light/#", l_ix);
+		l_filters[l_ix].Filter = l_text[l_ix];
+		l_filters[l_ix].Length = strlen(l_text[l_ix]);
+		l_filters[l_ix].Qos = 1;
+	}
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_subscribe_list_packet(&l_client, &l_packet, l_filters, TEST_FILTERS, &l_id, &l_packed));
+	TEST_ASSERT_TRUE(l_packed > 1 && l_packed < TEST_FILTERS);
+	TEST_ASSERT_TRUE(l_packet.Packet_length <= CONFIG_MQTT_SUBSCRIBE_PACKET_BYTE);
+	TEST_ASSERT_TRUE(l_packet.Packet_length + 2 + l_filters[0].Length + 1 > CONFIG_MQTT_SUBSCRIBE_PACKET_BYTE);
+	mqtt_outbox_commit(&l_outbox, &l_packet);
+
+	l_filters[1].Length = 0;
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, mqtt_build_subscribe_list_packet(&l_client, &l_packet, l_filters, 2, &l_id, &l_packed));
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, mqtt_build_subscribe_list_packet(&l_client, &l_packet, l_filters, 0, &l_id, &l_packed));
+	mqtt_outbox_deinit(&l_outbox);
+}
+
+TEST_CASE("subscriptions are batched, acked per filter and sent again on reconnect", "[mqtt][subscription]") {
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	SubscriptionSet_t l_set;
+	char l_text[TEST_FILTERS][32];
+	char *l_topics[TEST_FILTERS];
+	uint8_t l_qos[TEST_FILTERS];
+	uint8_t l_codes[TEST_FILTERS];
+	uint16_t l_ids[4];
+	int l_type, l_packets = 0, l_filters = 0, l_first = 0, l_count, l_ix;
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_subscription_init(&l_set, TEST_FILTERS, 2048));
+	test_client_init(&l_client, &l_outbox, &l_state, TEST_LANE_SIZE, NULL, &l_set);
+	for (l_ix = 0; l_ix < TEST_FILTERS; l_ix++) {
+		snprintf(l_text[l_ix], sizeof(l_text[l_ix]), TEST_PREFIX "room%02d/light/#", l_ix);
+		l_topics[l_ix] = l_text[l_ix];
+		l_qos[l_ix] = 1;
+	}
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_subscribe_many(&l_client, l_topics, l_qos, TEST_FILTERS));
+	while ((l_count = test_take_filters(&l_outbox, &l_type, &l_ids[l_packets])) > 0) {
+		TEST_ASSERT_EQUAL(MQTT_CONTROL_PACKET_TYPE_SUBSCRIBE, l_type);
+		l_first = l_first == 0 ? l_count : l_first;
+		l_filters += l_count;
+		l_packets++;
+	}
+	// 40 filters of 33 bytes need two packets, not forty
+	TEST_ASSERT_EQUAL(2, l_packets);
+	TEST_ASSERT_EQUAL(TEST_FILTERS, l_filters);
+
+	memset(l_codes, 1, sizeof(l_codes));
+	l_codes[3] = 0x80;
+	TEST_ASSERT_EQUAL(l_first, mqtt_subscription_granted(&l_set, l_ids[0], l_codes, TEST_FILTERS));
+	TEST_ASSERT_EQUAL(0x80, l_set.Entries[4].Granted);
+	TEST_ASSERT_EQUAL(0x01, l_set.Entries[1].Granted);
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_unsubscribe_many(&l_client, l_topics, 2));
+	TEST_ASSERT_EQUAL(2, test_take_filters(&l_outbox, &l_type, &l_ids[0]));
+	TEST_ASSERT_EQUAL(MQTT_CONTROL_PACKET_TYPE_UNSUBSCRIBE, l_type);
+
+	// What the next connection is sent: everything still subscribed to
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_resubscribe(&l_client));
+	l_packets = l_filters = 0;
+	while ((l_count = test_take_filters(&l_outbox, &l_type, &l_ids[l_packets])) > 0) {
+		l_filters += l_count;
+		l_packets++;
+	}
+	TEST_ASSERT_EQUAL(2, l_packets);
+	TEST_ASSERT_EQUAL(TEST_FILTERS - 2, l_filters);
+
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, mqtt_subscribe_many(&l_client, l_topics, NULL, 1));
+	l_topics[1] = "";
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, mqtt_unsubscribe_many(&l_client, l_topics, 2));
+	mqtt_outbox_deinit(&l_outbox);
+	mqtt_subscription_deinit(&l_set);
+}
+
+// ### END DBK
@@ -0,0 +1,42 @@
+/*
+ * test_text.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#include <string.h>
+
+#include "unity.h"
+
+#include "mqtt_text.h"
+
+TEST_CASE("text pool appends names until full and hashes with FNV-1a", "[mqtt][text]") {
+	TextPool_t l_pool;
+	int32_t l_room, l_light;
+
+	// Published FNV-1a test vectors
+	TEST_ASSERT_EQUAL_UINT32(0x811c9dc5, mqtt_text_hash("", 0));
+	TEST_ASSERT_EQUAL_UINT32(0xe40c292c, mqtt_text_hash("a", 1));
+	TEST_ASSERT_EQUAL_UINT32(0xbf9cf968, mqtt_text_hash("foobar", 6));
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_text_init(&l_pool, 16));
+	l_room = mqtt_text_add(&l_pool, "room1", 5);
+	l_light = mqtt_text_add(&l_pool, "light", 5);
+	TEST_ASSERT_EQUAL(0, l_room);
+	TEST_ASSERT_EQUAL(5, l_light);
+	TEST_ASSERT_TRUE(mqtt_text_equal(&l_pool, l_light, "light", 5));
+	TEST_ASSERT_FALSE(mqtt_text_equal(&l_pool, l_room, "light", 5));
+	// Six bytes left: a seven byte name is refused and takes nothing
+	TEST_ASSERT_EQUAL(-1, mqtt_text_add(&l_pool, "kitchen", 7));
+	TEST_ASSERT_EQUAL(10, l_pool.Fill);
+	TEST_ASSERT_EQUAL(10, mqtt_text_add(&l_pool, "hall/1", 6));
+	TEST_ASSERT_EQUAL(16, l_pool.Fill);
+
+	mqtt_text_clear(&l_pool);
+	TEST_ASSERT_EQUAL(0, mqtt_text_add(&l_pool, "kitchen", 7));
+	mqtt_text_deinit(&l_pool);
+	TEST_ASSERT_NULL(l_pool.Text);
+}
+
+// ### END DBK
@@ -0,0 +1,144 @@
+/*
+ * test_topic.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "unity.h"
+
+#include "mqtt_structs.h"
+#include "mqtt_packet.h"
+#include "mqtt_outbox.h"
+#include "mqtt_topic.h"
+
+#include "test_client.h"
+
+#define TEST_PREFIX				"pyhouse/House 1/"
+#define TEST_LANE_SIZE			1024
+#define TEST_HOUSE_TOPICS		200
+
+TEST_CASE("topics are interned once with the shared prefix stored once", "[mqtt][topic]") {
+	TopicTable_t l_table;
+	TopicHandle_t l_light, l_again, l_other, l_bare;
+	uint8_t l_buffer[64];
+	uint8_t *l_end;
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_topic_table_init(&l_table, TEST_PREFIX, 4, 64));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_topic_intern(&l_table, TEST_PREFIX "room1/light", &l_light));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_topic_intern(&l_table, TEST_PREFIX "room1/light", &l_again));
+	TEST_ASSERT_EQUAL(l_light, l_again);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_topic_intern(&l_table, "other/room1/light", &l_other));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_topic_intern(&l_table, "room1/light", &l_bare));
+	TEST_ASSERT_NOT_EQUAL(l_light, l_bare);
+	// Only "room1/light" for the first; the other two have no prefix and are kept whole
+	TEST_ASSERT_EQUAL(strlen(TEST_PREFIX) + 11 + 17 + 11, l_table.Pool.Fill);
+
+	TEST_ASSERT_EQUAL(2 + strlen(TEST_PREFIX) + 11, mqtt_topic_encoded_length(&l_table, l_light));
+	l_end = mqtt_topic_put(&l_table, l_light, l_buffer);
+	TEST_ASSERT_EQUAL(2 + strlen(TEST_PREFIX) + 11, l_end - l_buffer);
+	TEST_ASSERT_EQUAL(0, l_buffer[0]);
+	TEST_ASSERT_EQUAL(strlen(TEST_PREFIX) + 11, l_buffer[1]);
+	TEST_ASSERT_EQUAL_MEMORY(TEST_PREFIX "room1/light", l_buffer + 2, strlen(TEST_PREFIX) + 11);
+	l_end = mqtt_topic_put(&l_table, l_bare, l_buffer);
+	TEST_ASSERT_EQUAL(13, l_end - l_buffer);
+	TEST_ASSERT_EQUAL_MEMORY("\x00\x0broom1/light", l_buffer, 13);
+
+	TEST_ASSERT_EQUAL(0, mqtt_topic_encoded_length(&l_table, 0));
+	TEST_ASSERT_EQUAL(0, mqtt_topic_encoded_length(&l_table, 9));
+	mqtt_topic_table_deinit(&l_table);
+}
+
+TEST_CASE("topic interning rejects wildcards and bad utf-8 and runs out of room cleanly", "[mqtt][topic]") {
+	// Wildcards, then malformed UTF-8: a stray continuation byte, a cut off sequence, overlong U+0000, a surrogate,
+	//  past U+10FFFF
+	static const char *l_bad[] = { "", "a/+", "a/#", "#", "a/\x80", "a/\xe2\x82", "a/\xc0\x80", "a/\xed\xa0\x80",
+			"a/\xf4\x90\x80\x80" };
+	TopicTable_t l_table;
+	TopicHandle_t l_handle;
+	char l_topic[32];
+	esp_err_t l_err = ESP_OK;
+	int l_ix;
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_topic_table_init(&l_table, TEST_PREFIX, 8, 64));
+	for (l_ix = 0; l_ix < sizeof(l_bad) / sizeof(l_bad[0]); l_ix++) {
+		TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, mqtt_topic_intern(&l_table, l_bad[l_ix], &l_handle));
+		TEST_ASSERT_EQUAL(0, l_handle);
+	}
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, mqtt_topic_intern(&l_table, NULL, &l_handle));
+	for (l_ix = 0; l_ix < 16 && l_err == ESP_OK; l_ix++) {
+		snprintf(l_topic, sizeof(l_topic), TEST_PREFIX "room%d/temp", l_ix);
+		l_err = mqtt_topic_intern(&l_table, l_topic, &l_handle);
+	}
+	TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, l_err);
+	// What went in before it filled up is still there
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_topic_intern(&l_table, TEST_PREFIX "room0/temp", &l_handle));
+	TEST_ASSERT_EQUAL(1, l_handle);
+	mqtt_topic_table_deinit(&l_table);
+
+	// Two, three and four byte characters are fine
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_topic_table_init(&l_table, NULL, 1, 16));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_topic_intern(&l_table, "caf\xc3\xa9/\xe2\x82\xac/\xf0\x9f\x8c\xa1", &l_handle));
+	mqtt_topic_table_deinit(&l_table);
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_topic_table_init(&l_table, TEST_PREFIX, 0, 0));
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, mqtt_topic_intern(&l_table, "a", &l_handle));
+	mqtt_topic_table_deinit(&l_table);
+}
+
+TEST_CASE("publish by handle builds the same packet as publish by name", "[mqtt][topic]") {
+	Client_t l_client;
+	Outbox_t l_outbox;
+	State_t l_state;
+	TopicTable_t l_table;
+	PacketInfo_t l_by_name, l_by_handle;
+	TopicHandle_t l_handle;
+	uint16_t l_id;
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_topic_table_init(&l_table, TEST_PREFIX, 4, 64));
+	test_client_init(&l_client, &l_outbox, &l_state, TEST_LANE_SIZE, &l_table, NULL);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_topic_intern(&l_table, TEST_PREFIX "room1/temp", &l_handle));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_publish_packet(&l_client, &l_by_name, TEST_PREFIX "room1/temp", "21.5", 4, 1, 0, &l_id));
+	TEST_ASSERT_EQUAL(1, l_id);
+	mqtt_outbox_commit(&l_outbox, &l_by_name);
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_build_publish_handle_packet(&l_client, &l_by_handle, l_handle, "21.5", 4, 1, 0, &l_id));
+	TEST_ASSERT_EQUAL(2, l_id);
+	TEST_ASSERT_EQUAL(l_by_name.Packet_length, l_by_handle.Packet_length);
+	// All but the packet id
+	TEST_ASSERT_EQUAL_MEMORY(l_by_name.PacketBuffer, l_by_handle.PacketBuffer, l_by_name.Packet_length - 6);
+	TEST_ASSERT_EQUAL(2, l_by_handle.PacketBuffer[l_by_handle.Packet_length - 5]);
+	mqtt_outbox_commit(&l_outbox, &l_by_handle);
+
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, mqtt_build_publish_handle_packet(&l_client, &l_by_handle, 7, "x", 1, 0, 0, &l_id));
+	l_client.Topics = NULL;
+	TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, mqtt_build_publish_handle_packet(&l_client, &l_by_handle, l_handle, "x", 1, 0, 0, &l_id));
+	mqtt_outbox_deinit(&l_outbox);
+	mqtt_topic_table_deinit(&l_table);
+}
+
+/*
+ * A house worth of device topics: with the prefix kept once, interning takes less room than the strings themselves.
+ * How much faster publishing by handle is goes in the host benchmark (build_publish_by_name / build_publish_by_handle).
+ */
+TEST_CASE("interned topics take less room than the strings", "[mqtt][topic]") {
+	TopicTable_t l_table;
+	TopicHandle_t l_handle;
+	char l_topic[48];
+	uint32_t l_ix, l_by_name_bytes = 0;
+
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_topic_table_init(&l_table, TEST_PREFIX, TEST_HOUSE_TOPICS, 4096));
+	for (l_ix = 0; l_ix < TEST_HOUSE_TOPICS; l_ix++) {
+		snprintf(l_topic, sizeof(l_topic), TEST_PREFIX "room%d/%s", l_ix / 4, (const char *[]) { "light", "temp", "motion", "door" }[l_ix % 4]);
+		l_by_name_bytes += strlen(l_topic) + 1;
+		TEST_ASSERT_EQUAL(ESP_OK, mqtt_topic_intern(&l_table, l_topic, &l_handle));
+		TEST_ASSERT_EQUAL(l_ix + 1, l_handle);
+	}
+	TEST_ASSERT_TRUE(l_table.Pool.Fill + TEST_HOUSE_TOPICS * sizeof(TopicEntry_t) < l_by_name_bytes);
+	mqtt_topic_table_deinit(&l_table);
+}
+
+// ### END DBK
@@ -0,0 +1,482 @@
+/*
+ * test_transport.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: briank
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+
+#include "unity.h"
+
+#include "mqtt.h"
+#include "mqtt_outbox.h"
+#include "mqtt_transport.h"
+
+#define TEST_BIG_PART		(64 * 1024)
+#define TEST_BENCH_PACKETS	50000
+#define TEST_BATCH_PACKETS	1000
+#define TEST_STREAM_PAYLOAD	300000
+
+static int64_t now_us(void) {
+	struct timeval l_tv;
+	gettimeofday(&l_tv, NULL);
+	return (int64_t) l_tv.tv_sec * 1000000 + l_tv.tv_usec;
+}
+
+typedef struct LoopbackReader {
+	int					Socket;
+	SemaphoreHandle_t	Done;
+	int					Bytes;
+	int					Errors;
+	int					Delay;  // Read slowly, so the writer sees a full send buffer
+} LoopbackReader_t;
+
+/*
+ * Read until the writer closes, checking the bytes count up 0, 1, 2 ... mod 251.
+ */
+static void loopback_reader(void *pvParameters) {
+	LoopbackReader_t *l_reader = pvParameters;
+	uint8_t l_buffer[1024];
+	int l_len, l_ix;
+
+	while ((l_len = read(l_reader->Socket, l_buffer, l_reader->Delay ? 256 : sizeof(l_buffer))) > 0) {
+		for (l_ix = 0; l_reader->Delay && l_ix < l_len; l_ix++) {
+			if (l_buffer[l_ix] != (l_reader->Bytes + l_ix) % 251) {
+				l_reader->Errors++;
+			}
+		}
+		l_reader->Bytes += l_len;
+		if (l_reader->Delay && l_reader->Bytes % 8192 < 256) {
+			vTaskDelay(l_reader->Delay);
+		}
+	}
+	close(l_reader->Socket);
+	xSemaphoreGive(l_reader->Done);
+	vTaskDelete(NULL);
+}
+
+/*
+ * Connect a TCP socket to itself over 127.0.0.1 and start a reader on the far end.
+ * r_sock is the writing end.
+ */
+static void loopback_open(LoopbackReader_t *p_reader, int *r_sock) {
+	struct sockaddr_in l_addr;
+	socklen_t l_len = sizeof(l_addr);
+	int l_listen, l_sock;
+
+	memset(&l_addr, 0, sizeof(l_addr));
+	l_addr.sin_family = AF_INET;
+	l_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	l_listen = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+	TEST_ASSERT_TRUE(l_listen >= 0);
+	TEST_ASSERT_EQUAL(0, bind(l_listen, (struct sockaddr *) &l_addr, sizeof(l_addr)));
+	TEST_ASSERT_EQUAL(0, listen(l_listen, 1));
+	TEST_ASSERT_EQUAL(0, getsockname(l_listen, (struct sockaddr *) &l_addr, &l_len));
+	*r_sock = l_sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+	TEST_ASSERT_EQUAL(0, connect(l_sock, (struct sockaddr *) &l_addr, sizeof(l_addr)));
+	p_reader->Socket = accept(l_listen, NULL, NULL);
+	TEST_ASSERT_TRUE(p_reader->Socket >= 0);
+	close(l_listen);
+	p_reader->Done = xSemaphoreCreateBinary();
+	xTaskCreate(&loopback_reader, "loopback_reader", 4096, p_reader, 5, NULL);
+}
+
+static void loopback_close(int p_sock, LoopbackReader_t *p_reader) {
+	close(p_sock);
+	TEST_ASSERT_TRUE(xSemaphoreTake(p_reader->Done, 10000 / portTICK_RATE_MS));
+	vSemaphoreDelete(p_reader->Done);
+}
+
+TEST_CASE("transport writev finishes partial writes on a non-blocking socket", "[mqtt][transport]") {
+	LoopbackReader_t l_reader = { 0 };
+	uint8_t *l_data = malloc(3 * TEST_BIG_PART);
+	struct iovec l_iov[3];
+	TransportStats_t l_before, l_after;
+	int l_sock, l_ix;
+
+	TEST_ASSERT_NOT_NULL(l_data);
+	for (l_ix = 0; l_ix < 3 * TEST_BIG_PART; l_ix++) {
+		l_data[l_ix] = l_ix % 251;
+	}
+	l_reader.Delay = 2;
+	loopback_open(&l_reader, &l_sock);
+	mqtt_transport_set_send_buffer(l_sock, 4096);
+	fcntl(l_sock, F_SETFL, fcntl(l_sock, F_GETFL, 0) | O_NONBLOCK);
+	mqtt_transport_get_stats(&l_before);
+	// Three uneven parts, like fixed header, variable header, payload
+	l_iov[0].iov_base = l_data;
+	l_iov[0].iov_len = 3;
+	l_iov[1].iov_base = l_data + 3;
+	l_iov[1].iov_len = TEST_BIG_PART - 3;
+	l_iov[2].iov_base = l_data + TEST_BIG_PART;
+	l_iov[2].iov_len = 2 * TEST_BIG_PART;
+	TEST_ASSERT_EQUAL(3 * TEST_BIG_PART, mqtt_transport_writev(l_sock, l_iov, 3));
+	mqtt_transport_get_stats(&l_after);
+	TEST_ASSERT_EQUAL(1, l_after.Packets - l_before.Packets);
+	TEST_ASSERT_TRUE(l_after.Retries > l_before.Retries);
+	loopback_close(l_sock, &l_reader);
+	TEST_ASSERT_EQUAL(3 * TEST_BIG_PART, l_reader.Bytes);
+	TEST_ASSERT_EQUAL(0, l_reader.Errors);
+	free(l_data);
+}
+
+/*
+ * A 2 + 13 + 20 byte publish, written the old way (three write calls) and with one writev.
+ */
+TEST_CASE("transport packets per second and syscalls per packet", "[mqtt][transport][bench]") {
+	LoopbackReader_t l_reader = { 0 };
+	uint8_t l_fixed[2] = { 0x30, 33 };
+	uint8_t l_variable[13] = { 0, 11, 't', 'e', 's', 't', '/', 'b', 'e', 'n', 'c', 'h', '1' };
+	uint8_t l_payload[20] = { 0 };
+	PacketInfo_t l_packet;
+	TransportStats_t l_before, l_after;
+	int l_sock, l_ix;
+	int64_t l_start, l_elapsed;
+
+	memset(&l_packet, 0, sizeof(l_packet));
+	l_packet.PacketFixedHeader = l_fixed;
+	l_packet.PacketFixedHeader_length = sizeof(l_fixed);
+	l_packet.PacketVariableHeader = l_variable;
+	l_packet.PacketVariableHeader_length = sizeof(l_variable);
+	l_packet.PacketPayload = l_payload;
+	l_packet.PacketPayload_length = sizeof(l_payload);
+
+	loopback_open(&l_reader, &l_sock);
+	mqtt_transport_set_nodelay(l_sock, 1);
+	l_start = now_us();
+	for (l_ix = 0; l_ix < TEST_BENCH_PACKETS; l_ix++) {
+		write(l_sock, l_fixed, sizeof(l_fixed));
+		write(l_sock, l_variable, sizeof(l_variable));
+		write(l_sock, l_payload, sizeof(l_payload));
+	}
+	l_elapsed = now_us() - l_start + 1;
+	printf("transport 3 x write: %10lld packets/s  3.00 syscalls/packet\n", (long long) TEST_BENCH_PACKETS * 1000000 / l_elapsed);
+
+	mqtt_transport_get_stats(&l_before);
+	l_start = now_us();
+	for (l_ix = 0; l_ix < TEST_BENCH_PACKETS; l_ix++) {
+		TEST_ASSERT_EQUAL(35, mqtt_transport_write(l_sock, &l_packet));
+	}
+	l_elapsed = now_us() - l_start + 1;
+	mqtt_transport_get_stats(&l_after);
+	printf("transport writev:    %10lld packets/s  %4.2f syscalls/packet\n", (long long) TEST_BENCH_PACKETS * 1000000 / l_elapsed,
+			(double) (l_after.Syscalls - l_before.Syscalls) / (l_after.Packets - l_before.Packets));
+	loopback_close(l_sock, &l_reader);
+	TEST_ASSERT_EQUAL(2 * 35 * TEST_BENCH_PACKETS, l_reader.Bytes);
+}
+
+/*
+ * Queue a burst of small publishes and have mqtt_send_ready() write them, first one at a time, then batched.
+ */
+TEST_CASE("transport batches small packets into few writes", "[mqtt][transport]") {
+	LoopbackReader_t l_reader = { 0 };
+	Client_t l_client;
+	BrokerConfig_t l_broker;
+	Buffers_t l_buffers;
+	Will_t l_will;
+	State_t l_state;
+	Outbox_t l_outbox;
+	TransportStats_t l_before, l_after;
+	int l_pass, l_ix;
+	int64_t l_start, l_elapsed;
+
+	memset(&l_client, 0, sizeof(l_client));
+	memset(&l_buffers, 0, sizeof(l_buffers));
+	memset(&l_will, 0, sizeof(l_will));
+	memset(&l_state, 0, sizeof(l_state));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_outbox_init(&l_outbox, 64 * 1024));
+	mqtt_outbox_set_consumer(&l_outbox, xTaskGetCurrentTaskHandle());
+	l_client.Broker = &l_broker;
+	l_client.Buffers = &l_buffers;
+	l_client.Will = &l_will;
+	l_client.State = &l_state;
+	l_client.Outbox = &l_outbox;
+	l_buffers.batch_buffer = malloc(1460);
+	loopback_open(&l_reader, (int *) &l_broker.Socket);
+	mqtt_transport_set_nodelay(l_broker.Socket, 1);
+	for (l_pass = 0; l_pass < 2; l_pass++) {
+		l_buffers.batch_size = l_pass ? 1460 : 0;
+		for (l_ix = 0; l_ix < TEST_BATCH_PACKETS; l_ix++) {
+			TEST_ASSERT_EQUAL(ESP_OK, mqtt_publish(&l_client, "sensor/temp", "21.5", 4, 0, 0));
+		}
+		mqtt_transport_get_stats(&l_before);
+		l_start = now_us();
+		mqtt_send_ready(&l_client);
+		l_elapsed = now_us() - l_start + 1;
+		mqtt_transport_get_stats(&l_after);
+		TEST_ASSERT_EQUAL(0, l_buffers.batch_fill);
+		TEST_ASSERT_EQUAL(TEST_BATCH_PACKETS * 19, l_after.Bytes - l_before.Bytes);
+		printf("transport batch %4d B: %4d writes for %d packets, %lld us\n", l_buffers.batch_size,
+				l_after.Syscalls - l_before.Syscalls, TEST_BATCH_PACKETS, (long long) l_elapsed);
+		if (l_pass) {
+			// 76 packets of 19 bytes to a batch
+			TEST_ASSERT_TRUE(l_after.Syscalls - l_before.Syscalls <= TEST_BATCH_PACKETS / 76 + 2);
+		} else {
+			TEST_ASSERT_EQUAL(TEST_BATCH_PACKETS, l_after.Syscalls - l_before.Syscalls);
+		}
+	}
+	loopback_close(l_broker.Socket, &l_reader);
+	TEST_ASSERT_EQUAL(2 * TEST_BATCH_PACKETS * 19, l_reader.Bytes);
+	mqtt_outbox_set_consumer(&l_outbox, NULL);
+	mqtt_outbox_deinit(&l_outbox);
+	free(l_buffers.batch_buffer);
+}
+
+typedef struct StreamCheck {
+	uint32_t			Chunks;
+	uint32_t			Bytes;
+	uint32_t			Errors;
+	uint32_t			Small;  // The short publish after the big one
+} StreamCheck_t;
+
+static StreamCheck_t s_stream;
+
+static void stream_data_cb(void *p_client, void *p_event) {
+	DataEvent_t *l_event = p_event;
+	uint32_t l_ix;
+	if (l_event->Topic_length == 3 && memcmp(l_event->Topic, "cfg", 3) == 0) {
+		s_stream.Small += l_event->Offset == 0 && l_event->Total_length == 2 && memcmp(l_event->Data, "ok", 2) == 0;
+		return;
+	}
+	if (l_event->Topic_length != 8 || memcmp(l_event->Topic, "fw/image", 8) != 0 || l_event->PacketId != 7
+			|| l_event->Offset != s_stream.Bytes || l_event->Total_length != TEST_STREAM_PAYLOAD) {
+		s_stream.Errors++;
+		return;
+	}
+	for (l_ix = 0; l_ix < l_event->Data_length; l_ix++) {
+		if (l_event->Data[l_ix] != (l_event->Offset + l_ix) % 251) {
+			s_stream.Errors++;
+			return;
+		}
+	}
+	s_stream.Chunks++;
+	s_stream.Bytes += l_event->Data_length;
+}
+
+/*
+ * Plays the broker: a big QoS 1 publish, a small QoS 0 one, then close.
+ */
+static void stream_writer(void *pvParameters) {
+	int l_sock = *(int *) pvParameters;
+	uint8_t l_header[16] = { 0x32 };
+	uint8_t l_payload[1000];
+	uint8_t l_small[9] = { 0x30, 7, 0, 3, 'c', 'f', 'g', 'o', 'k' };
+	uint32_t l_remaining = 2 + 8 + 2 + TEST_STREAM_PAYLOAD;
+	uint32_t l_sent, l_ix;
+	int l_len = 1;
+
+	while (l_remaining > 0) {
+		l_header[l_len++] = (l_remaining % 128) | (l_remaining >= 128 ? 0x80 : 0);
+		l_remaining /= 128;
+	}
+	memcpy(l_header + l_len, "\0\010fw/image\0\07", 12);
+	write(l_sock, l_header, l_len + 12);
+	for (l_sent = 0; l_sent < TEST_STREAM_PAYLOAD; l_sent += l_len) {
+		l_len = TEST_STREAM_PAYLOAD - l_sent < sizeof(l_payload) ? TEST_STREAM_PAYLOAD - l_sent : sizeof(l_payload);
+		for (l_ix = 0; l_ix < l_len; l_ix++) {
+			l_payload[l_ix] = (l_sent + l_ix) % 251;
+		}
+		write(l_sock, l_payload, l_len);
+	}
+	write(l_sock, l_small, sizeof(l_small));
+	close(l_sock);
+	vTaskDelete(NULL);
+}
+
+TEST_CASE("transport streams a publish larger than the receive buffer to data_cb", "[mqtt][transport]") {
+	Client_t l_client;
+	BrokerConfig_t l_broker;
+	Buffers_t l_buffers;
+	Callback_t l_cb;
+	State_t l_state;
+	Outbox_t l_outbox;
+	uint8_t l_puback[4] = { 0x40, 0x02, 0x00, 0x07 };
+	uint8_t *l_data;
+	int l_pair[2];
+
+	memset(&l_client, 0, sizeof(l_client));
+	memset(&l_buffers, 0, sizeof(l_buffers));
+	memset(&l_cb, 0, sizeof(l_cb));
+	memset(&l_state, 0, sizeof(l_state));
+	memset(&s_stream, 0, sizeof(s_stream));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_outbox_init(&l_outbox, 4096));
+	l_client.Broker = &l_broker;
+	l_client.Buffers = &l_buffers;
+	l_client.Cb = &l_cb;
+	l_client.State = &l_state;
+	l_client.Outbox = &l_outbox;
+	l_cb.data_cb = stream_data_cb;
+	l_buffers.in_buffer_length = 1024;
+	l_buffers.in_buffer = malloc(l_buffers.in_buffer_length);
+	mqtt_decoder_init(&l_buffers.in_decoder, l_buffers.in_buffer, l_buffers.in_buffer_length);
+	TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, l_pair));
+	l_broker.Socket = l_pair[0];
+	xTaskCreate(&stream_writer, "stream_writer", 4096, &l_pair[1], 5, NULL);
+
+	mqtt_start_receive_schedule(&l_client);
+	close(l_pair[0]);
+	TEST_ASSERT_EQUAL(0, s_stream.Errors);
+	TEST_ASSERT_EQUAL(TEST_STREAM_PAYLOAD, s_stream.Bytes);
+	TEST_ASSERT_TRUE(s_stream.Chunks >= TEST_STREAM_PAYLOAD / 1024);
+	TEST_ASSERT_EQUAL(1, s_stream.Small);
+	// Acked once the whole publish has arrived
+	TEST_ASSERT_EQUAL(sizeof(l_puback), mqtt_outbox_peek(&l_outbox, &l_data));
+	TEST_ASSERT_EQUAL(0, memcmp(l_data, l_puback, sizeof(l_puback)));
+	mqtt_outbox_consume(&l_outbox);
+	mqtt_outbox_deinit(&l_outbox);
+	free(l_buffers.in_buffer);
+}
+
+typedef struct AckLog {
+	uint8_t				Acks[8][4];  // Control packets in the order they were queued
+	int					Count;
+	char				Delivered[8];  // Payload byte of each publish data_cb saw
+	int					Deliveries;
+	int					Errors;  // Deliveries that found their ack not yet queued
+} AckLog_t;
+
+static AckLog_t s_acks;
+static Outbox_t *s_ack_outbox;
+
+static void ack_drain(void) {
+	uint8_t *l_data;
+	int32_t l_len;
+	while ((l_len = mqtt_outbox_peek(s_ack_outbox, &l_data)) > 0) {
+		if (s_acks.Count < 8 && l_len == 4) {
+			memcpy(s_acks.Acks[s_acks.Count++], l_data, 4);
+		}
+		mqtt_outbox_consume(s_ack_outbox);
+	}
+}
+
+static void ack_data_cb(void *p_client, void *p_event) {
+	DataEvent_t *l_event = p_event;
+	ack_drain();
+	if (s_acks.Count == 0 || s_acks.Acks[s_acks.Count - 1][3] != l_event->PacketId) {
+		s_acks.Errors++;
+	}
+	s_acks.Delivered[s_acks.Deliveries++] = l_event->Data[0];
+}
+
+/*
+ * A QoS 2 publish, its resend, the PUBREL, the id used again for a new publish, then a QoS 1 one.
+ */
+TEST_CASE("transport acks received publishes before data_cb and delivers qos 2 once", "[mqtt][transport]") {
+	static const uint8_t l_stream[] = {
+		0x34, 0x06, 0x00, 0x01, 'a', 0x00, 0x09, '1',
+		0x3c, 0x06, 0x00, 0x01, 'a', 0x00, 0x09, '1',  // DUP
+		0x62, 0x02, 0x00, 0x09,
+		0x34, 0x06, 0x00, 0x01, 'a', 0x00, 0x09, '2',
+		0x32, 0x06, 0x00, 0x01, 'a', 0x00, 0x0a, '3' };
+	static const uint8_t l_expected[5][4] = {
+		{ 0x50, 0x02, 0x00, 0x09 }, { 0x50, 0x02, 0x00, 0x09 }, { 0x70, 0x02, 0x00, 0x09 },
+		{ 0x50, 0x02, 0x00, 0x09 }, { 0x40, 0x02, 0x00, 0x0a } };
+	Client_t l_client;
+	BrokerConfig_t l_broker;
+	Buffers_t l_buffers;
+	Callback_t l_cb;
+	State_t l_state;
+	Outbox_t l_outbox;
+	int l_pair[2], l_ix;
+
+	memset(&l_client, 0, sizeof(l_client));
+	memset(&l_buffers, 0, sizeof(l_buffers));
+	memset(&l_cb, 0, sizeof(l_cb));
+	memset(&l_state, 0, sizeof(l_state));
+	memset(&s_acks, 0, sizeof(s_acks));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_outbox_init(&l_outbox, 4096));
+	s_ack_outbox = &l_outbox;
+	l_client.Broker = &l_broker;
+	l_client.Buffers = &l_buffers;
+	l_client.Cb = &l_cb;
+	l_client.State = &l_state;
+	l_client.Outbox = &l_outbox;
+	l_cb.data_cb = ack_data_cb;
+	l_buffers.in_buffer_length = 1024;
+	l_buffers.in_buffer = malloc(l_buffers.in_buffer_length);
+	mqtt_decoder_init(&l_buffers.in_decoder, l_buffers.in_buffer, l_buffers.in_buffer_length);
+	TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, l_pair));
+	l_broker.Socket = l_pair[0];
+	TEST_ASSERT_EQUAL(sizeof(l_stream), write(l_pair[1], l_stream, sizeof(l_stream)));
+	close(l_pair[1]);
+
+	mqtt_start_receive_schedule(&l_client);
+	close(l_pair[0]);
+	ack_drain();
+	TEST_ASSERT_EQUAL(0, s_acks.Errors);
+	TEST_ASSERT_EQUAL(3, s_acks.Deliveries);
+	TEST_ASSERT_EQUAL(0, memcmp(s_acks.Delivered, "123", 3));
+	TEST_ASSERT_EQUAL(5, s_acks.Count);
+	for (l_ix = 0; l_ix < 5; l_ix++) {
+		TEST_ASSERT_EQUAL(0, memcmp(s_acks.Acks[l_ix], l_expected[l_ix], 4));
+	}
+	TEST_ASSERT_EQUAL(1, l_state.inbound_qos2.Count);  // The second id 9, still waiting for its PUBREL
+	mqtt_outbox_deinit(&l_outbox);
+	free(l_buffers.in_buffer);
+}
+
+/*
+ * A QoS 2 publish too big for the receive buffer, whose topic is too long to keep while it streams.
+ */
+TEST_CASE("transport still acks a streamed publish it has to drop", "[mqtt][transport]") {
+	static const uint8_t l_pubrec[4] = { 0x50, 0x02, 0x00, 0x0b };
+	Client_t l_client;
+	BrokerConfig_t l_broker;
+	Buffers_t l_buffers;
+	Callback_t l_cb;
+	State_t l_state;
+	Outbox_t l_outbox;
+	uint8_t l_packet[3 + 2 + 600 + 2 + 1000];
+	uint32_t l_remaining = sizeof(l_packet) - 3;
+	int l_pair[2];
+
+	memset(&l_client, 0, sizeof(l_client));
+	memset(&l_buffers, 0, sizeof(l_buffers));
+	memset(&l_cb, 0, sizeof(l_cb));
+	memset(&l_state, 0, sizeof(l_state));
+	memset(&s_acks, 0, sizeof(s_acks));
+	TEST_ASSERT_EQUAL(ESP_OK, mqtt_outbox_init(&l_outbox, 4096));
+	s_ack_outbox = &l_outbox;
+	l_client.Broker = &l_broker;
+	l_client.Buffers = &l_buffers;
+	l_client.Cb = &l_cb;
+	l_client.State = &l_state;
+	l_client.Outbox = &l_outbox;
+	l_cb.data_cb = ack_data_cb;
+	l_buffers.in_buffer_length = 1024;
+	l_buffers.in_buffer = malloc(l_buffers.in_buffer_length);
+	mqtt_decoder_init(&l_buffers.in_decoder, l_buffers.in_buffer, l_buffers.in_buffer_length);
+	memset(l_packet, 't', sizeof(l_packet));
+	l_packet[0] = 0x34;
+	l_packet[1] = 0x80 | (l_remaining % 128);
+	l_packet[2] = l_remaining / 128;
+	l_packet[3] = 600 >> 8;
+	l_packet[4] = 600 & 0xff;
+	l_packet[3 + 2 + 600] = 0x00;
+	l_packet[3 + 2 + 600 + 1] = 0x0b;
+	TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, l_pair));
+	l_broker.Socket = l_pair[0];
+	TEST_ASSERT_EQUAL(sizeof(l_packet), write(l_pair[1], l_packet, sizeof(l_packet)));
+	close(l_pair[1]);
+
+	mqtt_start_receive_schedule(&l_client);
+	close(l_pair[0]);
+	ack_drain();
+	TEST_ASSERT_EQUAL(0, s_acks.Deliveries);
+	TEST_ASSERT_EQUAL(1, s_acks.Count);
+	TEST_ASSERT_EQUAL_MEMORY(l_pubrec, s_acks.Acks[0], 4);
+	TEST_ASSERT_EQUAL(0, l_state.inbound_qos2.Count);  // Not recorded as delivered
+	mqtt_outbox_deinit(&l_outbox);
+	free(l_buffers.in_buffer);
+}
+
+// ### END DBK